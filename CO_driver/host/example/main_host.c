@@ -0,0 +1,226 @@
+/*
+ * CANopen network of several nodes on simulated CAN bus.
+ *
+ * @file        main_host.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Usage: main_host [nodes [seconds]]
+ *
+ * Nodes 1..nodes run the stack with Object Dictionary of the stack example,
+ * each on its own simulated TWAI controller, as on target: CO_CANinit(),
+ * CO_CANopenInit(), receive task and CO_process() in mainline. Nodes share
+ * the Object Dictionary, so they have the same configuration and differ only
+ * in node-ID. Node 1 is NMT master, it starts operational and starts the
+ * other nodes with NMT command. Returns 0, if all nodes got operational,
+ * have no CAN error and produced heartbeats. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CANopen.h"
+#include "OD.h"
+#include "CO_hostBus.h"
+
+#define NODES_MAX 127
+#define BITRATE 500U
+#define HEARTBEAT_MS 100U
+#define FIRST_HB_TIME_MS 500U
+#define SDO_SRV_TIMEOUT_MS 1000U
+#define SDO_CLI_TIMEOUT_MS 500U
+#define NMT_CONTROL (CO_NMT_ERR_ON_ERR_REG | CO_ERR_REG_GENERIC_ERR | CO_ERR_REG_COMMUNICATION)
+#define NMT_MASTER_ID 1U
+
+typedef struct
+{
+  CO_hostNode_t *hostNode;
+  CO_t *co;
+  uint8_t nodeId;
+  /* LSS slave keeps pointers to them */
+  uint8_t pendingNodeId;
+  uint16_t pendingBitRate;
+} node_t;
+
+static node_t nodes[NODES_MAX];
+
+/* Initialize node as main() of target does, with calling task bound to its
+ * simulated controller */
+static int nodeInit(node_t *node)
+{
+  uint32_t heapMemoryUsed = 0;
+  uint32_t errInfo = 0;
+  uint16_t nmtControl;
+  CO_ReturnError_t err;
+
+  CO_hostNode_bind(node->hostNode);
+  node->co = CO_new(NULL, &heapMemoryUsed);
+  if (node->co == NULL)
+  {
+    return -1;
+  }
+
+  node->pendingNodeId = node->nodeId;
+  node->pendingBitRate = BITRATE;
+  err = CO_CANinit(node->co, NULL, node->pendingBitRate);
+  if (err != CO_ERROR_NO)
+  {
+    return -2;
+  }
+
+#if ((CO_CONFIG_LSS) & CO_CONFIG_LSS_SLAVE)
+  CO_LSS_address_t lssAddress = {.identity = {.serialNumber = node->nodeId}};
+  err = CO_LSSinit(node->co, &lssAddress, &node->pendingNodeId, &node->pendingBitRate);
+  if (err != CO_ERROR_NO)
+  {
+    return -3;
+  }
+#endif
+
+  nmtControl = NMT_CONTROL | ((node->nodeId == NMT_MASTER_ID) ? CO_NMT_STARTUP_TO_OPERATIONAL : 0U);
+  err = CO_CANopenInit(node->co, NULL, NULL, OD, NULL, nmtControl, FIRST_HB_TIME_MS, SDO_SRV_TIMEOUT_MS,
+                       SDO_CLI_TIMEOUT_MS, false, node->pendingNodeId, &errInfo);
+  if (err != CO_ERROR_NO)
+  {
+    printf("node %u: CO_CANopenInit failed %d, OD 0x%04X\n", node->nodeId, (int)err, (unsigned int)errInfo);
+    return -4;
+  }
+  err = CO_CANopenInitPDO(node->co, node->co->em, OD, node->pendingNodeId, &errInfo);
+  if (err != CO_ERROR_NO)
+  {
+    printf("node %u: CO_CANopenInitPDO failed %d, OD 0x%04X\n", node->nodeId, (int)err, (unsigned int)errInfo);
+    return -5;
+  }
+
+  CO_CANsetNormalMode(node->co->CANmodule);
+  if (!CO_CANrxTaskStart(node->co->CANmodule))
+  {
+    return -6;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int count = (argc > 1) ? atoi(argv[1]) : 4;
+  int seconds = (argc > 2) ? atoi(argv[2]) : 2;
+  CO_hostBus_t *bus;
+  CO_hostBusStats_t stats;
+  int64_t start, last;
+  bool started = false;
+  int failed = 0;
+  int i;
+
+  if ((count < 2) || (count > NODES_MAX) || (seconds < 1))
+  {
+    printf("usage: main_host [nodes 2..%d [seconds]]\n", NODES_MAX);
+    return 2;
+  }
+  esp_log_level_set("*", ESP_LOG_WARN);
+
+  /* all nodes share Object Dictionary, configure it once */
+  if (OD_set_u16(OD_find(OD, 0x1017), 0, HEARTBEAT_MS, true) != ODR_OK)
+  {
+    printf("no producer heartbeat time in OD\n");
+    return 1;
+  }
+
+  bus = CO_hostBus_create(NULL);
+  for (i = 0; i < count; i++)
+  {
+    char name[16];
+
+    snprintf(name, sizeof(name), "node%d", i + 1);
+    nodes[i].hostNode = CO_hostNode_create(bus, name);
+    nodes[i].nodeId = (uint8_t)(i + 1);
+    if (nodeInit(&nodes[i]) != 0)
+    {
+      printf("node %d: init failed\n", i + 1);
+      return 1;
+    }
+  }
+
+  /* Mainline of all nodes in one task, each node is processed with its
+   * controller bound */
+  start = esp_timer_get_time();
+  last = start;
+  while ((esp_timer_get_time() - start) < (int64_t)seconds * 1000000)
+  {
+    int64_t now = esp_timer_get_time();
+    uint32_t timeDifference_us = (uint32_t)(now - last);
+
+    last = now;
+    /* NMT master starts all nodes, when they have booted */
+    if (!started && ((now - start) >= (int64_t)FIRST_HB_TIME_MS * 1000))
+    {
+      CO_hostNode_bind(nodes[NMT_MASTER_ID - 1U].hostNode);
+      CO_NMT_sendCommand(nodes[NMT_MASTER_ID - 1U].co->NMT, CO_NMT_ENTER_OPERATIONAL, 0);
+      started = true;
+    }
+    for (i = 0; i < count; i++)
+    {
+      CO_t *co = nodes[i].co;
+      bool_t syncWas;
+
+      CO_hostNode_bind(nodes[i].hostNode);
+      CO_CANmodule_process(co->CANmodule);
+      if (CO_process(co, false, timeDifference_us, NULL) != CO_RESET_NOT)
+      {
+        printf("node %u: reset requested\n", nodes[i].nodeId);
+        failed++;
+      }
+      syncWas = CO_process_SYNC(co, timeDifference_us, NULL);
+      CO_process_RPDO(co, syncWas, timeDifference_us, NULL);
+      CO_process_TPDO(co, syncWas, timeDifference_us, NULL);
+    }
+    vTaskDelay(1);
+  }
+
+  /* each node sends heartbeat each HEARTBEAT_MS, half of them is enough */
+  for (i = 0; i < count; i++)
+  {
+    CO_CANmodule_t *CANmodule = nodes[i].co->CANmodule;
+    uint32_t rxFrames = __atomic_load_n(&CANmodule->stats.rxFrames, __ATOMIC_RELAXED);
+    uint32_t txFrames = __atomic_load_n(&CANmodule->stats.txFrames, __ATOMIC_RELAXED);
+    uint32_t txExpected = ((uint32_t)seconds * 1000U - FIRST_HB_TIME_MS) / HEARTBEAT_MS / 2U;
+    CO_NMT_internalState_t state = CO_NMT_getInternalState(nodes[i].co->NMT);
+    bool ok = (state == CO_NMT_OPERATIONAL) && (CANmodule->CANerrorStatus == 0U) && (txFrames >= txExpected);
+
+    printf("node %3u: NMT state %3d, CAN error status 0x%04X, rx %u frames, tx %u frames (>= %u) %s\n",
+           nodes[i].nodeId, (int)state, CANmodule->CANerrorStatus, (unsigned int)rxFrames, (unsigned int)txFrames,
+           (unsigned int)txExpected, ok ? "ok" : "FAILED");
+    if (!ok)
+    {
+      failed++;
+    }
+  }
+  CO_hostBus_getStats(bus, &stats);
+  printf("bus: %llu frames, %llu error frames, load %.1f %%\n", (unsigned long long)stats.frames,
+         (unsigned long long)stats.errorFrames, (double)stats.busyNs / ((double)seconds * 1e7));
+
+  for (i = 0; i < count; i++)
+  {
+    CO_hostNode_bind(nodes[i].hostNode);
+    CO_CANrxTaskStop(nodes[i].co->CANmodule);
+    CO_CANmodule_disable(nodes[i].co->CANmodule);
+    CO_delete(nodes[i].co);
+    CO_hostNode_delete(nodes[i].hostNode);
+  }
+  CO_hostBus_delete(bus);
+
+  return (failed == 0) ? 0 : 1;
+}
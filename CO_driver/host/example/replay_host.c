@@ -0,0 +1,213 @@
+/*
+ * Replay of candump log to CANopen node on simulated CAN bus.
+ *
+ * @file        replay_host.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Usage: replay_host log [nodeId [timeScale]]
+ *
+ * Node with nodeId (default 1) runs the stack with Object Dictionary of the
+ * stack example, as in main_host.c. Received frames of candump log, for
+ * example exported by CO_CANcapture_exportCandump() on target, are given to
+ * the node with CO_CANcapture_replayCandump() at their logged time, scaled by
+ * timeScale (default 1, 0 replays as fast as possible). Frames marked as sent
+ * by the logging node are skipped. Second node on the bus acknowledges frames
+ * sent by the node.
+ *
+ * Capture of the node, replayed frames and node's responses, is written to
+ * stdout as candump log, so it can be compared with the original. Returns 0,
+ * if all lines of the log were parsed. Requires CO_CAN_CAPTURE. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CANopen.h"
+#include "OD.h"
+#include "CO_CANcapture.h"
+#include "CO_hostBus.h"
+
+#if !CO_CAN_CAPTURE
+#error replay_host requires CO_CAN_CAPTURE
+#endif
+
+#define BITRATE 500U
+#define FIRST_HB_TIME_MS 500U
+#define SDO_SRV_TIMEOUT_MS 1000U
+#define SDO_CLI_TIMEOUT_MS 500U
+#define NMT_CONTROL (CO_NMT_ERR_ON_ERR_REG | CO_ERR_REG_GENERIC_ERR | CO_ERR_REG_COMMUNICATION)
+#define CAPTURE_SIZE 4096U
+/* node keeps running after the last frame, so its responses are captured */
+#define TAIL_MS 100
+#define LINE_MAX 256
+
+static CO_t *co;
+static CO_CANcapture_t capture;
+static CO_CANcaptureRecord_t records[CAPTURE_SIZE];
+static int64_t last;
+
+static size_t writeStdout(void *arg, const void *buf, size_t len)
+{
+  return fwrite(buf, 1, len, (FILE *)arg);
+}
+
+/* Initialize node as main() of target does */
+static int nodeInit(uint8_t nodeId)
+{
+  uint32_t heapMemoryUsed = 0;
+  uint32_t errInfo = 0;
+  CO_ReturnError_t err;
+
+  co = CO_new(NULL, &heapMemoryUsed);
+  if (co == NULL)
+  {
+    return -1;
+  }
+  err = CO_CANinit(co, NULL, BITRATE);
+  if (err != CO_ERROR_NO)
+  {
+    return -2;
+  }
+  err = CO_CANopenInit(co, NULL, NULL, OD, NULL, NMT_CONTROL, FIRST_HB_TIME_MS, SDO_SRV_TIMEOUT_MS, SDO_CLI_TIMEOUT_MS,
+                       false, nodeId, &errInfo);
+  if (err != CO_ERROR_NO)
+  {
+    fprintf(stderr, "CO_CANopenInit failed %d, OD 0x%04X\n", (int)err, (unsigned int)errInfo);
+    return -3;
+  }
+  err = CO_CANopenInitPDO(co, co->em, OD, nodeId, &errInfo);
+  if (err != CO_ERROR_NO)
+  {
+    fprintf(stderr, "CO_CANopenInitPDO failed %d, OD 0x%04X\n", (int)err, (unsigned int)errInfo);
+    return -4;
+  }
+  CO_CANsetNormalMode(co->CANmodule);
+  return 0;
+}
+
+/* Process the node until time until_us */
+static void processUntil(int64_t until_us)
+{
+  do
+  {
+    int64_t now = esp_timer_get_time();
+    uint32_t timeDifference_us = (uint32_t)(now - last);
+    bool_t syncWas;
+
+    last = now;
+    CO_CANmodule_process(co->CANmodule);
+    CO_process(co, false, timeDifference_us, NULL);
+    syncWas = CO_process_SYNC(co, timeDifference_us, NULL);
+    CO_process_RPDO(co, syncWas, timeDifference_us, NULL);
+    CO_process_TPDO(co, syncWas, timeDifference_us, NULL);
+    if (esp_timer_get_time() < until_us)
+    {
+      vTaskDelay(1);
+    }
+  } while (esp_timer_get_time() < until_us);
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t nodeId = (argc > 2) ? (uint8_t)atoi(argv[2]) : 1U;
+  double timeScale = (argc > 3) ? atof(argv[3]) : 1.0;
+  CO_CANmodule_t peer;
+  CO_CANrx_t peerRx[1];
+  CO_CANtx_t peerTx[1];
+  CO_hostBus_t *bus;
+  CO_hostNode_t *node, *peerNode;
+  char line[LINE_MAX];
+  uint32_t lines = 0U, failed = 0U;
+  int64_t start, logStart_us = -1;
+  FILE *log;
+
+  if ((argc < 2) || (nodeId < 1U) || (nodeId > 127U) || (timeScale < 0.0))
+  {
+    fprintf(stderr, "usage: replay_host log [nodeId 1..127 [timeScale]]\n");
+    return 2;
+  }
+  log = fopen(argv[1], "r");
+  if (log == NULL)
+  {
+    perror(argv[1]);
+    return 2;
+  }
+  esp_log_level_set("*", ESP_LOG_WARN);
+
+  bus = CO_hostBus_create(NULL);
+  peerNode = CO_hostNode_create(bus, "peer");
+  CO_hostNode_bind(peerNode);
+  CO_CANmodule_init(&peer, NULL, peerRx, 1U, peerTx, 1U, BITRATE);
+  CO_CANsetNormalMode(&peer);
+
+  node = CO_hostNode_create(bus, "node");
+  CO_hostNode_bind(node);
+  if (nodeInit(nodeId) != 0)
+  {
+    fprintf(stderr, "node init failed\n");
+    return 1;
+  }
+  CO_CANcapture_init(&capture, records, CAPTURE_SIZE);
+  CO_CANcapture_attach(co->CANmodule, &capture);
+  CO_CANcapture_enable(&capture, true);
+
+  start = esp_timer_get_time();
+  last = start;
+  while (fgets(line, sizeof(line), log) != NULL)
+  {
+    int64_t due_us = esp_timer_get_time();
+
+    lines++;
+    /* "(sec.usec) ...", frame is due at its time relative to the first one */
+    if (line[0] == '(')
+    {
+      int64_t time_us = (int64_t)(strtod(&line[1], NULL) * 1e6);
+
+      if (logStart_us < 0)
+      {
+        logStart_us = time_us;
+      }
+      due_us = start + (int64_t)((double)(time_us - logStart_us) * timeScale);
+    }
+    processUntil(due_us);
+    if (CO_CANcapture_replayCandump(co->CANmodule, line) != CO_ERROR_NO)
+    {
+      fprintf(stderr, "%s:%u: not parsed: %s", argv[1], (unsigned int)lines, line);
+      failed++;
+    }
+  }
+  fclose(log);
+  processUntil(esp_timer_get_time() + (TAIL_MS * 1000));
+
+  CO_CANcapture_enable(&capture, false);
+  CO_CANcapture_exportCandump(&capture, "can0", writeStdout, stdout);
+  fprintf(stderr, "%u lines, %u not parsed, %u frames captured, %u sent by node\n", (unsigned int)lines,
+          (unsigned int)failed, (unsigned int)CO_CANcapture_count(&capture),
+          (unsigned int)__atomic_load_n(&co->CANmodule->stats.txFrames, __ATOMIC_RELAXED));
+
+  CO_CANcapture_attach(co->CANmodule, NULL);
+  CO_CANmodule_disable(co->CANmodule);
+  CO_delete(co);
+  CO_hostNode_delete(node);
+  CO_hostNode_bind(peerNode);
+  CO_CANmodule_disable(&peer);
+  CO_hostNode_delete(peerNode);
+  CO_hostBus_delete(bus);
+
+  return (failed == 0U) ? 0 : 1;
+}
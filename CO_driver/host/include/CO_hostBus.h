@@ -0,0 +1,116 @@
+/*
+ * Simulated CAN bus for host build of ESP32 TWAI driver.
+ *
+ * @file        CO_hostBus.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_HOST_BUS_H
+#define CO_HOST_BUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/twai.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Simulated bus connects simulated TWAI controllers (nodes) in one
+     * process. Frames are arbitrated by identifier and take the time of their
+     * real length at the bitrate, including stuff bits. Nodes with different
+     * bitrate see each other's frames as bus errors. */
+    typedef struct CO_hostBus_t CO_hostBus_t;
+
+    /* One simulated TWAI controller */
+    typedef struct CO_hostNode_t CO_hostNode_t;
+
+    typedef struct
+    {
+        /* Multiplier of frame time: 1.0 is real time, 0 sends frames as fast
+         * as possible, in arbitration order */
+        double timeScale;
+        /* Probability of error frame for each transmission, in ppm */
+        uint32_t errorRatePpm;
+        /* Seed for error injection */
+        uint32_t seed;
+    } CO_hostBusConfig_t;
+
+    /* Bus statistics */
+    typedef struct
+    {
+        uint64_t frames;
+        uint64_t errorFrames;
+        uint64_t bits; /* bits of frames including stuff bits and intermission */
+        uint64_t busyNs; /* simulated time of bus activity */
+    } CO_hostBusStats_t;
+
+    /* Create bus and start its thread. config may be NULL for real time
+     * without errors. */
+    CO_hostBus_t *CO_hostBus_create(const CO_hostBusConfig_t *config);
+
+    /* Stop bus thread and free bus. Nodes must be deleted before. */
+    void CO_hostBus_delete(CO_hostBus_t *bus);
+
+    void CO_hostBus_setErrorRate(CO_hostBus_t *bus, uint32_t errorRatePpm);
+    void CO_hostBus_setTimeScale(CO_hostBus_t *bus, double timeScale);
+    void CO_hostBus_getStats(CO_hostBus_t *bus, CO_hostBusStats_t *stats);
+
+    /* Connect bus to SocketCAN interface, for example vcan0. Frames sent by
+     * nodes are written to interface, frames from interface are received by
+     * nodes. Returns false, if interface can not be opened or SocketCAN is
+     * not available. */
+    bool CO_hostBus_openSocketCAN(CO_hostBus_t *bus, const char *ifName);
+
+    /* Create node on bus, TWAI driver is not installed yet */
+    CO_hostNode_t *CO_hostNode_create(CO_hostBus_t *bus, const char *name);
+
+    /* Remove node from bus and free it */
+    void CO_hostNode_delete(CO_hostNode_t *node);
+
+    /* Bind calling task to node. All twai_*() functions called from this task
+     * and from tasks created by it operate on this node. */
+    void CO_hostNode_bind(CO_hostNode_t *node);
+
+    /* Assign node to TWAI controller 0..3 for v2 API, twai_driver_install_v2()
+     * with this controller_id then operates on node regardless of binding.
+     * NULL removes assignment. */
+    void CO_hostNode_setController(CO_hostNode_t *node, int controllerId);
+
+    /* Node bound to calling task, or NULL */
+    CO_hostNode_t *CO_hostNode_bound(void);
+
+    /* Error injection: add to error counters of node, as after bus errors.
+     * Node goes bus-off, if transmit error counter exceeds 255. */
+    void CO_hostNode_injectErrors(CO_hostNode_t *node, uint32_t txErrors, uint32_t rxErrors);
+
+    /* Error injection: drop next 'count' frames received by node, as rx FIFO
+     * overrun */
+    void CO_hostNode_injectOverrun(CO_hostNode_t *node, uint32_t count);
+
+    /* Number of bits in frame on the wire, with stuff bits, CRC delimiter, ACK,
+     * EOF and intermission */
+    uint32_t CO_hostBus_frameBits(const twai_message_t *msg);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_HOST_BUS_H */
@@ -0,0 +1,86 @@
+/*
+ * Simulated flash for host build of ESP32 drivers.
+ *
+ * @file        CO_hostFlash.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_HOST_FLASH_H
+#define CO_HOST_FLASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Erase unit of simulated flash */
+#define CO_HOST_FLASH_SECTOR 4096U
+
+    /* Simulated flash behaves as NOR flash: erase sets sector to 0xFF, write
+     * can only clear bits. Operations take no time, their duration on target
+     * is estimated from timing below. */
+    typedef struct
+    {
+        uint32_t read_ns;      /* per byte, with esp_partition_read() or mapped */
+        uint32_t program_us;   /* per started 256-byte page */
+        uint32_t erase_us;     /* per sector */
+    } CO_hostFlashTiming_t;
+
+    /* Flash statistics */
+    typedef struct
+    {
+        uint64_t readBytes;    /* by esp_partition_read(), mapped reads are not counted */
+        uint64_t writeBytes;   /* bytes given to esp_partition_write() */
+        uint64_t programBytes; /* bytes, which changed at least one bit */
+        uint64_t erases;
+        uint32_t sectorErasesMin; /* wear of the least and the most erased sector */
+        uint32_t sectorErasesMax;
+        uint64_t busy_us;      /* estimated duration of all operations */
+    } CO_hostFlashStats_t;
+
+    /* Create erased partition of size bytes, multiple of CO_HOST_FLASH_SECTOR,
+     * with label and data type, timing may be NULL for ESP32 typical values.
+     * Returns NULL, if partition can not be created. */
+    const esp_partition_t *CO_hostFlash_create(const char *label, uint32_t size, const CO_hostFlashTiming_t *timing);
+
+    /* Delete partition, it must not be mapped */
+    void CO_hostFlash_delete(const esp_partition_t *partition);
+
+    /* Enable or disable esp_partition_mmap(), enabled by default */
+    void CO_hostFlash_setMmap(const esp_partition_t *partition, bool enable);
+
+    /* Simulate power loss after bytes more bytes are written: the write
+     * stops in the middle, next erase leaves sector partially erased, and
+     * all next writes and erases fail until CO_hostFlash_powerOn(). */
+    void CO_hostFlash_powerCut(const esp_partition_t *partition, uint64_t bytes);
+    void CO_hostFlash_powerOn(const esp_partition_t *partition);
+
+    /* Read and reset statistics */
+    void CO_hostFlash_getStats(const esp_partition_t *partition, CO_hostFlashStats_t *stats);
+    void CO_hostFlash_resetStats(const esp_partition_t *partition);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_HOST_FLASH_H */
@@ -0,0 +1,87 @@
+/*
+ * Host implementation of ESP-IDF partition API over simulated flash.
+ *
+ * @file        esp_partition.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        ESP_PARTITION_TYPE_APP = 0x00,
+        ESP_PARTITION_TYPE_DATA = 0x01,
+        ESP_PARTITION_TYPE_ANY = 0xFF
+    } esp_partition_type_t;
+
+    typedef enum
+    {
+        ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+        ESP_PARTITION_SUBTYPE_DATA_UNDEFINED = 0x06,
+        ESP_PARTITION_SUBTYPE_ANY = 0xFF
+    } esp_partition_subtype_t;
+
+    typedef enum
+    {
+        ESP_PARTITION_MMAP_DATA,
+        ESP_PARTITION_MMAP_INST
+    } esp_partition_mmap_memory_t;
+
+    typedef uint32_t esp_partition_mmap_handle_t;
+
+    typedef struct
+    {
+        void *flash_chip;
+        esp_partition_type_t type;
+        esp_partition_subtype_t subtype;
+        uint32_t address;
+        uint32_t size;
+        uint32_t erase_size;
+        char label[17];
+        bool encrypted;
+        bool readonly;
+    } esp_partition_t;
+
+    /* Partitions are created with CO_hostFlash_create() */
+    const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                    const char *label);
+    esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+    esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+    esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+    esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                                 esp_partition_mmap_memory_t memory, const void **out_ptr,
+                                 esp_partition_mmap_handle_t *out_handle);
+    void esp_partition_munmap(esp_partition_mmap_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* HOST_ESP_PARTITION_H */
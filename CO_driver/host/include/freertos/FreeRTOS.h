@@ -0,0 +1,107 @@
+/*
+ * Host implementation of the FreeRTOS subset used by CANopenNode driver,
+ * built on POSIX threads.
+ *
+ * @file        FreeRTOS.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef uint32_t TickType_t;
+    typedef int BaseType_t;
+    typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL pdFALSE
+#define errQUEUE_EMPTY pdFALSE
+
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((uint64_t)(xTimeInMs) * configTICK_RATE_HZ) / 1000U))
+#define pdTICKS_TO_MS(xTicks) ((uint32_t)(((uint64_t)(xTicks) * 1000U) / configTICK_RATE_HZ))
+
+#define portNUM_PROCESSORS 2
+#define portYIELD() vPortYield()
+#define portYIELD_FROM_ISR(x) ((void)(x))
+
+    void vPortYield(void);
+    BaseType_t xPortGetCoreID(void);
+
+    /* Spinlock, recursive for the owning thread like on ESP32 */
+    typedef struct
+    {
+        volatile uintptr_t owner;
+        uint32_t count;
+    } portMUX_TYPE;
+
+#define portMUX_FREE_VAL ((uintptr_t)0)
+#define portMUX_INITIALIZER_UNLOCKED {portMUX_FREE_VAL, 0}
+#define portMUX_INITIALIZE(mux)            \
+    do                                     \
+    {                                      \
+        (mux)->owner = portMUX_FREE_VAL;   \
+        (mux)->count = 0;                  \
+    } while (0)
+#define spinlock_initialize(mux) portMUX_INITIALIZE(mux)
+
+    void vPortEnterCritical(portMUX_TYPE *mux);
+    void vPortExitCritical(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+#define taskENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define taskENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+
+    /* Storage for statically allocated objects, large enough for the POSIX
+     * objects behind them */
+    typedef struct
+    {
+        uint64_t storage[32];
+    } StaticSemaphore_t;
+    typedef StaticSemaphore_t StaticQueue_t;
+    typedef struct
+    {
+        uint64_t storage[32];
+    } StaticTask_t;
+    typedef uint8_t StackType_t;
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* HOST_FREERTOS_H */
@@ -0,0 +1,84 @@
+/*
+ * Host implementation of FreeRTOS tasks and task notifications. Each task is
+ * a POSIX thread, priority and core affinity are ignored.
+ *
+ * @file        task.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct hostTask_t *TaskHandle_t;
+    typedef void (*TaskFunction_t)(void *);
+
+    typedef enum
+    {
+        eNoAction = 0,
+        eSetBits,
+        eIncrement,
+        eSetValueWithOverwrite,
+        eSetValueWithoutOverwrite
+    } eNotifyAction;
+
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+#define tskIDLE_PRIORITY ((UBaseType_t)0U)
+#define configMAX_PRIORITIES 25
+
+    BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                       void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask,
+                                       BaseType_t xCoreID);
+#define xTaskCreate(code, name, stack, param, prio, handle) \
+    xTaskCreatePinnedToCore(code, name, stack, param, prio, handle, tskNO_AFFINITY)
+
+    /* Task is deleted, when its function returns or when it deletes itself.
+     * Deleting other tasks is not supported on host. */
+    void vTaskDelete(TaskHandle_t xTaskToDelete);
+    void vTaskDelay(TickType_t xTicksToDelay);
+    BaseType_t xTaskDelayUntil(TickType_t *pxPreviousWakeTime, TickType_t xTimeIncrement);
+#define vTaskDelayUntil(prev, inc) ((void)xTaskDelayUntil(prev, inc))
+    TickType_t xTaskGetTickCount(void);
+#define xTaskGetTickCountFromISR() xTaskGetTickCount()
+    TaskHandle_t xTaskGetCurrentTaskHandle(void);
+    const char *pcTaskGetName(TaskHandle_t xTaskToQuery);
+
+    BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction);
+    BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit,
+                               uint32_t *pulNotificationValue, TickType_t xTicksToWait);
+    uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+#define xTaskNotifyGive(task) xTaskNotify(task, 0, eIncrement)
+#define vTaskNotifyGiveFromISR(task, woken) ((void)xTaskNotify(task, 0, eIncrement))
+#define xTaskNotifyFromISR(task, value, action, woken) xTaskNotify(task, value, action)
+
+    /* Host only: pointer, which is inherited by tasks created from this task.
+     * Used to bind tasks to simulated CAN controller, see CO_hostBus.h. */
+    void vTaskSetHostContext(void *context);
+    void *pvTaskGetHostContext(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* HOST_FREERTOS_TASK_H */
@@ -0,0 +1,38 @@
+/*
+ * Host build configuration, replaces ESP-IDF generated sdkconfig.h.
+ *
+ * @file        sdkconfig.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+/* GPIOs are not used on host, values only keep driver configuration valid */
+#ifndef CONFIG_CAN_TX_GPIO
+#define CONFIG_CAN_TX_GPIO 0
+#endif
+#ifndef CONFIG_CAN_RX_GPIO
+#define CONFIG_CAN_RX_GPIO 1
+#endif
+
+#ifndef CONFIG_FREERTOS_HZ
+#define CONFIG_FREERTOS_HZ 1000
+#endif
+
+#endif /* HOST_SDKCONFIG_H */
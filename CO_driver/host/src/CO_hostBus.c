@@ -0,0 +1,1340 @@
+/*
+ * Simulated CAN bus and TWAI driver API for host build of ESP32 TWAI driver.
+ *
+ * @file        CO_hostBus.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/can.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#endif
+
+#include "CO_hostBus.h"
+#include "CO_hostRTOS.h"
+#include "driver/twai.h"
+#include "freertos/task.h"
+
+/* Number of controllers, which can be assigned with CO_hostNode_setController() */
+#define HOST_TWAI_CONTROLLERS 4
+
+/* Clock of ESP32 TWAI controller, used with brp */
+#define HOST_TWAI_CLOCK_HZ 80000000UL
+/* Bus-off recovery takes 128 occurrences of 11 recessive bits */
+#define HOST_RECOVERY_BITS (128U * 11U)
+
+struct CO_hostNode_t
+{
+  CO_hostBus_t *bus;
+  CO_hostNode_t *next;
+  char name[16];
+
+  bool installed;
+  twai_mode_t mode;
+  twai_state_t state;
+  uint32_t bitrate;
+  twai_filter_config_t filter;
+  uint32_t alertsEnabled;
+  uint32_t alerts;
+
+  /* Transmit queue, first message is in hardware buffer */
+  twai_message_t *txBuf;
+  uint32_t txCap;
+  uint32_t txHead;
+  uint32_t txCount;
+  uint32_t txGeneration;
+  twai_message_t *rxBuf;
+  uint32_t rxCap;
+  uint32_t rxHead;
+  uint32_t rxCount;
+
+  twai_status_info_t status;
+  uint32_t overrunInject;
+  uint64_t recoverAtNs;
+
+  pthread_cond_t txCond;
+  pthread_cond_t rxCond;
+  pthread_cond_t alertCond;
+};
+
+struct CO_hostBus_t
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  bool stop;
+  CO_hostNode_t *nodes;
+  CO_hostNode_t *inFlight;
+  CO_hostBusConfig_t config;
+  CO_hostBusStats_t stats;
+  uint64_t rng;
+  uint64_t busTimeNs;
+  int sock;
+  pthread_t sockThread;
+};
+
+/* Nodes assigned to controller IDs for v2 API */
+static CO_hostNode_t *hostControllers[HOST_TWAI_CONTROLLERS];
+
+/******************************************************************************/
+static uint64_t hostNowNs(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000U) + (uint64_t)now.tv_nsec;
+}
+
+static void hostSleepUntilNs(uint64_t t)
+{
+  struct timespec ts;
+
+  ts.tv_sec = (time_t)(t / 1000000000U);
+  ts.tv_nsec = (long)(t % 1000000000U);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+  {
+  }
+}
+
+/* xorshift64 */
+static uint32_t hostRandom(CO_hostBus_t *bus)
+{
+  bus->rng ^= bus->rng << 13;
+  bus->rng ^= bus->rng >> 7;
+  bus->rng ^= bus->rng << 17;
+  return (uint32_t)(bus->rng >> 32);
+}
+
+/******************************************************************************/
+/* Bit writer, which calculates CRC and counts stuff bits */
+typedef struct
+{
+  uint32_t bits;
+  uint32_t stuffBits;
+  uint16_t crc;
+  uint8_t last;
+  uint8_t run;
+} hostBitWriter_t;
+
+static void hostBitsStuff(hostBitWriter_t *w, uint8_t bit)
+{
+  w->bits++;
+  if ((w->run > 0U) && (bit == w->last))
+  {
+    w->run++;
+  }
+  else
+  {
+    w->last = bit;
+    w->run = 1U;
+  }
+  if (w->run == 5U)
+  {
+    /* stuff bit of opposite value starts new run */
+    w->stuffBits++;
+    w->last = bit ^ 1U;
+    w->run = 1U;
+  }
+}
+
+static void hostBitsPut(hostBitWriter_t *w, uint32_t value, uint8_t count)
+{
+  while (count > 0U)
+  {
+    uint8_t bit = (uint8_t)((value >> --count) & 1U);
+
+    if (((bit ^ (w->crc >> 14)) & 1U) != 0U)
+    {
+      w->crc = (uint16_t)(((w->crc << 1) ^ 0x4599U) & 0x7FFFU);
+    }
+    else
+    {
+      w->crc = (uint16_t)((w->crc << 1) & 0x7FFFU);
+    }
+    hostBitsStuff(w, bit);
+  }
+}
+
+uint32_t CO_hostBus_frameBits(const twai_message_t *msg)
+{
+  hostBitWriter_t w = {0};
+  uint8_t dlc = msg->data_length_code;
+  uint8_t len = (dlc > 8U) ? 8U : dlc;
+  uint16_t crc;
+  uint8_t i;
+
+  hostBitsPut(&w, 0U, 1U); /* SOF */
+  if (msg->extd)
+  {
+    hostBitsPut(&w, (msg->identifier >> 18) & 0x7FFU, 11U);
+    hostBitsPut(&w, 3U, 2U); /* SRR, IDE */
+    hostBitsPut(&w, msg->identifier & 0x3FFFFU, 18U);
+    hostBitsPut(&w, msg->rtr, 1U);
+    hostBitsPut(&w, 0U, 2U); /* r1, r0 */
+  }
+  else
+  {
+    hostBitsPut(&w, msg->identifier & 0x7FFU, 11U);
+    hostBitsPut(&w, msg->rtr, 1U);
+    hostBitsPut(&w, 0U, 2U); /* IDE, r0 */
+  }
+  hostBitsPut(&w, dlc & 0xFU, 4U);
+  if (!msg->rtr)
+  {
+    for (i = 0U; i < len; i++)
+    {
+      hostBitsPut(&w, msg->data[i], 8U);
+    }
+  }
+  crc = w.crc;
+  for (i = 15U; i > 0U; i--)
+  {
+    hostBitsStuff(&w, (uint8_t)((crc >> (i - 1U)) & 1U));
+  }
+
+  /* CRC delimiter, ACK slot and delimiter, EOF, intermission */
+  return w.bits + w.stuffBits + 1U + 2U + 7U + 3U;
+}
+
+/******************************************************************************/
+/* Arbitration field as compared on the bus, lower value wins */
+static uint32_t hostArbitration(const twai_message_t *msg)
+{
+  if (msg->extd)
+  {
+    return (((msg->identifier >> 18) & 0x7FFU) << 21) | (3U << 19) | ((msg->identifier & 0x3FFFFU) << 1) | msg->rtr;
+  }
+  return ((msg->identifier & 0x7FFU) << 21) | ((uint32_t)msg->rtr << 20);
+}
+
+/* TWAI acceptance filter, mask bit 1 is don't care */
+static bool hostFilterAccepts(const twai_filter_config_t *f, const twai_message_t *msg)
+{
+  uint32_t code = f->acceptance_code;
+  uint32_t care = ~f->acceptance_mask;
+  uint8_t len = msg->rtr ? 0U : msg->data_length_code;
+  uint32_t value, relevant;
+
+  if (f->single_filter)
+  {
+    if (msg->extd)
+    {
+      value = (msg->identifier << 3) | ((uint32_t)msg->rtr << 2);
+      relevant = 0xFFFFFFFCUL;
+    }
+    else
+    {
+      value = (msg->identifier << 21) | ((uint32_t)msg->rtr << 20) | ((uint32_t)msg->data[0] << 8) | msg->data[1];
+      relevant = 0xFFF00000UL | ((len > 0U) ? 0xFF00UL : 0U) | ((len > 1U) ? 0xFFUL : 0U);
+    }
+    return ((value ^ code) & care & relevant) == 0U;
+  }
+
+  if (msg->extd)
+  {
+    value = (msg->identifier >> 13) & 0xFFFFU;
+    return (((((value << 16) ^ code) & care & 0xFFFF0000UL) == 0U) || (((value ^ code) & care & 0xFFFFUL) == 0U));
+  }
+  value = (msg->identifier << 21) | ((uint32_t)msg->rtr << 20) | ((uint32_t)(msg->data[0] >> 4) << 16) |
+          (msg->data[0] & 0xFU);
+  relevant = 0xFFF00000UL | ((len > 0U) ? 0x000F000FUL : 0U);
+  if (((value ^ code) & care & relevant) == 0U)
+  {
+    return true;
+  }
+  value = (msg->identifier << 5) | ((uint32_t)msg->rtr << 4);
+  return ((value ^ code) & care & 0xFFF0UL) == 0U;
+}
+
+/******************************************************************************/
+static void hostAlert(CO_hostNode_t *node, uint32_t alerts)
+{
+  alerts &= node->alertsEnabled;
+  if (alerts != 0U)
+  {
+    node->alerts |= alerts;
+    pthread_cond_broadcast(&node->alertCond);
+  }
+}
+
+/* Set error counters and raise alerts for crossed limits */
+static void hostErrorCounters(CO_hostNode_t *node, uint32_t tec, uint32_t rec)
+{
+  uint32_t oldMax = (node->status.tx_error_counter > node->status.rx_error_counter) ? node->status.tx_error_counter
+                                                                                     : node->status.rx_error_counter;
+  uint32_t newMax = (tec > rec) ? tec : rec;
+
+  node->status.tx_error_counter = tec;
+  node->status.rx_error_counter = rec;
+
+  if ((oldMax < 96U) && (newMax >= 96U))
+  {
+    hostAlert(node, TWAI_ALERT_ABOVE_ERR_WARN);
+  }
+  else if ((oldMax >= 96U) && (newMax < 96U))
+  {
+    hostAlert(node, TWAI_ALERT_BELOW_ERR_WARN);
+  }
+  if ((oldMax < 128U) && (newMax >= 128U))
+  {
+    hostAlert(node, TWAI_ALERT_ERR_PASS);
+  }
+  else if ((oldMax >= 128U) && (newMax < 128U))
+  {
+    hostAlert(node, TWAI_ALERT_ERR_ACTIVE);
+  }
+
+  if ((tec >= 256U) && (node->state == TWAI_STATE_RUNNING))
+  {
+    /* bus-off, transmit queue is cleared */
+    node->state = TWAI_STATE_BUS_OFF;
+    node->status.tx_failed_count += node->txCount;
+    node->txCount = 0U;
+    node->txGeneration++;
+    pthread_cond_broadcast(&node->txCond);
+    hostAlert(node, TWAI_ALERT_BUS_OFF);
+  }
+}
+
+static void hostRxPush(CO_hostNode_t *node, const twai_message_t *msg)
+{
+  if (!hostFilterAccepts(&node->filter, msg))
+  {
+    return;
+  }
+  if (node->overrunInject > 0U)
+  {
+    node->overrunInject--;
+    node->status.rx_overrun_count++;
+    hostAlert(node, TWAI_ALERT_RX_FIFO_OVERRUN);
+  }
+  else if (node->rxCount >= node->rxCap)
+  {
+    node->status.rx_missed_count++;
+    hostAlert(node, TWAI_ALERT_RX_QUEUE_FULL);
+  }
+  else
+  {
+    node->rxBuf[(node->rxHead + node->rxCount) % node->rxCap] = *msg;
+    node->rxCount++;
+    pthread_cond_signal(&node->rxCond);
+    hostAlert(node, TWAI_ALERT_RX_DATA);
+  }
+}
+
+/******************************************************************************/
+/* Transmit frame of the winner node. Called with bus locked, returns locked. */
+static void hostTransmit(CO_hostBus_t *bus, CO_hostNode_t *winner)
+{
+  twai_message_t msg = winner->txBuf[winner->txHead];
+  uint32_t generation = winner->txGeneration;
+  uint32_t bits = CO_hostBus_frameBits(&msg);
+  uint64_t durationNs = (uint64_t)((double)bits * 1e9 / (double)winner->bitrate * bus->config.timeScale);
+  bool injected = (bus->config.errorRatePpm > 0U) && ((hostRandom(bus) % 1000000U) < bus->config.errorRatePpm);
+  bool mismatched = false;
+  bool acked = winner->mode == TWAI_MODE_NO_ACK;
+  CO_hostNode_t *node;
+
+  bus->inFlight = winner;
+  for (node = bus->nodes; node != NULL; node = node->next)
+  {
+    if ((node == winner) || !node->installed || (node->state != TWAI_STATE_RUNNING))
+    {
+      continue;
+    }
+    if (node->bitrate != winner->bitrate)
+    {
+      /* node with other bitrate sends error flags, unless listen only */
+      mismatched = mismatched || (node->mode != TWAI_MODE_LISTEN_ONLY);
+    }
+    else if (node->mode != TWAI_MODE_LISTEN_ONLY)
+    {
+      acked = true;
+    }
+    /* other contenders lose arbitration */
+    if ((node->txCount > 0U) && (node->mode != TWAI_MODE_LISTEN_ONLY))
+    {
+      node->status.arb_lost_count++;
+      hostAlert(node, TWAI_ALERT_ARB_LOST);
+    }
+  }
+
+  /* frame takes its time on the bus, consecutive frames keep exact timing */
+  if (durationNs > 0U)
+  {
+    uint64_t now = hostNowNs();
+
+    if (bus->busTimeNs < now)
+    {
+      bus->busTimeNs = now;
+    }
+    bus->busTimeNs += durationNs;
+    pthread_mutex_unlock(&bus->lock);
+    hostSleepUntilNs(bus->busTimeNs);
+    pthread_mutex_lock(&bus->lock);
+  }
+  else
+  {
+    /* without timing let tasks access the bus between frames */
+    pthread_mutex_unlock(&bus->lock);
+    sched_yield();
+    pthread_mutex_lock(&bus->lock);
+  }
+  bus->inFlight = NULL;
+  pthread_cond_broadcast(&bus->cond);
+  bus->stats.bits += bits;
+  bus->stats.busyNs += durationNs;
+
+  /* transmission was aborted meanwhile */
+  if ((winner->txGeneration != generation) || (winner->state != TWAI_STATE_RUNNING))
+  {
+    return;
+  }
+
+  if (injected || mismatched || !acked)
+  {
+    uint32_t tec = winner->status.tx_error_counter;
+
+    bus->stats.errorFrames++;
+    winner->status.bus_error_count++;
+    hostAlert(winner, TWAI_ALERT_BUS_ERROR);
+    /* missing acknowledge alone does not raise error passive transmitter */
+    if (injected || mismatched || acked || (tec < 128U))
+    {
+      tec += 8U;
+    }
+    for (node = bus->nodes; node != NULL; node = node->next)
+    {
+      if ((node != winner) && node->installed && (node->state == TWAI_STATE_RUNNING) && acked)
+      {
+        node->status.bus_error_count++;
+        hostAlert(node, TWAI_ALERT_BUS_ERROR);
+        hostErrorCounters(node, node->status.tx_error_counter, node->status.rx_error_counter + 1U);
+      }
+    }
+    if (msg.ss)
+    {
+      /* single shot is not retransmitted */
+      winner->txHead = (winner->txHead + 1U) % winner->txCap;
+      winner->txCount--;
+      winner->status.tx_failed_count++;
+      pthread_cond_signal(&winner->txCond);
+      hostAlert(winner, TWAI_ALERT_TX_FAILED | ((winner->txCount == 0U) ? TWAI_ALERT_TX_IDLE : 0U));
+    }
+    else
+    {
+      hostAlert(winner, TWAI_ALERT_TX_RETRIED);
+    }
+    hostErrorCounters(winner, tec, winner->status.rx_error_counter);
+    return;
+  }
+
+  bus->stats.frames++;
+  winner->txHead = (winner->txHead + 1U) % winner->txCap;
+  winner->txCount--;
+  pthread_cond_signal(&winner->txCond);
+  hostAlert(winner, TWAI_ALERT_TX_SUCCESS | ((winner->txCount == 0U) ? TWAI_ALERT_TX_IDLE : 0U));
+  if (winner->status.tx_error_counter > 0U)
+  {
+    hostErrorCounters(winner, winner->status.tx_error_counter - 1U, winner->status.rx_error_counter);
+  }
+
+  for (node = bus->nodes; node != NULL; node = node->next)
+  {
+    if (!node->installed || (node->state != TWAI_STATE_RUNNING) || (node->bitrate != winner->bitrate) ||
+        ((node == winner) && !msg.self))
+    {
+      continue;
+    }
+    if ((node != winner) && (node->status.rx_error_counter > 0U))
+    {
+      hostErrorCounters(node, node->status.tx_error_counter, node->status.rx_error_counter - 1U);
+    }
+    hostRxPush(node, &msg);
+  }
+
+#ifdef __linux__
+  if (bus->sock >= 0)
+  {
+    struct can_frame frame = {0};
+
+    frame.can_id = msg.identifier | (msg.extd ? CAN_EFF_FLAG : 0U) | (msg.rtr ? CAN_RTR_FLAG : 0U);
+    frame.can_dlc = (msg.data_length_code > 8U) ? 8U : msg.data_length_code;
+    memcpy(frame.data, msg.data, sizeof(frame.data));
+    (void)write(bus->sock, &frame, sizeof(frame));
+  }
+#endif
+}
+
+/* Bus thread: bus-off recovery and arbitration */
+static void *hostBusRun(void *arg)
+{
+  CO_hostBus_t *bus = (CO_hostBus_t *)arg;
+
+  pthread_mutex_lock(&bus->lock);
+  while (!bus->stop)
+  {
+    uint64_t now = hostNowNs();
+    uint64_t wake = UINT64_MAX;
+    CO_hostNode_t *winner = NULL;
+    uint32_t winnerKey = UINT32_MAX;
+    CO_hostNode_t *node;
+
+    for (node = bus->nodes; node != NULL; node = node->next)
+    {
+      if (!node->installed)
+      {
+        continue;
+      }
+      if (node->state == TWAI_STATE_RECOVERING)
+      {
+        if (now >= node->recoverAtNs)
+        {
+          node->state = TWAI_STATE_STOPPED;
+          hostErrorCounters(node, 0U, 0U);
+          hostAlert(node, TWAI_ALERT_BUS_RECOVERED);
+        }
+        else if (node->recoverAtNs < wake)
+        {
+          wake = node->recoverAtNs;
+        }
+      }
+      if ((node->state == TWAI_STATE_RUNNING) && (node->txCount > 0U) && (node->mode != TWAI_MODE_LISTEN_ONLY))
+      {
+        uint32_t key = hostArbitration(&node->txBuf[node->txHead]);
+
+        if (key < winnerKey)
+        {
+          winnerKey = key;
+          winner = node;
+        }
+      }
+    }
+
+    if (winner != NULL)
+    {
+      hostTransmit(bus, winner);
+    }
+    else if (wake != UINT64_MAX)
+    {
+      struct timespec deadline;
+
+      deadline.tv_sec = (time_t)(wake / 1000000000U);
+      deadline.tv_nsec = (long)(wake % 1000000000U);
+      pthread_cond_timedwait(&bus->cond, &bus->lock, &deadline);
+    }
+    else
+    {
+      pthread_cond_wait(&bus->cond, &bus->lock);
+    }
+  }
+  pthread_mutex_unlock(&bus->lock);
+  return NULL;
+}
+
+/******************************************************************************/
+CO_hostBus_t *CO_hostBus_create(const CO_hostBusConfig_t *config)
+{
+  CO_hostBus_t *bus = calloc(1, sizeof(*bus));
+
+  if (bus == NULL)
+  {
+    return NULL;
+  }
+  bus->config.timeScale = 1.0;
+  if (config != NULL)
+  {
+    bus->config = *config;
+  }
+  bus->rng = ((uint64_t)bus->config.seed << 1) | 1U;
+  bus->sock = -1;
+  pthread_mutex_init(&bus->lock, NULL);
+  CO_hostCondInit(&bus->cond);
+  if (pthread_create(&bus->thread, NULL, hostBusRun, bus) != 0)
+  {
+    free(bus);
+    return NULL;
+  }
+  return bus;
+}
+
+void CO_hostBus_delete(CO_hostBus_t *bus)
+{
+  pthread_mutex_lock(&bus->lock);
+  bus->stop = true;
+  pthread_cond_broadcast(&bus->cond);
+  pthread_mutex_unlock(&bus->lock);
+  pthread_join(bus->thread, NULL);
+#ifdef __linux__
+  if (bus->sock >= 0)
+  {
+    shutdown(bus->sock, SHUT_RDWR);
+    pthread_cancel(bus->sockThread);
+    pthread_join(bus->sockThread, NULL);
+    close(bus->sock);
+  }
+#endif
+  pthread_cond_destroy(&bus->cond);
+  pthread_mutex_destroy(&bus->lock);
+  free(bus);
+}
+
+void CO_hostBus_setErrorRate(CO_hostBus_t *bus, uint32_t errorRatePpm)
+{
+  pthread_mutex_lock(&bus->lock);
+  bus->config.errorRatePpm = errorRatePpm;
+  pthread_mutex_unlock(&bus->lock);
+}
+
+void CO_hostBus_setTimeScale(CO_hostBus_t *bus, double timeScale)
+{
+  pthread_mutex_lock(&bus->lock);
+  bus->config.timeScale = timeScale;
+  pthread_mutex_unlock(&bus->lock);
+}
+
+void CO_hostBus_getStats(CO_hostBus_t *bus, CO_hostBusStats_t *stats)
+{
+  pthread_mutex_lock(&bus->lock);
+  *stats = bus->stats;
+  pthread_mutex_unlock(&bus->lock);
+}
+
+/******************************************************************************/
+#ifdef __linux__
+/* Frames from SocketCAN interface are received by all running nodes */
+static void *hostSocketRun(void *arg)
+{
+  CO_hostBus_t *bus = (CO_hostBus_t *)arg;
+  struct can_frame frame;
+
+  while (read(bus->sock, &frame, sizeof(frame)) == (ssize_t)sizeof(frame))
+  {
+    twai_message_t msg = {0};
+    CO_hostNode_t *node;
+
+    msg.extd = (frame.can_id & CAN_EFF_FLAG) != 0U;
+    msg.rtr = (frame.can_id & CAN_RTR_FLAG) != 0U;
+    msg.identifier = frame.can_id & (msg.extd ? CAN_EFF_MASK : CAN_SFF_MASK);
+    msg.data_length_code = frame.can_dlc;
+    memcpy(msg.data, frame.data, sizeof(msg.data));
+
+    pthread_mutex_lock(&bus->lock);
+    bus->stats.frames++;
+    for (node = bus->nodes; node != NULL; node = node->next)
+    {
+      if (node->installed && (node->state == TWAI_STATE_RUNNING))
+      {
+        hostRxPush(node, &msg);
+      }
+    }
+    pthread_mutex_unlock(&bus->lock);
+  }
+  return NULL;
+}
+#endif
+
+bool CO_hostBus_openSocketCAN(CO_hostBus_t *bus, const char *ifName)
+{
+#ifdef __linux__
+  struct sockaddr_can addr = {0};
+  struct ifreq ifr = {0};
+  int sock;
+
+  if (bus->sock >= 0)
+  {
+    return false;
+  }
+  sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if (sock < 0)
+  {
+    return false;
+  }
+  strncpy(ifr.ifr_name, ifName, IFNAMSIZ - 1);
+  if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0)
+  {
+    close(sock);
+    return false;
+  }
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(sock);
+    return false;
+  }
+  bus->sock = sock;
+  if (pthread_create(&bus->sockThread, NULL, hostSocketRun, bus) != 0)
+  {
+    bus->sock = -1;
+    close(sock);
+    return false;
+  }
+  return true;
+#else
+  (void)bus;
+  (void)ifName;
+  return false;
+#endif
+}
+
+/******************************************************************************/
+CO_hostNode_t *CO_hostNode_create(CO_hostBus_t *bus, const char *name)
+{
+  CO_hostNode_t *node = calloc(1, sizeof(*node));
+
+  if (node == NULL)
+  {
+    return NULL;
+  }
+  node->bus = bus;
+  strncpy(node->name, (name != NULL) ? name : "", sizeof(node->name) - 1U);
+  CO_hostCondInit(&node->txCond);
+  CO_hostCondInit(&node->rxCond);
+  CO_hostCondInit(&node->alertCond);
+
+  pthread_mutex_lock(&bus->lock);
+  node->next = bus->nodes;
+  bus->nodes = node;
+  pthread_mutex_unlock(&bus->lock);
+  return node;
+}
+
+void CO_hostNode_delete(CO_hostNode_t *node)
+{
+  CO_hostBus_t *bus = node->bus;
+  CO_hostNode_t **p;
+  int i;
+
+  pthread_mutex_lock(&bus->lock);
+  while (bus->inFlight == node)
+  {
+    pthread_cond_wait(&bus->cond, &bus->lock);
+  }
+  for (i = 0; i < HOST_TWAI_CONTROLLERS; i++)
+  {
+    if (hostControllers[i] == node)
+    {
+      hostControllers[i] = NULL;
+    }
+  }
+  for (p = &bus->nodes; *p != NULL; p = &(*p)->next)
+  {
+    if (*p == node)
+    {
+      *p = node->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&bus->lock);
+
+  free(node->txBuf);
+  free(node->rxBuf);
+  pthread_cond_destroy(&node->txCond);
+  pthread_cond_destroy(&node->rxCond);
+  pthread_cond_destroy(&node->alertCond);
+  free(node);
+}
+
+void CO_hostNode_setController(CO_hostNode_t *node, int controllerId)
+{
+  if ((controllerId >= 0) && (controllerId < HOST_TWAI_CONTROLLERS))
+  {
+    __atomic_store_n(&hostControllers[controllerId], node, __ATOMIC_RELEASE);
+  }
+}
+
+void CO_hostNode_bind(CO_hostNode_t *node)
+{
+  vTaskSetHostContext(node);
+}
+
+CO_hostNode_t *CO_hostNode_bound(void)
+{
+  return (CO_hostNode_t *)pvTaskGetHostContext();
+}
+
+void CO_hostNode_injectErrors(CO_hostNode_t *node, uint32_t txErrors, uint32_t rxErrors)
+{
+  pthread_mutex_lock(&node->bus->lock);
+  hostErrorCounters(node, node->status.tx_error_counter + txErrors, node->status.rx_error_counter + rxErrors);
+  pthread_mutex_unlock(&node->bus->lock);
+}
+
+void CO_hostNode_injectOverrun(CO_hostNode_t *node, uint32_t count)
+{
+  pthread_mutex_lock(&node->bus->lock);
+  node->overrunInject += count;
+  pthread_mutex_unlock(&node->bus->lock);
+}
+
+/******************************************************************************/
+/* TWAI driver API. Legacy functions operate on node bound to calling task,
+ * v2 functions on node given by handle. */
+
+/* Lock bus of node, returns NULL if there is no node */
+static CO_hostNode_t *hostLock(CO_hostNode_t *node)
+{
+  if (node != NULL)
+  {
+    pthread_mutex_lock(&node->bus->lock);
+  }
+  return node;
+}
+
+/* Unlock bus. Polling without wait yields, so polling task does not starve
+ * the bus thread, when frames are sent without timing. */
+static void hostUnlock(CO_hostNode_t *node, esp_err_t ret)
+{
+  pthread_mutex_unlock(&node->bus->lock);
+  if (ret == ESP_ERR_TIMEOUT)
+  {
+    sched_yield();
+  }
+}
+
+static void hostTicksDeadline(struct timespec *deadline, TickType_t ticks)
+{
+  if ((ticks != 0) && (ticks != portMAX_DELAY))
+  {
+    CO_hostDeadline(deadline, (uint64_t)pdTICKS_TO_MS(ticks) * 1000000U);
+  }
+}
+
+static esp_err_t hostTwaiDriverInstall(CO_hostNode_t *node, const twai_general_config_t *g_config,
+                                       const twai_timing_config_t *t_config, const twai_filter_config_t *f_config)
+{
+  uint32_t tq;
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_driver_install");
+  if ((g_config == NULL) || (t_config == NULL) || (f_config == NULL))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  tq = 1U + t_config->tseg_1 + t_config->tseg_2;
+  if ((t_config->quanta_resolution_hz == 0U) && (t_config->brp == 0U))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (node->installed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    free(node->txBuf);
+    free(node->rxBuf);
+    /* queue and hardware transmit buffer */
+    node->txCap = g_config->tx_queue_len + 1U;
+    node->rxCap = (g_config->rx_queue_len > 0U) ? g_config->rx_queue_len : 1U;
+    node->txBuf = calloc(node->txCap, sizeof(twai_message_t));
+    node->rxBuf = calloc(node->rxCap, sizeof(twai_message_t));
+    if ((node->txBuf == NULL) || (node->rxBuf == NULL))
+    {
+      ret = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+      node->installed = true;
+      node->mode = g_config->mode;
+      node->state = TWAI_STATE_STOPPED;
+      node->bitrate = (t_config->quanta_resolution_hz != 0U) ? (t_config->quanta_resolution_hz / tq)
+                                                             : (uint32_t)(HOST_TWAI_CLOCK_HZ / (t_config->brp * tq));
+      node->filter = *f_config;
+      node->alertsEnabled = g_config->alerts_enabled;
+      node->alerts = 0U;
+      node->txHead = node->txCount = 0U;
+      node->rxHead = node->rxCount = 0U;
+      node->overrunInject = 0U;
+      memset(&node->status, 0, sizeof(node->status));
+    }
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiDriverUninstall(CO_hostNode_t *node)
+{
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_driver_uninstall");
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!node->installed || ((node->state != TWAI_STATE_STOPPED) && (node->state != TWAI_STATE_BUS_OFF)))
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    node->installed = false;
+    node->txCount = 0U;
+    node->rxCount = 0U;
+    node->txGeneration++;
+    /* wake tasks waiting in driver, they return error */
+    pthread_cond_broadcast(&node->txCond);
+    pthread_cond_broadcast(&node->rxCond);
+    pthread_cond_broadcast(&node->alertCond);
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiStart(CO_hostNode_t *node)
+{
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_start");
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!node->installed || (node->state != TWAI_STATE_STOPPED))
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    node->state = TWAI_STATE_RUNNING;
+    node->txCount = 0U;
+    node->rxCount = 0U;
+    pthread_cond_broadcast(&node->bus->cond);
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiStop(CO_hostNode_t *node)
+{
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_stop");
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!node->installed || (node->state != TWAI_STATE_RUNNING))
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    node->state = TWAI_STATE_STOPPED;
+    node->txCount = 0U;
+    node->txGeneration++;
+    pthread_cond_broadcast(&node->txCond);
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiTransmit(CO_hostNode_t *node, const twai_message_t *message, TickType_t ticks_to_wait)
+{
+  struct timespec deadline;
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_transmit");
+  if ((message == NULL) || ((message->data_length_code > TWAI_FRAME_MAX_DLC) && !message->dlc_non_comp))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  hostTicksDeadline(&deadline, ticks_to_wait);
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  while (node->installed && (node->state == TWAI_STATE_RUNNING) && (node->txCount >= node->txCap) &&
+         CO_hostCondWait(&node->txCond, &node->bus->lock, ticks_to_wait, &deadline))
+  {
+  }
+  if (!node->installed || (node->state != TWAI_STATE_RUNNING))
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else if (node->mode == TWAI_MODE_LISTEN_ONLY)
+  {
+    ret = ESP_ERR_NOT_SUPPORTED;
+  }
+  else if (node->txCount >= node->txCap)
+  {
+    ret = ESP_ERR_TIMEOUT;
+  }
+  else
+  {
+    node->txBuf[(node->txHead + node->txCount) % node->txCap] = *message;
+    node->txCount++;
+    pthread_cond_signal(&node->bus->cond);
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiReceive(CO_hostNode_t *node, twai_message_t *message, TickType_t ticks_to_wait)
+{
+  struct timespec deadline;
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_receive");
+  if (message == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  hostTicksDeadline(&deadline, ticks_to_wait);
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  while (node->installed && (node->rxCount == 0U) &&
+         CO_hostCondWait(&node->rxCond, &node->bus->lock, ticks_to_wait, &deadline))
+  {
+  }
+  if (!node->installed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else if (node->rxCount == 0U)
+  {
+    ret = ESP_ERR_TIMEOUT;
+  }
+  else
+  {
+    *message = node->rxBuf[node->rxHead];
+    node->rxHead = (node->rxHead + 1U) % node->rxCap;
+    node->rxCount--;
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiReadAlerts(CO_hostNode_t *node, uint32_t *alerts, TickType_t ticks_to_wait)
+{
+  struct timespec deadline;
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_read_alerts");
+  if (alerts == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  hostTicksDeadline(&deadline, ticks_to_wait);
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  while (node->installed && (node->alerts == 0U) &&
+         CO_hostCondWait(&node->alertCond, &node->bus->lock, ticks_to_wait, &deadline))
+  {
+  }
+  *alerts = node->alerts;
+  node->alerts = 0U;
+  if (!node->installed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else if (*alerts == 0U)
+  {
+    ret = ESP_ERR_TIMEOUT;
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiReconfigureAlerts(CO_hostNode_t *node, uint32_t alerts_enabled, uint32_t *current_alerts)
+{
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_reconfigure_alerts");
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!node->installed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    if (current_alerts != NULL)
+    {
+      *current_alerts = node->alerts;
+    }
+    node->alerts = 0U;
+    node->alertsEnabled = alerts_enabled;
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiInitiateRecovery(CO_hostNode_t *node)
+{
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_initiate_recovery");
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!node->installed || (node->state != TWAI_STATE_BUS_OFF))
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    node->state = TWAI_STATE_RECOVERING;
+    node->recoverAtNs = hostNowNs() + (uint64_t)((double)HOST_RECOVERY_BITS * 1e9 / (double)node->bitrate *
+                                                 node->bus->config.timeScale);
+    hostAlert(node, TWAI_ALERT_RECOVERY_IN_PROGRESS);
+    pthread_cond_broadcast(&node->bus->cond);
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiGetStatusInfo(CO_hostNode_t *node, twai_status_info_t *status_info)
+{
+  esp_err_t ret = ESP_OK;
+
+  if (status_info == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!node->installed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    *status_info = node->status;
+    status_info->state = node->state;
+    status_info->msgs_to_tx = node->txCount;
+    status_info->msgs_to_rx = node->rxCount;
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiClearTransmitQueue(CO_hostNode_t *node)
+{
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_clear_transmit_queue");
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!node->installed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    /* message in hardware buffer is not affected */
+    node->txCount = ((node->bus->inFlight == node) && (node->txCount > 0U)) ? 1U : 0U;
+    pthread_cond_broadcast(&node->txCond);
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+static esp_err_t hostTwaiClearReceiveQueue(CO_hostNode_t *node)
+{
+  esp_err_t ret = ESP_OK;
+
+  CO_hostNotCritical("twai_clear_receive_queue");
+  if (hostLock(node) == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!node->installed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    node->rxCount = 0U;
+  }
+  hostUnlock(node, ret);
+  return ret;
+}
+
+/******************************************************************************/
+esp_err_t twai_driver_install(const twai_general_config_t *g_config, const twai_timing_config_t *t_config,
+                              const twai_filter_config_t *f_config)
+{
+  return hostTwaiDriverInstall(CO_hostNode_bound(), g_config, t_config, f_config);
+}
+
+esp_err_t twai_driver_uninstall(void)
+{
+  return hostTwaiDriverUninstall(CO_hostNode_bound());
+}
+
+esp_err_t twai_start(void)
+{
+  return hostTwaiStart(CO_hostNode_bound());
+}
+
+esp_err_t twai_stop(void)
+{
+  return hostTwaiStop(CO_hostNode_bound());
+}
+
+esp_err_t twai_transmit(const twai_message_t *message, TickType_t ticks_to_wait)
+{
+  return hostTwaiTransmit(CO_hostNode_bound(), message, ticks_to_wait);
+}
+
+esp_err_t twai_receive(twai_message_t *message, TickType_t ticks_to_wait)
+{
+  return hostTwaiReceive(CO_hostNode_bound(), message, ticks_to_wait);
+}
+
+esp_err_t twai_read_alerts(uint32_t *alerts, TickType_t ticks_to_wait)
+{
+  return hostTwaiReadAlerts(CO_hostNode_bound(), alerts, ticks_to_wait);
+}
+
+esp_err_t twai_reconfigure_alerts(uint32_t alerts_enabled, uint32_t *current_alerts)
+{
+  return hostTwaiReconfigureAlerts(CO_hostNode_bound(), alerts_enabled, current_alerts);
+}
+
+esp_err_t twai_initiate_recovery(void)
+{
+  return hostTwaiInitiateRecovery(CO_hostNode_bound());
+}
+
+esp_err_t twai_get_status_info(twai_status_info_t *status_info)
+{
+  return hostTwaiGetStatusInfo(CO_hostNode_bound(), status_info);
+}
+
+esp_err_t twai_clear_transmit_queue(void)
+{
+  return hostTwaiClearTransmitQueue(CO_hostNode_bound());
+}
+
+esp_err_t twai_clear_receive_queue(void)
+{
+  return hostTwaiClearReceiveQueue(CO_hostNode_bound());
+}
+
+/******************************************************************************/
+/* Handle is the node. Controller without assigned node is the bound node, as
+ * with legacy API. */
+esp_err_t twai_driver_install_v2(const twai_general_config_t *g_config, const twai_timing_config_t *t_config,
+                                 const twai_filter_config_t *f_config, twai_handle_t *ret_twai)
+{
+  CO_hostNode_t *node;
+  esp_err_t ret;
+
+  if ((g_config == NULL) || (ret_twai == NULL) || (g_config->controller_id < 0) ||
+      (g_config->controller_id >= HOST_TWAI_CONTROLLERS))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  node = __atomic_load_n(&hostControllers[g_config->controller_id], __ATOMIC_ACQUIRE);
+  if (node == NULL)
+  {
+    node = CO_hostNode_bound();
+  }
+  ret = hostTwaiDriverInstall(node, g_config, t_config, f_config);
+  if (ret == ESP_OK)
+  {
+    *ret_twai = (twai_handle_t)node;
+  }
+  return ret;
+}
+
+esp_err_t twai_driver_uninstall_v2(twai_handle_t handle)
+{
+  return hostTwaiDriverUninstall((CO_hostNode_t *)handle);
+}
+
+esp_err_t twai_start_v2(twai_handle_t handle)
+{
+  return hostTwaiStart((CO_hostNode_t *)handle);
+}
+
+esp_err_t twai_stop_v2(twai_handle_t handle)
+{
+  return hostTwaiStop((CO_hostNode_t *)handle);
+}
+
+esp_err_t twai_transmit_v2(twai_handle_t handle, const twai_message_t *message, TickType_t ticks_to_wait)
+{
+  return hostTwaiTransmit((CO_hostNode_t *)handle, message, ticks_to_wait);
+}
+
+esp_err_t twai_receive_v2(twai_handle_t handle, twai_message_t *message, TickType_t ticks_to_wait)
+{
+  return hostTwaiReceive((CO_hostNode_t *)handle, message, ticks_to_wait);
+}
+
+esp_err_t twai_read_alerts_v2(twai_handle_t handle, uint32_t *alerts, TickType_t ticks_to_wait)
+{
+  return hostTwaiReadAlerts((CO_hostNode_t *)handle, alerts, ticks_to_wait);
+}
+
+esp_err_t twai_reconfigure_alerts_v2(twai_handle_t handle, uint32_t alerts_enabled, uint32_t *current_alerts)
+{
+  return hostTwaiReconfigureAlerts((CO_hostNode_t *)handle, alerts_enabled, current_alerts);
+}
+
+esp_err_t twai_initiate_recovery_v2(twai_handle_t handle)
+{
+  return hostTwaiInitiateRecovery((CO_hostNode_t *)handle);
+}
+
+esp_err_t twai_get_status_info_v2(twai_handle_t handle, twai_status_info_t *status_info)
+{
+  return hostTwaiGetStatusInfo((CO_hostNode_t *)handle, status_info);
+}
+
+esp_err_t twai_clear_transmit_queue_v2(twai_handle_t handle)
+{
+  return hostTwaiClearTransmitQueue((CO_hostNode_t *)handle);
+}
+
+esp_err_t twai_clear_receive_queue_v2(twai_handle_t handle)
+{
+  return hostTwaiClearReceiveQueue((CO_hostNode_t *)handle);
+}
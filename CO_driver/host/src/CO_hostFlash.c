@@ -0,0 +1,384 @@
+/*
+ * Simulated flash and ESP-IDF partition API for host build.
+ *
+ * @file        CO_hostFlash.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CO_hostFlash.h"
+
+/* Number of partitions, which can be created with CO_hostFlash_create() */
+#define HOST_FLASH_PARTITIONS 8
+#define HOST_FLASH_PAGE 256U
+
+typedef struct
+{
+  esp_partition_t partition;
+  uint8_t *data;
+  uint32_t *sectorErases;
+  CO_hostFlashTiming_t timing;
+  CO_hostFlashStats_t stats;
+  bool mmapEnabled;
+  uint32_t mapped;
+  bool powerCut;
+  uint64_t powerBytes;
+} hostFlash_t;
+
+static hostFlash_t *hostFlashes[HOST_FLASH_PARTITIONS];
+static pthread_mutex_t hostFlashLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Partition is the first member of hostFlash_t */
+static hostFlash_t *hostFlashGet(const esp_partition_t *partition)
+{
+  return (hostFlash_t *)partition;
+}
+
+static bool hostFlashRange(const hostFlash_t *flash, size_t offset, size_t size)
+{
+  return (offset <= flash->partition.size) && (size <= (flash->partition.size - offset));
+}
+
+/******************************************************************************/
+const esp_partition_t *CO_hostFlash_create(const char *label, uint32_t size, const CO_hostFlashTiming_t *timing)
+{
+  hostFlash_t *flash;
+  uint32_t i;
+
+  if ((label == NULL) || (size == 0U) || ((size % CO_HOST_FLASH_SECTOR) != 0U))
+  {
+    return NULL;
+  }
+  flash = calloc(1, sizeof(*flash));
+  if (flash == NULL)
+  {
+    return NULL;
+  }
+  flash->data = malloc(size);
+  flash->sectorErases = calloc(size / CO_HOST_FLASH_SECTOR, sizeof(uint32_t));
+  if ((flash->data == NULL) || (flash->sectorErases == NULL))
+  {
+    free(flash->data);
+    free(flash->sectorErases);
+    free(flash);
+    return NULL;
+  }
+  memset(flash->data, 0xFF, size);
+  flash->partition.type = ESP_PARTITION_TYPE_DATA;
+  flash->partition.subtype = ESP_PARTITION_SUBTYPE_DATA_UNDEFINED;
+  flash->partition.size = size;
+  flash->partition.erase_size = CO_HOST_FLASH_SECTOR;
+  strncpy(flash->partition.label, label, sizeof(flash->partition.label) - 1U);
+  flash->mmapEnabled = true;
+  if (timing != NULL)
+  {
+    flash->timing = *timing;
+  }
+  else
+  {
+    /* ESP32 with 40 MHz QIO flash, typical page program and sector erase */
+    flash->timing.read_ns = 50U;
+    flash->timing.program_us = 700U;
+    flash->timing.erase_us = 45000U;
+  }
+
+  pthread_mutex_lock(&hostFlashLock);
+  for (i = 0U; i < HOST_FLASH_PARTITIONS; i++)
+  {
+    if (hostFlashes[i] == NULL)
+    {
+      flash->partition.address = 0x110000UL + (i * 0x100000UL);
+      hostFlashes[i] = flash;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&hostFlashLock);
+
+  if (i == HOST_FLASH_PARTITIONS)
+  {
+    free(flash->data);
+    free(flash->sectorErases);
+    free(flash);
+    return NULL;
+  }
+  return &flash->partition;
+}
+
+/******************************************************************************/
+void CO_hostFlash_delete(const esp_partition_t *partition)
+{
+  hostFlash_t *flash;
+  uint32_t i;
+
+  if (partition == NULL)
+  {
+    return;
+  }
+  flash = hostFlashGet(partition);
+  pthread_mutex_lock(&hostFlashLock);
+  for (i = 0U; i < HOST_FLASH_PARTITIONS; i++)
+  {
+    if (hostFlashes[i] == flash)
+    {
+      hostFlashes[i] = NULL;
+    }
+  }
+  pthread_mutex_unlock(&hostFlashLock);
+  free(flash->data);
+  free(flash->sectorErases);
+  free(flash);
+}
+
+/******************************************************************************/
+void CO_hostFlash_setMmap(const esp_partition_t *partition, bool enable)
+{
+  hostFlashGet(partition)->mmapEnabled = enable;
+}
+
+/******************************************************************************/
+void CO_hostFlash_powerCut(const esp_partition_t *partition, uint64_t bytes)
+{
+  hostFlash_t *flash = hostFlashGet(partition);
+
+  pthread_mutex_lock(&hostFlashLock);
+  flash->powerCut = true;
+  flash->powerBytes = bytes;
+  pthread_mutex_unlock(&hostFlashLock);
+}
+
+/******************************************************************************/
+void CO_hostFlash_powerOn(const esp_partition_t *partition)
+{
+  hostFlash_t *flash = hostFlashGet(partition);
+
+  pthread_mutex_lock(&hostFlashLock);
+  flash->powerCut = false;
+  pthread_mutex_unlock(&hostFlashLock);
+}
+
+/******************************************************************************/
+void CO_hostFlash_getStats(const esp_partition_t *partition, CO_hostFlashStats_t *stats)
+{
+  hostFlash_t *flash = hostFlashGet(partition);
+  uint32_t sectors = flash->partition.size / CO_HOST_FLASH_SECTOR;
+  uint32_t i;
+
+  pthread_mutex_lock(&hostFlashLock);
+  *stats = flash->stats;
+  stats->sectorErasesMin = UINT32_MAX;
+  stats->sectorErasesMax = 0U;
+  for (i = 0U; i < sectors; i++)
+  {
+    stats->sectorErasesMin = (flash->sectorErases[i] < stats->sectorErasesMin) ? flash->sectorErases[i]
+                                                                              : stats->sectorErasesMin;
+    stats->sectorErasesMax = (flash->sectorErases[i] > stats->sectorErasesMax) ? flash->sectorErases[i]
+                                                                              : stats->sectorErasesMax;
+  }
+  pthread_mutex_unlock(&hostFlashLock);
+}
+
+/******************************************************************************/
+void CO_hostFlash_resetStats(const esp_partition_t *partition)
+{
+  hostFlash_t *flash = hostFlashGet(partition);
+
+  pthread_mutex_lock(&hostFlashLock);
+  memset(&flash->stats, 0, sizeof(flash->stats));
+  memset(flash->sectorErases, 0, (flash->partition.size / CO_HOST_FLASH_SECTOR) * sizeof(uint32_t));
+  pthread_mutex_unlock(&hostFlashLock);
+}
+
+/******************************************************************************/
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+  const esp_partition_t *found = NULL;
+  uint32_t i;
+
+  pthread_mutex_lock(&hostFlashLock);
+  for (i = 0U; (i < HOST_FLASH_PARTITIONS) && (found == NULL); i++)
+  {
+    const esp_partition_t *p = (hostFlashes[i] != NULL) ? &hostFlashes[i]->partition : NULL;
+
+    if ((p != NULL) && ((type == ESP_PARTITION_TYPE_ANY) || (p->type == type)) &&
+        ((subtype == ESP_PARTITION_SUBTYPE_ANY) || (p->subtype == subtype)) &&
+        ((label == NULL) || (strcmp(p->label, label) == 0)))
+    {
+      found = p;
+    }
+  }
+  pthread_mutex_unlock(&hostFlashLock);
+  return found;
+}
+
+/******************************************************************************/
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+  hostFlash_t *flash;
+
+  if ((partition == NULL) || (dst == NULL))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  flash = hostFlashGet(partition);
+  if (!hostFlashRange(flash, src_offset, size))
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  pthread_mutex_lock(&hostFlashLock);
+  memcpy(dst, &flash->data[src_offset], size);
+  flash->stats.readBytes += size;
+  flash->stats.busy_us += ((uint64_t)size * flash->timing.read_ns) / 1000U;
+  pthread_mutex_unlock(&hostFlashLock);
+  return ESP_OK;
+}
+
+/******************************************************************************/
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+  const uint8_t *bytes = (const uint8_t *)src;
+  hostFlash_t *flash;
+  esp_err_t ret = ESP_OK;
+  size_t i;
+
+  if ((partition == NULL) || (src == NULL))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  flash = hostFlashGet(partition);
+  if (!hostFlashRange(flash, dst_offset, size))
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  pthread_mutex_lock(&hostFlashLock);
+  if (flash->powerCut && (flash->powerBytes < size))
+  {
+    size = (size_t)flash->powerBytes;
+    ret = ESP_FAIL;
+  }
+  if (flash->powerCut)
+  {
+    flash->powerBytes -= size;
+  }
+  for (i = 0U; i < size; i++)
+  {
+    uint8_t value = flash->data[dst_offset + i] & bytes[i];
+
+    if (value != flash->data[dst_offset + i])
+    {
+      flash->stats.programBytes++;
+    }
+    flash->data[dst_offset + i] = value;
+  }
+  flash->stats.writeBytes += size;
+  if (size > 0U)
+  {
+    flash->stats.busy_us += (uint64_t)flash->timing.program_us *
+                            (((dst_offset + size - 1U) / HOST_FLASH_PAGE) - (dst_offset / HOST_FLASH_PAGE) + 1U);
+  }
+  pthread_mutex_unlock(&hostFlashLock);
+  return ret;
+}
+
+/******************************************************************************/
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  hostFlash_t *flash;
+  esp_err_t ret = ESP_OK;
+  size_t pos;
+
+  if (partition == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  flash = hostFlashGet(partition);
+  if (!hostFlashRange(flash, offset, size) || ((offset % CO_HOST_FLASH_SECTOR) != 0U) ||
+      ((size % CO_HOST_FLASH_SECTOR) != 0U))
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  pthread_mutex_lock(&hostFlashLock);
+  for (pos = offset; pos < (offset + size); pos += CO_HOST_FLASH_SECTOR)
+  {
+    if (flash->powerCut && (flash->powerBytes == 0U))
+    {
+      /* power lost during erase, sector is only partially erased */
+      memset(&flash->data[pos], 0xFF, CO_HOST_FLASH_SECTOR / 2U);
+      ret = ESP_FAIL;
+      break;
+    }
+    memset(&flash->data[pos], 0xFF, CO_HOST_FLASH_SECTOR);
+    flash->sectorErases[pos / CO_HOST_FLASH_SECTOR]++;
+    flash->stats.erases++;
+    flash->stats.busy_us += flash->timing.erase_us;
+  }
+  pthread_mutex_unlock(&hostFlashLock);
+  return ret;
+}
+
+/******************************************************************************/
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle)
+{
+  hostFlash_t *flash;
+  uint32_t i;
+
+  if ((partition == NULL) || (out_ptr == NULL) || (out_handle == NULL) || (memory != ESP_PARTITION_MMAP_DATA))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  flash = hostFlashGet(partition);
+  if (!hostFlashRange(flash, offset, size))
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (!flash->mmapEnabled)
+  {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  /* handle is index of partition + 1, writes are seen through the mapping */
+  pthread_mutex_lock(&hostFlashLock);
+  for (i = 0U; (i < HOST_FLASH_PARTITIONS) && (hostFlashes[i] != flash); i++)
+  {
+  }
+  flash->mapped++;
+  pthread_mutex_unlock(&hostFlashLock);
+  *out_ptr = &flash->data[offset];
+  *out_handle = i + 1U;
+  return ESP_OK;
+}
+
+/******************************************************************************/
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+  pthread_mutex_lock(&hostFlashLock);
+  if ((handle > 0U) && (handle <= HOST_FLASH_PARTITIONS) && (hostFlashes[handle - 1U] != NULL) &&
+      (hostFlashes[handle - 1U]->mapped > 0U))
+  {
+    hostFlashes[handle - 1U]->mapped--;
+  }
+  pthread_mutex_unlock(&hostFlashLock);
+}
@@ -0,0 +1,896 @@
+/*
+ * Host implementation of the FreeRTOS and ESP-IDF subset used by CANopenNode
+ * driver, built on POSIX threads.
+ *
+ * @file        CO_hostRTOS.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "CO_hostRTOS.h"
+
+/* Task is a detached thread. Task objects are never freed, because other tasks
+ * may still hold their handles for notifications. */
+struct hostTask_t
+{
+  pthread_t thread;
+  TaskFunction_t code;
+  void *param;
+  char name[16];
+  void *context;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t notifyValue;
+  bool notifyPending;
+};
+
+typedef enum
+{
+  HOST_SEM_BINARY,
+  HOST_SEM_COUNTING,
+  HOST_SEM_MUTEX,
+  HOST_SEM_RECURSIVE
+} hostSemType_t;
+
+struct hostSemaphore_t
+{
+  hostSemType_t type;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t count;
+  uint32_t max;
+  TaskHandle_t owner;
+  uint32_t recursion;
+  bool isStatic;
+};
+
+struct hostQueue_t
+{
+  pthread_mutex_t lock;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+  uint8_t *storage;
+  size_t itemSize;
+  size_t length;
+  size_t head;
+  size_t count;
+  bool isStatic;
+};
+
+_Static_assert(sizeof(struct hostSemaphore_t) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t too small");
+_Static_assert(sizeof(struct hostQueue_t) <= sizeof(StaticQueue_t), "StaticQueue_t too small");
+
+static __thread TaskHandle_t hostCurrentTask;
+static __thread uint8_t hostThreadId;
+/* Number of critical sections the thread is in, also nested */
+static __thread uint32_t hostCriticalNesting;
+static pthread_once_t hostClockOnce = PTHREAD_ONCE_INIT;
+static struct timespec hostClockStart;
+static esp_log_level_t hostLogLevel = ESP_LOG_INFO;
+
+/******************************************************************************/
+static void hostClockInit(void)
+{
+  clock_gettime(CLOCK_MONOTONIC, &hostClockStart);
+}
+
+int64_t esp_timer_get_time(void)
+{
+  struct timespec now;
+
+  pthread_once(&hostClockOnce, hostClockInit);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((int64_t)(now.tv_sec - hostClockStart.tv_sec) * 1000000) + ((now.tv_nsec - hostClockStart.tv_nsec) / 1000);
+}
+
+/******************************************************************************/
+struct esp_timer
+{
+  esp_timer_cb_t callback;
+  void *arg;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool armed;
+  bool quit;
+  struct timespec deadline;
+};
+
+static void *hostTimerRun(void *arg)
+{
+  esp_timer_handle_t timer = (esp_timer_handle_t)arg;
+
+  pthread_mutex_lock(&timer->lock);
+  while (!timer->quit)
+  {
+    if (!timer->armed)
+    {
+      pthread_cond_wait(&timer->cond, &timer->lock);
+    }
+    else if (pthread_cond_timedwait(&timer->cond, &timer->lock, &timer->deadline) == ETIMEDOUT)
+    {
+      timer->armed = false;
+      pthread_mutex_unlock(&timer->lock);
+      timer->callback(timer->arg);
+      pthread_mutex_lock(&timer->lock);
+    }
+  }
+  pthread_mutex_unlock(&timer->lock);
+  return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+  esp_timer_handle_t timer;
+
+  if ((create_args == NULL) || (create_args->callback == NULL) || (out_handle == NULL))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  timer = calloc(1, sizeof(*timer));
+  if (timer == NULL)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  timer->callback = create_args->callback;
+  timer->arg = create_args->arg;
+  pthread_mutex_init(&timer->lock, NULL);
+  CO_hostCondInit(&timer->cond);
+  if (pthread_create(&timer->thread, NULL, hostTimerRun, timer) != 0)
+  {
+    free(timer);
+    return ESP_ERR_NO_MEM;
+  }
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+  esp_err_t ret = ESP_OK;
+
+  pthread_mutex_lock(&timer->lock);
+  if (timer->armed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  else
+  {
+    CO_hostDeadline(&timer->deadline, timeout_us * 1000U);
+    timer->armed = true;
+    pthread_cond_signal(&timer->cond);
+  }
+  pthread_mutex_unlock(&timer->lock);
+  return ret;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+  esp_err_t ret = ESP_OK;
+
+  pthread_mutex_lock(&timer->lock);
+  if (!timer->armed)
+  {
+    ret = ESP_ERR_INVALID_STATE;
+  }
+  timer->armed = false;
+  pthread_cond_signal(&timer->cond);
+  pthread_mutex_unlock(&timer->lock);
+  return ret;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+  pthread_mutex_lock(&timer->lock);
+  timer->quit = true;
+  pthread_cond_signal(&timer->cond);
+  pthread_mutex_unlock(&timer->lock);
+  pthread_join(timer->thread, NULL);
+  pthread_mutex_destroy(&timer->lock);
+  pthread_cond_destroy(&timer->cond);
+  free(timer);
+  return ESP_OK;
+}
+
+/******************************************************************************/
+void CO_hostCondInit(pthread_cond_t *cond)
+{
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+/******************************************************************************/
+void CO_hostDeadline(struct timespec *deadline, uint64_t ns)
+{
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  ns += (uint64_t)deadline->tv_nsec;
+  deadline->tv_sec += (time_t)(ns / 1000000000U);
+  deadline->tv_nsec = (long)(ns % 1000000000U);
+}
+
+/******************************************************************************/
+bool CO_hostCondWait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline)
+{
+  if (ticks == portMAX_DELAY)
+  {
+    pthread_cond_wait(cond, lock);
+    return true;
+  }
+  if (ticks == 0)
+  {
+    return false;
+  }
+  return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+/* Absolute timeout for waiting 'ticks' */
+static void hostTicksDeadline(struct timespec *deadline, TickType_t ticks)
+{
+  if ((ticks != 0) && (ticks != portMAX_DELAY))
+  {
+    CO_hostDeadline(deadline, (uint64_t)pdTICKS_TO_MS(ticks) * 1000000U);
+  }
+}
+
+/******************************************************************************/
+const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code)
+  {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+/******************************************************************************/
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+  (void)tag;
+  hostLogLevel = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  static const char letter[] = "NEWIDV";
+  va_list args;
+
+  if ((level > hostLogLevel) || (level == ESP_LOG_NONE))
+  {
+    return;
+  }
+  fprintf(stderr, "%c (%lld) %s: ", letter[level], (long long)(esp_timer_get_time() / 1000), tag);
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+/******************************************************************************/
+void vPortYield(void)
+{
+  sched_yield();
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+  return 0;
+}
+
+/* Spinlock owner is identified by address of thread local variable */
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+  uintptr_t self = (uintptr_t)&hostThreadId;
+  uintptr_t expected;
+
+  hostCriticalNesting++;
+  if (__atomic_load_n(&mux->owner, __ATOMIC_RELAXED) == self)
+  {
+    mux->count++;
+    return;
+  }
+  for (;;)
+  {
+    expected = portMUX_FREE_VAL;
+    if (__atomic_compare_exchange_n(&mux->owner, &expected, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      break;
+    }
+    sched_yield();
+  }
+  mux->count = 1;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+  hostCriticalNesting--;
+  if (--mux->count == 0)
+  {
+    __atomic_store_n(&mux->owner, portMUX_FREE_VAL, __ATOMIC_RELEASE);
+  }
+}
+
+void CO_hostNotCritical(const char *function)
+{
+  if (hostCriticalNesting > 0U)
+  {
+    fprintf(stderr, "%s() called inside critical section\n", function);
+    abort();
+  }
+}
+
+/******************************************************************************/
+static TaskHandle_t hostTaskNew(const char *name)
+{
+  TaskHandle_t task = calloc(1, sizeof(*task));
+
+  if (task != NULL)
+  {
+    strncpy(task->name, (name != NULL) ? name : "", sizeof(task->name) - 1U);
+    pthread_mutex_init(&task->lock, NULL);
+    CO_hostCondInit(&task->cond);
+  }
+  return task;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  if (hostCurrentTask == NULL)
+  {
+    /* thread not created by xTaskCreate(), for example main() */
+    hostCurrentTask = hostTaskNew("main");
+    if (hostCurrentTask != NULL)
+    {
+      hostCurrentTask->thread = pthread_self();
+    }
+  }
+  return hostCurrentTask;
+}
+
+static void *hostTaskRun(void *arg)
+{
+  TaskHandle_t task = (TaskHandle_t)arg;
+
+  hostCurrentTask = task;
+  task->code(task->param);
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask,
+                                   BaseType_t xCoreID)
+{
+  TaskHandle_t task = hostTaskNew(pcName);
+  pthread_attr_t attr;
+  int err;
+
+  (void)usStackDepth;
+  (void)uxPriority;
+  (void)xCoreID;
+
+  if (task == NULL)
+  {
+    return pdFAIL;
+  }
+  task->code = pvTaskCode;
+  task->param = pvParameters;
+  task->context = pvTaskGetHostContext();
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  err = pthread_create(&task->thread, &attr, hostTaskRun, task);
+  pthread_attr_destroy(&attr);
+  if (err != 0)
+  {
+    free(task);
+    return pdFAIL;
+  }
+  if (pvCreatedTask != NULL)
+  {
+    *pvCreatedTask = task;
+  }
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+  if ((xTaskToDelete == NULL) || (xTaskToDelete == hostCurrentTask))
+  {
+    pthread_exit(NULL);
+  }
+  /* asynchronous deletion of other tasks is not supported */
+  abort();
+}
+
+const char *pcTaskGetName(TaskHandle_t xTaskToQuery)
+{
+  if (xTaskToQuery == NULL)
+  {
+    xTaskToQuery = xTaskGetCurrentTaskHandle();
+  }
+  return xTaskToQuery->name;
+}
+
+void vTaskSetHostContext(void *context)
+{
+  xTaskGetCurrentTaskHandle()->context = context;
+}
+
+void *pvTaskGetHostContext(void)
+{
+  return (hostCurrentTask != NULL) ? hostCurrentTask->context : NULL;
+}
+
+/******************************************************************************/
+TickType_t xTaskGetTickCount(void)
+{
+  return (TickType_t)((uint64_t)esp_timer_get_time() * configTICK_RATE_HZ / 1000000U);
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+  struct timespec delay;
+  uint64_t ns = (uint64_t)pdTICKS_TO_MS(xTicksToDelay) * 1000000U;
+
+  CO_hostNotCritical(__func__);
+  if (xTicksToDelay == 0)
+  {
+    sched_yield();
+    return;
+  }
+  delay.tv_sec = (time_t)(ns / 1000000000U);
+  delay.tv_nsec = (long)(ns % 1000000000U);
+  while (nanosleep(&delay, &delay) != 0)
+  {
+  }
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *pxPreviousWakeTime, TickType_t xTimeIncrement)
+{
+  TickType_t wake = *pxPreviousWakeTime + xTimeIncrement;
+  TickType_t now = xTaskGetTickCount();
+  BaseType_t delayed = pdFALSE;
+
+  if ((int32_t)(wake - now) > 0)
+  {
+    vTaskDelay(wake - now);
+    delayed = pdTRUE;
+  }
+  *pxPreviousWakeTime = wake;
+  return delayed;
+}
+
+/******************************************************************************/
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction)
+{
+  BaseType_t ret = pdPASS;
+
+  pthread_mutex_lock(&xTaskToNotify->lock);
+  switch (eAction)
+  {
+  case eSetBits:
+    xTaskToNotify->notifyValue |= ulValue;
+    break;
+  case eIncrement:
+    xTaskToNotify->notifyValue++;
+    break;
+  case eSetValueWithOverwrite:
+    xTaskToNotify->notifyValue = ulValue;
+    break;
+  case eSetValueWithoutOverwrite:
+    if (xTaskToNotify->notifyPending)
+    {
+      ret = pdFAIL;
+    }
+    else
+    {
+      xTaskToNotify->notifyValue = ulValue;
+    }
+    break;
+  default:
+    break;
+  }
+  xTaskToNotify->notifyPending = true;
+  pthread_cond_broadcast(&xTaskToNotify->cond);
+  pthread_mutex_unlock(&xTaskToNotify->lock);
+  return ret;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit,
+                           uint32_t *pulNotificationValue, TickType_t xTicksToWait)
+{
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  struct timespec deadline;
+  BaseType_t ret = pdFALSE;
+
+  CO_hostNotCritical(__func__);
+  hostTicksDeadline(&deadline, xTicksToWait);
+  pthread_mutex_lock(&task->lock);
+  if (!task->notifyPending)
+  {
+    task->notifyValue &= ~ulBitsToClearOnEntry;
+  }
+  while (!task->notifyPending && CO_hostCondWait(&task->cond, &task->lock, xTicksToWait, &deadline))
+  {
+  }
+  if (pulNotificationValue != NULL)
+  {
+    *pulNotificationValue = task->notifyValue;
+  }
+  if (task->notifyPending)
+  {
+    task->notifyValue &= ~ulBitsToClearOnExit;
+    task->notifyPending = false;
+    ret = pdTRUE;
+  }
+  pthread_mutex_unlock(&task->lock);
+  return ret;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  struct timespec deadline;
+  uint32_t value;
+
+  CO_hostNotCritical(__func__);
+  hostTicksDeadline(&deadline, xTicksToWait);
+  pthread_mutex_lock(&task->lock);
+  while ((task->notifyValue == 0U) && CO_hostCondWait(&task->cond, &task->lock, xTicksToWait, &deadline))
+  {
+  }
+  value = task->notifyValue;
+  if (value != 0U)
+  {
+    task->notifyValue = (xClearCountOnExit != pdFALSE) ? 0U : (value - 1U);
+  }
+  task->notifyPending = false;
+  pthread_mutex_unlock(&task->lock);
+  return value;
+}
+
+/******************************************************************************/
+static SemaphoreHandle_t hostSemaphoreInit(SemaphoreHandle_t sem, hostSemType_t type, uint32_t max, uint32_t count,
+                                           bool isStatic)
+{
+  if (sem == NULL)
+  {
+    return NULL;
+  }
+  memset(sem, 0, sizeof(*sem));
+  sem->type = type;
+  sem->max = max;
+  sem->count = count;
+  sem->isStatic = isStatic;
+  pthread_mutex_init(&sem->lock, NULL);
+  CO_hostCondInit(&sem->cond);
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+  return hostSemaphoreInit(malloc(sizeof(struct hostSemaphore_t)), HOST_SEM_MUTEX, 1U, 1U, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *pxMutexBuffer)
+{
+  return hostSemaphoreInit((SemaphoreHandle_t)pxMutexBuffer, HOST_SEM_MUTEX, 1U, 1U, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+  return hostSemaphoreInit(malloc(sizeof(struct hostSemaphore_t)), HOST_SEM_RECURSIVE, 1U, 1U, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t *pxMutexBuffer)
+{
+  return hostSemaphoreInit((SemaphoreHandle_t)pxMutexBuffer, HOST_SEM_RECURSIVE, 1U, 1U, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+  return hostSemaphoreInit(malloc(sizeof(struct hostSemaphore_t)), HOST_SEM_BINARY, 1U, 0U, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *pxSemaphoreBuffer)
+{
+  return hostSemaphoreInit((SemaphoreHandle_t)pxSemaphoreBuffer, HOST_SEM_BINARY, 1U, 0U, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount)
+{
+  return hostSemaphoreInit(malloc(sizeof(struct hostSemaphore_t)), HOST_SEM_COUNTING, uxMaxCount, uxInitialCount,
+                           false);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+{
+  pthread_cond_destroy(&xSemaphore->cond);
+  pthread_mutex_destroy(&xSemaphore->lock);
+  if (!xSemaphore->isStatic)
+  {
+    free(xSemaphore);
+  }
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait)
+{
+  struct timespec deadline;
+  BaseType_t ret = pdFALSE;
+
+  CO_hostNotCritical(__func__);
+  hostTicksDeadline(&deadline, xTicksToWait);
+  pthread_mutex_lock(&xSemaphore->lock);
+  while ((xSemaphore->count == 0U) && CO_hostCondWait(&xSemaphore->cond, &xSemaphore->lock, xTicksToWait, &deadline))
+  {
+  }
+  if (xSemaphore->count > 0U)
+  {
+    xSemaphore->count--;
+    xSemaphore->owner = xTaskGetCurrentTaskHandle();
+    ret = pdTRUE;
+  }
+  pthread_mutex_unlock(&xSemaphore->lock);
+  return ret;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+  BaseType_t ret = pdFALSE;
+
+  pthread_mutex_lock(&xSemaphore->lock);
+  if (xSemaphore->count < xSemaphore->max)
+  {
+    xSemaphore->count++;
+    xSemaphore->owner = NULL;
+    pthread_cond_signal(&xSemaphore->cond);
+    ret = pdTRUE;
+  }
+  pthread_mutex_unlock(&xSemaphore->lock);
+  return ret;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t xMutex, TickType_t xTicksToWait)
+{
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+  CO_hostNotCritical(__func__);
+  pthread_mutex_lock(&xMutex->lock);
+  if ((xMutex->count == 0U) && (xMutex->owner == self))
+  {
+    xMutex->recursion++;
+    pthread_mutex_unlock(&xMutex->lock);
+    return pdTRUE;
+  }
+  pthread_mutex_unlock(&xMutex->lock);
+
+  if (xSemaphoreTake(xMutex, xTicksToWait) != pdTRUE)
+  {
+    return pdFALSE;
+  }
+  xMutex->recursion = 1U;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t xMutex)
+{
+  pthread_mutex_lock(&xMutex->lock);
+  if ((xMutex->owner != xTaskGetCurrentTaskHandle()) || (xMutex->recursion == 0U))
+  {
+    pthread_mutex_unlock(&xMutex->lock);
+    return pdFALSE;
+  }
+  if (--xMutex->recursion > 0U)
+  {
+    pthread_mutex_unlock(&xMutex->lock);
+    return pdTRUE;
+  }
+  pthread_mutex_unlock(&xMutex->lock);
+  return xSemaphoreGive(xMutex);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t xSemaphore)
+{
+  UBaseType_t count;
+
+  pthread_mutex_lock(&xSemaphore->lock);
+  count = xSemaphore->count;
+  pthread_mutex_unlock(&xSemaphore->lock);
+  return count;
+}
+
+/******************************************************************************/
+static QueueHandle_t hostQueueInit(QueueHandle_t queue, UBaseType_t length, UBaseType_t itemSize, uint8_t *storage,
+                                   bool isStatic)
+{
+  if ((queue == NULL) || (storage == NULL))
+  {
+    return NULL;
+  }
+  memset(queue, 0, sizeof(*queue));
+  queue->storage = storage;
+  queue->itemSize = itemSize;
+  queue->length = length;
+  queue->isStatic = isStatic;
+  pthread_mutex_init(&queue->lock, NULL);
+  CO_hostCondInit(&queue->notEmpty);
+  CO_hostCondInit(&queue->notFull);
+  return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+  QueueHandle_t queue = malloc(sizeof(*queue));
+  uint8_t *storage = malloc((size_t)uxQueueLength * uxItemSize + 1U);
+
+  if ((queue == NULL) || (storage == NULL))
+  {
+    free(queue);
+    free(storage);
+    return NULL;
+  }
+  return hostQueueInit(queue, uxQueueLength, uxItemSize, storage, false);
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t uxQueueLength, UBaseType_t uxItemSize, uint8_t *pucQueueStorage,
+                                 StaticQueue_t *pxQueueBuffer)
+{
+  return hostQueueInit((QueueHandle_t)pxQueueBuffer, uxQueueLength, uxItemSize, pucQueueStorage, true);
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+  pthread_cond_destroy(&xQueue->notEmpty);
+  pthread_cond_destroy(&xQueue->notFull);
+  pthread_mutex_destroy(&xQueue->lock);
+  if (!xQueue->isStatic)
+  {
+    free(xQueue->storage);
+    free(xQueue);
+  }
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+  struct timespec deadline;
+  BaseType_t ret = errQUEUE_FULL;
+
+  CO_hostNotCritical(__func__);
+  hostTicksDeadline(&deadline, xTicksToWait);
+  pthread_mutex_lock(&xQueue->lock);
+  while ((xQueue->count == xQueue->length) &&
+         CO_hostCondWait(&xQueue->notFull, &xQueue->lock, xTicksToWait, &deadline))
+  {
+  }
+  if (xQueue->count < xQueue->length)
+  {
+    size_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+
+    memcpy(&xQueue->storage[tail * xQueue->itemSize], pvItemToQueue, xQueue->itemSize);
+    xQueue->count++;
+    pthread_cond_signal(&xQueue->notEmpty);
+    ret = pdPASS;
+  }
+  pthread_mutex_unlock(&xQueue->lock);
+  return ret;
+}
+
+static BaseType_t hostQueueGet(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait, bool remove)
+{
+  struct timespec deadline;
+  BaseType_t ret = errQUEUE_EMPTY;
+
+  CO_hostNotCritical(__func__);
+  hostTicksDeadline(&deadline, xTicksToWait);
+  pthread_mutex_lock(&xQueue->lock);
+  while ((xQueue->count == 0U) && CO_hostCondWait(&xQueue->notEmpty, &xQueue->lock, xTicksToWait, &deadline))
+  {
+  }
+  if (xQueue->count > 0U)
+  {
+    memcpy(pvBuffer, &xQueue->storage[xQueue->head * xQueue->itemSize], xQueue->itemSize);
+    if (remove)
+    {
+      xQueue->head = (xQueue->head + 1U) % xQueue->length;
+      xQueue->count--;
+      pthread_cond_signal(&xQueue->notFull);
+    }
+    ret = pdPASS;
+  }
+  pthread_mutex_unlock(&xQueue->lock);
+  return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+  return hostQueueGet(xQueue, pvBuffer, xTicksToWait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+  return hostQueueGet(xQueue, pvBuffer, xTicksToWait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+  UBaseType_t count;
+
+  pthread_mutex_lock(&xQueue->lock);
+  count = (UBaseType_t)xQueue->count;
+  pthread_mutex_unlock(&xQueue->lock);
+  return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t xQueue)
+{
+  UBaseType_t spaces;
+
+  pthread_mutex_lock(&xQueue->lock);
+  spaces = (UBaseType_t)(xQueue->length - xQueue->count);
+  pthread_mutex_unlock(&xQueue->lock);
+  return spaces;
+}
+
+BaseType_t xQueueReset(QueueHandle_t xQueue)
+{
+  pthread_mutex_lock(&xQueue->lock);
+  xQueue->head = 0U;
+  xQueue->count = 0U;
+  pthread_cond_broadcast(&xQueue->notFull);
+  pthread_mutex_unlock(&xQueue->lock);
+  return pdPASS;
+}
@@ -0,0 +1,48 @@
+/*
+ * Helpers shared by host implementations of FreeRTOS and TWAI.
+ *
+ * @file        CO_hostRTOS.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_HOST_RTOS_H
+#define CO_HOST_RTOS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+
+/* Initialize condition variable, which waits on monotonic clock */
+void CO_hostCondInit(pthread_cond_t *cond);
+
+/* Monotonic time 'ns' from now */
+void CO_hostDeadline(struct timespec *deadline, uint64_t ns);
+
+/* Wait on condition: forever for portMAX_DELAY, not at all for 0, otherwise
+ * until deadline. Returns false on timeout. */
+bool CO_hostCondWait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline);
+
+/* Abort, if calling task is inside critical section. ESP-IDF does not allow
+ * to block there, nor to call functions, which may block, even if they would
+ * not block this time. */
+void CO_hostNotCritical(const char *function);
+
+#endif /* CO_HOST_RTOS_H */
@@ -0,0 +1,143 @@
+/*
+ * Helpers for host tests of ESP32 TWAI driver.
+ *
+ * @file        CO_hostTest.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_HOST_TEST_H
+#define CO_HOST_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "driver/twai.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* Tests are programs registered with ctest. Failed check is printed and
+ * counted, main() returns CO_HOST_TEST_RESULT(). Benchmarks print their
+ * results and fail only on limits, which hold also on slow CI machines. */
+static int CO_hostTest_failed;
+
+#define CO_HOST_TEST_CHECK(cond, ...)                                      \
+  do                                                                       \
+  {                                                                        \
+    if (!(cond))                                                           \
+    {                                                                      \
+      printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond);      \
+      printf(__VA_ARGS__);                                                 \
+      printf("\n");                                                        \
+      CO_hostTest_failed++;                                                \
+    }                                                                      \
+  } while (0)
+
+#define CO_HOST_TEST_RESULT() ((CO_hostTest_failed == 0) ? 0 : 1)
+
+/* Deterministic pseudo random numbers (xorshift32), seed must not be 0 */
+static inline uint32_t CO_hostTest_random(uint32_t *seed)
+{
+  uint32_t x = *seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *seed = x;
+  return x;
+}
+
+/* CPU time of calling thread in nanoseconds, for benchmarks */
+static inline int64_t CO_hostTest_cpuNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Frame received by CO_hostTest_record() */
+typedef struct
+{
+  int64_t time_us;
+  uint32_t ident;
+  uint32_t flags;
+  uint8_t DLC;
+  uint8_t data[8];
+} CO_hostTestFrame_t;
+
+/* Frames received by rx buffer of another node, which sees the bus */
+typedef struct
+{
+  CO_hostTestFrame_t *frames;
+  uint32_t size;
+  /* Number of received frames, also of those, which did not fit */
+  uint32_t count;
+} CO_hostTestRecorder_t;
+
+/* Rx callback with CO_hostTestRecorder_t as object. It is called from one
+ * receive task, so count has single writer. */
+static inline void CO_hostTest_record(void *object, void *message)
+{
+  CO_hostTestRecorder_t *recorder = (CO_hostTestRecorder_t *)object;
+  const twai_message_t *msg = (const twai_message_t *)message;
+  uint32_t count = __atomic_load_n(&recorder->count, __ATOMIC_RELAXED);
+
+  if (count < recorder->size)
+  {
+    CO_hostTestFrame_t *frame = &recorder->frames[count];
+
+    frame->time_us = esp_timer_get_time();
+    frame->ident = msg->identifier;
+    frame->flags = msg->flags;
+    frame->DLC = msg->data_length_code;
+    memcpy(frame->data, msg->data, sizeof(frame->data));
+  }
+  __atomic_store_n(&recorder->count, count + 1U, __ATOMIC_RELEASE);
+}
+
+/* Number of frames received by recorder, which may be receiving meanwhile */
+static inline uint32_t CO_hostTest_recorded(CO_hostTestRecorder_t *recorder)
+{
+  return __atomic_load_n(&recorder->count, __ATOMIC_ACQUIRE);
+}
+
+/* Start recording from the first frame again */
+static inline void CO_hostTest_recordReset(CO_hostTestRecorder_t *recorder)
+{
+  __atomic_store_n(&recorder->count, 0U, __ATOMIC_RELEASE);
+}
+
+/* Wait until recorder has count frames or timeout_ms elapses, returns number
+ * of recorded frames */
+static inline uint32_t CO_hostTest_recordWait(CO_hostTestRecorder_t *recorder, uint32_t count, uint32_t timeout_ms)
+{
+  TickType_t start = xTaskGetTickCount();
+  uint32_t recorded;
+
+  while (((recorded = __atomic_load_n(&recorder->count, __ATOMIC_ACQUIRE)) < count) &&
+         ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(timeout_ms)))
+  {
+    vTaskDelay(1);
+  }
+  return recorded;
+}
+
+#endif /* CO_HOST_TEST_H */
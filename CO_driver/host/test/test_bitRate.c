@@ -0,0 +1,253 @@
+/*
+ * Host test of runtime bitrate selection of ESP32 TWAI driver.
+ *
+ * @file        test_bitRate.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Sender node sends from mainline, receiver node records the bus with its
+ * receive task, which runs through all driver reinstallations.
+ * - CO_CANcheckBitRate() accepts CiA 301 bitrates, which the controller
+ *   supports. CO_CANmodule_init() rejects others and uses Kconfig bitrate
+ *   for 0.
+ * - Both nodes switch through all bitrates with CO_CANsetBitRate(). Frames
+ *   must be received and take the time of their bits on the simulated bus,
+ *   so TWAI timing really matches CANbitRate.
+ * - Nodes with different bitrates see only bus errors. Sender recovers from
+ *   bus off and communicates, after receiver switches too.
+ * - CO_CANactivateBitRate(), the LSS activate bit timing callback, switches
+ *   between two delays. Unsupported pending bitrate keeps the old one.
+ * - CO_CANmodule_disable() and CO_CANmodule_init() with other bitrate, as at
+ *   communication reset, work repeatedly with running receive task. */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define FRAMES_MAX 256U
+#define RESETS 20U
+
+static CO_CANmodule_t sender, receiver;
+static CO_CANrx_t senderRx[1], receiverRx[1];
+static CO_CANtx_t senderTx[1], receiverTx[1];
+static CO_hostBus_t *bus;
+static CO_hostNode_t *senderNode, *receiverNode;
+static CO_hostTestFrame_t frames[FRAMES_MAX];
+static CO_hostTestRecorder_t recorder = {frames, FRAMES_MAX, 0U};
+
+static const uint16_t supported[] = {1000U, 800U, 500U, 250U, 125U, 100U, 50U, 25U,
+#ifdef TWAI_TIMING_CONFIG_20KBITS
+                                     20U,
+#endif
+#ifdef TWAI_TIMING_CONFIG_10KBITS
+                                     10U,
+#endif
+};
+
+static void senderInit(uint16_t bitRate)
+{
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_disable(&sender);
+  CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, 1U, bitRate);
+  CO_CANtxBufferInit(&sender, 0U, 0x181U, false, 8U, false);
+  CO_CANsetNormalMode(&sender);
+}
+
+static void receiverInit(uint16_t bitRate)
+{
+  CO_hostNode_bind(receiverNode);
+  CO_CANmodule_disable(&receiver);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, 1U, receiverTx, 1U, bitRate);
+  CO_CANrxBufferInit(&receiver, 0U, 0x181U, 0x07FFU, false, &recorder, CO_hostTest_record);
+  CO_CANsetNormalMode(&receiver);
+  CO_hostNode_bind(senderNode);
+}
+
+static bool_t receiverSet(uint16_t bitRate)
+{
+  bool_t ok;
+
+  CO_hostNode_bind(receiverNode);
+  ok = CO_CANsetBitRate(&receiver, bitRate);
+  CO_hostNode_bind(senderNode);
+  return ok;
+}
+
+/* Send frame and wait for it at receiver */
+static bool_t exchange(uint8_t value, uint32_t timeout_ms)
+{
+  uint32_t count = CO_hostTest_recorded(&recorder);
+
+  senderTx[0].data[0] = value;
+  CO_CANsend(&sender, &senderTx[0]);
+  CO_CANmodule_process(&sender);
+  return (CO_hostTest_recordWait(&recorder, count + 1U, timeout_ms) == (count + 1U)) &&
+         (frames[count].data[0] == value);
+}
+
+static void mapping(void)
+{
+  static const uint16_t unsupported[] = {0U, 1U, 300U, 600U, 2000U};
+  CO_ReturnError_t err;
+  uint16_t i;
+
+  for (i = 0U; i < (sizeof(supported) / sizeof(supported[0])); i++)
+  {
+    CO_HOST_TEST_CHECK(CO_CANcheckBitRate(NULL, supported[i]), "%u kbit/s not supported", supported[i]);
+  }
+  for (i = 0U; i < (sizeof(unsupported) / sizeof(unsupported[0])); i++)
+  {
+    CO_HOST_TEST_CHECK(!CO_CANcheckBitRate(NULL, unsupported[i]), "%u kbit/s supported", unsupported[i]);
+  }
+
+  CO_hostNode_bind(senderNode);
+  err = CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, 1U, 300U);
+  CO_HOST_TEST_CHECK(err == CO_ERROR_ILLEGAL_BAUDRATE, "CO_CANmodule_init() with 300 kbit/s returned %d", (int)err);
+  err = CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, 1U, 0U);
+  CO_HOST_TEST_CHECK((err == CO_ERROR_NO) && (sender.CANbitRate == CO_CAN_BITRATE_DEFAULT),
+                     "CO_CANmodule_init() with 0 returned %d, %u kbit/s", (int)err, sender.CANbitRate);
+  senderInit(250U);
+  CO_HOST_TEST_CHECK(!CO_CANsetBitRate(&sender, 300U) && (sender.CANbitRate == 250U),
+                     "unsupported bitrate set, now %u kbit/s", sender.CANbitRate);
+}
+
+/* Frames at each bitrate take time of their bits */
+static void allBitRates(void)
+{
+  uint16_t i;
+
+  CO_hostBus_setTimeScale(bus, 1.0);
+  for (i = 0U; i < (sizeof(supported) / sizeof(supported[0])); i++)
+  {
+    uint16_t bitRate = supported[i];
+    CO_hostBusStats_t stats0, stats1;
+    double bitNs;
+    bool_t ok;
+
+    ok = receiverSet(bitRate) && CO_CANsetBitRate(&sender, bitRate);
+    CO_hostBus_getStats(bus, &stats0);
+    ok = ok && exchange((uint8_t)i, 1000U) && exchange((uint8_t)(i + 0x80U), 1000U);
+    CO_hostBus_getStats(bus, &stats1);
+    bitNs = (double)(stats1.busyNs - stats0.busyNs) / (double)(stats1.bits - stats0.bits);
+    CO_HOST_TEST_CHECK(ok && (stats1.errorFrames == stats0.errorFrames), "%u kbit/s: no communication", bitRate);
+    CO_HOST_TEST_CHECK((bitNs > 0.99e6 / bitRate) && (bitNs < 1.01e6 / bitRate), "%u kbit/s: bit takes %.0f ns",
+                       bitRate, bitNs);
+  }
+  CO_hostBus_setTimeScale(bus, 0.0);
+}
+
+static void mismatch(void)
+{
+  uint32_t count;
+  TickType_t start;
+
+  CO_CANsetBitRate(&sender, 500U);
+  receiverSet(250U);
+  count = CO_hostTest_recorded(&recorder);
+  senderTx[0].data[0] = 0x55U;
+  CO_CANsend(&sender, &senderTx[0]);
+  vTaskDelay(pdMS_TO_TICKS(20));
+  CO_CANmodule_process(&sender);
+  CO_HOST_TEST_CHECK(CO_hostTest_recorded(&recorder) == count, "frame received at other bitrate");
+  CO_HOST_TEST_CHECK(sender.stats.busErrors > 0U, "no bus errors at other bitrate");
+
+  /* sender went bus off, it recovers and communicates at the same bitrate */
+  receiverSet(500U);
+  start = xTaskGetTickCount();
+  while (sender.busOff && ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(2000)))
+  {
+    CO_CANmodule_process(&sender);
+    vTaskDelay(1);
+  }
+  CO_HOST_TEST_CHECK(exchange(0x56U, 1000U), "no communication after switch");
+  /* error counters of sender are reset by reinstallation */
+  CO_CANsetBitRate(&sender, 250U);
+  receiverSet(250U);
+}
+
+static void lssActivate(void)
+{
+  uint16_t pendingBitRate = 125U;
+  CO_CANbitRateSwitch_t bitRateSwitch = {&sender, &pendingBitRate};
+  int64_t start, took;
+
+  receiverSet(125U);
+  start = esp_timer_get_time();
+  CO_CANactivateBitRate(&bitRateSwitch, 50U);
+  took = esp_timer_get_time() - start;
+  CO_HOST_TEST_CHECK((sender.CANbitRate == 125U) && (took >= 99000), "activate: %u kbit/s after %lld us",
+                     sender.CANbitRate, (long long)took);
+  CO_HOST_TEST_CHECK(exchange(0x125U & 0xFFU, 1000U), "no communication after activate");
+
+  pendingBitRate = 300U;
+  CO_CANactivateBitRate(&bitRateSwitch, 0U);
+  CO_HOST_TEST_CHECK(sender.CANbitRate == 125U, "unsupported pending bitrate activated");
+  CO_HOST_TEST_CHECK(exchange(0x30U, 1000U), "no communication after unsupported bitrate");
+}
+
+/* Communication reset with other bitrate, receive task keeps running */
+static void resets(void)
+{
+  uint32_t i, ok = 0U;
+
+  for (i = 0U; i < RESETS; i++)
+  {
+    uint16_t bitRate = ((i % 2U) == 0U) ? 500U : 1000U;
+
+    receiverInit(bitRate);
+    senderInit(bitRate);
+    if (exchange((uint8_t)i, 1000U) && (receiver.CANbitRate == bitRate))
+    {
+      ok++;
+    }
+  }
+  CO_HOST_TEST_CHECK(ok == RESETS, "%u of %u resets communicate", (unsigned int)ok, RESETS);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 0.0};
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  receiverNode = CO_hostNode_create(bus, "receiver");
+  senderNode = CO_hostNode_create(bus, "sender");
+
+  receiverInit(250U);
+  CO_hostNode_bind(receiverNode);
+  CO_CANrxTaskStart(&receiver);
+
+  mapping();
+  allBitRates();
+  mismatch();
+  lssActivate();
+  resets();
+  printf("%u bitrates, %u communication resets, %u frames received\n",
+         (unsigned int)(sizeof(supported) / sizeof(supported[0])), RESETS,
+         (unsigned int)CO_hostTest_recorded(&recorder));
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_bind(receiverNode);
+  CO_CANrxTaskStop(&receiver);
+  CO_CANmodule_disable(&receiver);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(receiverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,267 @@
+/*
+ * Host test of CAN bridge between two TWAI controllers of ESP32 TWAI driver.
+ *
+ * @file        test_bridge.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CO_CAN_BRIDGE and CO_CAN_RAW_RANGES. Gateway has one CAN module
+ * on each of two buses, with v2 API, and bridge from the first to the second.
+ * Node X sends on the first bus, node Y records the second one. Host RTOS
+ * aborts the test, if bridge sends inside critical section.
+ * - Frames in standard and extended range are forwarded, also when gateway
+ *   has rx buffer for them. Other frames are not, rx buffer of gateway gets
+ *   them.
+ * - Bridge is detached and attached while X sends. After detach returns,
+ *   nothing is forwarded anymore. */
+
+#include "301/CO_driver.h"
+#include "CO_CANbridge.h"
+#include "CO_CANraw.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if !CO_CAN_BRIDGE || !CO_CAN_RAW_RANGES
+#error test_bridge requires CO_CAN_BRIDGE and CO_CAN_RAW_RANGES
+#endif
+
+#define ROUNDS 100U
+#define SWITCHES 200U
+
+static CO_CANmodule_t gateway1, gateway2, nodeX, nodeY;
+static CO_CANrx_t gateway1Rx[2], gateway2Rx[1], nodeXRx[1], nodeYRx[3];
+static CO_CANtx_t gateway1Tx[1], gateway2Tx[1], nodeXTx[3], nodeYTx[1];
+static CO_CANbridge_t bridge;
+/* frames received by gateway and by Y, per identifier */
+static uint32_t gateway181, gateway701, y181, y701, y281, yExtended;
+static volatile bool_t stop;
+
+/* Counters are incremented by rx task of the node and read by main task */
+static void countIf(uint32_t *counter, bool_t match)
+{
+  if (match)
+  {
+    __atomic_store_n(counter, *counter + 1U, __ATOMIC_RELEASE);
+  }
+}
+
+static uint32_t counted(const uint32_t *counter)
+{
+  return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+}
+
+static void gatewayCallback(void *object, void *message)
+{
+  uint16_t ident = CO_CANrxMsg_readIdent(message);
+
+  (void)object;
+  countIf(&gateway181, ident == 0x181U);
+  countIf(&gateway701, ident == 0x701U);
+}
+
+static void yCallback(void *object, void *message)
+{
+  uint16_t ident = CO_CANrxMsg_readIdent(message);
+
+  (void)object;
+  countIf(&y181, ident == 0x181U);
+  countIf(&y701, ident == 0x701U);
+  countIf(&y281, ident == 0x281U);
+}
+
+static void yRawCallback(void *object, const CO_CANrxMsg_t *message)
+{
+  (void)object;
+  (void)message;
+  countIf(&yExtended, true);
+}
+
+/* Frames from X: 0x181 and extended are forwarded, 0x701 and 0x281 not */
+static void sendX(void)
+{
+  twai_message_t extended = {.identifier = 0x18FF0001UL, .flags = TWAI_MSG_FLAG_EXTD, .data_length_code = 1U};
+  uint16_t i;
+
+  for (i = 0U; i < 3U; i++)
+  {
+    CO_CANsend(&nodeX, &nodeXTx[i]);
+  }
+  CO_CANsendRaw(&nodeX, &extended);
+}
+
+/* Gateway uses v2 API, so calling task stays bound to X */
+static void processAll(void)
+{
+  CO_CANmodule_process(&nodeX);
+  CO_CANmodule_process(&gateway1);
+  CO_CANmodule_process(&gateway2);
+}
+
+/* Process until Y received count frames, which are only forwarded ones */
+static bool_t forwardedWait(uint32_t count)
+{
+  TickType_t start = xTaskGetTickCount();
+
+  while (((counted(&y181) + counted(&yExtended)) < count)
+         && ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(1000)))
+  {
+    processAll();
+    vTaskDelay(1);
+  }
+  return (counted(&y181) + counted(&yExtended)) == count;
+}
+
+static void ranges(void)
+{
+  uint32_t i;
+
+  for (i = 0U; i < ROUNDS; i++)
+  {
+    sendX();
+    forwardedWait(2U * (i + 1U));
+  }
+  for (i = 0U; i < 20U; i++)
+  {
+    processAll();
+    vTaskDelay(1);
+  }
+  CO_HOST_TEST_CHECK((counted(&y181) == ROUNDS) && (counted(&yExtended) == ROUNDS), "%u and %u of %u frames forwarded",
+                     (unsigned int)counted(&y181), (unsigned int)counted(&yExtended), ROUNDS);
+  CO_HOST_TEST_CHECK((counted(&y701) == 0U) && (counted(&y281) == 0U), "%u 0x701 and %u 0x281 forwarded",
+                     (unsigned int)counted(&y701), (unsigned int)counted(&y281));
+  CO_HOST_TEST_CHECK((counted(&gateway181) == ROUNDS) && (counted(&gateway701) == ROUNDS),
+                     "gateway received %u 0x181 and %u 0x701", (unsigned int)counted(&gateway181),
+                     (unsigned int)counted(&gateway701));
+  CO_HOST_TEST_CHECK((counted(&bridge.forwarded) == (2U * ROUNDS)) && (counted(&bridge.dropped) == 0U),
+                     "%u forwarded, %u dropped", (unsigned int)counted(&bridge.forwarded),
+                     (unsigned int)counted(&bridge.dropped));
+}
+
+/* Task created by X bound task sends from X */
+static void senderTask(void *arg)
+{
+  (void)arg;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    sendX();
+    CO_CANmodule_process(&nodeX);
+    vTaskDelay(0);
+  }
+  __atomic_store_n(&stop, false, __ATOMIC_RELEASE);
+  vTaskDelete(NULL);
+}
+
+static void attachDetach(void)
+{
+  uint32_t i, late = 0U;
+
+  __atomic_store_n(&stop, false, __ATOMIC_RELEASE);
+  xTaskCreate(senderTask, "X", 4096, NULL, 5, NULL);
+  for (i = 0U; i < SWITCHES; i++)
+  {
+    uint32_t forwarded;
+
+    CO_CANbridge_attach(&bridge, false);
+    forwarded = counted(&bridge.forwarded);
+    vTaskDelay(0);
+    CO_CANmodule_process(&gateway2);
+    late += counted(&bridge.forwarded) - forwarded;
+    CO_CANbridge_attach(&bridge, true);
+    vTaskDelay(0);
+    CO_CANmodule_process(&gateway2);
+  }
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    vTaskDelay(1);
+  }
+  CO_HOST_TEST_CHECK(late == 0U, "%u frames forwarded by detached bridge", (unsigned int)late);
+  printf("%u frames forwarded, %u dropped, %u attach switches\n", (unsigned int)counted(&bridge.forwarded),
+         (unsigned int)counted(&bridge.dropped), SWITCHES);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 0.0};
+  CO_hostBus_t *bus1, *bus2;
+  CO_hostNode_t *gatewayNode1, *gatewayNode2, *xNode, *yNode;
+  CO_CANport_t port1 = {0, 5, 4, TWAI_MODE_NORMAL};
+  CO_CANport_t port2 = {1, 6, 7, TWAI_MODE_NORMAL};
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus1 = CO_hostBus_create(&config);
+  bus2 = CO_hostBus_create(&config);
+  gatewayNode1 = CO_hostNode_create(bus1, "gateway1");
+  gatewayNode2 = CO_hostNode_create(bus2, "gateway2");
+  xNode = CO_hostNode_create(bus1, "X");
+  yNode = CO_hostNode_create(bus2, "Y");
+
+  CO_hostNode_bind(yNode);
+  CO_CANmodule_init(&nodeY, NULL, nodeYRx, 3U, nodeYTx, 1U, 250U);
+  CO_CANrxBufferInit(&nodeY, 0U, 0x181U, 0x07FFU, false, &nodeY, yCallback);
+  CO_CANrxBufferInit(&nodeY, 1U, 0x701U, 0x07FFU, false, &nodeY, yCallback);
+  CO_CANrxBufferInit(&nodeY, 2U, 0x281U, 0x07FFU, false, &nodeY, yCallback);
+  CO_CANrawRangeAdd(&nodeY, 0x18FF0000UL, 0x18FFFFFFUL, &nodeY, yRawCallback);
+  CO_CANsetNormalMode(&nodeY);
+  CO_CANrxTaskStart(&nodeY);
+
+  CO_hostNode_bind(xNode);
+  CO_CANmodule_init(&nodeX, NULL, nodeXRx, 1U, nodeXTx, 3U, 250U);
+  CO_CANtxBufferInit(&nodeX, 0U, 0x181U, false, 8U, false);
+  CO_CANtxBufferInit(&nodeX, 1U, 0x701U, false, 1U, false);
+  CO_CANtxBufferInit(&nodeX, 2U, 0x281U, false, 8U, false);
+  CO_CANsetNormalMode(&nodeX);
+
+  /* gateway: both controllers are assigned, so any task can use them */
+  CO_hostNode_bind(gatewayNode1);
+  CO_hostNode_setController(gatewayNode1, 0);
+  CO_hostNode_setController(gatewayNode2, 1);
+  CO_CANmodule_init(&gateway1, &port1, gateway1Rx, 2U, gateway1Tx, 1U, 250U);
+  CO_CANmodule_init(&gateway2, &port2, gateway2Rx, 1U, gateway2Tx, 1U, 250U);
+  CO_CANrxBufferInit(&gateway1, 0U, 0x181U, 0x07FFU, false, &gateway1, gatewayCallback);
+  CO_CANrxBufferInit(&gateway1, 1U, 0x701U, 0x07FFU, false, &gateway1, gatewayCallback);
+  CO_CANbridge_init(&bridge, &gateway1, &gateway2);
+  CO_CANbridge_addRange(&bridge, 0x180U, 0x1FFU, false);
+  CO_CANbridge_addRange(&bridge, 0x18FF0000UL, 0x18FFFFFFUL, true);
+  CO_CANbridge_attach(&bridge, true);
+  CO_CANsetNormalMode(&gateway1);
+  CO_CANsetNormalMode(&gateway2);
+  CO_CANrxTaskStart(&gateway1);
+  CO_CANrxTaskStart(&gateway2);
+
+  CO_hostNode_bind(xNode);
+  ranges();
+  attachDetach();
+
+  CO_CANmodule_disable(&nodeX);
+  CO_hostNode_bind(gatewayNode1);
+  CO_CANrxTaskStop(&gateway1);
+  CO_CANrxTaskStop(&gateway2);
+  CO_CANmodule_disable(&gateway1);
+  CO_CANmodule_disable(&gateway2);
+  CO_hostNode_bind(yNode);
+  CO_CANrxTaskStop(&nodeY);
+  CO_CANmodule_disable(&nodeY);
+  CO_hostNode_delete(xNode);
+  CO_hostNode_delete(yNode);
+  CO_hostNode_delete(gatewayNode1);
+  CO_hostNode_delete(gatewayNode2);
+  CO_hostBus_delete(bus1);
+  CO_hostBus_delete(bus2);
+  return CO_HOST_TEST_RESULT();
+}
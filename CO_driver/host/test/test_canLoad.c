@@ -0,0 +1,347 @@
+/*
+ * Host test of bus-load meter of ESP32 TWAI driver.
+ *
+ * @file        test_canLoad.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CO_CAN_LOAD and CO_CAN_RX_FILTERS 0. Bit tables are checked
+ * against exact length of random frames from the simulator. Burst detection
+ * is checked with frames of given times: one 8 byte frame per millisecond
+ * and 4 of them during BURST_MS. Then talker node sends cyclic PDOs of
+ * different length, one of them extended, in real time at 500 kbit/s. Node
+ * with the meter and open acceptance filter receives all of them and sends
+ * its heartbeat, mainline sleeps in CO_CANwait() and calls
+ * CO_CANload_process().
+ * - Exact length of each frame is within the table bounds.
+ * - Burst is one burst of about BURST_MS with peak inside it, utilization
+ *   has all frames of given times.
+ * - Each COB-ID has all its frames, top talkers are sorted by bits and bits
+ *   on the bus are within the bounds of counted bits.
+ * - Export has one line per top talker and reset clears them. */
+
+#include "301/CO_driver.h"
+#include "CO_CANload.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if !CO_CAN_LOAD
+#error test_canLoad requires CO_CAN_LOAD
+#endif
+#if CO_CAN_RX_FILTERS
+#error test_canLoad requires CO_CAN_RX_FILTERS 0, filter hides frames from the meter
+#endif
+
+#define BITRATE 500U
+#define RANDOM_FRAMES 100000U
+/* frames of given times are 250 us apart */
+#define GIVEN_MS 300U
+#define BURST_START_MS 100U
+#define BURST_MS 60U
+#define BURST_PERMILLE 500U
+#define RUN_MS 600U
+#define HEARTBEAT_MS 100U
+#define TIMEOUT_US 5000000
+#define EXPORT_SIZE 2048U
+/* bucket width in microseconds */
+#define BUCKET_US (CO_CAN_LOAD_BUCKET_MS * 1024U)
+
+/* COB-IDs of the talker, extended frame is sent directly to TWAI */
+typedef enum
+{
+  PDO_FAST, /* 0x181, 8 bytes every 5 ms */
+  PDO_SLOW, /* 0x182, 2 bytes every 20 ms */
+  PDO_EXTD  /* 0x18FF0001 extended, 4 bytes every 50 ms */
+} talkerPdo_t;
+
+#define TALKERS 4U
+
+static CO_CANmodule_t node, talker;
+static CO_CANrx_t nodeRx[1], talkerRx[1];
+static CO_CANtx_t nodeTx[1], talkerTx[PDO_EXTD];
+static CO_CANload_t load, given;
+/* written by talker task */
+static uint32_t sent[PDO_EXTD + 1U];
+static volatile bool_t stop;
+static char exported[EXPORT_SIZE];
+static size_t exportedLen;
+
+static void nodeCallback(void *object, void *message)
+{
+  (void)object;
+  (void)message;
+}
+
+static size_t exportWrite(void *arg, const void *buf, size_t len)
+{
+  (void)arg;
+  if ((exportedLen + len) < EXPORT_SIZE)
+  {
+    memcpy(&exported[exportedLen], buf, len);
+    exportedLen += len;
+    exported[exportedLen] = '\0';
+  }
+  return len;
+}
+
+/* Send PDO, count it, if it will be transmitted */
+static void talkerSend(talkerPdo_t pdo)
+{
+  bool_t queued;
+
+  if (pdo != PDO_EXTD)
+  {
+    queued = CO_CANsend(&talker, &talkerTx[pdo]) == CO_ERROR_NO;
+  }
+  else
+  {
+    twai_message_t msg = {.identifier = 0x18FF0001UL, .flags = TWAI_MSG_FLAG_EXTD, .data_length_code = 4U};
+
+    queued = twai_transmit(&msg, 0) == ESP_OK;
+  }
+  if (queued)
+  {
+    __atomic_store_n(&sent[pdo], sent[pdo] + 1U, __ATOMIC_RELEASE);
+  }
+}
+
+/* Talker task, PDOs of each millisecond, which is due */
+static void talkerTask(void *arg)
+{
+  int64_t start = esp_timer_get_time();
+  uint32_t ms = 0U;
+
+  (void)arg;
+  while (ms < RUN_MS)
+  {
+    while ((ms < RUN_MS) && (esp_timer_get_time() >= (start + ((int64_t)ms * 1000))))
+    {
+      if ((ms % 5U) == 0U)
+      {
+        talkerSend(PDO_FAST);
+      }
+      if ((ms % 20U) == 0U)
+      {
+        talkerSend(PDO_SLOW);
+      }
+      if ((ms % 50U) == 0U)
+      {
+        talkerSend(PDO_EXTD);
+      }
+      ms++;
+    }
+    CO_CANmodule_process(&talker);
+    vTaskDelay(1);
+  }
+  /* until queued frames are transmitted */
+  vTaskDelay(pdMS_TO_TICKS(50U));
+  CO_CANmodule_process(&talker);
+  vTaskDelay(pdMS_TO_TICKS(20U));
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  vTaskDelete(NULL);
+}
+
+/* Exact length of random frames is within bounds of bit tables */
+static void bounds(void)
+{
+  uint32_t seed = 25U, outside = 0U, i, k;
+
+  for (i = 0U; i < RANDOM_FRAMES; i++)
+  {
+    twai_message_t msg = {0};
+    uint32_t extd, bits;
+
+    msg.flags = ((CO_hostTest_random(&seed) & 1U) != 0U) ? TWAI_MSG_FLAG_EXTD : 0U;
+    extd = (msg.flags != 0U) ? 1U : 0U;
+    msg.identifier = CO_hostTest_random(&seed) & ((extd != 0U) ? 0x1FFFFFFFUL : 0x7FFUL);
+    msg.data_length_code = (uint8_t)(CO_hostTest_random(&seed) % 9U);
+    for (k = 0U; k < msg.data_length_code; k++)
+    {
+      /* runs of equal bits need most stuffing */
+      msg.data[k] = ((i % 4U) == 0U) ? 0U : (uint8_t)CO_hostTest_random(&seed);
+    }
+    bits = CO_hostBus_frameBits(&msg);
+    if ((bits < CO_CANload_bits[extd][msg.data_length_code]) ||
+        (bits > (uint32_t)(CO_CANload_bits[extd][msg.data_length_code] +
+                           CO_CANload_stuffBits[extd][msg.data_length_code])))
+    {
+      outside++;
+    }
+  }
+  CO_HOST_TEST_CHECK(outside == 0U, "%u of %u frames outside of bit tables", (unsigned int)outside, RANDOM_FRAMES);
+}
+
+/* Burst of frames with given times, which are processed after they passed.
+ * Bucket in burst has above 1000 permille with worst case stuffing, the rest
+ * about 260, bucket, where burst starts or ends, may have any load. */
+static void burst(void)
+{
+  twai_message_t msg = {.identifier = 0x281U, .data_length_code = 8U};
+  CO_CANloadUtil_t util;
+  uint32_t frames = 0U, us;
+  int32_t peak_us;
+  int64_t start;
+
+  CO_CANload_init(&given, BURST_PERMILLE);
+  given.bitRate = BITRATE;
+  start = esp_timer_get_time();
+  for (us = 0U; us < (GIVEN_MS * 1000U); us += 250U)
+  {
+    if (((us % 1000U) == 0U) || ((us >= (BURST_START_MS * 1000U)) && (us < ((BURST_START_MS + BURST_MS) * 1000U))))
+    {
+      CO_CANload_frame(&given, CO_CAN_LOAD_RX, &msg, start + us);
+      frames++;
+    }
+  }
+  vTaskDelay(pdMS_TO_TICKS(GIVEN_MS + (3U * CO_CAN_LOAD_BUCKET_MS)));
+  CO_CANload_process(&given);
+
+  peak_us = (int32_t)(given.peakTime_us - (uint32_t)start);
+  CO_HOST_TEST_CHECK((given.bursts == 1U) && (given.burstMax >= ((BURST_MS * 1000U) / BUCKET_US)) &&
+                         (given.burstMax <= (((BURST_MS * 1000U) / BUCKET_US) + 2U)) && (given.bucketsMissed == 0U),
+                     "%u bursts, longest %u buckets, %u buckets missed", (unsigned int)given.bursts,
+                     (unsigned int)given.burstMax, (unsigned int)given.bucketsMissed);
+  CO_HOST_TEST_CHECK((given.peakPermille > 1000U) && (peak_us > (int32_t)((BURST_START_MS * 1000U) - BUCKET_US)) &&
+                         (peak_us < (int32_t)((BURST_START_MS + BURST_MS) * 1000U)),
+                     "peak %u permille at %d us", (unsigned int)given.peakPermille, (int)peak_us);
+  (void)CO_CANload_utilization(&given, UINT32_MAX, &util);
+  CO_HOST_TEST_CHECK((util.frames == frames) && (util.bits == (frames * CO_CANload_bits[0][8])) &&
+                         (util.stuffBits == (frames * CO_CANload_stuffBits[0][8])),
+                     "%u frames of %u, %u bits, %u stuff bits", (unsigned int)util.frames, (unsigned int)frames,
+                     (unsigned int)util.bits, (unsigned int)util.stuffBits);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 1.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *nodeNode, *talkerNode;
+  CO_hostBusStats_t stats;
+  CO_CANloadTop_t top[TALKERS + 1U];
+  CO_CANloadUtil_t util;
+  /* expected order of top talkers by bits */
+  const uint32_t keys[TALKERS] = {0x181U, 0x182U, 0x18FF0001UL | CO_CAN_LOAD_KEY_EXTD, 0x701U};
+  uint32_t frames[TALKERS];
+  uint32_t heartbeats = 0U, total = 0U, bitsMin = 0U, bitsMax = 0U, lines, i;
+  uint16_t count;
+  int64_t start, nextHeartbeat;
+  char line[32];
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bounds();
+  burst();
+
+  bus = CO_hostBus_create(&config);
+  nodeNode = CO_hostNode_create(bus, "node");
+  talkerNode = CO_hostNode_create(bus, "talker");
+
+  CO_hostNode_bind(talkerNode);
+  CO_CANmodule_init(&talker, NULL, talkerRx, 1U, talkerTx, PDO_EXTD, BITRATE);
+  CO_CANtxBufferInit(&talker, PDO_FAST, 0x181U, false, 8U, false);
+  CO_CANtxBufferInit(&talker, PDO_SLOW, 0x182U, false, 2U, false);
+  CO_CANsetNormalMode(&talker);
+
+  /* rx buffer matches all standard frames */
+  CO_hostNode_bind(nodeNode);
+  CO_CANmodule_init(&node, NULL, nodeRx, 1U, nodeTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&node, 0U, 0x000U, 0x0000U, false, &node, nodeCallback);
+  CO_CANtxBufferInit(&node, 0U, 0x701U, false, 1U, false);
+  nodeTx[0].data[0] = 5U;
+  CO_CANload_init(&load, 0U);
+  CO_CANload_attach(&node, &load);
+  CO_CANsetNormalMode(&node);
+  CO_CANrxTaskStart(&node);
+
+  CO_hostNode_bind(talkerNode);
+  xTaskCreate(talkerTask, "talker", 4096, NULL, 5, NULL);
+  CO_hostNode_bind(nodeNode);
+
+  start = esp_timer_get_time();
+  nextHeartbeat = start;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE) && ((esp_timer_get_time() - start) < TIMEOUT_US))
+  {
+    CO_CANwait(&node, 5000U);
+    CO_CANmodule_process(&node);
+    CO_CANload_process(&load);
+    if ((esp_timer_get_time() >= nextHeartbeat) && (heartbeats < (RUN_MS / HEARTBEAT_MS)))
+    {
+      heartbeats += (CO_CANsend(&node, &nodeTx[0]) == CO_ERROR_NO) ? 1U : 0U;
+      nextHeartbeat += HEARTBEAT_MS * 1000;
+    }
+  }
+  /* the last bucket is completed */
+  vTaskDelay(pdMS_TO_TICKS(2U * CO_CAN_LOAD_BUCKET_MS));
+  CO_CANmodule_process(&node);
+  CO_CANload_process(&load);
+
+  frames[0] = sent[PDO_FAST];
+  frames[1] = sent[PDO_SLOW];
+  frames[2] = sent[PDO_EXTD];
+  frames[3] = heartbeats;
+  count = CO_CANload_top(&load, top, TALKERS + 1U);
+  CO_HOST_TEST_CHECK(count == TALKERS, "%u top talkers of %u", count, TALKERS);
+  for (i = 0U; (i < count) && (i < TALKERS); i++)
+  {
+    uint32_t extd = ((top[i].key & CO_CAN_LOAD_KEY_EXTD) != 0U) ? 1U : 0U;
+    uint32_t bytes = (top[i].frames == 0U) ? 0U : (top[i].bytes / top[i].frames);
+
+    CO_HOST_TEST_CHECK(((top[i].key & ~CO_CAN_LOAD_KEY_USED) == keys[i]) && (top[i].frames == frames[i]) &&
+                           (top[i].dir == ((i == (TALKERS - 1U)) ? CO_CAN_LOAD_TX : CO_CAN_LOAD_RX)),
+                       "top %u: %s %X, %u frames, expected %X, %u frames", (unsigned int)i,
+                       (top[i].dir == CO_CAN_LOAD_TX) ? "tx" : "rx", (unsigned int)(top[i].key & 0x1FFFFFFFUL),
+                       (unsigned int)top[i].frames, (unsigned int)(keys[i] & 0x1FFFFFFFUL), (unsigned int)frames[i]);
+    total += top[i].frames;
+    bitsMin += top[i].frames * CO_CANload_bits[extd][bytes];
+    bitsMax += top[i].bits;
+  }
+  CO_HOST_TEST_CHECK((load.dir[CO_CAN_LOAD_RX].idsOverflow == 0U) && (load.dir[CO_CAN_LOAD_TX].idsOverflow == 0U),
+                     "COB-IDs overflow");
+
+  CO_hostBus_getStats(bus, &stats);
+  CO_HOST_TEST_CHECK((stats.frames == total) && (stats.bits >= bitsMin) && (stats.bits <= bitsMax),
+                     "%u frames with %u bits on the bus, %u frames with %u to %u bits counted",
+                     (unsigned int)stats.frames, (unsigned int)stats.bits, (unsigned int)total,
+                     (unsigned int)bitsMin, (unsigned int)bitsMax);
+  (void)CO_CANload_utilization(&load, UINT32_MAX, &util);
+  CO_HOST_TEST_CHECK((util.frames == total) && ((util.bits + util.stuffBits) == bitsMax) &&
+                         (util.permilleMin <= util.permille) && (load.bursts == 0U),
+                     "%u frames, %u bits in %u ms, %u to %u permille, %u bursts", (unsigned int)util.frames,
+                     (unsigned int)(util.bits + util.stuffBits), (unsigned int)util.window_ms,
+                     (unsigned int)util.permilleMin, (unsigned int)util.permille, (unsigned int)load.bursts);
+
+  /* two lines of load, peak, then top talkers */
+  lines = CO_CANload_export(&load, TALKERS, exportWrite, NULL);
+  snprintf(line, sizeof(line), "\nrx 181 %u ", (unsigned int)frames[0]);
+  CO_HOST_TEST_CHECK((lines == (3U + TALKERS)) && (strncmp(exported, "load ", 5U) == 0) &&
+                         (strstr(exported, "\npeak ") != NULL) && (strstr(exported, line) != NULL) &&
+                         (strstr(exported, "\nrx 18FF0001x ") != NULL),
+                     "%u lines exported:\n%s", (unsigned int)lines, exported);
+  printf("%s", exported);
+  CO_CANload_reset(&load);
+  CO_HOST_TEST_CHECK((CO_CANload_top(&load, top, TALKERS) == 0U) && (load.peakPermille == 0U),
+                     "reset did not clear top talkers");
+
+  CO_CANrxTaskStop(&node);
+  CO_CANmodule_disable(&node);
+  CO_hostNode_bind(talkerNode);
+  CO_CANmodule_disable(&talker);
+  CO_hostNode_delete(nodeNode);
+  CO_hostNode_delete(talkerNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,169 @@
+/*
+ * Host test of CO_CANwait() with receive task of ESP32 TWAI driver.
+ *
+ * @file        test_canWait.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Node mainline sleeps in CO_CANwait() with short deadline and calls
+ * CO_CANmodule_process() after each wake up, as on target, its receive task
+ * waits for TWAI alerts. Peer sends pairs of frames in real time at
+ * 500 kbit/s with their send time, rx callback blocks for a tick.
+ * - Receive task is the only reader of TWAI alerts. Frame is processed soon
+ *   after reception, not when receive task's wait for alerts times out after
+ *   CO_CAN_RX_WAIT_MS, because mainline took received data alert.
+ * - Burst of frames longer than TWAI transmit queue is sent with transmit
+ *   alerts, mainline is woken for them. */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define BITRATE 500U
+#define PAIRS 100U
+#define FRAMES (2U * PAIRS)
+#define BURST 24U
+#define DEADLINE_US 1000U
+/* frame processed later is late, receive task's wait timed out */
+#define LATE_US ((CO_CAN_RX_WAIT_MS * 1000) / 2)
+
+static CO_CANmodule_t node, peer;
+static CO_CANrx_t nodeRx[1], peerRx[1];
+static CO_CANtx_t nodeTx[BURST], peerTx[2];
+static CO_hostNode_t *nodeNode, *peerNode;
+/* written by receive task of node */
+static uint32_t received, late;
+static int64_t latencyMax;
+static volatile bool_t stop;
+
+/* Send time is in data of the frame */
+static void rxCallback(void *object, void *message)
+{
+  const CO_CANrxMsg_t *rxMsg = (const CO_CANrxMsg_t *)message;
+  int64_t sent, latency;
+
+  (void)object;
+  memcpy(&sent, rxMsg->msg.data, sizeof(sent));
+  latency = esp_timer_get_time() - sent;
+  late += (latency > LATE_US) ? 1U : 0U;
+  latencyMax = (latency > latencyMax) ? latency : latencyMax;
+  __atomic_store_n(&received, received + 1U, __ATOMIC_RELEASE);
+  /* the second frame of pair arrives meanwhile */
+  vTaskDelay(1);
+}
+
+/* Peer task, pairs of frames at irregular intervals of few ms */
+static void peerTask(void *arg)
+{
+  uint32_t i;
+
+  (void)arg;
+  for (i = 0U; (i < PAIRS) && !stop; i++)
+  {
+    int64_t now;
+
+    vTaskDelay(pdMS_TO_TICKS(3U + (i % 5U)));
+    now = esp_timer_get_time();
+    memcpy(peerTx[0].data, &now, sizeof(now));
+    memcpy(peerTx[1].data, &now, sizeof(now));
+    CO_CANsend(&peer, &peerTx[0]);
+    CO_CANsend(&peer, &peerTx[1]);
+    CO_CANmodule_process(&peer);
+  }
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  vTaskDelete(NULL);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 1.0};
+  CO_hostBus_t *bus;
+  uint32_t wakes = 0U, txWakes = 0U, i;
+  int64_t burstStart = 0, burstTook = -1;
+  bool_t burstSent = false;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  nodeNode = CO_hostNode_create(bus, "node");
+  peerNode = CO_hostNode_create(bus, "peer");
+
+  CO_hostNode_bind(peerNode);
+  CO_CANmodule_init(&peer, NULL, peerRx, 1U, peerTx, 2U, BITRATE);
+  CO_CANtxBufferInit(&peer, 0U, 0x201U, false, 8U, false);
+  CO_CANtxBufferInit(&peer, 1U, 0x202U, false, 8U, false);
+  CO_CANsetNormalMode(&peer);
+
+  CO_hostNode_bind(nodeNode);
+  CO_CANmodule_init(&node, NULL, nodeRx, 1U, nodeTx, BURST, BITRATE);
+  CO_CANrxBufferInit(&node, 0U, 0x200U, 0x07FCU, false, &node, rxCallback);
+  for (i = 0U; i < BURST; i++)
+  {
+    CO_CANtxBufferInit(&node, (uint16_t)i, (uint16_t)(0x300U + i), false, 8U, false);
+  }
+  CO_CANsetNormalMode(&node);
+  CO_CANrxTaskStart(&node);
+
+  CO_hostNode_bind(peerNode);
+  xTaskCreate(peerTask, "peer", 4096, NULL, 5, NULL);
+  CO_hostNode_bind(nodeNode);
+
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    uint32_t events = CO_CANwait(&node, DEADLINE_US);
+
+    CO_CANmodule_process(&node);
+    wakes++;
+    txWakes += ((events & CO_CAN_WAIT_TX) != 0U) ? 1U : 0U;
+    if (!burstSent && (__atomic_load_n(&received, __ATOMIC_ACQUIRE) >= (FRAMES / 2U)))
+    {
+      burstSent = true;
+      burstStart = esp_timer_get_time();
+      for (i = 0U; i < BURST; i++)
+      {
+        CO_CANsend(&node, &nodeTx[i]);
+      }
+    }
+    if ((burstStart != 0) && (burstTook < 0) && (__atomic_load_n(&node.CANtxCount, __ATOMIC_RELAXED) == 0U) &&
+        (__atomic_load_n(&node.txInflightCount, __ATOMIC_RELAXED) == 0U))
+    {
+      burstTook = esp_timer_get_time() - burstStart;
+    }
+  }
+  for (i = 0U; (i < 100U) && (__atomic_load_n(&received, __ATOMIC_ACQUIRE) < FRAMES); i++)
+  {
+    vTaskDelay(1);
+  }
+
+  CO_HOST_TEST_CHECK(received == FRAMES, "%u of %u frames received", (unsigned int)received, FRAMES);
+  CO_HOST_TEST_CHECK(late <= (FRAMES / 20U), "%u of %u frames processed after %u us, max %lld us", (unsigned int)late,
+                     FRAMES, LATE_US, (long long)latencyMax);
+  CO_HOST_TEST_CHECK((burstTook >= 0) && (txWakes > 0U), "burst of %u frames not sent, %u transmit wake ups", BURST,
+                     (unsigned int)txWakes);
+  printf("%u frames, %u late, latency max %lld us, %u wake ups, burst of %u frames sent in %lld us\n",
+         (unsigned int)received, (unsigned int)late, (long long)latencyMax, (unsigned int)wakes, BURST,
+         (long long)burstTook);
+
+  CO_CANrxTaskStop(&node);
+  CO_CANmodule_disable(&node);
+  CO_hostNode_bind(peerNode);
+  CO_CANmodule_disable(&peer);
+  CO_hostNode_delete(nodeNode);
+  CO_hostNode_delete(peerNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
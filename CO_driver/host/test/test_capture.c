@@ -0,0 +1,185 @@
+/*
+ * Host test of CAN frame capture, candump export and replay of ESP32 TWAI
+ * driver.
+ *
+ * @file        test_capture.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CO_CAN_CAPTURE. Node captures data and remote frames, which it
+ * sends and receives, peer node sends frames to it.
+ * - candump export has the same frames, remote frames as "R<dlc>".
+ * - Replay of the export to peer processes received frames with the same
+ *   CAN-ID, flags, DLC and data, sent frames are skipped. Remote frame
+ *   without DLC has DLC 0, malformed lines are rejected. */
+
+#include "301/CO_driver.h"
+#include "CO_CANcapture.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if !CO_CAN_CAPTURE
+#error test_capture requires CO_CAN_CAPTURE
+#endif
+
+#define CAPTURE_SIZE 16U
+#define FRAMES_MAX 16U
+#define EXPORT_MAX 1024U
+
+static CO_CANmodule_t node, peer;
+static CO_CANrx_t nodeRx[2], peerRx[2];
+static CO_CANtx_t nodeTx[2], peerTx[2];
+static CO_CANcapture_t capture;
+static CO_CANcaptureRecord_t records[CAPTURE_SIZE];
+static CO_hostTestFrame_t nodeFrames[FRAMES_MAX], peerFrames[FRAMES_MAX];
+static CO_hostTestRecorder_t nodeRecorder = {nodeFrames, FRAMES_MAX, 0U};
+static CO_hostTestRecorder_t peerRecorder = {peerFrames, FRAMES_MAX, 0U};
+
+typedef struct
+{
+  char text[EXPORT_MAX];
+  size_t len;
+} exportBuffer_t;
+
+static size_t exportWrite(void *arg, const void *buf, size_t len)
+{
+  exportBuffer_t *out = (exportBuffer_t *)arg;
+
+  if ((out->len + len) >= sizeof(out->text))
+  {
+    return 0U;
+  }
+  memcpy(&out->text[out->len], buf, len);
+  out->len += len;
+  out->text[out->len] = '\0';
+  return len;
+}
+
+/* Line of export without timestamp */
+static const char *frameOf(const char *line)
+{
+  const char *p = strchr(line, ')');
+
+  return (p != NULL) ? (p + 2) : "";
+}
+
+int main(void)
+{
+  static const char *expected[] = {"can0 181#AABBCC T", "can0 281#R8 T", "can0 701#R1 R", "can0 201#1122 R"};
+  CO_hostBusConfig_t config = {.timeScale = 0.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *nodeNode, *peerNode;
+  exportBuffer_t out = {{0}, 0U};
+  char *line, *next;
+  uint32_t exported, i;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  peerNode = CO_hostNode_create(bus, "peer");
+  nodeNode = CO_hostNode_create(bus, "node");
+
+  CO_hostNode_bind(peerNode);
+  CO_CANmodule_init(&peer, NULL, peerRx, 2U, peerTx, 2U, 1000U);
+  CO_CANrxBufferInit(&peer, 0U, 0x701U, 0x07FFU, true, &peerRecorder, CO_hostTest_record);
+  CO_CANrxBufferInit(&peer, 1U, 0x201U, 0x07FFU, false, &peerRecorder, CO_hostTest_record);
+  CO_CANtxBufferInit(&peer, 0U, 0x701U, true, 1U, false);
+  CO_CANtxBufferInit(&peer, 1U, 0x201U, false, 2U, false);
+  CO_CANsetNormalMode(&peer);
+
+  CO_hostNode_bind(nodeNode);
+  CO_CANmodule_init(&node, NULL, nodeRx, 2U, nodeTx, 2U, 1000U);
+  CO_CANrxBufferInit(&node, 0U, 0x701U, 0x07FFU, true, &nodeRecorder, CO_hostTest_record);
+  CO_CANrxBufferInit(&node, 1U, 0x201U, 0x07FFU, false, &nodeRecorder, CO_hostTest_record);
+  CO_CANtxBufferInit(&node, 0U, 0x181U, false, 3U, false);
+  CO_CANtxBufferInit(&node, 1U, 0x281U, true, 8U, false);
+  CO_CANsetNormalMode(&node);
+  CO_CANrxTaskStart(&node);
+  CO_CANcapture_init(&capture, records, CAPTURE_SIZE);
+  CO_CANcapture_attach(&node, &capture);
+  CO_CANcapture_enable(&capture, true);
+
+  /* node sends, then receives */
+  memcpy(nodeTx[0].data, "\xAA\xBB\xCC", 3U);
+  CO_CANsend(&node, &nodeTx[0]);
+  CO_CANsend(&node, &nodeTx[1]);
+  CO_hostNode_bind(peerNode);
+  memcpy(peerTx[1].data, "\x11\x22", 2U);
+  CO_CANsend(&peer, &peerTx[0]);
+  CO_CANsend(&peer, &peerTx[1]);
+  CO_HOST_TEST_CHECK(CO_hostTest_recordWait(&nodeRecorder, 2U, 1000U) == 2U, "%u of 2 frames received by node",
+                     (unsigned int)CO_hostTest_recorded(&nodeRecorder));
+  CO_CANcapture_enable(&capture, false);
+
+  exported = CO_CANcapture_exportCandump(&capture, "can0", exportWrite, &out);
+  CO_HOST_TEST_CHECK(exported == 4U, "%u frames exported:\n%s", (unsigned int)exported, out.text);
+  for (i = 0U, line = out.text; (i < 4U) && (line != NULL); i++, line = next)
+  {
+    next = strchr(line, '\n');
+    if (next != NULL)
+    {
+      *next++ = '\0';
+    }
+    CO_HOST_TEST_CHECK(strcmp(frameOf(line), expected[i]) == 0, "exported \"%s\", expected \"%s\"", line,
+                       expected[i]);
+  }
+
+  /* replay of the same lines to peer, sent ones are skipped */
+  out.len = 0U;
+  CO_CANcapture_exportCandump(&capture, "can0", exportWrite, &out);
+  for (line = out.text; (line != NULL) && (*line != '\0'); line = next)
+  {
+    next = strchr(line, '\n');
+    if (next != NULL)
+    {
+      *next++ = '\0';
+    }
+    CO_HOST_TEST_CHECK(CO_CANcapture_replayCandump(&peer, line) == CO_ERROR_NO, "\"%s\" not replayed", line);
+  }
+  CO_HOST_TEST_CHECK(CO_hostTest_recorded(&peerRecorder) == 2U, "%u frames replayed",
+                     (unsigned int)CO_hostTest_recorded(&peerRecorder));
+  for (i = 0U; (i < 2U) && (i < CO_hostTest_recorded(&peerRecorder)); i++)
+  {
+    CO_HOST_TEST_CHECK((peerFrames[i].ident == nodeFrames[i].ident) && (peerFrames[i].flags == nodeFrames[i].flags) &&
+                           (peerFrames[i].DLC == nodeFrames[i].DLC) &&
+                           (memcmp(peerFrames[i].data, nodeFrames[i].data, nodeFrames[i].DLC) == 0),
+                       "replayed 0x%03X flags 0x%X DLC %u, received 0x%03X flags 0x%X DLC %u",
+                       (unsigned int)peerFrames[i].ident, (unsigned int)peerFrames[i].flags, peerFrames[i].DLC,
+                       (unsigned int)nodeFrames[i].ident, (unsigned int)nodeFrames[i].flags, nodeFrames[i].DLC);
+  }
+
+  /* remote frame without DLC, as written by older candump */
+  CO_CANcapture_replayCandump(&peer, "(1.000000) can0 701#R R");
+  CO_HOST_TEST_CHECK((CO_hostTest_recorded(&peerRecorder) == 3U) && ((peerFrames[2].flags & TWAI_MSG_FLAG_RTR) != 0U) &&
+                         (peerFrames[2].DLC == 0U),
+                     "remote frame without DLC: %u frames, DLC %u", (unsigned int)CO_hostTest_recorded(&peerRecorder),
+                     peerFrames[2].DLC);
+  CO_HOST_TEST_CHECK(CO_CANcapture_replayCandump(&peer, "can0 701#R1 R") == CO_ERROR_ILLEGAL_ARGUMENT,
+                     "line without timestamp accepted");
+  CO_HOST_TEST_CHECK(CO_CANcapture_replayCandump(&peer, "(1.000000) can0 701 R") == CO_ERROR_ILLEGAL_ARGUMENT,
+                     "line without '#' accepted");
+  printf("%u frames exported and replayed\n", (unsigned int)exported);
+
+  CO_CANmodule_disable(&peer);
+  CO_hostNode_bind(nodeNode);
+  CO_CANrxTaskStop(&node);
+  CO_CANmodule_disable(&node);
+  CO_hostNode_delete(nodeNode);
+  CO_hostNode_delete(peerNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,224 @@
+/*
+ * Host test of heartbeat monitor of the whole network with ESP32 TWAI driver.
+ *
+ * @file        test_hbMonitor.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CONFIG_CANOPEN_MONITOR_HB_NETWORK. Monitoring node has rxArray
+ * with exact number of rx buffers for the stack, as allocated by CO_new()
+ * without HB consumer, all of them configured. CO_HBmonitor uses rx buffer
+ * reserved by the driver. Network task sends heartbeats of all NODES nodes
+ * in real time at 500 kbit/s and SYNC each period, mainline sleeps in
+ * CO_CANwait() until timerNext_us of CO_HBmonitor_process().
+ * - Rx buffer after the reserved ones is rejected.
+ * - Each node is reported operational once. Node SILENT stops sending and
+ *   times out once, node REBOOT reports boot-up, pre-operational and
+ *   operational again. There are no other events and none is lost.
+ * - Rx buffers of the stack receive their messages meanwhile. */
+
+#include "301/CO_driver.h"
+#include "CO_HBmonitor.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if CO_CAN_RX_EXTRA < 1
+#error test_hbMonitor requires CONFIG_CANOPEN_MONITOR_HB_NETWORK
+#endif
+
+#define BITRATE 500U
+#define NODES 127U
+#define PERIOD_US 200000
+#define PERIODS 12U
+#define CONSUMER_MS 500U
+#define SILENT 5U
+#define REBOOT 7U
+#define TIMEOUT_US 10000000
+/* NMT, SYNC and SDO server of the stack */
+#define RX_STACK 3U
+
+static CO_CANmodule_t node, network;
+static CO_CANrx_t nodeRx[RX_STACK], networkRx[1];
+/* heartbeat of each node and SYNC */
+static CO_CANtx_t nodeTx[1], networkTx[NODES + 1U];
+static CO_HBmonitor_t hbMonitor;
+/* written by receive task of node */
+static uint32_t stackReceived[RX_STACK];
+static volatile bool_t stop;
+
+static void stackCallback(void *object, void *message)
+{
+  uint32_t *received = (uint32_t *)object;
+
+  (void)message;
+  __atomic_store_n(received, *received + 1U, __ATOMIC_RELEASE);
+}
+
+/* Network task, heartbeats of nodes spread over the period, SYNC at its start */
+static void networkTask(void *arg)
+{
+  int64_t start = esp_timer_get_time();
+  uint32_t period = 0U, k = 0U;
+
+  (void)arg;
+  while (period < PERIODS)
+  {
+    int64_t due = start + ((int64_t)period * PERIOD_US) + (((int64_t)k * PERIOD_US) / NODES);
+
+    while (esp_timer_get_time() >= due)
+    {
+      uint8_t nodeId = (uint8_t)(k + 1U);
+
+      if (k == 0U)
+      {
+        CO_CANsend(&network, &networkTx[NODES]);
+      }
+      if ((nodeId == REBOOT) && (period == ((3U * PERIODS) / 4U)))
+      {
+        networkTx[k].data[0] = 0U;
+        CO_CANsend(&network, &networkTx[k]);
+        CO_CANmodule_process(&network);
+        networkTx[k].data[0] = 127U;
+        CO_CANsend(&network, &networkTx[k]);
+      }
+      else if ((nodeId != SILENT) || (period < (PERIODS / 2U)))
+      {
+        networkTx[k].data[0] = 5U;
+        CO_CANsend(&network, &networkTx[k]);
+      }
+      if (++k == NODES)
+      {
+        k = 0U;
+        period++;
+      }
+      due = start + ((int64_t)period * PERIOD_US) + (((int64_t)k * PERIOD_US) / NODES);
+    }
+    CO_CANmodule_process(&network);
+    vTaskDelay(1);
+  }
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  vTaskDelete(NULL);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 1.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *nodeNode, *networkNode;
+  uint32_t operational[NODES + 1U] = {0};
+  uint32_t silentTimeouts = 0U, rebootEvents = 0U, other = 0U, wakes = 0U, timerNext_us = 0U, i;
+  CO_HBmonitorEvent_t event;
+  int64_t start;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  nodeNode = CO_hostNode_create(bus, "node");
+  networkNode = CO_hostNode_create(bus, "network");
+
+  CO_hostNode_bind(networkNode);
+  CO_CANmodule_init(&network, NULL, networkRx, 1U, networkTx, NODES + 1U, BITRATE);
+  for (i = 0U; i < NODES; i++)
+  {
+    CO_CANtxBufferInit(&network, (uint16_t)i, (uint16_t)(CO_CAN_ID_HEARTBEAT + i + 1U), false, 1U, false);
+    networkTx[i].data[0] = 5U;
+  }
+  CO_CANtxBufferInit(&network, NODES, 0x080U, false, 0U, false);
+  CO_CANsetNormalMode(&network);
+
+  CO_hostNode_bind(nodeNode);
+  CO_CANmodule_init(&node, NULL, nodeRx, RX_STACK, nodeTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&node, 0U, 0x000U, 0x07FFU, false, &stackReceived[0], stackCallback);
+  CO_CANrxBufferInit(&node, 1U, 0x080U, 0x07FFU, false, &stackReceived[1], stackCallback);
+  CO_CANrxBufferInit(&node, 2U, 0x601U, 0x07FFU, false, &stackReceived[2], stackCallback);
+  CO_HOST_TEST_CHECK(CO_CANrxBufferInit(&node, CO_CANrxExtraIndex(&node, CO_CAN_RX_EXTRA), 0x100U, 0x07FFU, false,
+                                        &stackReceived[0], stackCallback) == CO_ERROR_ILLEGAL_ARGUMENT,
+                     "rx buffer after reserved ones accepted");
+  CO_HOST_TEST_CHECK(CO_HBmonitor_init(&hbMonitor, &node, CO_CANrxExtraIndex(&node, 0U)) == CO_ERROR_NO,
+                     "no rx buffer for heartbeat monitor");
+  for (i = 1U; i <= NODES; i++)
+  {
+    CO_HBmonitor_setNode(&hbMonitor, (uint8_t)i, CONSUMER_MS);
+  }
+  CO_CANsetNormalMode(&node);
+  CO_CANrxTaskStart(&node);
+
+  CO_hostNode_bind(networkNode);
+  xTaskCreate(networkTask, "network", 4096, NULL, 5, NULL);
+  CO_hostNode_bind(nodeNode);
+
+  /* until node SILENT times out after the network stopped */
+  start = esp_timer_get_time();
+  while ((!__atomic_load_n(&stop, __ATOMIC_ACQUIRE) || (silentTimeouts == 0U)) &&
+         ((esp_timer_get_time() - start) < TIMEOUT_US))
+  {
+    CO_CANwait(&node, timerNext_us);
+    CO_CANmodule_process(&node);
+    wakes++;
+    timerNext_us = 100000U;
+    CO_HBmonitor_process(&hbMonitor, &timerNext_us);
+    while (CO_HBmonitor_getEvent(&hbMonitor, &event, 0))
+    {
+      if ((event.state == 5U) && (event.previous == CO_HB_MONITOR_UNKNOWN))
+      {
+        operational[event.nodeId]++;
+      }
+      else if ((event.nodeId == SILENT) && (event.state == CO_HB_MONITOR_UNKNOWN))
+      {
+        silentTimeouts++;
+      }
+      else if ((event.nodeId == REBOOT) && (((event.previous == 5U) && (event.state == 0U)) ||
+                                            ((event.previous == 0U) && (event.state == 127U)) ||
+                                            ((event.previous == 127U) && (event.state == 5U))))
+      {
+        rebootEvents++;
+      }
+      else
+      {
+        printf("unexpected event: node %u, %u -> %u\n", event.nodeId, event.previous, event.state);
+        other++;
+      }
+    }
+  }
+
+  for (i = 1U; i <= NODES; i++)
+  {
+    CO_HOST_TEST_CHECK(operational[i] == 1U, "node %u reported operational %u times", (unsigned int)i,
+                       (unsigned int)operational[i]);
+  }
+  CO_HOST_TEST_CHECK((silentTimeouts == 1U) && (rebootEvents == 3U) && (other == 0U),
+                     "%u timeouts of node %u, %u reboot events of node %u, %u other events",
+                     (unsigned int)silentTimeouts, SILENT, (unsigned int)rebootEvents, REBOOT, (unsigned int)other);
+  CO_HOST_TEST_CHECK((hbMonitor.timeouts == 1U) && (hbMonitor.eventsLost == 0U), "%u timeouts, %u events lost",
+                     (unsigned int)hbMonitor.timeouts, (unsigned int)hbMonitor.eventsLost);
+  CO_HOST_TEST_CHECK((CO_HBmonitor_getState(&hbMonitor, SILENT) == CO_HB_MONITOR_UNKNOWN) &&
+                         (CO_HBmonitor_getState(&hbMonitor, REBOOT) == 5U),
+                     "node %u in state %u, node %u in state %u", SILENT, CO_HBmonitor_getState(&hbMonitor, SILENT),
+                     REBOOT, CO_HBmonitor_getState(&hbMonitor, REBOOT));
+  CO_HOST_TEST_CHECK(stackReceived[1] == PERIODS, "%u of %u SYNC received by rx buffer of the stack",
+                     (unsigned int)stackReceived[1], PERIODS);
+  printf("%u nodes, %u heartbeats, %u wake ups\n", NODES, (unsigned int)hbMonitor.heartbeats, (unsigned int)wakes);
+
+  CO_CANrxTaskStop(&node);
+  CO_CANmodule_disable(&node);
+  CO_hostNode_bind(networkNode);
+  CO_CANmodule_disable(&network);
+  CO_hostNode_delete(nodeNode);
+  CO_hostNode_delete(networkNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,229 @@
+/*
+ * Host test of latency histograms of ESP32 TWAI driver.
+ *
+ * @file        test_latency.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CO_CAN_LATENCY. Histogram buckets and percentiles are checked
+ * with given latencies. Then master sends SYNC and RPDO every SYNC_PERIOD_MS
+ * in real time at 500 kbit/s, node answers each SYNC with synchronous TPDO
+ * from mainline, which sleeps in CO_CANwait().
+ * - Each SYNC, RPDO and TPDO is in its histogram, by function code, also
+ *   TPDO, whose transmission is detected after the next SYNC.
+ * - TPDO latencies include its transmission, so none is below the time of
+ *   the frame on the bus.
+ * - Maximum is within the 100th percentile, export has one line per
+ *   non-empty histogram and reset clears them. */
+
+#include "301/CO_driver.h"
+#include "CO_CANlatency.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if !CO_CAN_LATENCY
+#error test_latency requires CO_CAN_LATENCY
+#endif
+
+#define BITRATE 500U
+#define SYNCS 200U
+#define SYNC_PERIOD_MS 10U
+#define TPDO_IDENT 0x181U
+#define RPDO_IDENT 0x201U
+/* TPDO with 8 bytes takes at least 111 bits on the bus, 222 us */
+#define TPDO_BUCKET_MIN 7U
+#define EXPORT_SIZE 4096U
+
+static CO_CANmodule_t node, master;
+static CO_CANrx_t nodeRx[2], masterRx[1];
+static CO_CANtx_t nodeTx[1], masterTx[2];
+static CO_CANlatency_t latency;
+/* written by receive task of node */
+static uint32_t syncs;
+static volatile bool_t stop;
+static char exported[EXPORT_SIZE];
+static size_t exportedLen;
+
+static void syncCallback(void *object, void *message)
+{
+  (void)object;
+  (void)message;
+  __atomic_store_n(&syncs, syncs + 1U, __ATOMIC_RELEASE);
+}
+
+static void rpdoCallback(void *object, void *message)
+{
+  (void)object;
+  (void)message;
+}
+
+static size_t exportWrite(void *arg, const void *buf, size_t len)
+{
+  (void)arg;
+  if ((exportedLen + len) < EXPORT_SIZE)
+  {
+    memcpy(&exported[exportedLen], buf, len);
+    exportedLen += len;
+    exported[exportedLen] = '\0';
+  }
+  return len;
+}
+
+/* Master task, SYNC followed by RPDO */
+static void masterTask(void *arg)
+{
+  uint32_t i;
+
+  (void)arg;
+  for (i = 0U; i < SYNCS; i++)
+  {
+    vTaskDelay(pdMS_TO_TICKS(SYNC_PERIOD_MS));
+    CO_CANsend(&master, &masterTx[0]);
+    CO_CANsend(&master, &masterTx[1]);
+    CO_CANmodule_process(&master);
+  }
+  vTaskDelay(pdMS_TO_TICKS(SYNC_PERIOD_MS));
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  vTaskDelete(NULL);
+}
+
+/* Buckets and percentiles of given latencies */
+static void buckets(void)
+{
+  CO_CANlatencyHist_t hist = {0};
+  const int64_t latencies[] = {-5, 0, 1, 2, 3, 1000, 1L << 19, 1L << 25};
+  uint32_t i;
+
+  for (i = 0U; i < (sizeof(latencies) / sizeof(latencies[0])); i++)
+  {
+    CO_CANlatency_record(&hist, latencies[i]);
+  }
+  CO_HOST_TEST_CHECK((hist.bucket[0] == 3U) && (hist.bucket[1] == 2U) && (hist.bucket[9] == 1U) &&
+                         (hist.bucket[CO_CAN_LATENCY_BUCKETS - 1U] == 2U) && (hist.count == 8U),
+                     "buckets %u %u %u %u, count %u", (unsigned int)hist.bucket[0], (unsigned int)hist.bucket[1],
+                     (unsigned int)hist.bucket[9], (unsigned int)hist.bucket[CO_CAN_LATENCY_BUCKETS - 1U],
+                     (unsigned int)hist.count);
+  CO_HOST_TEST_CHECK(hist.max_us == (1UL << 25), "max %u us", (unsigned int)hist.max_us);
+  CO_HOST_TEST_CHECK((CO_CANlatency_percentile(&hist, 375U) == 1U) && (CO_CANlatency_percentile(&hist, 500U) == 3U) &&
+                         (CO_CANlatency_percentile(&hist, 750U) == 1023U) &&
+                         (CO_CANlatency_percentile(&hist, 1000U) == (1UL << 25)),
+                     "percentiles %u %u %u %u", (unsigned int)CO_CANlatency_percentile(&hist, 375U),
+                     (unsigned int)CO_CANlatency_percentile(&hist, 500U),
+                     (unsigned int)CO_CANlatency_percentile(&hist, 750U),
+                     (unsigned int)CO_CANlatency_percentile(&hist, 1000U));
+}
+
+/* Histogram has no latency below bucket */
+static bool_t noneBelow(const CO_CANlatencyHist_t *hist, uint32_t bucket)
+{
+  uint32_t k;
+
+  for (k = 0U; k < bucket; k++)
+  {
+    if (hist->bucket[k] != 0U)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 1.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *nodeNode, *masterNode;
+  const CO_CANlatencyHist_t *rxSync = &latency.rxCallback[0x080U >> 7];
+  const CO_CANlatencyHist_t *rxRpdo = &latency.rxCallback[RPDO_IDENT >> 7];
+  const CO_CANlatencyHist_t *txTpdo = &latency.txComplete[TPDO_IDENT >> 7];
+  uint32_t answered = 0U, lines;
+  char first[16];
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  buckets();
+
+  bus = CO_hostBus_create(&config);
+  nodeNode = CO_hostNode_create(bus, "node");
+  masterNode = CO_hostNode_create(bus, "master");
+
+  CO_hostNode_bind(masterNode);
+  CO_CANmodule_init(&master, NULL, masterRx, 1U, masterTx, 2U, BITRATE);
+  CO_CANtxBufferInit(&master, 0U, 0x080U, false, 0U, false);
+  CO_CANtxBufferInit(&master, 1U, RPDO_IDENT, false, 8U, false);
+  CO_CANsetNormalMode(&master);
+
+  CO_hostNode_bind(nodeNode);
+  CO_CANmodule_init(&node, NULL, nodeRx, 2U, nodeTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&node, 0U, 0x080U, 0x07FFU, false, &node, syncCallback);
+  CO_CANrxBufferInit(&node, 1U, RPDO_IDENT, 0x07FFU, false, &node, rpdoCallback);
+  CO_CANtxBufferInit(&node, 0U, TPDO_IDENT, false, 8U, true);
+  CO_CANlatency_reset(&latency);
+  CO_CANlatency_attach(&node, &latency);
+  CO_CANsetNormalMode(&node);
+  CO_CANrxTaskStart(&node);
+
+  CO_hostNode_bind(masterNode);
+  xTaskCreate(masterTask, "master", 4096, NULL, 5, NULL);
+  CO_hostNode_bind(nodeNode);
+
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    CO_CANwait(&node, 1000U);
+    CO_CANmodule_process(&node);
+    if (answered < __atomic_load_n(&syncs, __ATOMIC_ACQUIRE))
+    {
+      answered++;
+      CO_CANsend(&node, &nodeTx[0]);
+      if (answered == (SYNCS / 2U))
+      {
+        /* the next SYNC comes before transmission of TPDO is detected */
+        vTaskDelay(pdMS_TO_TICKS(SYNC_PERIOD_MS + 5U));
+      }
+    }
+  }
+  CO_CANmodule_process(&node);
+
+  CO_HOST_TEST_CHECK((rxSync->count == SYNCS) && (rxRpdo->count == SYNCS), "%u SYNC, %u RPDO of %u in histograms",
+                     (unsigned int)rxSync->count, (unsigned int)rxRpdo->count, SYNCS);
+  CO_HOST_TEST_CHECK((txTpdo->count == SYNCS) && (latency.syncTpdo.count == SYNCS),
+                     "%u transmitted TPDO, %u SYNC to TPDO of %u in histograms", (unsigned int)txTpdo->count,
+                     (unsigned int)latency.syncTpdo.count, SYNCS);
+  CO_HOST_TEST_CHECK(noneBelow(txTpdo, TPDO_BUCKET_MIN) && noneBelow(&latency.syncTpdo, TPDO_BUCKET_MIN),
+                     "TPDO latency below its time on the bus");
+  CO_HOST_TEST_CHECK(latency.syncTpdo.max_us <= CO_CANlatency_percentile(&latency.syncTpdo, 1000U),
+                     "max %u us above 100th percentile %u us", (unsigned int)latency.syncTpdo.max_us,
+                     (unsigned int)CO_CANlatency_percentile(&latency.syncTpdo, 1000U));
+
+  /* the first line is SYNC, function code 1 */
+  snprintf(first, sizeof(first), "rx 1 %u ", SYNCS);
+  lines = CO_CANlatency_export(&latency, exportWrite, NULL);
+  CO_HOST_TEST_CHECK((lines == 4U) && (strncmp(exported, first, strlen(first)) == 0), "%u lines exported:\n%s",
+                     (unsigned int)lines, exported);
+  printf("%s", exported);
+  CO_CANlatency_reset(&latency);
+  CO_HOST_TEST_CHECK(CO_CANlatency_export(&latency, exportWrite, NULL) == 0U, "histograms not cleared");
+
+  CO_CANrxTaskStop(&node);
+  CO_CANmodule_disable(&node);
+  CO_hostNode_bind(masterNode);
+  CO_CANmodule_disable(&master);
+  CO_hostNode_delete(nodeNode);
+  CO_hostNode_delete(masterNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,259 @@
+/*
+ * Host test of node-ID assignment by LSS fastscan with ESP32 TWAI driver.
+ *
+ * @file        test_lssAssign.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CONFIG_CANOPEN_LSS_MASTER. Master node assigns node-IDs to
+ * NODES unconfigured nodes at 500 kbit/s in real time, mainline sleeps in
+ * CO_CANwait(). Nodes have the same vendor and product, which are matched,
+ * and random serial number, which is scanned. Nodes are emulated by one CAN
+ * module, which answers from its receive callback, as LSS slave with
+ * CO_CONFIG_LSS_SLAVE_FASTSCAN_DIRECT_RESPOND does. Equal answers of more
+ * nodes are one frame on the bus.
+ * - All nodes are found, each gets its own node-ID, which is stored.
+ * - Found addresses are addresses of the nodes.
+ * - Assignment ends with CO_LSSmaster_OK, when no node answers anymore. */
+
+#include "301/CO_driver.h"
+#include "CO_LSSassign.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if !((CO_CONFIG_LSS) & CO_CONFIG_LSS_MASTER)
+#error test_lssAssign requires CONFIG_CANOPEN_LSS_MASTER
+#endif
+
+#define BITRATE 500U
+#define NODES 40U
+#define FIRST_NODE_ID 2U
+#define VENDOR 0x1234UL
+#define PRODUCT 0x5678UL
+#define TIMEOUT_US 60000000
+
+/* Emulated unconfigured node */
+typedef struct
+{
+  CO_LSS_address_t address;
+  uint8_t fastscanPos;
+  bool_t selected;
+  uint8_t nodeId;
+  bool_t stored;
+} slave_t;
+
+static CO_CANmodule_t master, slaves;
+static CO_CANrx_t masterRx[1], slavesRx[1];
+static CO_CANtx_t masterTx[1], slavesTx[1];
+static CO_LSSmaster_t LSSmaster;
+static CO_LSSassign_t assign;
+static CO_LSSassignNode_t found[NODES + 4U];
+static slave_t slave[NODES];
+
+/* Fastscan step of the node, returns true, if it answers */
+static bool_t fastscan(slave_t *s, uint32_t idNumber, uint8_t bitChecked, uint8_t lssSub, uint8_t lssNext)
+{
+  uint32_t mask;
+
+  if (bitChecked == 0x80U)
+  {
+    s->fastscanPos = 0U;
+    return true;
+  }
+  if ((s->fastscanPos != lssSub) || (bitChecked > 31U))
+  {
+    return false;
+  }
+  mask = 0xFFFFFFFFUL << bitChecked;
+  if (((s->address.addr[lssSub] ^ idNumber) & mask) != 0U)
+  {
+    return false;
+  }
+  if (bitChecked == 0U)
+  {
+    s->fastscanPos = lssNext;
+    s->selected = lssNext <= lssSub;
+  }
+  return true;
+}
+
+/* LSS requests to all nodes, from receive task */
+static void slavesCallback(void *object, void *message)
+{
+  const uint8_t *data = CO_CANrxMsg_readData(message);
+  uint32_t idNumber = CO_getUint32(&data[1]);
+  bool_t answer = false;
+  uint8_t response = 0U, error = 0U;
+  uint32_t n;
+
+  (void)object;
+  for (n = 0U; n < NODES; n++)
+  {
+    slave_t *s = &slave[n];
+
+    switch (data[0])
+    {
+    case CO_LSS_IDENT_FASTSCAN:
+      if ((s->nodeId == CO_LSS_NODE_ID_ASSIGNMENT) && fastscan(s, idNumber, data[5], data[6], data[7]))
+      {
+        answer = true;
+        response = CO_LSS_IDENT_SLAVE;
+      }
+      break;
+    case CO_LSS_CFG_NODE_ID:
+      if (s->selected)
+      {
+        answer = true;
+        response = CO_LSS_CFG_NODE_ID;
+        error = ((data[1] >= 1U) && (data[1] <= 127U)) ? 0U : 1U;
+        s->nodeId = (error == 0U) ? data[1] : s->nodeId;
+      }
+      break;
+    case CO_LSS_CFG_STORE:
+      if (s->selected)
+      {
+        answer = true;
+        response = CO_LSS_CFG_STORE;
+        s->stored = true;
+      }
+      break;
+    case CO_LSS_SWITCH_STATE_GLOBAL:
+      s->selected = s->selected && (data[1] != 0U);
+      break;
+    default:
+      break;
+    }
+  }
+  if (answer)
+  {
+    memset(slavesTx[0].data, 0, sizeof(slavesTx[0].data));
+    slavesTx[0].data[0] = response;
+    slavesTx[0].data[1] = error;
+    CO_CANsend(&slaves, &slavesTx[0]);
+  }
+}
+
+/* Node with found address, or NULL */
+static const slave_t *slaveOf(const CO_LSS_address_t *address)
+{
+  uint32_t n;
+
+  for (n = 0U; n < NODES; n++)
+  {
+    const CO_LSS_address_t *a = &slave[n].address;
+
+    if ((a->identity.vendorID == address->identity.vendorID) &&
+        (a->identity.productCode == address->identity.productCode) &&
+        (a->identity.serialNumber == address->identity.serialNumber))
+    {
+      return &slave[n];
+    }
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 1.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *masterNode, *slavesNode;
+  CO_LSSmaster_fastscan_t scan = {
+    .scan = {CO_LSSmaster_FS_MATCH, CO_LSSmaster_FS_MATCH, CO_LSSmaster_FS_SKIP, CO_LSSmaster_FS_SCAN}};
+  CO_LSSmaster_return_t ret = CO_LSSmaster_WAIT_SLAVE;
+  uint32_t seed = 23U, timerNext_us = 0U, wakes = 0U, verified = 0U, duplicate = 0U, i, k;
+  int64_t start, last, took;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  for (i = 0U; i < NODES; i++)
+  {
+    slave[i].address.identity.vendorID = VENDOR;
+    slave[i].address.identity.productCode = PRODUCT;
+    slave[i].address.identity.revisionNumber = i % 3U;
+    slave[i].address.identity.serialNumber = CO_hostTest_random(&seed);
+    slave[i].nodeId = CO_LSS_NODE_ID_ASSIGNMENT;
+  }
+  scan.match.identity.vendorID = VENDOR;
+  scan.match.identity.productCode = PRODUCT;
+
+  bus = CO_hostBus_create(&config);
+  slavesNode = CO_hostNode_create(bus, "slaves");
+  masterNode = CO_hostNode_create(bus, "master");
+
+  CO_hostNode_bind(slavesNode);
+  CO_CANmodule_init(&slaves, NULL, slavesRx, 1U, slavesTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&slaves, 0U, CO_CAN_ID_LSS_MST, 0x07FFU, false, &slaves, slavesCallback);
+  CO_CANtxBufferInit(&slaves, 0U, CO_CAN_ID_LSS_SLV, false, 8U, false);
+  CO_CANsetNormalMode(&slaves);
+  CO_CANrxTaskStart(&slaves);
+
+  CO_hostNode_bind(masterNode);
+  CO_CANmodule_init(&master, NULL, masterRx, 1U, masterTx, 1U, BITRATE);
+  CO_LSSmaster_init(&LSSmaster, 1000U, &master, 0U, CO_CAN_ID_LSS_SLV, &master, 0U, CO_CAN_ID_LSS_MST);
+  CO_CANsetNormalMode(&master);
+  CO_CANrxTaskStart(&master);
+
+  CO_HOST_TEST_CHECK(CO_LSSassign_init(&assign, &LSSmaster, &scan, FIRST_NODE_ID, 127U, true, found,
+                                       NODES + 4U) == CO_ERROR_NO,
+                     "init failed");
+  start = esp_timer_get_time();
+  last = start;
+  while ((ret == CO_LSSmaster_WAIT_SLAVE) && ((last - start) < TIMEOUT_US))
+  {
+    int64_t now;
+
+    CO_CANwait(&master, timerNext_us);
+    CO_CANmodule_process(&master);
+    wakes++;
+    now = esp_timer_get_time();
+    timerNext_us = 100000U;
+    ret = CO_LSSassign_process(&assign, (uint32_t)(now - last), &timerNext_us);
+    last = now;
+  }
+  took = esp_timer_get_time() - start;
+
+  for (i = 0U; i < assign.nodesCount; i++)
+  {
+    const slave_t *s = slaveOf(&found[i].address);
+
+    verified += ((s != NULL) && (s->nodeId == found[i].nodeId) && s->stored) ? 1U : 0U;
+  }
+  for (i = 0U; i < NODES; i++)
+  {
+    for (k = i + 1U; k < NODES; k++)
+    {
+      duplicate += (slave[i].nodeId == slave[k].nodeId) ? 1U : 0U;
+    }
+  }
+  CO_HOST_TEST_CHECK(ret == CO_LSSmaster_OK, "assignment ended with %d", (int)ret);
+  CO_HOST_TEST_CHECK((assign.nodesCount == NODES) && (verified == NODES), "%u of %u nodes found, %u verified",
+                     assign.nodesCount, NODES, (unsigned int)verified);
+  CO_HOST_TEST_CHECK(duplicate == 0U, "%u duplicate node-IDs", (unsigned int)duplicate);
+  printf("%u nodes assigned in %lld ms, %.1f ms per node, %u failures, %u wake ups\n", assign.nodesCount,
+         (long long)(took / 1000), (double)took / 1000.0 / NODES, (unsigned int)assign.failures,
+         (unsigned int)wakes);
+
+  CO_CANrxTaskStop(&master);
+  CO_CANmodule_disable(&master);
+  CO_hostNode_bind(slavesNode);
+  CO_CANrxTaskStop(&slaves);
+  CO_CANmodule_disable(&slaves);
+  CO_hostNode_delete(masterNode);
+  CO_hostNode_delete(slavesNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,369 @@
+/*
+ * Host test of network configuration manager with ESP32 TWAI driver.
+ *
+ * @file        test_netConfig.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Manager node configures NODES nodes with CHANNELS SDO clients at 500 kbit/s
+ * in real time, each node has ENTRIES expedited entries (PDO mapping) and one
+ * segmented domain. Nodes are emulated by one CAN module with SDO server
+ * protocol, each node answers after its own delay of 1 to 5 ms.
+ * - All nodes get all entries and are started with NMT command.
+ * - Node 13 loses its first two requests, entry is repeated.
+ * - Node 42 rejects one entry, it fails with server's abort code and is not
+ *   started, other nodes are not affected.
+ * - Nodes fail without crash, when SDO client setup fails, also node with
+ *   empty script. */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+#include "CO_netConfig.h"
+#include "OD.h"
+
+#if !(((CO_CONFIG_SDO_CLI) & CO_CONFIG_SDO_CLI_ENABLE) && ((CO_CONFIG_NMT) & CO_CONFIG_NMT_MASTER))
+#error test_netConfig requires SDO client and NMT master
+#endif
+
+#define BITRATE 500U
+#define NODES 60U
+#define CHANNELS 8U
+#define ENTRIES 48U
+#define LOSSY_NODE 13U
+#define REJECTING_NODE 42U
+/* 0x1A00:05 */
+#define REJECTED_ENTRY 29U
+#define REJECT_CODE 0x06090030UL
+#define TIMEOUT_US 60000000
+
+/* Emulated node */
+typedef struct
+{
+  uint8_t request[8];
+  bool_t pending;
+  int64_t due;
+  uint32_t delay_us;
+  uint32_t lost;
+  uint8_t toggle;
+  size_t segmented;
+  uint32_t written;
+  bool_t started;
+} slave_t;
+
+static CO_CANmodule_t manager, slaves;
+static CO_CANrx_t managerRx[CHANNELS], slavesRx[2];
+static CO_CANtx_t managerTx[CHANNELS + 1U], slavesTx[NODES];
+static CO_SDOclient_t clients[CHANNELS + 1U];
+static CO_NMT_t NMT;
+static CO_netConfig_t netConfig;
+static CO_netConfigNode_t nodes[NODES];
+static CO_netConfigEntry_t scripts[NODES][ENTRIES + 1U];
+static uint8_t domain[64];
+static slave_t slave[NODES + 1U];
+static portMUX_TYPE slaveLock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool_t stop;
+
+/* SDO request of any node, from receive task */
+static void slaveCallback(void *object, void *message)
+{
+  const CO_CANrxMsg_t *rxMsg = (const CO_CANrxMsg_t *)message;
+  uint32_t nodeId = rxMsg->msg.identifier - CO_CAN_ID_SDO_CLI;
+  int64_t now = esp_timer_get_time();
+  slave_t *s;
+
+  (void)object;
+  /* abort from client has no response */
+  if ((nodeId < 1U) || (nodeId > NODES) || (rxMsg->msg.data[0] == 0x80U))
+  {
+    return;
+  }
+  s = &slave[nodeId];
+  portENTER_CRITICAL(&slaveLock);
+  if (s->lost > 0U)
+  {
+    s->lost--;
+  }
+  else
+  {
+    memcpy(s->request, rxMsg->msg.data, sizeof(s->request));
+    s->pending = true;
+    s->due = now + s->delay_us;
+  }
+  portEXIT_CRITICAL(&slaveLock);
+}
+
+static void nmtCallback(void *object, void *message)
+{
+  const CO_CANrxMsg_t *rxMsg = (const CO_CANrxMsg_t *)message;
+  uint8_t nodeId = rxMsg->msg.data[1];
+
+  (void)object;
+  if ((rxMsg->msg.data[0] == CO_NMT_ENTER_OPERATIONAL) && (nodeId >= 1U) && (nodeId <= NODES))
+  {
+    portENTER_CRITICAL(&slaveLock);
+    slave[nodeId].started = true;
+    portEXIT_CRITICAL(&slaveLock);
+  }
+}
+
+/* SDO server response of the node to download request */
+static bool_t slaveResponse(uint32_t nodeId, const uint8_t *request, uint8_t *response)
+{
+  slave_t *s = &slave[nodeId];
+  uint8_t command = request[0];
+
+  memset(response, 0, 8U);
+  if ((command & 0xE0U) == 0x20U)
+  {
+    uint16_t index = (uint16_t)(request[1] | ((uint16_t)request[2] << 8));
+
+    memcpy(&response[1], &request[1], 3U);
+    if ((nodeId == REJECTING_NODE) && (index == 0x1A00U) && (request[3] == 5U))
+    {
+      uint32_t abortCode = REJECT_CODE;
+
+      response[0] = 0x80U;
+      memcpy(&response[4], &abortCode, sizeof(abortCode));
+      return true;
+    }
+    response[0] = 0x60U;
+    s->toggle = 0U;
+    s->segmented = 0U;
+    s->written += ((command & 0x02U) != 0U) ? 1U : 0U;
+    return true;
+  }
+  if ((command & 0xE0U) == 0x00U)
+  {
+    uint8_t toggle = (command >> 4) & 1U;
+
+    if (toggle == s->toggle)
+    {
+      s->segmented += 7U - ((command >> 1) & 7U);
+      s->toggle ^= 1U;
+      if (((command & 0x01U) != 0U) && (s->segmented == sizeof(domain)))
+      {
+        s->written++;
+      }
+    }
+    response[0] = (uint8_t)(0x20U | (toggle << 4));
+    return true;
+  }
+  return false;
+}
+
+static void slavesTask(void *arg)
+{
+  (void)arg;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    int64_t now = esp_timer_get_time();
+    uint32_t n;
+
+    for (n = 1U; n <= NODES; n++)
+    {
+      uint8_t request[8];
+      bool_t due = false;
+
+      portENTER_CRITICAL(&slaveLock);
+      if (slave[n].pending && (now >= slave[n].due))
+      {
+        memcpy(request, slave[n].request, sizeof(request));
+        slave[n].pending = false;
+        due = true;
+      }
+      portEXIT_CRITICAL(&slaveLock);
+      if (due && slaveResponse(n, request, slavesTx[n - 1U].data))
+      {
+        CO_CANsend(&slaves, &slavesTx[n - 1U]);
+      }
+    }
+    CO_CANmodule_process(&slaves);
+    vTaskDelay(1);
+  }
+  __atomic_store_n(&stop, false, __ATOMIC_RELEASE);
+  vTaskDelete(NULL);
+}
+
+static void scriptsInit(void)
+{
+  uint32_t n, e;
+
+  for (e = 0U; e < sizeof(domain); e++)
+  {
+    domain[e] = (uint8_t)e;
+  }
+  for (n = 0U; n < NODES; n++)
+  {
+    for (e = 0U; e < ENTRIES; e++)
+    {
+      CO_netConfigEntry_t *entry = &scripts[n][e];
+
+      entry->index = (uint16_t)(((e < (ENTRIES / 2U)) ? 0x1600U : 0x1A00U) + ((e / 8U) % 3U));
+      entry->subIndex = (uint8_t)(e % 8U);
+      entry->value = 0x60000010UL + e;
+      entry->size = 4U;
+    }
+    scripts[n][ENTRIES].index = 0x2000U;
+    scripts[n][ENTRIES].data = domain;
+    scripts[n][ENTRIES].size = sizeof(domain);
+    nodes[n].nodeId = (uint8_t)(n + 1U);
+    nodes[n].script = scripts[n];
+    nodes[n].scriptCount = ENTRIES + 1U;
+    slave[n + 1U].delay_us = 1000U + (((n + 1U) * 397U) % 4000U);
+  }
+  slave[LOSSY_NODE].lost = 2U;
+}
+
+static void configure(void)
+{
+  uint32_t timerNext_us = 0U, done = 0U, written = 0U, started = 0U, n;
+  int64_t start, last, took;
+  bool_t rejectedStarted;
+
+  CO_HOST_TEST_CHECK(CO_netConfig_init(&netConfig, clients, CHANNELS, &NMT, &manager, nodes, NODES) == CO_ERROR_NO,
+                     "init failed");
+  start = esp_timer_get_time();
+  last = start;
+  CO_netConfig_start(&netConfig);
+  for (;;)
+  {
+    int64_t now;
+
+    CO_CANwait(&manager, timerNext_us);
+    CO_CANmodule_process(&manager);
+    now = esp_timer_get_time();
+    timerNext_us = 100000U;
+    if ((CO_netConfig_process(&netConfig, (uint32_t)(now - last), &timerNext_us) == 0U) ||
+        ((now - start) > TIMEOUT_US))
+    {
+      break;
+    }
+    last = now;
+  }
+  took = esp_timer_get_time() - start;
+  vTaskDelay(pdMS_TO_TICKS(20));
+
+  portENTER_CRITICAL(&slaveLock);
+  for (n = 0U; n < NODES; n++)
+  {
+    if (nodes[n].nodeId == REJECTING_NODE)
+    {
+      continue;
+    }
+    done += (nodes[n].state == CO_NET_CONFIG_DONE) ? 1U : 0U;
+    written += (slave[n + 1U].written == (ENTRIES + 1U)) ? 1U : 0U;
+    started += slave[n + 1U].started ? 1U : 0U;
+  }
+  rejectedStarted = slave[REJECTING_NODE].started;
+  portEXIT_CRITICAL(&slaveLock);
+  CO_HOST_TEST_CHECK(netConfig.pending == 0U, "%u nodes pending after %lld ms", (unsigned int)netConfig.pending,
+                     (long long)(took / 1000));
+  CO_HOST_TEST_CHECK((done == (NODES - 1U)) && (written == (NODES - 1U)) && (started == (NODES - 1U)),
+                     "%u of %u nodes done, %u with all entries, %u started", (unsigned int)done, NODES - 1U,
+                     (unsigned int)written, (unsigned int)started);
+  CO_HOST_TEST_CHECK((nodes[REJECTING_NODE - 1U].state == CO_NET_CONFIG_FAILED) &&
+                         (nodes[REJECTING_NODE - 1U].abortCode == REJECT_CODE) &&
+                         (nodes[REJECTING_NODE - 1U].entry == REJECTED_ENTRY) && !rejectedStarted,
+                     "node %u: state %u, abort code %08X, entry %u", REJECTING_NODE,
+                     (unsigned int)nodes[REJECTING_NODE - 1U].state,
+                     (unsigned int)nodes[REJECTING_NODE - 1U].abortCode,
+                     (unsigned int)nodes[REJECTING_NODE - 1U].entry);
+  CO_HOST_TEST_CHECK(netConfig.retries == 2U, "%u retries", (unsigned int)netConfig.retries);
+  printf("%u nodes x %u entries with %u channels configured in %lld ms, %u retries\n", NODES, ENTRIES + 1U,
+         CHANNELS, (long long)(took / 1000), (unsigned int)netConfig.retries);
+}
+
+/* Client on rx buffer, which does not exist, so its setup fails */
+static void setupFailure(void)
+{
+  static CO_netConfig_t broken;
+  CO_netConfigNode_t brokenNodes[2] = {{.nodeId = 1U, .script = NULL, .scriptCount = 0U},
+                                       {.nodeId = 2U, .script = scripts[1], .scriptCount = ENTRIES + 1U}};
+  uint32_t errInfo = 0U, timerNext_us = 0U;
+  uint8_t pending;
+
+  (void)CO_SDOclient_init(&clients[CHANNELS], OD, OD_ENTRY_H1280, 1U, &manager, CHANNELS, &manager, CHANNELS,
+                          &errInfo);
+  CO_HOST_TEST_CHECK(CO_netConfig_init(&broken, &clients[CHANNELS], 1U, &NMT, NULL, brokenNodes, 2U) == CO_ERROR_NO,
+                     "init failed");
+  CO_netConfig_start(&broken);
+  pending = CO_netConfig_process(&broken, 0U, &timerNext_us);
+  CO_HOST_TEST_CHECK((pending == 0U) && (brokenNodes[0].state == CO_NET_CONFIG_FAILED) &&
+                         (brokenNodes[1].state == CO_NET_CONFIG_FAILED) &&
+                         (brokenNodes[0].abortCode == CO_SDO_AB_GENERAL),
+                     "%u pending, states %u and %u after setup failure", pending, (unsigned int)brokenNodes[0].state,
+                     (unsigned int)brokenNodes[1].state);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 1.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *managerNode, *slavesNode;
+  uint32_t errInfo = 0U;
+  uint16_t i;
+
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  scriptsInit();
+  bus = CO_hostBus_create(&config);
+  slavesNode = CO_hostNode_create(bus, "slaves");
+  managerNode = CO_hostNode_create(bus, "manager");
+
+  CO_hostNode_bind(slavesNode);
+  CO_CANmodule_init(&slaves, NULL, slavesRx, 2U, slavesTx, NODES, BITRATE);
+  CO_CANrxBufferInit(&slaves, 0U, CO_CAN_ID_SDO_CLI, 0x0780U, false, &slaves, slaveCallback);
+  CO_CANrxBufferInit(&slaves, 1U, CO_CAN_ID_NMT_SERVICE, 0x07FFU, false, &slaves, nmtCallback);
+  for (i = 0U; i < NODES; i++)
+  {
+    CO_CANtxBufferInit(&slaves, i, (uint16_t)(CO_CAN_ID_SDO_SRV + i + 1U), false, 8U, false);
+  }
+  CO_CANsetNormalMode(&slaves);
+  CO_CANrxTaskStart(&slaves);
+  xTaskCreate(slavesTask, "slaves", 4096, NULL, 5, NULL);
+
+  /* NMT master sends commands as CO_NMT_init() configures it */
+  CO_hostNode_bind(managerNode);
+  CO_CANmodule_init(&manager, NULL, managerRx, CHANNELS, managerTx, CHANNELS + 1U, BITRATE);
+  for (i = 0U; i < CHANNELS; i++)
+  {
+    CO_SDOclient_init(&clients[i], OD, OD_ENTRY_H1280, 1U, &manager, i, &manager, i, &errInfo);
+  }
+  NMT.NMT_CANdevTx = &manager;
+  NMT.NMT_TXbuff = CO_CANtxBufferInit(&manager, CHANNELS, CO_CAN_ID_NMT_SERVICE, false, 2U, false);
+  CO_CANsetNormalMode(&manager);
+  CO_CANrxTaskStart(&manager);
+
+  configure();
+  setupFailure();
+
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    vTaskDelay(1);
+  }
+  CO_CANrxTaskStop(&manager);
+  CO_CANmodule_disable(&manager);
+  CO_hostNode_bind(slavesNode);
+  CO_CANrxTaskStop(&slaves);
+  CO_CANmodule_disable(&slaves);
+  CO_hostNode_delete(managerNode);
+  CO_hostNode_delete(slavesNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,210 @@
+/*
+ * Host test of batch receive of ESP32 TWAI driver.
+ *
+ * @file        test_rxBatch.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Receiver node has no receive task, frames are taken by the test.
+ * - CANreceiveBatch() processes queued frames up to budget and returns their
+ *   number. On quiet bus it returns 0 after timeout, also after timeout
+ *   longer than CO_CAN_RX_WAIT_MS, and it returns early, when a frame arrives
+ *   during the wait.
+ * - Benchmark: bursts of frames are queued in TWAI receive queue (its
+ *   default length is 5), then processed by CANreceive() per frame or by one
+ *   CANreceiveBatch(). CPU time per frame and frames/s are printed. */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define RX_BUFFERS 8U
+#define BURST_MAX 5U
+#define BENCH_BURSTS 1000U
+
+static CO_CANmodule_t sender, receiver;
+static CO_CANrx_t senderRx[1], receiverRx[RX_BUFFERS];
+static CO_CANtx_t senderTx[RX_BUFFERS], receiverTx[1];
+static CO_hostNode_t *senderNode, *receiverNode;
+static uint32_t calls;
+
+static void rxCallback(void *object, void *message)
+{
+  (void)object;
+  (void)message;
+  calls++;
+}
+
+/* Send count frames from sender and wait until they are in TWAI receive
+ * queue of receiver. Calling task is bound to receiver after return. */
+static bool_t queueFrames(uint16_t count)
+{
+  twai_status_info_t status = {0};
+  TickType_t start;
+  uint16_t i;
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_process(&sender);
+  for (i = 0U; i < count; i++)
+  {
+    CO_CANsend(&sender, &senderTx[i % RX_BUFFERS]);
+  }
+  CO_hostNode_bind(receiverNode);
+  start = xTaskGetTickCount();
+  while ((twai_get_status_info(&status) == ESP_OK) && (status.msgs_to_rx < count) &&
+         ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(1000)))
+  {
+    vTaskDelay(0);
+  }
+  return status.msgs_to_rx == count;
+}
+
+/* Task bound to sender sends one frame after 20 ms */
+static void lateSender(void *arg)
+{
+  (void)arg;
+  vTaskDelay(pdMS_TO_TICKS(20));
+  CO_CANsend(&sender, &senderTx[0]);
+  vTaskDelete(NULL);
+}
+
+static void semantics(void)
+{
+  uint16_t n;
+  int64_t start, waited;
+
+  CO_HOST_TEST_CHECK(queueFrames(BURST_MAX), "frames not queued");
+  calls = 0U;
+  n = CANreceiveBatch(&receiver, 0U, 3U);
+  CO_HOST_TEST_CHECK((n == 3U) && (calls == 3U), "budget 3: %u processed, %u callbacks", n, (unsigned int)calls);
+  n = CANreceiveBatch(&receiver, 0U, 16U);
+  CO_HOST_TEST_CHECK((n == BURST_MAX - 3U) && (calls == BURST_MAX), "rest: %u processed, %u callbacks", n,
+                     (unsigned int)calls);
+
+  start = esp_timer_get_time();
+  n = CANreceiveBatch(&receiver, 0U, 16U);
+  waited = esp_timer_get_time() - start;
+  CO_HOST_TEST_CHECK((n == 0U) && (waited < 5000), "timeout 0: %u processed in %lld us", n, (long long)waited);
+
+  /* longer than one wait slice */
+  start = esp_timer_get_time();
+  n = CANreceiveBatch(&receiver, 3U * CO_CAN_RX_WAIT_MS + 5U, 16U);
+  waited = esp_timer_get_time() - start;
+  CO_HOST_TEST_CHECK((n == 0U) && (waited >= (3 * CO_CAN_RX_WAIT_MS + 4) * 1000) &&
+                         (waited < (4 * CO_CAN_RX_WAIT_MS + 25) * 1000),
+                     "timeout %u ms: %u processed in %lld us", 3U * CO_CAN_RX_WAIT_MS + 5U, n, (long long)waited);
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_process(&sender);
+  xTaskCreate(lateSender, "lateSender", 4096, NULL, 5, NULL);
+  CO_hostNode_bind(receiverNode);
+  start = esp_timer_get_time();
+  n = CANreceiveBatch(&receiver, 1000U, 16U);
+  waited = esp_timer_get_time() - start;
+  CO_HOST_TEST_CHECK((n == 1U) && (waited >= 19000) && (waited < 200000), "frame during wait: %u processed in %lld us",
+                     n, (long long)waited);
+}
+
+static void benchmark(void)
+{
+  uint16_t burst;
+
+  for (burst = 1U; burst <= BURST_MAX; burst++)
+  {
+    int64_t singleNs = 0, batchNs = 0, start;
+    uint32_t singleFrames = 0U, batchFrames = 0U, batchCalls = 0U;
+    uint32_t i;
+
+    calls = 0U;
+    for (i = 0U; i < BENCH_BURSTS; i++)
+    {
+      uint16_t n;
+
+      if (!queueFrames(burst))
+      {
+        break;
+      }
+      start = CO_hostTest_cpuNs();
+      for (n = 0U; n < burst; n++)
+      {
+        CANreceive(&receiver);
+      }
+      singleNs += CO_hostTest_cpuNs() - start;
+      singleFrames += burst;
+
+      if (!queueFrames(burst))
+      {
+        break;
+      }
+      start = CO_hostTest_cpuNs();
+      batchFrames += CANreceiveBatch(&receiver, 0U, CO_CAN_RX_BATCH);
+      batchNs += CO_hostTest_cpuNs() - start;
+      batchCalls++;
+    }
+    CO_HOST_TEST_CHECK((singleFrames == (BENCH_BURSTS * burst)) && (batchFrames == singleFrames) &&
+                           (calls == (singleFrames + batchFrames)),
+                       "burst %u: %u and %u frames processed, %u callbacks", burst, (unsigned int)singleFrames,
+                       (unsigned int)batchFrames, (unsigned int)calls);
+    printf("burst of %u: CANreceive() %.0f ns/frame (%.2f M frames/s), CANreceiveBatch() %.0f ns/frame "
+           "(%.2f M frames/s), %.1f frames per call\n",
+           burst, (double)singleNs / singleFrames, (double)singleFrames * 1e3 / (double)singleNs,
+           (double)batchNs / batchFrames, (double)batchFrames * 1e3 / (double)batchNs,
+           (double)batchFrames / batchCalls);
+  }
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 0.0};
+  CO_hostBus_t *bus;
+  uint16_t i;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  receiverNode = CO_hostNode_create(bus, "receiver");
+  senderNode = CO_hostNode_create(bus, "sender");
+
+  CO_hostNode_bind(receiverNode);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, RX_BUFFERS, receiverTx, 1U, 1000U);
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, RX_BUFFERS, 1000U);
+  for (i = 0U; i < RX_BUFFERS; i++)
+  {
+    /* RPDOs of node 1, one of them as remote frame */
+    uint16_t ident = (uint16_t)(0x201U + (i * 0x100U % 0x400U) + (i / 4U));
+
+    CO_CANtxBufferInit(&sender, i, ident, i == (RX_BUFFERS - 1U), 8U, false);
+    CO_hostNode_bind(receiverNode);
+    CO_CANrxBufferInit(&receiver, i, ident, 0x07FFU, i == (RX_BUFFERS - 1U), &calls, rxCallback);
+    CO_hostNode_bind(senderNode);
+  }
+  CO_CANsetNormalMode(&sender);
+  CO_hostNode_bind(receiverNode);
+  CO_CANsetNormalMode(&receiver);
+
+  semantics();
+  benchmark();
+
+  CO_CANmodule_disable(&receiver);
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(receiverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
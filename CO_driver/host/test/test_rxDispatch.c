@@ -0,0 +1,318 @@
+/*
+ * Host test of rx callbacks and concurrent rx buffer reconfiguration of ESP32
+ * TWAI driver.
+ *
+ * @file        test_rxDispatch.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CO_CAN_RAW_RANGES. Receiver node runs receive task, its rx and
+ * raw callbacks answer each request with CO_CANsend() and yield, as LSS slave
+ * fastscan response does. Host RTOS aborts the test, if anything, which may
+ * block, is called inside critical section.
+ * - Callback reconfigures its own rx buffer.
+ * - Stress: sender task sends requests, mainline meanwhile switches rx buffers
+ *   and raw range between two objects. Object is retired, when
+ *   CO_CANrxBufferInit() or CO_CANrawRangeRemove() returns, its callback must
+ *   not run after that. Every accepted answer reaches the sender. */
+
+#include "301/CO_driver.h"
+#include "CO_CANraw.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if !CO_CAN_RAW_RANGES
+#error test_rxDispatch requires CO_CAN_RAW_RANGES
+#endif
+
+#define BUFFERS 8U
+#define SELF_INDEX BUFFERS
+#define SELF_IDENT 0x0F0U
+#define ANSWER_IDENT 0x7E4U
+#define RAW_FIRST 0x10000000UL
+#define RAW_LAST 0x100000FFUL
+#define RAW_KEEP 0x1FFFFFFFUL
+#define STRESS_MS 1000U
+
+typedef struct
+{
+  uint32_t ident;
+  bool_t retired;
+} rxObject_t;
+
+static CO_CANmodule_t sender, receiver;
+static CO_CANrx_t senderRx[1], receiverRx[BUFFERS + 1U];
+static CO_CANtx_t senderTx[1], receiverTx[1];
+static CO_hostNode_t *senderNode, *receiverNode;
+static rxObject_t objects[BUFFERS][2], rawObjects[2], selfObject;
+static CO_hostTestRecorder_t answers = {NULL, 0U, 0U};
+/* written by receive task only */
+static uint32_t calls, rawCalls, selfCalls, stale, accepted;
+static volatile bool_t stop;
+
+/* Object is retired by main task and checked by its callback */
+static bool_t isRetired(const rxObject_t *rxObject)
+{
+  return __atomic_load_n(&rxObject->retired, __ATOMIC_ACQUIRE);
+}
+
+static void retire(rxObject_t *rxObject, bool_t retired)
+{
+  __atomic_store_n(&rxObject->retired, retired, __ATOMIC_RELEASE);
+}
+
+static uint32_t identOf(uint16_t index, uint16_t k)
+{
+  return ((k == 0U) ? 0x181U : 0x281U) + index;
+}
+
+/* Answer from receive task, TWAI queue or tx buffer takes it */
+static void answer(void)
+{
+  if (CO_CANsend(&receiver, &receiverTx[0]) == CO_ERROR_NO)
+  {
+    accepted++;
+  }
+}
+
+static void rxCallback(void *object, void *message)
+{
+  rxObject_t *rxObject = (rxObject_t *)object;
+  const CO_CANrxMsg_t *rxMsg = (const CO_CANrxMsg_t *)message;
+
+  if (isRetired(rxObject) || (rxMsg->msg.identifier != rxObject->ident))
+  {
+    stale++;
+  }
+  /* reconfiguration must wait for the callback */
+  vTaskDelay(0);
+  if (isRetired(rxObject))
+  {
+    stale++;
+  }
+  answer();
+  calls++;
+}
+
+static void rawCallback(void *object, const CO_CANrxMsg_t *message)
+{
+  rxObject_t *rxObject = (rxObject_t *)object;
+
+  if (isRetired(rxObject) || (message->msg.identifier < RAW_FIRST) || (message->msg.identifier > RAW_LAST))
+  {
+    stale++;
+  }
+  vTaskDelay(0);
+  if (isRetired(rxObject))
+  {
+    stale++;
+  }
+  answer();
+  rawCalls++;
+}
+
+/* Callback, which configures its own rx buffer again */
+static void selfCallback(void *object, void *message)
+{
+  (void)message;
+  CO_CANrxBufferInit(&receiver, SELF_INDEX, SELF_IDENT, 0x07FFU, false, object, selfCallback);
+  answer();
+  __atomic_store_n(&selfCalls, selfCalls + 1U, __ATOMIC_RELEASE);
+}
+
+/* Request from sender node, directly to its TWAI */
+static bool_t request(uint32_t ident, bool_t extended, TickType_t ticks)
+{
+  twai_message_t msg = {0};
+
+  msg.identifier = ident;
+  msg.flags = extended ? TWAI_MSG_FLAG_EXTD : TWAI_MSG_FLAG_NONE;
+  msg.data_length_code = 1U;
+  return twai_transmit(&msg, ticks) == ESP_OK;
+}
+
+static void senderTask(void *arg)
+{
+  uint32_t n = 0U;
+
+  (void)arg;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    uint16_t index = (uint16_t)(n % BUFFERS);
+    bool_t sent;
+
+    if ((n % 4U) == 3U)
+    {
+      sent = request(RAW_FIRST + (n & 0xFFU), true, pdMS_TO_TICKS(1));
+    }
+    else
+    {
+      sent = request(identOf(index, (uint16_t)((n / BUFFERS) % 2U)), false, pdMS_TO_TICKS(1));
+    }
+    n += sent ? 1U : 0U;
+    CO_CANmodule_process(&sender);
+    vTaskDelay(0);
+  }
+  __atomic_store_n(&stop, false, __ATOMIC_RELEASE);
+  vTaskDelete(NULL);
+}
+
+static void switchBuffer(uint16_t index, uint16_t k)
+{
+  rxObject_t *next = &objects[index][k];
+  rxObject_t *old = &objects[index][1U - k];
+
+  retire(next, false);
+  CO_CANrxBufferInit(&receiver, index, (uint16_t)next->ident, 0x07FFU, false, next, rxCallback);
+  retire(old, true);
+}
+
+static void switchRaw(uint16_t k)
+{
+  CO_CANrawRangeRemove(&receiver, RAW_FIRST);
+  retire(&rawObjects[1U - k], true);
+  retire(&rawObjects[k], false);
+  CO_CANrawRangeAdd(&receiver, RAW_FIRST, RAW_LAST, &rawObjects[k], rawCallback);
+}
+
+/* Wait until answers to all accepted requests are received */
+static bool_t answersWait(void)
+{
+  TickType_t start = xTaskGetTickCount();
+
+  while ((__atomic_load_n(&answers.count, __ATOMIC_ACQUIRE) < __atomic_load_n(&accepted, __ATOMIC_ACQUIRE)) &&
+         ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(1000)))
+  {
+    CO_CANmodule_process(&receiver);
+    vTaskDelay(1);
+  }
+  return answers.count == accepted;
+}
+
+static void self(void)
+{
+  TickType_t start = xTaskGetTickCount();
+  uint32_t i;
+
+  CO_hostNode_bind(senderNode);
+  for (i = 0U; i < 2U; i++)
+  {
+    request(SELF_IDENT, false, portMAX_DELAY);
+  }
+  CO_hostNode_bind(receiverNode);
+  while ((__atomic_load_n(&selfCalls, __ATOMIC_ACQUIRE) < 2U) &&
+         ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(1000)))
+  {
+    vTaskDelay(1);
+  }
+  CO_HOST_TEST_CHECK(__atomic_load_n(&selfCalls, __ATOMIC_ACQUIRE) == 2U, "%u calls of reconfiguring callback",
+                     (unsigned int)__atomic_load_n(&selfCalls, __ATOMIC_ACQUIRE));
+  CO_HOST_TEST_CHECK(answersWait(), "%u of %u answers", (unsigned int)answers.count, (unsigned int)accepted);
+}
+
+static void stress(void)
+{
+  uint32_t switches = 0U, rawSwitches = 0U;
+  int64_t start;
+
+  __atomic_store_n(&stop, false, __ATOMIC_RELEASE);
+  CO_hostNode_bind(senderNode);
+  xTaskCreate(senderTask, "sender", 4096, NULL, 5, NULL);
+  CO_hostNode_bind(receiverNode);
+
+  start = esp_timer_get_time();
+  while ((esp_timer_get_time() - start) < ((int64_t)STRESS_MS * 1000))
+  {
+    uint16_t index = (uint16_t)(switches % BUFFERS);
+
+    switchBuffer(index, (uint16_t)((switches / BUFFERS) % 2U));
+    switches++;
+    if ((switches % 64U) == 0U)
+    {
+      switchRaw((uint16_t)(rawSwitches % 2U));
+      rawSwitches++;
+    }
+    CO_CANmodule_process(&receiver);
+    vTaskDelay(0);
+  }
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    vTaskDelay(1);
+  }
+
+  CO_HOST_TEST_CHECK(answersWait(), "%u of %u answers", (unsigned int)answers.count, (unsigned int)accepted);
+  CO_HOST_TEST_CHECK((calls > 0U) && (rawCalls > 0U), "%u rx callbacks, %u raw callbacks", (unsigned int)calls,
+                     (unsigned int)rawCalls);
+  CO_HOST_TEST_CHECK(stale == 0U, "%u callbacks for replaced object", (unsigned int)stale);
+  printf("%u rx buffer and %u raw range switches, %u rx and %u raw callbacks, %u answers\n", (unsigned int)switches,
+         (unsigned int)rawSwitches, (unsigned int)calls, (unsigned int)rawCalls, (unsigned int)answers.count);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 0.0};
+  CO_hostBus_t *bus;
+  uint16_t i;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  receiverNode = CO_hostNode_create(bus, "receiver");
+  senderNode = CO_hostNode_create(bus, "sender");
+
+  for (i = 0U; i < BUFFERS; i++)
+  {
+    objects[i][0].ident = identOf(i, 0U);
+    objects[i][1].ident = identOf(i, 1U);
+    objects[i][1].retired = true;
+  }
+  rawObjects[1].retired = true;
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, 1U, 1000U);
+  CO_CANrxBufferInit(&sender, 0U, ANSWER_IDENT, 0x07FFU, false, &answers, CO_hostTest_record);
+  CO_CANsetNormalMode(&sender);
+  CO_CANrxTaskStart(&sender);
+
+  CO_hostNode_bind(receiverNode);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, BUFFERS + 1U, receiverTx, 1U, 1000U);
+  for (i = 0U; i < BUFFERS; i++)
+  {
+    CO_CANrxBufferInit(&receiver, i, (uint16_t)objects[i][0].ident, 0x07FFU, false, &objects[i][0], rxCallback);
+  }
+  CO_CANrxBufferInit(&receiver, SELF_INDEX, SELF_IDENT, 0x07FFU, false, &selfObject, selfCallback);
+  CO_CANtxBufferInit(&receiver, 0U, ANSWER_IDENT, false, 0U, false);
+  CO_CANrawRangeAdd(&receiver, RAW_FIRST, RAW_LAST, &rawObjects[0], rawCallback);
+  /* keeps acceptance filter open, reinstallation would drop queued answers */
+  CO_CANrawRangeAdd(&receiver, RAW_KEEP, RAW_KEEP, &rawObjects[0], rawCallback);
+  CO_CANsetNormalMode(&receiver);
+  CO_CANrxTaskStart(&receiver);
+
+  self();
+  stress();
+
+  CO_CANrxTaskStop(&receiver);
+  CO_CANmodule_disable(&receiver);
+  CO_hostNode_bind(senderNode);
+  CO_CANrxTaskStop(&sender);
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(receiverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
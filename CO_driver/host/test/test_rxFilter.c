@@ -0,0 +1,357 @@
+/*
+ * Host test of TWAI acceptance filter planned by ESP32 TWAI driver.
+ *
+ * @file        test_rxFilter.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Rx buffers and reserved range are configured randomly, filter is planned
+ * by CO_CANsetNormalMode() and opened by later CO_CANrxBufferInit(). The
+ * installed filter, evaluated as by TWAI hardware with random data bytes,
+ * must accept every standard frame, which some rx buffer accepts. Frames the
+ * planned filter accepts beyond them (false accepts) are counted and printed,
+ * also for typical CANopen slave and master. Filter opened while TWAI
+ * transmit queue is full must not lose the queued frames. */
+
+#include "301/CO_driver.h"
+#include "CO_CANraw.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define RX_MAX 32U
+#define ROUNDS 500U
+/* queued frames take longer than CANreceive() waits before reinstall */
+#define BITRATE 10U
+
+typedef struct
+{
+  uint16_t ident;
+  uint16_t mask;
+} rxModel_t;
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[RX_MAX];
+static CO_CANtx_t txArray[1];
+static rxModel_t model[RX_MAX];
+static uint16_t modelCount;
+/* range given to CO_CANrxFilterReserve(), data frames only */
+static rxModel_t reserved;
+static bool_t reservedUsed;
+static uint32_t seed = 0x0F117E55UL;
+
+static void rxCallback(void *object, void *message)
+{
+  (void)object;
+  (void)message;
+}
+
+/* Counts frames into object, from receive task */
+static void countCallback(void *object, void *message)
+{
+  uint32_t *count = (uint32_t *)object;
+
+  (void)message;
+  __atomic_store_n(count, *count + 1U, __ATOMIC_RELEASE);
+}
+
+/* Wait up to one second for count to reach value */
+static bool_t countWait(const uint32_t *count, uint32_t value)
+{
+  TickType_t start = xTaskGetTickCount();
+
+  while ((__atomic_load_n(count, __ATOMIC_ACQUIRE) < value) && ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(1000)))
+  {
+    vTaskDelay(1);
+  }
+  return __atomic_load_n(count, __ATOMIC_ACQUIRE) == value;
+}
+
+/* Acceptance of standard frame by TWAI filter, as described in ESP32
+ * technical reference manual, mask bit 1 is don't care */
+static bool_t twaiAccepts(const twai_filter_config_t *filter, uint32_t key, const uint8_t data[2], uint8_t DLC)
+{
+  uint32_t code = filter->acceptance_code;
+  uint32_t care = ~filter->acceptance_mask;
+  uint32_t ident = key & 0x07FFU;
+  uint32_t rtr = (key >> 11) & 1U;
+  uint32_t value, relevant;
+
+  if (rtr != 0U)
+  {
+    DLC = 0U;
+  }
+  if (filter->single_filter)
+  {
+    value = (ident << 21) | (rtr << 20) | ((uint32_t)data[0] << 8) | data[1];
+    relevant = 0xFFF00000UL | ((DLC > 0U) ? 0xFF00UL : 0U) | ((DLC > 1U) ? 0xFFUL : 0U);
+    return ((value ^ code) & care & relevant) == 0U;
+  }
+  value = (ident << 21) | (rtr << 20) | ((uint32_t)(data[0] >> 4) << 16) | (data[0] & 0x0FU);
+  relevant = 0xFFF00000UL | ((DLC > 0U) ? 0x000F000FUL : 0U);
+  if (((value ^ code) & care & relevant) == 0U)
+  {
+    return true;
+  }
+  value = (ident << 5) | (rtr << 4);
+  return ((value ^ code) & care & 0xFFF0UL) == 0U;
+}
+
+static bool_t modelAccepts(uint32_t key)
+{
+  uint16_t i;
+
+  for (i = 0U; i < modelCount; i++)
+  {
+    if (((key ^ model[i].ident) & model[i].mask) == 0U)
+    {
+      return true;
+    }
+  }
+  return reservedUsed && (((key ^ reserved.ident) & reserved.mask) == 0U);
+}
+
+static void configure(uint16_t index, uint16_t ident, uint16_t mask, bool_t rtr)
+{
+  CO_CANrxBufferInit(&CANmodule, index, ident, mask, rtr, &CANmodule, rxCallback);
+  model[index].ident = (uint16_t)((ident & 0x07FFU) | (rtr ? 0x0800U : 0U));
+  model[index].mask = (uint16_t)((mask & 0x07FFU) | 0x0800U);
+}
+
+static void randomConfig(uint16_t *ident, uint16_t *mask, bool_t *rtr)
+{
+  uint32_t r = CO_hostTest_random(&seed);
+
+  *ident = (uint16_t)(r & 0x07FFU);
+  switch ((r >> 11) % 16U)
+  {
+  case 0:
+    *mask = 0x0780U;
+    break;
+  case 1:
+  case 2:
+    *mask = (uint16_t)(CO_hostTest_random(&seed) | CO_hostTest_random(&seed)) & 0x07FFU;
+    break;
+  case 3:
+    *mask = 0U;
+    break;
+  default:
+    *mask = 0x07FFU;
+    break;
+  }
+  *rtr = ((r >> 16) % 16U) == 0U;
+}
+
+/* Check installed filter against model, returns number of false rejects and
+ * adds false accepts and frames not needed */
+static uint32_t checkFilter(uint32_t *falseAccepts, uint32_t *notNeeded)
+{
+  uint32_t rejects = 0U;
+  uint32_t key;
+
+  for (key = 0U; key < 0x1000U; key++)
+  {
+    uint32_t r = CO_hostTest_random(&seed);
+    uint8_t data[2] = {(uint8_t)r, (uint8_t)(r >> 8)};
+    uint8_t DLC = (uint8_t)((r >> 16) % 9U);
+    bool_t accepted = !CANmodule.useCANrxFilters || twaiAccepts(&CANmodule.rxFilter, key, data, DLC);
+
+    if (modelAccepts(key))
+    {
+      if (!accepted && (rejects++ < 5U))
+      {
+        printf("%s 0x%03X rejected, filter %s code 0x%08X mask 0x%08X\n", ((key & 0x0800U) != 0U) ? "remote" : "data",
+               (unsigned int)(key & 0x07FFU), CANmodule.rxFilter.single_filter ? "single" : "dual",
+               (unsigned int)CANmodule.rxFilter.acceptance_code, (unsigned int)CANmodule.rxFilter.acceptance_mask);
+      }
+    }
+    else
+    {
+      (*notNeeded)++;
+      if (accepted)
+      {
+        (*falseAccepts)++;
+      }
+    }
+  }
+  return rejects;
+}
+
+static void moduleInit(uint16_t rxSize)
+{
+  CO_CANmodule_init(&CANmodule, NULL, rxArray, rxSize, txArray, 1U, 500U);
+  modelCount = 0U;
+  reservedUsed = false;
+}
+
+/* Fixed configuration, prints its false accept rate */
+static void checkNamed(const char *name, const uint16_t (*config)[2], uint16_t count)
+{
+  uint32_t falseAccepts = 0U, notNeeded = 0U, rejects;
+  uint16_t i;
+
+  moduleInit(count);
+  for (i = 0U; i < count; i++)
+  {
+    configure(i, config[i][0], config[i][1], false);
+  }
+  modelCount = count;
+  CO_CANsetNormalMode(&CANmodule);
+  rejects = checkFilter(&falseAccepts, &notNeeded);
+  CO_HOST_TEST_CHECK(rejects == 0U, "%s: %u frames rejected", name, (unsigned int)rejects);
+  printf("%s: %s filter, %.1f %% of other frames accepted\n", name,
+         CANmodule.rxFilter.single_filter ? "single" : "dual", 100.0 * falseAccepts / notNeeded);
+}
+
+/* Rx buffer configured in normal mode, while TWAI transmit queue is full.
+ * Filter is opened after the queue is empty, frames queued before and the
+ * one waiting in txArray reach the peer, then the buffer receives. */
+static void openQueued(CO_hostBus_t *bus)
+{
+  static CO_CANmodule_t sender, peer;
+  static CO_CANrx_t senderRx[2], peerRx[1];
+  static CO_CANtx_t senderTx[1], peerTx[1];
+  static uint32_t senderReceived, peerReceived;
+  twai_message_t msg = {.identifier = 0x181U, .data_length_code = 8U};
+  CO_hostNode_t *senderNode = CO_hostNode_create(bus, "sender");
+  CO_hostNode_t *peerNode = CO_hostNode_create(bus, "peer");
+  uint32_t queued = 0U;
+  CO_ReturnError_t err;
+  TickType_t start;
+  bool_t deferred;
+
+  CO_hostNode_bind(peerNode);
+  CO_CANmodule_init(&peer, NULL, peerRx, 1U, peerTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&peer, 0U, 0x180U, 0x0780U, false, &peerReceived, countCallback);
+  CO_CANtxBufferInit(&peer, 0U, 0x601U, false, 8U, false);
+  CO_CANsetNormalMode(&peer);
+  CO_CANrxTaskStart(&peer);
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_init(&sender, NULL, senderRx, 2U, senderTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&sender, 0U, 0x000U, 0x07FFU, false, &senderReceived, countCallback);
+  CO_CANtxBufferInit(&sender, 0U, 0x182U, false, 8U, false);
+  CO_CANsetNormalMode(&sender);
+  CO_CANrxTaskStart(&sender);
+
+  while (CO_CANsendRaw(&sender, &msg) == CO_ERROR_NO)
+  {
+    queued++;
+  }
+  CO_CANsend(&sender, &senderTx[0]);
+  queued++;
+  /* 0x601 is not accepted by filter planned for NMT only */
+  err = CO_CANrxBufferInit(&sender, 1U, 0x601U, 0x07FFU, false, &senderReceived, countCallback);
+  deferred = sender.useCANrxFilters && sender.rxFilterOpen;
+  start = xTaskGetTickCount();
+  while ((sender.useCANrxFilters || (sender.CANtxCount > 0U)) && ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(1000)))
+  {
+    CO_CANmodule_process(&sender);
+    vTaskDelay(1);
+  }
+  CO_HOST_TEST_CHECK((err == CO_ERROR_NO) && deferred && !sender.useCANrxFilters,
+                     "filter %s with full transmit queue, %s after it, error %d", deferred ? "kept" : "opened",
+                     sender.useCANrxFilters ? "kept" : "opened", (int)err);
+  CO_HOST_TEST_CHECK(countWait(&peerReceived, queued), "%u of %u queued frames received",
+                     (unsigned int)__atomic_load_n(&peerReceived, __ATOMIC_ACQUIRE), (unsigned int)queued);
+
+  CO_hostNode_bind(peerNode);
+  CO_CANsend(&peer, &peerTx[0]);
+  CO_HOST_TEST_CHECK(countWait(&senderReceived, 1U), "frame of rx buffer configured in normal mode not received");
+
+  CO_CANrxTaskStop(&peer);
+  CO_CANmodule_disable(&peer);
+  CO_hostNode_bind(senderNode);
+  CO_CANrxTaskStop(&sender);
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(peerNode);
+}
+
+int main(void)
+{
+  /* CANopen slave 0x21: NMT, SYNC, TIME, SDO server, 4 RPDO, LSS */
+  static const uint16_t slave[][2] = {{0x000, 0x7FF}, {0x080, 0x7FF}, {0x100, 0x7FF}, {0x621, 0x7FF},
+                                      {0x221, 0x7FF}, {0x321, 0x7FF}, {0x421, 0x7FF}, {0x521, 0x7FF},
+                                      {0x7E5, 0x7FF}};
+  /* CANopen master: NMT, SYNC, EMCY and TPDO1 of all, SDO clients, heartbeats */
+  static const uint16_t master[][2] = {{0x000, 0x7FF}, {0x080, 0x7FF}, {0x080, 0x780}, {0x180, 0x780},
+                                       {0x581, 0x7FF}, {0x582, 0x7FF}, {0x700, 0x780}, {0x7E4, 0x7FF}};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *node;
+  uint32_t falseAccepts = 0U, notNeeded = 0U, openedAccepts = 0U, openedNotNeeded = 0U;
+  uint32_t round;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(NULL);
+  node = CO_hostNode_create(bus, "node");
+  CO_hostNode_bind(node);
+
+  for (round = 0U; round < ROUNDS; round++)
+  {
+    uint16_t rxSize = (uint16_t)(1U + (CO_hostTest_random(&seed) % RX_MAX));
+    uint16_t configured = (uint16_t)(1U + (CO_hostTest_random(&seed) % rxSize));
+    uint32_t rejects;
+    uint16_t i, ident, mask;
+    bool_t rtr;
+
+    moduleInit(rxSize);
+    /* buffers configured before normal mode are planned together */
+    for (i = 0U; i < configured; i++)
+    {
+      randomConfig(&ident, &mask, &rtr);
+      configure(i, ident, mask, rtr);
+    }
+    modelCount = configured;
+    if ((round % 4U) == 0U)
+    {
+      /* reserved range is planned together with buffers */
+      randomConfig(&ident, &mask, &rtr);
+      mask |= 0x0700U;
+      CO_CANrxFilterReserve(&CANmodule, ident, mask);
+      reserved.ident = ident & mask & 0x07FFU;
+      reserved.mask = (mask & 0x07FFU) | 0x0800U;
+      reservedUsed = true;
+    }
+    CO_CANsetNormalMode(&CANmodule);
+    rejects = checkFilter(&falseAccepts, &notNeeded);
+    CO_HOST_TEST_CHECK(rejects == 0U, "round %u, planned: %u frames rejected", (unsigned int)round,
+                       (unsigned int)rejects);
+
+    /* the rest is configured in normal mode, filter is opened */
+    for (i = configured; i < rxSize; i++)
+    {
+      randomConfig(&ident, &mask, &rtr);
+      configure(i, ident, mask, rtr);
+    }
+    modelCount = rxSize;
+    rejects = checkFilter(&openedAccepts, &openedNotNeeded);
+    CO_HOST_TEST_CHECK(rejects == 0U, "round %u, opened: %u frames rejected", (unsigned int)round,
+                       (unsigned int)rejects);
+  }
+  printf("%u random configurations, %.1f %% of other frames accepted\n", ROUNDS,
+         100.0 * falseAccepts / notNeeded);
+
+  checkNamed("CANopen slave", slave, sizeof(slave) / sizeof(slave[0]));
+  checkNamed("CANopen master", master, sizeof(master) / sizeof(master[0]));
+
+  CO_CANmodule_disable(&CANmodule);
+  CO_hostNode_delete(node);
+  openQueued(bus);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
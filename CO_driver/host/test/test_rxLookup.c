@@ -0,0 +1,326 @@
+/*
+ * Host test of CAN-ID lookup table of ESP32 TWAI driver.
+ *
+ * @file        test_rxLookup.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Rx buffers are configured randomly, also reconfigured and overlapping, and
+ * each standard identifier is dispatched as data and remote frame with
+ * CANreceiveMessage(). The called buffer must be the first one, which
+ * accepts the frame, found by linear search over model of rxArray, as
+ * CANreceive() did before the lookup table. Then dispatch of data frame for
+ * the last of 8 to 256 rx buffers is measured, compared with linear search
+ * over rxArray, and configuration cost. Also built with single lookup table
+ * and without it, see CO_CAN_RX_LOOKUP. */
+
+#include <stdlib.h>
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define RX_MAX 256U
+/* maximum number of rx buffers in random configuration */
+#define RANDOM_MAX 64U
+#define ROUNDS 200U
+#define BENCH_FRAMES 200000U
+
+typedef struct
+{
+  uint16_t ident;
+  uint16_t mask;
+  bool_t configured;
+} rxModel_t;
+
+static CO_CANmodule_t CANmodule;
+static CO_CANrx_t rxArray[RX_MAX];
+static CO_CANtx_t txArray[1];
+static rxModel_t model[RX_MAX];
+/* rx buffer objects, callback gets index of the buffer from object */
+static uint8_t objects[RX_MAX];
+static int called;
+static uint32_t calls;
+
+static void rxCallback(void *object, void *message)
+{
+  (void)message;
+  called = (int)((uint8_t *)object - objects);
+  calls++;
+}
+
+/* Random configuration, mostly as in CANopen: single identifier, function
+ * code range, all identifiers, random mask, sometimes remote frame */
+static void randomConfig(uint32_t *seed, uint16_t *ident, uint16_t *mask, bool_t *rtr)
+{
+  uint32_t r = CO_hostTest_random(seed);
+
+  *ident = (uint16_t)(r & 0x07FFU);
+  switch ((r >> 11) % 8U)
+  {
+  case 0:
+    *mask = 0U;
+    break;
+  case 1:
+    *mask = 0x0780U;
+    break;
+  case 2:
+    *mask = (uint16_t)(CO_hostTest_random(seed) & 0x07FFU);
+    break;
+  default:
+    *mask = 0x07FFU;
+    break;
+  }
+  *rtr = ((r >> 16) % 16U) == 0U;
+}
+
+/* Index of the first buffer in model, which accepts the frame, -1 if none
+ * or if that buffer has no callback */
+static int linearFirst(uint16_t rxSize, uint32_t key)
+{
+  uint16_t i;
+
+  for (i = 0U; i < rxSize; i++)
+  {
+    if (((key ^ model[i].ident) & model[i].mask) == 0U)
+    {
+      return model[i].configured ? (int)i : -1;
+    }
+  }
+  return -1;
+}
+
+static void moduleInit(uint16_t rxSize)
+{
+  uint16_t i;
+
+  CO_CANmodule_init(&CANmodule, NULL, rxArray, rxSize, txArray, 1U, 500U);
+  for (i = 0U; i < rxSize; i++)
+  {
+    /* unconfigured buffer, as in CO_CANmodule_init() */
+    model[i].ident = 0U;
+    model[i].mask = 0xFFFFU;
+    model[i].configured = false;
+  }
+}
+
+static void configure(uint16_t index, uint16_t ident, uint16_t mask, bool_t rtr)
+{
+  CO_CANrxBufferInit(&CANmodule, index, ident, mask, rtr, &objects[index], rxCallback);
+  model[index].ident = (uint16_t)((ident & 0x07FFU) | (rtr ? 0x0800U : 0U));
+  model[index].mask = (uint16_t)((mask & 0x07FFU) | 0x0800U);
+  model[index].configured = true;
+}
+
+static void dispatch(uint32_t ident, uint32_t flags)
+{
+  twai_message_t msg = {0};
+
+  msg.identifier = ident;
+  msg.flags = flags;
+  msg.data_length_code = 8U;
+  called = -1;
+  CANreceiveMessage(&CANmodule, &msg);
+}
+
+/* Dispatch all standard identifiers, data and remote, compare with model */
+static uint32_t checkAll(uint16_t rxSize, uint32_t round)
+{
+  uint32_t errors = 0U;
+  uint32_t key;
+
+  for (key = 0U; key < 0x1000U; key++)
+  {
+    int expected = linearFirst(rxSize, key);
+
+    dispatch(key & 0x07FFU, ((key & 0x0800U) != 0U) ? TWAI_MSG_FLAG_RTR : TWAI_MSG_FLAG_NONE);
+    if ((called != expected) && (errors++ < 5U))
+    {
+      printf("round %u, %u buffers: %s 0x%03X to buffer %d, expected %d\n", (unsigned int)round,
+             (unsigned int)rxSize, ((key & 0x0800U) != 0U) ? "remote" : "data", (unsigned int)(key & 0x07FFU),
+             called, expected);
+    }
+  }
+
+  /* extended identifier with the same lower bits never matches */
+  dispatch(0x10000000UL | 0x0181U, TWAI_MSG_FLAG_EXTD);
+  if (called != -1)
+  {
+    errors++;
+  }
+  return errors;
+}
+
+/* Table read and callback, as in CANreceive() with lookup table, without the
+ * rest of CANreceiveMessage() */
+static void tableDispatch(const uint16_t *table, uint16_t key)
+{
+  uint16_t index = table[key & (CO_CAN_RX_LOOKUP_SIZE - 1U)];
+
+  if (index != CO_CAN_RX_LOOKUP_NONE)
+  {
+    rxArray[index].CANrx_callback(rxArray[index].object, NULL);
+  }
+}
+
+/* Linear search over rxArray and callback, as CANreceive() did before the
+ * lookup table */
+static void linearDispatch(uint16_t rxSize, uint16_t key)
+{
+  uint16_t i;
+
+  for (i = 0U; i < rxSize; i++)
+  {
+    const CO_CANrx_t *buffer = &rxArray[i];
+
+    if (((key ^ buffer->ident) & buffer->mask) == 0U)
+    {
+      buffer->CANrx_callback(buffer->object, NULL);
+      return;
+    }
+  }
+}
+
+/* Data frame for the last of rxSize buffers, the worst case of linear search */
+static void sweep(uint16_t rxSize)
+{
+  static uint16_t table[CO_CAN_RX_LOOKUP_SIZE];
+  uint16_t last = (uint16_t)(0x100U + rxSize - 1U);
+  uint32_t i;
+  int64_t start, dispatchNs, tableNs, linearNs;
+
+  moduleInit(rxSize);
+  for (i = 0U; i < rxSize; i++)
+  {
+    configure((uint16_t)i, (uint16_t)(0x100U + i), 0x07FFU, false);
+  }
+  for (i = 0U; i < CO_CAN_RX_LOOKUP_SIZE; i++)
+  {
+    int first = linearFirst(rxSize, i);
+
+    table[i] = (first < 0) ? CO_CAN_RX_LOOKUP_NONE : (uint16_t)first;
+  }
+
+  start = CO_hostTest_cpuNs();
+  for (i = 0U; i < BENCH_FRAMES; i++)
+  {
+    dispatch(last, TWAI_MSG_FLAG_NONE);
+  }
+  dispatchNs = CO_hostTest_cpuNs() - start;
+  CO_HOST_TEST_CHECK(called == (int)(rxSize - 1U), "%u rx buffers: 0x%03X dispatched to buffer %d",
+                     (unsigned int)rxSize, (unsigned int)last, called);
+
+  start = CO_hostTest_cpuNs();
+  for (i = 0U; i < BENCH_FRAMES; i++)
+  {
+    tableDispatch(table, last);
+  }
+  tableNs = CO_hostTest_cpuNs() - start;
+  start = CO_hostTest_cpuNs();
+  for (i = 0U; i < BENCH_FRAMES; i++)
+  {
+    linearDispatch(rxSize, last);
+  }
+  linearNs = CO_hostTest_cpuNs() - start;
+
+  printf("%3u rx buffers: CANreceiveMessage() (%s) %.1f ns, search only: table %.1f ns, linear %.1f ns\n",
+         (unsigned int)rxSize, CO_CAN_RX_LOOKUP ? "lookup" : "linear", (double)dispatchNs / BENCH_FRAMES,
+         (double)tableNs / BENCH_FRAMES, (double)linearNs / BENCH_FRAMES);
+}
+
+static void benchmark(void)
+{
+  static const uint16_t sizes[] = {8U, 32U, 64U, 128U, 256U};
+  uint32_t seed = 0x5EED0001UL;
+  uint32_t i, errors = 0U;
+  int64_t start, configNs, configAllNs;
+  uint16_t ident, mask;
+  bool_t rtr;
+
+  for (i = 0U; i < (sizeof(sizes) / sizeof(sizes[0])); i++)
+  {
+    sweep(sizes[i]);
+  }
+
+  /* reconfiguration of buffer with single identifier and with mask 0 */
+  start = CO_hostTest_cpuNs();
+  for (i = 0U; i < 10000U; i++)
+  {
+    configure(RX_MAX / 2U, (uint16_t)(0x600U + (i % 128U)), 0x07FFU, false);
+  }
+  configNs = CO_hostTest_cpuNs() - start;
+  start = CO_hostTest_cpuNs();
+  for (i = 0U; i < 1000U; i++)
+  {
+    configure(RX_MAX / 2U, (uint16_t)i, 0U, false);
+  }
+  configAllNs = CO_hostTest_cpuNs() - start;
+
+  /* still equal to linear search after that */
+  for (i = 0U; i < 100U; i++)
+  {
+    randomConfig(&seed, &ident, &mask, &rtr);
+    configure((uint16_t)(CO_hostTest_random(&seed) % RX_MAX), ident, mask, rtr);
+  }
+  errors = checkAll(RX_MAX, ROUNDS);
+  CO_HOST_TEST_CHECK(errors == 0U, "%u frames dispatched wrong after benchmark", (unsigned int)errors);
+
+  printf("%u rx buffers: CO_CANrxBufferInit() %.2f us, with mask 0 %.2f us\n", RX_MAX,
+         (double)configNs / 10000.0 / 1000.0, (double)configAllNs / 1000.0 / 1000.0);
+}
+
+int main(void)
+{
+  CO_hostBus_t *bus;
+  CO_hostNode_t *node;
+  uint32_t seed = 0x12345678UL;
+  uint32_t round;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(NULL);
+  node = CO_hostNode_create(bus, "node");
+  CO_hostNode_bind(node);
+
+  for (round = 0U; round < ROUNDS; round++)
+  {
+    uint16_t rxSize = (uint16_t)(1U + (CO_hostTest_random(&seed) % RANDOM_MAX));
+    uint32_t changes = 2U * rxSize;
+    uint32_t i, errors;
+
+    moduleInit(rxSize);
+    for (i = 0U; i < changes; i++)
+    {
+      uint16_t ident, mask;
+      bool_t rtr;
+
+      randomConfig(&seed, &ident, &mask, &rtr);
+      configure((uint16_t)(CO_hostTest_random(&seed) % rxSize), ident, mask, rtr);
+    }
+    errors = checkAll(rxSize, round);
+    CO_HOST_TEST_CHECK(errors == 0U, "round %u: %u frames dispatched wrong", (unsigned int)round,
+                       (unsigned int)errors);
+  }
+  printf("%u random configurations, %u callbacks, all equal to linear search\n", ROUNDS, (unsigned int)calls);
+
+  benchmark();
+
+  CO_CANmodule_disable(&CANmodule);
+  CO_hostNode_delete(node);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
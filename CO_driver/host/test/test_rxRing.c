@@ -0,0 +1,326 @@
+/*
+ * Host test of receive ring of ESP32 TWAI driver.
+ *
+ * @file        test_rxRing.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CO_CAN_RX_RING. Sender node transmits frames with sequence
+ * number directly to TWAI, so they are on the bus in sending order. Receiver
+ * has rx buffers for PDOs and for SYNC, which bypasses the ring.
+ * - Semantics, without receive task: SYNC callback is called directly from
+ *   CANreceive() only if ring is empty, otherwise it waits behind older
+ *   messages. Full ring counts overruns, message for reconfigured rx buffer is
+ *   dropped as stale.
+ * - Stress: receive task (producer) and mainline (consumer) run concurrently
+ *   on fast bus with injected errors, mainline is sometimes busy. Callbacks
+ *   must see increasing sequence numbers with intact data and every frame must
+ *   be delivered or counted as lost.
+ * - Benchmark: at 250 kbit/s mainline is busy 4 ms of each 5 ms. Ring must
+ *   absorb the bursts without loss in TWAI receive queue (5 frames). */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if !CO_CAN_RX_RING
+#error test_rxRing requires CO_CAN_RX_RING
+#endif
+
+#define PDO_BUFFERS 8U
+#define RX_BUFFERS (PDO_BUFFERS + 1U)
+#define SYNC_INDEX PDO_BUFFERS
+#define STRESS_MS 2000U
+#define BENCH_MS 2000U
+
+static CO_CANmodule_t sender, receiver;
+static CO_CANrx_t senderRx[1], receiverRx[RX_BUFFERS];
+static CO_CANtx_t senderTx[1], receiverTx[1];
+static CO_hostNode_t *senderNode, *receiverNode;
+static uint32_t callbacks, corrupted, disordered, lastSeq;
+static volatile bool_t stop;
+static uint32_t sent;
+
+static uint16_t identOf(uint16_t index)
+{
+  return (index == SYNC_INDEX) ? 0x080U : (uint16_t)(0x181U + index);
+}
+
+/* Sequence number in the first four bytes, its complement in the rest */
+static void rxCallback(void *object, void *message)
+{
+  const CO_CANrxMsg_t *rxMsg = (const CO_CANrxMsg_t *)message;
+  uint32_t seq, check;
+
+  (void)object;
+  memcpy(&seq, &rxMsg->msg.data[0], sizeof(seq));
+  memcpy(&check, &rxMsg->msg.data[4], sizeof(check));
+  if ((check != ~seq) || (rxMsg->msg.data_length_code != 8U))
+  {
+    corrupted++;
+  }
+  if ((callbacks > 0U) && (seq <= lastSeq))
+  {
+    disordered++;
+  }
+  lastSeq = seq;
+  callbacks++;
+}
+
+static void receiverBuffers(void)
+{
+  uint16_t i;
+
+  for (i = 0U; i < RX_BUFFERS; i++)
+  {
+    CO_CANrxBufferInit(&receiver, i, identOf(i), 0x07FFU, false, &callbacks, rxCallback);
+  }
+}
+
+/* Frame with sequence number, directly to TWAI of sender node */
+static bool_t transmit(uint16_t index, uint32_t seq, TickType_t ticks)
+{
+  twai_message_t msg = {0};
+  uint32_t check = ~seq;
+
+  msg.identifier = identOf(index);
+  msg.data_length_code = 8U;
+  memcpy(&msg.data[0], &seq, sizeof(seq));
+  memcpy(&msg.data[4], &check, sizeof(check));
+  return twai_transmit(&msg, ticks) == ESP_OK;
+}
+
+/* Transmit from sender node and wait until the frames are in TWAI receive
+ * queue of receiver. Calling task is bound to receiver after return. */
+static bool_t queueFrames(const uint16_t *indexes, uint16_t count, uint32_t seq)
+{
+  twai_status_info_t status = {0};
+  TickType_t start;
+  uint16_t i;
+
+  CO_hostNode_bind(senderNode);
+  for (i = 0U; i < count; i++)
+  {
+    transmit(indexes[i], seq + i, portMAX_DELAY);
+  }
+  CO_hostNode_bind(receiverNode);
+  start = xTaskGetTickCount();
+  while ((twai_get_status_info(&status) == ESP_OK) && (status.msgs_to_rx < count) &&
+         ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(1000)))
+  {
+    vTaskDelay(0);
+  }
+  return status.msgs_to_rx == count;
+}
+
+static void receiveAll(uint16_t count)
+{
+  uint16_t i;
+
+  for (i = 0U; i < count; i++)
+  {
+    CANreceive(&receiver);
+  }
+}
+
+static void semantics(void)
+{
+  static const uint16_t pdoSync[] = {0U, SYNC_INDEX, 1U};
+  static const uint16_t pdos[] = {0U, 1U, 2U, 3U, 4U};
+  uint32_t seq = 1U, pushed;
+
+  callbacks = 0U;
+  /* SYNC on empty ring is processed directly */
+  queueFrames(&pdoSync[1], 1U, seq++);
+  receiveAll(1U);
+  CO_HOST_TEST_CHECK(callbacks == 1U, "direct SYNC: %u callbacks", (unsigned int)callbacks);
+
+  /* SYNC behind PDO waits in ring */
+  queueFrames(pdoSync, 3U, seq);
+  seq += 3U;
+  receiveAll(3U);
+  CO_HOST_TEST_CHECK(callbacks == 1U, "SYNC overtakes PDO: %u callbacks", (unsigned int)callbacks);
+  CO_HOST_TEST_CHECK(CO_CANrxRingProcess(&receiver, 16U) == 3U, "ring did not keep 3 messages");
+  CO_HOST_TEST_CHECK((callbacks == 4U) && (disordered == 0U), "%u callbacks, %u out of order",
+                     (unsigned int)callbacks, (unsigned int)disordered);
+
+  /* fill the ring over its size, five frames at a time */
+  for (pushed = 0U; pushed < (CO_CAN_RX_RING + 10U); pushed += 5U)
+  {
+    queueFrames(pdos, 5U, seq);
+    seq += 5U;
+    receiveAll(5U);
+  }
+  CO_HOST_TEST_CHECK((receiver.rxRingOverruns == (pushed - CO_CAN_RX_RING)) && (receiver.rxRingPeak == CO_CAN_RX_RING),
+                     "full ring: %u overruns, peak %u", (unsigned int)receiver.rxRingOverruns,
+                     (unsigned int)receiver.rxRingPeak);
+  CO_HOST_TEST_CHECK(CO_CANrxRingProcess(&receiver, CO_CAN_RX_RING) == CO_CAN_RX_RING, "full ring not processed");
+  CO_HOST_TEST_CHECK((callbacks == (4U + CO_CAN_RX_RING)) && (disordered == 0U) && (corrupted == 0U),
+                     "full ring: %u callbacks, %u out of order, %u corrupted", (unsigned int)callbacks,
+                     (unsigned int)disordered, (unsigned int)corrupted);
+
+  /* rx buffer gets other CAN-ID while its messages wait */
+  queueFrames(pdos, 5U, seq);
+  receiveAll(5U);
+  CO_CANrxBufferInit(&receiver, 2U, 0x202U, 0x07FFU, false, &callbacks, rxCallback);
+  CO_CANrxRingProcess(&receiver, 16U);
+  CO_HOST_TEST_CHECK((receiver.rxRingStale == 1U) && (callbacks == (8U + CO_CAN_RX_RING)),
+                     "reconfigured: %u stale, %u callbacks", (unsigned int)receiver.rxRingStale,
+                     (unsigned int)callbacks);
+  receiverBuffers();
+}
+
+static void senderTask(void *arg)
+{
+  uint32_t seq = lastSeq + 1U;
+
+  (void)arg;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    if (transmit((uint16_t)(seq % RX_BUFFERS), seq, pdMS_TO_TICKS(1)))
+    {
+      seq++;
+      __atomic_store_n(&sent, __atomic_load_n(&sent, __ATOMIC_RELAXED) + 1U, __ATOMIC_RELEASE);
+    }
+    if ((seq % 64U) == 0U)
+    {
+      vTaskDelay(0);
+    }
+  }
+  __atomic_store_n(&stop, false, __ATOMIC_RELEASE);
+  vTaskDelete(NULL);
+}
+
+/* Run sender task for duration_ms, mainline processes the ring and is busy
+ * busy_us each period_us. Returns number of lost frames. */
+static uint32_t run(uint32_t duration_ms, int64_t period_us, int64_t busy_us, double *nsPerMessage)
+{
+  CO_CANstats_t *stats = &receiver.stats;
+  uint32_t delivered0 = callbacks, lost;
+  int64_t start, processNs = 0;
+  TickType_t settle;
+
+  sent = 0U;
+  __atomic_store_n(&stop, false, __ATOMIC_RELEASE);
+  CO_hostNode_bind(senderNode);
+  xTaskCreate(senderTask, "sender", 4096, NULL, 5, NULL);
+  CO_hostNode_bind(receiverNode);
+
+  start = esp_timer_get_time();
+  while ((esp_timer_get_time() - start) < ((int64_t)duration_ms * 1000))
+  {
+    int64_t period = esp_timer_get_time();
+    int64_t cpu = CO_hostTest_cpuNs();
+
+    CO_CANmodule_process(&receiver);
+    processNs += CO_hostTest_cpuNs() - cpu;
+    while ((esp_timer_get_time() - period) < busy_us)
+    {
+    }
+    while ((esp_timer_get_time() - period) < period_us)
+    {
+      vTaskDelay(0);
+    }
+  }
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    vTaskDelay(1);
+  }
+  /* bus and receive task get idle */
+  settle = xTaskGetTickCount();
+  while ((xTaskGetTickCount() - settle) < pdMS_TO_TICKS(100))
+  {
+    CO_CANmodule_process(&receiver);
+    vTaskDelay(1);
+  }
+
+  lost = sent - (callbacks - delivered0);
+  CO_HOST_TEST_CHECK(lost == (stats->rxMissed + receiver.rxRingOverruns),
+                     "%u sent, %u delivered, %u missed in TWAI queue, %u ring overruns", (unsigned int)sent,
+                     (unsigned int)(callbacks - delivered0), (unsigned int)stats->rxMissed,
+                     (unsigned int)receiver.rxRingOverruns);
+  CO_HOST_TEST_CHECK((disordered == 0U) && (corrupted == 0U), "%u out of order, %u corrupted",
+                     (unsigned int)disordered, (unsigned int)corrupted);
+  *nsPerMessage = (callbacks > delivered0) ? (double)processNs / (callbacks - delivered0) : 0.0;
+  return lost;
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 0.0, .errorRatePpm = 1000U, .seed = 0x7E1A0012UL};
+  CO_hostBus_t *bus;
+  uint32_t lost;
+  double ns;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  receiverNode = CO_hostNode_create(bus, "receiver");
+  senderNode = CO_hostNode_create(bus, "sender");
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, 1U, 1000U);
+  CO_CANsetNormalMode(&sender);
+  CO_hostNode_bind(receiverNode);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, RX_BUFFERS, receiverTx, 1U, 1000U);
+  receiverBuffers();
+  CO_CANsetNormalMode(&receiver);
+
+  CO_hostBus_setErrorRate(bus, 0U);
+  semantics();
+
+  /* receive task and mainline concurrently */
+  CO_CANmodule_disable(&receiver);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, RX_BUFFERS, receiverTx, 1U, 1000U);
+  receiverBuffers();
+  CO_CANsetNormalMode(&receiver);
+  CO_CANrxTaskStart(&receiver);
+  CO_hostBus_setErrorRate(bus, 1000U);
+  lost = run(STRESS_MS, 1000, 900, &ns);
+  printf("stress: %u frames, %u lost, ring peak %u, %u ring overruns\n", (unsigned int)sent, (unsigned int)lost,
+         (unsigned int)receiver.rxRingPeak, (unsigned int)receiver.rxRingOverruns);
+  CO_HOST_TEST_CHECK(sent > 1000U, "only %u frames sent", (unsigned int)sent);
+
+  /* benchmark at real bus timing */
+  CO_hostBus_setErrorRate(bus, 0U);
+  CO_hostBus_setTimeScale(bus, 1.0);
+  CO_CANrxTaskStop(&receiver);
+  CO_CANmodule_disable(&receiver);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, RX_BUFFERS, receiverTx, 1U, 250U);
+  receiverBuffers();
+  CO_CANsetNormalMode(&receiver);
+  CO_CANrxTaskStart(&receiver);
+  CO_hostNode_bind(senderNode);
+  CO_CANsetBitRate(&sender, 250U);
+  CO_hostNode_bind(receiverNode);
+  lost = run(BENCH_MS, 5000, 4000, &ns);
+  printf("busy mainline at 250 kbit/s: %u frames (%.0f frames/s), %u lost, ring peak %u, "
+         "%.0f ns per message in CO_CANmodule_process()\n",
+         (unsigned int)sent, (double)sent * 1000.0 / BENCH_MS, (unsigned int)lost, (unsigned int)receiver.rxRingPeak,
+         ns);
+  CO_HOST_TEST_CHECK(lost == 0U, "%u frames lost with busy mainline", (unsigned int)lost);
+
+  CO_CANrxTaskStop(&receiver);
+  CO_CANmodule_disable(&receiver);
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(receiverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
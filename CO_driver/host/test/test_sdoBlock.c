@@ -0,0 +1,196 @@
+/*
+ * Host test of transmit stream with SDO block download of ESP32 TWAI driver.
+ *
+ * @file        test_sdoBlock.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CONFIG_CANOPEN_SDO_BLOCK. Client node downloads data to server
+ * node with SDO block transfer at 500 kbit/s in real time, while it sends
+ * PDOs every 10 ms. Client sends segments of a block from one tx buffer
+ * (0x601) as the stack does, while the buffer is free, mainline runs with
+ * CO_CANwait() of 1 ms. Server acknowledges each block (0x581) from its
+ * receive task.
+ * - Tx buffer is never full, whole block is sent in one mainline cycle.
+ * - Server receives all segments in order and data are intact. */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#if !CO_CAN_TX_STREAM
+#error test_sdoBlock requires CONFIG_CANOPEN_SDO_BLOCK
+#endif
+
+#define BITRATE 500U
+#define TOTAL (16U * 1024U)
+#define BLOCK 127U
+#define PDOS 3U
+#define PDO_PERIOD_US 10000
+#define TIMEOUT_US 5000000
+
+static CO_CANmodule_t client, server;
+static CO_CANrx_t clientRx[1], serverRx[1];
+static CO_CANtx_t clientTx[1U + PDOS], serverTx[1];
+static uint8_t source[TOTAL], received[TOTAL];
+/* written by receive task of server */
+static uint32_t receivedBytes, sequence, badSequence;
+/* written by receive task of client */
+static uint32_t acks;
+
+/* Block segment: sequence number and last flag, 7 bytes of data */
+static void serverCallback(void *object, void *message)
+{
+  const CO_CANrxMsg_t *rxMsg = (const CO_CANrxMsg_t *)message;
+  uint32_t seqno = rxMsg->msg.data[0] & 0x7FU;
+  uint32_t n = ((TOTAL - receivedBytes) < 7U) ? (TOTAL - receivedBytes) : 7U;
+
+  (void)object;
+  if (seqno != (sequence + 1U))
+  {
+    badSequence++;
+    return;
+  }
+  sequence = seqno;
+  memcpy(&received[receivedBytes], &rxMsg->msg.data[1], n);
+  receivedBytes += n;
+  if ((seqno == BLOCK) || ((rxMsg->msg.data[0] & 0x80U) != 0U))
+  {
+    /* block download response */
+    serverTx[0].data[0] = 0xA2U;
+    serverTx[0].data[1] = (uint8_t)seqno;
+    serverTx[0].data[2] = BLOCK;
+    CO_CANsend(&server, &serverTx[0]);
+    sequence = 0U;
+  }
+}
+
+static void clientCallback(void *object, void *message)
+{
+  (void)object;
+  (void)message;
+  __atomic_store_n(&acks, acks + 1U, __ATOMIC_RELEASE);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 1.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *clientNode, *serverNode;
+  uint32_t position = 0U, blocks = 0U, seenAcks = 0U, stalls = 0U, split = 0U, pdo = 0U, i;
+  bool_t waitAck = false;
+  int64_t start, nextPdo, took;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  for (i = 0U; i < TOTAL; i++)
+  {
+    source[i] = (uint8_t)((i * 131U) + 7U);
+  }
+  bus = CO_hostBus_create(&config);
+  serverNode = CO_hostNode_create(bus, "server");
+  clientNode = CO_hostNode_create(bus, "client");
+
+  CO_hostNode_bind(serverNode);
+  CO_CANmodule_init(&server, NULL, serverRx, 1U, serverTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&server, 0U, 0x601U, 0x07FFU, false, &server, serverCallback);
+  CO_CANtxBufferInit(&server, 0U, 0x581U, false, 8U, false);
+  CO_CANsetNormalMode(&server);
+  CO_CANrxTaskStart(&server);
+
+  CO_hostNode_bind(clientNode);
+  CO_CANmodule_init(&client, NULL, clientRx, 1U, clientTx, 1U + PDOS, BITRATE);
+  CO_CANrxBufferInit(&client, 0U, 0x581U, 0x07FFU, false, &client, clientCallback);
+  CO_CANtxBufferInit(&client, 0U, 0x601U, false, 8U, false);
+  for (i = 1U; i <= PDOS; i++)
+  {
+    CO_CANtxBufferInit(&client, (uint16_t)i, (uint16_t)(0x180U + i), false, 8U, false);
+  }
+  CO_CANsetNormalMode(&client);
+  CO_CANrxTaskStart(&client);
+
+  start = esp_timer_get_time();
+  nextPdo = start;
+  while (((position < TOTAL) || waitAck) && ((esp_timer_get_time() - start) < TIMEOUT_US))
+  {
+    uint32_t seqno = 0U;
+
+    CO_CANwait(&client, 1000U);
+    CO_CANmodule_process(&client);
+    if (esp_timer_get_time() >= nextPdo)
+    {
+      CO_CANsend(&client, &clientTx[1U + (pdo++ % PDOS)]);
+      nextPdo += PDO_PERIOD_US;
+    }
+    if (waitAck)
+    {
+      uint32_t n = __atomic_load_n(&acks, __ATOMIC_ACQUIRE);
+
+      if (n == seenAcks)
+      {
+        continue;
+      }
+      seenAcks = n;
+      waitAck = false;
+    }
+
+    /* block as CO_SDOclientDownload() sends it, while tx buffer is free */
+    while ((position < TOTAL) && (seqno < BLOCK))
+    {
+      uint32_t n = ((TOTAL - position) < 7U) ? (TOTAL - position) : 7U;
+
+      if (clientTx[0].bufferFull)
+      {
+        stalls++;
+        break;
+      }
+      seqno++;
+      clientTx[0].data[0] = (uint8_t)(seqno | (((position + n) >= TOTAL) ? 0x80U : 0U));
+      memcpy(&clientTx[0].data[1], &source[position], n);
+      CO_HOST_TEST_CHECK(CO_CANsend(&client, &clientTx[0]) == CO_ERROR_NO, "segment %u overflow",
+                         (unsigned int)seqno);
+      position += n;
+    }
+    if (seqno > 0U)
+    {
+      blocks++;
+      split += ((seqno < BLOCK) && (position < TOTAL)) ? 1U : 0U;
+      waitAck = true;
+    }
+  }
+  took = esp_timer_get_time() - start;
+
+  CO_HOST_TEST_CHECK((position == TOTAL) && !waitAck, "%u of %u bytes sent in %lld us", (unsigned int)position, TOTAL,
+                     (long long)took);
+  CO_HOST_TEST_CHECK((stalls == 0U) && (split == 0U), "tx buffer full in %u cycles, %u blocks split",
+                     (unsigned int)stalls, (unsigned int)split);
+  CO_HOST_TEST_CHECK((receivedBytes == TOTAL) && (badSequence == 0U) && (memcmp(source, received, TOTAL) == 0),
+                     "%u of %u bytes received, %u segments out of order", (unsigned int)receivedBytes, TOTAL,
+                     (unsigned int)badSequence);
+  printf("%u bytes in %u blocks, %lld ms, %.1f KB/s, %u PDOs\n", TOTAL, (unsigned int)blocks,
+         (long long)(took / 1000), (double)TOTAL / 1024.0 / ((double)took / 1e6), (unsigned int)pdo);
+
+  CO_CANrxTaskStop(&client);
+  CO_CANmodule_disable(&client);
+  CO_hostNode_bind(serverNode);
+  CO_CANrxTaskStop(&server);
+  CO_CANmodule_disable(&server);
+  CO_hostNode_delete(clientNode);
+  CO_hostNode_delete(serverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
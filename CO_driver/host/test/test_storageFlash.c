@@ -0,0 +1,275 @@
+/*
+ * Host test of parameter storage in flash partition for ESP32.
+ *
+ * @file        test_storageFlash.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Built with CONFIG_CANOPEN_STORAGE. Four entries, as of communication,
+ * application and manufacturer parameters and of auto stored counters, are
+ * stored in simulated flash partition of SECTORS sectors. Each boot is
+ * CO_storageFlash_init() with default values in entries.
+ * - Stored entries are restored after reboot, restored defaults (0x1011)
+ *   stay after reboot.
+ * - Repeated "store all" commands, which change few bytes, write less to
+ *   flash than the entries would take, wear is spread over all sectors.
+ * - Entries are restored from mapped partition and with esp_partition_read().
+ * - Power loss at any byte during store keeps each entry old or new. Only
+ *   entries, whose store was interrupted, are reported at next boot. */
+
+#include <stdlib.h>
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostFlash.h"
+#include "CO_hostTest.h"
+#include "CO_storageFlash.h"
+
+#if !((CO_CONFIG_STORAGE) & CO_CONFIG_STORAGE_ENABLE)
+#error test_storageFlash requires CONFIG_CANOPEN_STORAGE
+#endif
+
+#define SECTORS 4U
+#define ENTRIES 4U
+#define STORES 2000U
+#define POWER_CUTS 1000U
+#define COMM_SIZE 300U
+#define APP_SIZE 64U
+#define MFG_SIZE 32U
+#define COUNTERS_SIZE 16U
+
+static CO_CANmodule_t node;
+static CO_CANrx_t nodeRx[1];
+static CO_CANtx_t nodeTx[1];
+static CO_storage_t storage;
+static CO_storageFlash_t flash;
+static CO_storage_entry_t entries[ENTRIES];
+static const esp_partition_t *partition;
+static uint8_t comm[COMM_SIZE], app[APP_SIZE], mfg[MFG_SIZE], counters[COUNTERS_SIZE];
+static uint8_t commDefault[COMM_SIZE], appDefault[APP_SIZE], mfgDefault[MFG_SIZE];
+static uint32_t seed = 1U;
+
+/* Power on with default values, returns storageInitError */
+static uint32_t boot(void)
+{
+  CO_storage_entry_t init[ENTRIES] = {
+    {.addr = comm, .len = COMM_SIZE, .subIndexOD = 2U, .attr = CO_storage_cmd | CO_storage_restore},
+    {.addr = app, .len = APP_SIZE, .subIndexOD = 3U, .attr = CO_storage_cmd | CO_storage_restore},
+    {.addr = mfg, .len = MFG_SIZE, .subIndexOD = 4U, .attr = CO_storage_cmd},
+    {.addr = counters, .len = COUNTERS_SIZE, .subIndexOD = 5U, .attr = CO_storage_auto},
+  };
+  uint32_t err = 0U;
+
+  memcpy(comm, commDefault, COMM_SIZE);
+  memcpy(app, appDefault, APP_SIZE);
+  memcpy(mfg, mfgDefault, MFG_SIZE);
+  memset(counters, 0, COUNTERS_SIZE);
+  memcpy(entries, init, sizeof(entries));
+  CO_storageFlash_init(&flash, "canopen", &storage, &node, NULL, NULL, entries, ENTRIES, &err);
+  return err;
+}
+
+/* Store parameters command (0x1010 sub 1) */
+static ODR_t storeAll(void)
+{
+  ODR_t ret = ODR_OK;
+  uint8_t i;
+
+  for (i = 0U; i < ENTRIES; i++)
+  {
+    if ((entries[i].attr & CO_storage_cmd) != 0U)
+    {
+      ODR_t r = storage.store(&entries[i], &node);
+
+      ret = (r != ODR_OK) ? r : ret;
+    }
+  }
+  return ret;
+}
+
+static void storeReboot(void)
+{
+  uint32_t err;
+
+  CO_HOST_TEST_CHECK(boot() == 0U, "storage of erased partition not initialized");
+  CO_HOST_TEST_CHECK(flash.sectors == SECTORS, "%u of %u sectors", flash.sectors, SECTORS);
+  comm[5] = 0xAAU;
+  app[0] = 1U;
+  CO_HOST_TEST_CHECK(storeAll() == ODR_OK, "store failed");
+  CO_storageFlash_close(&flash);
+
+  err = boot();
+  CO_HOST_TEST_CHECK((err == 0U) && (comm[5] == 0xAAU) && (app[0] == 1U) && (mfg[0] == mfgDefault[0]),
+                     "after reboot: error 0x%X, comm[5] 0x%02X, app[0] %u", (unsigned int)err, comm[5], app[0]);
+
+  /* restore default parameters (0x1011) of communication entry only */
+  storage.restore(&entries[0], &node);
+  CO_storageFlash_close(&flash);
+  boot();
+  CO_HOST_TEST_CHECK((comm[5] == commDefault[5]) && (app[0] == 1U), "after restore: comm[5] 0x%02X, app[0] %u",
+                     comm[5], app[0]);
+}
+
+static void writeAmplification(void)
+{
+  CO_hostFlashStats_t stats;
+  CO_storageFlashStats_t before = flash.stats;
+  uint8_t commStored[COMM_SIZE], appStored[APP_SIZE], mfgStored[MFG_SIZE], countersStored[COUNTERS_SIZE];
+  uint64_t naive = 0U;
+  uint32_t i, dataBytes, flashBytes;
+
+  CO_hostFlash_resetStats(partition);
+  for (i = 0U; i < STORES; i++)
+  {
+    uint8_t e;
+
+    /* one in four commands follows change of one byte */
+    if ((CO_hostTest_random(&seed) % 4U) == 0U)
+    {
+      CO_storage_entry_t *entry = &entries[CO_hostTest_random(&seed) % 3U];
+
+      ((uint8_t *)entry->addr)[CO_hostTest_random(&seed) % entry->len]++;
+    }
+    for (e = 0U; e < ENTRIES; e++)
+    {
+      naive += ((entries[e].attr & CO_storage_cmd) != 0U) ? entries[e].len : 0U;
+    }
+    CO_HOST_TEST_CHECK(storeAll() == ODR_OK, "store %u failed", (unsigned int)i);
+    counters[0]++;
+    CO_HOST_TEST_CHECK(CO_storageFlash_auto_process(&flash) == 0U, "auto store %u failed", (unsigned int)i);
+  }
+  CO_hostFlash_getStats(partition, &stats);
+  dataBytes = flash.stats.dataBytes - before.dataBytes;
+  flashBytes = flash.stats.flashBytes - before.flashBytes;
+  CO_HOST_TEST_CHECK((flash.stats.unchanged - before.unchanged) > ((STORES * 3U) / 2U),
+                     "%u of %u stores skipped as unchanged", (unsigned int)(flash.stats.unchanged - before.unchanged),
+                     STORES * 3U);
+  CO_HOST_TEST_CHECK((flashBytes * 4U) < naive, "%u bytes written to flash, %llu bytes of entries",
+                     (unsigned int)flashBytes, (unsigned long long)naive);
+  CO_HOST_TEST_CHECK(stats.writeBytes == flashBytes, "%llu bytes written by partition, %u by storage",
+                     (unsigned long long)stats.writeBytes, (unsigned int)flashBytes);
+  CO_HOST_TEST_CHECK((stats.sectorErasesMax - stats.sectorErasesMin) <= 1U, "sector wear from %u to %u erases",
+                     (unsigned int)stats.sectorErasesMin, (unsigned int)stats.sectorErasesMax);
+  printf("%u stores: %u bytes of data, %u bytes written, %llu bytes of entries, %llu erases, %llu ms on target\n",
+         STORES, (unsigned int)dataBytes, (unsigned int)flashBytes, (unsigned long long)naive,
+         (unsigned long long)stats.erases, (unsigned long long)(stats.busy_us / 1000U));
+
+  memcpy(commStored, comm, COMM_SIZE);
+  memcpy(appStored, app, APP_SIZE);
+  memcpy(mfgStored, mfg, MFG_SIZE);
+  memcpy(countersStored, counters, COUNTERS_SIZE);
+  CO_storageFlash_close(&flash);
+
+  /* restore from mapped partition, then with esp_partition_read() */
+  for (i = 0U; i < 2U; i++)
+  {
+    CO_hostFlash_setMmap(partition, i == 0U);
+    CO_HOST_TEST_CHECK(boot() == 0U, "restore %u reported corrupt record", (unsigned int)i);
+    CO_HOST_TEST_CHECK((memcmp(comm, commStored, COMM_SIZE) == 0) && (memcmp(app, appStored, APP_SIZE) == 0) &&
+                           (memcmp(mfg, mfgStored, MFG_SIZE) == 0) &&
+                           (memcmp(counters, countersStored, COUNTERS_SIZE) == 0),
+                       "%s restore differs from stored entries", (i == 0U) ? "mapped" : "read");
+    printf("%s restore took %u us on host\n", (i == 0U) ? "mapped" : "read", (unsigned int)flash.stats.restore_us);
+    CO_storageFlash_close(&flash);
+  }
+  CO_hostFlash_setMmap(partition, true);
+}
+
+/* Entry is new, or old if its store failed */
+static bool_t oldOrNew(const uint8_t *data, const uint8_t *oldData, const uint8_t *newData, size_t len, ODR_t stored)
+{
+  return (memcmp(data, newData, len) == 0) || ((memcmp(data, oldData, len) == 0) && (stored != ODR_OK));
+}
+
+static void powerCuts(void)
+{
+  uint32_t i, mixed = 0U, corrupt = 0U, reported = 0U;
+
+  for (i = 0U; i < POWER_CUTS; i++)
+  {
+    uint8_t commOld[COMM_SIZE], appOld[APP_SIZE], commNew[COMM_SIZE], appNew[APP_SIZE];
+    ODR_t commStored, appStored;
+    uint32_t failed, err;
+
+    boot();
+    memcpy(commOld, comm, COMM_SIZE);
+    memcpy(appOld, app, APP_SIZE);
+    comm[CO_hostTest_random(&seed) % COMM_SIZE] ^= 0x5AU;
+    app[CO_hostTest_random(&seed) % APP_SIZE] += 3U;
+    memcpy(commNew, comm, COMM_SIZE);
+    memcpy(appNew, app, APP_SIZE);
+
+    CO_hostFlash_powerCut(partition, CO_hostTest_random(&seed) % 600U);
+    commStored = storage.store(&entries[0], &node);
+    appStored = storage.store(&entries[1], &node);
+    CO_storageFlash_close(&flash);
+    CO_hostFlash_powerOn(partition);
+
+    /* interrupted record is reported, only of entry, which failed */
+    failed = ((commStored != ODR_OK) ? (1UL << 2) : 0U) | ((appStored != ODR_OK) ? (1UL << 3) : 0U);
+    err = boot();
+    reported += (err != 0U) ? 1U : 0U;
+    corrupt += ((err & ~failed) != 0U) ? 1U : 0U;
+    if (!oldOrNew(comm, commOld, commNew, COMM_SIZE, commStored) ||
+        !oldOrNew(app, appOld, appNew, APP_SIZE, appStored))
+    {
+      mixed++;
+    }
+    CO_storageFlash_close(&flash);
+  }
+  CO_HOST_TEST_CHECK(mixed == 0U, "%u of %u power cuts lost or mixed entry", (unsigned int)mixed, POWER_CUTS);
+  CO_HOST_TEST_CHECK(corrupt == 0U, "%u of %u boots reported corrupt record of stored entry", (unsigned int)corrupt,
+                     POWER_CUTS);
+  printf("%u power cuts, %u interrupted stores reported\n", POWER_CUTS, (unsigned int)reported);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 0.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *nodeNode;
+  uint32_t i;
+
+  /* failed writes after power cut are logged as errors */
+  esp_log_level_set("*", ESP_LOG_NONE);
+  bus = CO_hostBus_create(&config);
+  nodeNode = CO_hostNode_create(bus, "node");
+  CO_hostNode_bind(nodeNode);
+  CO_CANmodule_init(&node, NULL, nodeRx, 1U, nodeTx, 1U, 250U);
+
+  for (i = 0U; i < COMM_SIZE; i++)
+  {
+    commDefault[i] = (uint8_t)i;
+  }
+  for (i = 0U; i < APP_SIZE; i++)
+  {
+    appDefault[i] = (uint8_t)(0x40U + i);
+  }
+  memset(mfgDefault, 7, MFG_SIZE);
+  partition = CO_hostFlash_create("canopen", SECTORS * CO_HOST_FLASH_SECTOR, NULL);
+
+  storeReboot();
+  writeAmplification();
+  powerCuts();
+
+  CO_hostFlash_delete(partition);
+  CO_CANmodule_disable(&node);
+  CO_hostNode_delete(nodeNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,324 @@
+/*
+ * Host test of CAN-ID priority order of waiting messages of ESP32 TWAI
+ * driver.
+ *
+ * @file        test_txPriority.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Sender node sends from mainline, receiver node records the bus.
+ * - Order: tx buffers get random, also equal, CAN-IDs and are reconfigured
+ *   randomly, also while their message waits. All are sent in random order
+ *   while the bus is slowed down, so most of them wait in txArray. Messages,
+ *   which went into TWAI queue, must be received in sending order, the
+ *   waiting ones after them by CAN-ID, then by index.
+ * - Latency: at 125 kbit/s low priority messages from 16 buffers keep the bus
+ *   saturated, while the last buffer sends high priority message each 20 ms.
+ *   The number of frames on the bus before it must be bounded by TWAI queue
+ *   length, not by the number of waiting messages. Its latency in time is only
+ *   printed, it depends also on scheduling of host threads. */
+
+#include <stdlib.h>
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define TX_BUFFERS 64U
+#define ROUNDS 20U
+#define FRAMES_MAX 4096U
+#define LOW_BUFFERS 16U
+#define LATENCY_MS 2000U
+
+static CO_CANmodule_t sender, receiver;
+static CO_CANrx_t senderRx[1], receiverRx[1];
+static CO_CANtx_t senderTx[TX_BUFFERS], receiverTx[1];
+static CO_hostTestFrame_t frames[FRAMES_MAX];
+static CO_hostTestRecorder_t recorder = {frames, FRAMES_MAX, 0U};
+static uint16_t ident[TX_BUFFERS];
+static uint32_t seed = 0x7E1A0004UL;
+
+/* Random CAN-ID outside the range streamed by CO_CAN_TX_STREAMED() */
+static uint16_t randomIdent(void)
+{
+  uint32_t r = CO_hostTest_random(&seed);
+
+  /* some buffers share few CAN-IDs */
+  return ((r & 0x3U) == 0U) ? (uint16_t)(0x181U + ((r >> 2) % 4U)) : (uint16_t)(1U + ((r >> 2) % 0x57FU));
+}
+
+static void configure(uint16_t index)
+{
+  ident[index] = randomIdent();
+  CO_CANtxBufferInit(&sender, index, ident[index], false, 2U, false);
+}
+
+static bool_t drain(uint32_t timeout_ms)
+{
+  TickType_t start = xTaskGetTickCount();
+
+  while (((sender.CANtxCount > 0U) || (sender.txInflightCount > 0U)) &&
+         ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(timeout_ms)))
+  {
+    CO_CANmodule_process(&sender);
+    vTaskDelay(1);
+  }
+  return (sender.CANtxCount == 0U) && (sender.txInflightCount == 0U);
+}
+
+/* Sorted by CAN-ID, then by index */
+static int compareWaiting(const void *a, const void *b)
+{
+  uint16_t ia = *(const uint16_t *)a;
+  uint16_t ib = *(const uint16_t *)b;
+  uint32_t ka = ((uint32_t)ident[ia] << 16) | ia;
+  uint32_t kb = ((uint32_t)ident[ib] << 16) | ib;
+
+  return (ka > kb) - (ka < kb);
+}
+
+static uint32_t orderRound(CO_hostBus_t *bus, uint32_t round)
+{
+  uint16_t order[TX_BUFFERS], expected[TX_BUFFERS];
+  uint16_t direct = 0U, waiting = 0U, sent = 0U;
+  uint32_t errors = 0U;
+  uint16_t i;
+
+  CO_hostTest_recordReset(&recorder);
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    uint16_t j = (uint16_t)(CO_hostTest_random(&seed) % (i + 1U));
+
+    order[i] = order[j];
+    order[j] = i;
+  }
+  for (i = 0U; i < TX_BUFFERS / 2U; i++)
+  {
+    configure((uint16_t)(CO_hostTest_random(&seed) % TX_BUFFERS));
+  }
+
+  /* frames take 100 times longer, so TWAI queue stays full */
+  CO_hostBus_setTimeScale(bus, 100.0);
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    CO_CANtx_t *buffer = &senderTx[order[i]];
+
+    buffer->data[0] = (uint8_t)order[i];
+    buffer->data[1] = (uint8_t)round;
+    CO_CANsend(&sender, buffer);
+    sent++;
+    if (!buffer->bufferFull)
+    {
+      expected[direct++] = order[i];
+    }
+  }
+  /* reconfiguration drops waiting message, new CAN-ID takes its rank */
+  for (i = 0U; i < 8U; i++)
+  {
+    uint16_t index = (uint16_t)(CO_hostTest_random(&seed) % TX_BUFFERS);
+
+    if (senderTx[index].bufferFull)
+    {
+      configure(index);
+      sent--;
+      if ((i % 2U) == 0U)
+      {
+        senderTx[index].data[0] = (uint8_t)index;
+        senderTx[index].data[1] = (uint8_t)round;
+        CO_CANsend(&sender, &senderTx[index]);
+        sent++;
+      }
+    }
+  }
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    if (senderTx[i].bufferFull)
+    {
+      expected[direct + waiting++] = i;
+    }
+  }
+  if ((direct + waiting) != sent)
+  {
+    printf("round %u: %u sent, %u direct and %u waiting\n", (unsigned int)round, sent, direct, waiting);
+    errors++;
+  }
+  if (sender.CANtxCount != waiting)
+  {
+    printf("round %u: CANtxCount %u, %u waiting\n", (unsigned int)round, sender.CANtxCount, waiting);
+    errors++;
+  }
+  qsort(&expected[direct], waiting, sizeof(expected[0]), compareWaiting);
+
+  CO_hostBus_setTimeScale(bus, 0.0);
+  if (!drain(2000U) || (CO_hostTest_recordWait(&recorder, sent, 2000U) != sent))
+  {
+    printf("round %u: %u of %u frames received\n", (unsigned int)round,
+           (unsigned int)CO_hostTest_recorded(&recorder), sent);
+    return errors + 1U;
+  }
+  for (i = 0U; i < sent; i++)
+  {
+    if (((frames[i].data[0] != expected[i]) || (frames[i].ident != ident[expected[i]])) && (errors++ < 5U))
+    {
+      printf("round %u, frame %u: buffer %u 0x%03X, expected buffer %u 0x%03X (%u direct)\n", (unsigned int)round, i,
+             frames[i].data[0], (unsigned int)frames[i].ident, expected[i], ident[expected[i]], direct);
+    }
+  }
+  return errors;
+}
+
+static void latency(CO_hostBus_t *bus)
+{
+  CO_hostBusStats_t stats;
+  uint64_t framesBase;
+  uint32_t aheadMax = 0U;
+  const uint16_t high = TX_BUFFERS - 1U;
+  uint32_t offered = 0U, highSent = 0U, i;
+  int64_t start, lastHigh = 0, latencyMax = 0, latencySum = 0;
+  uint32_t highReceived = 0U;
+  uint16_t next = 0U;
+
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    CO_CANtxBufferInit(&sender, (uint16_t)i, (uint16_t)(0x481U + i), false, 8U, false);
+  }
+  /* EMCY of node 1 in the last buffer, the worst case of index order */
+  CO_CANtxBufferInit(&sender, high, 0x081U, false, 8U, false);
+  drain(1000U);
+  vTaskDelay(pdMS_TO_TICKS(10));
+  CO_hostTest_recordReset(&recorder);
+  CO_hostBus_getStats(bus, &stats);
+  framesBase = stats.frames;
+
+  start = esp_timer_get_time();
+  while ((esp_timer_get_time() - start) < (int64_t)LATENCY_MS * 1000)
+  {
+    int64_t now = esp_timer_get_time();
+
+    /* low priority buffers are sent again, as soon as they are free */
+    for (i = 0U; i < LOW_BUFFERS; i++)
+    {
+      if (!senderTx[next].bufferFull)
+      {
+        CO_CANsend(&sender, &senderTx[next]);
+        offered++;
+      }
+      next = (uint16_t)((next + 1U) % LOW_BUFFERS);
+    }
+    if ((now - lastHigh) >= 20000)
+    {
+      uint32_t now32 = (uint32_t)now;
+      uint32_t onBus;
+
+      /* time and number of frames already on the bus */
+      CO_hostBus_getStats(bus, &stats);
+      onBus = (uint32_t)(stats.frames - framesBase);
+      lastHigh = now;
+      memcpy(&senderTx[high].data[0], &now32, sizeof(now32));
+      memcpy(&senderTx[high].data[4], &onBus, sizeof(onBus));
+      CO_CANsend(&sender, &senderTx[high]);
+      highSent++;
+    }
+    CO_CANmodule_process(&sender);
+    vTaskDelay(1);
+  }
+  drain(1000U);
+  CO_hostTest_recordWait(&recorder, FRAMES_MAX, 100U);
+
+  for (i = 0U; (i < CO_hostTest_recorded(&recorder)) && (i < FRAMES_MAX); i++)
+  {
+    if (frames[i].ident == 0x081U)
+    {
+      uint32_t sentTime, onBus;
+      int64_t latency;
+
+      memcpy(&sentTime, &frames[i].data[0], sizeof(sentTime));
+      memcpy(&onBus, &frames[i].data[4], sizeof(onBus));
+      if ((i - onBus) > aheadMax)
+      {
+        aheadMax = i - onBus;
+      }
+      latency = (int64_t)(uint32_t)((uint32_t)frames[i].time_us - sentTime);
+      latencySum += latency;
+      if (latency > latencyMax)
+      {
+        latencyMax = latency;
+      }
+      highReceived++;
+    }
+  }
+  printf("high priority message under saturated bus: %u of %u received, up to %u frames before it, latency mean "
+         "%.0f us, max %lld us, %u low priority messages offered\n",
+         (unsigned int)highReceived, (unsigned int)highSent, (unsigned int)aheadMax,
+         (highReceived > 0U) ? (double)latencySum / highReceived : 0.0, (long long)latencyMax, (unsigned int)offered);
+  CO_HOST_TEST_CHECK(highReceived == highSent, "%u of %u high priority messages received",
+                     (unsigned int)highReceived, (unsigned int)highSent);
+  /* only TWAI queue and frame on the bus are ahead */
+  CO_HOST_TEST_CHECK(aheadMax <= (CO_CAN_TX_QUEUE_LEN + 1U), "%u frames before high priority message",
+                     (unsigned int)aheadMax);
+}
+
+int main(void)
+{
+  CO_hostBus_t *bus;
+  CO_hostNode_t *senderNode, *receiverNode;
+  uint32_t round, errors = 0U;
+  uint16_t i;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(NULL);
+  receiverNode = CO_hostNode_create(bus, "receiver");
+  senderNode = CO_hostNode_create(bus, "sender");
+
+  CO_hostNode_bind(receiverNode);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, 1U, receiverTx, 1U, 1000U);
+  CO_CANrxBufferInit(&receiver, 0U, 0U, 0U, false, &recorder, CO_hostTest_record);
+  CO_CANsetNormalMode(&receiver);
+  CO_CANrxTaskStart(&receiver);
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, TX_BUFFERS, 1000U);
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    configure(i);
+  }
+  CO_CANsetNormalMode(&sender);
+
+  for (round = 0U; round < ROUNDS; round++)
+  {
+    errors += orderRound(bus, round);
+  }
+  CO_HOST_TEST_CHECK(errors == 0U, "%u errors in priority order", (unsigned int)errors);
+  printf("%u rounds of %u messages sent in random order\n", ROUNDS, TX_BUFFERS);
+
+  CO_hostBus_setTimeScale(bus, 1.0);
+  CO_CANsetBitRate(&sender, 125U);
+  CO_hostNode_bind(receiverNode);
+  CO_CANsetBitRate(&receiver, 125U);
+  CO_hostNode_bind(senderNode);
+  latency(bus);
+
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_bind(receiverNode);
+  CO_CANrxTaskStop(&receiver);
+  CO_CANmodule_disable(&receiver);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(receiverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,296 @@
+/*
+ * Host test of non-blocking transmit and deferred sending of ESP32 TWAI
+ * driver.
+ *
+ * @file        test_txQueue.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Sender node sends from mainline only, receiver node records the bus with
+ * its receive task. Bus runs in real time at 125 kbit/s, so 8-byte frame
+ * takes about 1 ms.
+ * - Burst of all tx buffers: CO_CANsend() never waits, messages, which don't
+ *   fit into TWAI queue, wait in txArray and CO_CANmodule_process() sends
+ *   them all. Overflow of waiting buffer, firstCANtxMessage and
+ *   bufferInhibitFlag of synchronous message are checked.
+ * - Saturated bus: mainline offers twice the bus capacity for a while.
+ *   CANtxCount must always equal the number of waiting buffers, bus must be
+ *   fully used and the last data of each buffer must be received. CO_CANsend()
+ *   time, throughput and latency are printed. */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define BITRATE 125U
+#define TX_BUFFERS 32U
+#define SATURATE_MS 1500U
+#define FRAMES_MAX 4096U
+/* CO_CANsend() blocked up to 10 ms in twai_transmit() before */
+#define SEND_MAX_US 5000
+
+static CO_CANmodule_t sender, receiver;
+static CO_CANrx_t senderRx[1], receiverRx[1];
+static CO_CANtx_t senderTx[TX_BUFFERS], receiverTx[1];
+static CO_hostTestFrame_t frames[FRAMES_MAX];
+static CO_hostTestRecorder_t recorder = {frames, FRAMES_MAX, 0U};
+static int64_t sendMax_us;
+
+static uint16_t waitingBuffers(void)
+{
+  uint16_t count = 0U;
+  uint16_t i;
+
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    if (senderTx[i].bufferFull)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+static CO_ReturnError_t send(uint16_t index)
+{
+  int64_t start = esp_timer_get_time();
+  CO_ReturnError_t err = CO_CANsend(&sender, &senderTx[index]);
+  int64_t time_us = esp_timer_get_time() - start;
+
+  if (time_us > sendMax_us)
+  {
+    sendMax_us = time_us;
+  }
+  return err;
+}
+
+/* Call CO_CANmodule_process() until all messages are sent */
+static bool_t drain(uint32_t timeout_ms)
+{
+  TickType_t start = xTaskGetTickCount();
+
+  while (((sender.CANtxCount > 0U) || (sender.txInflightCount > 0U)) &&
+         ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(timeout_ms)))
+  {
+    CO_CANmodule_process(&sender);
+    vTaskDelay(1);
+  }
+  return (sender.CANtxCount == 0U) && (sender.txInflightCount == 0U);
+}
+
+static void txConfig(bool_t syncFirst)
+{
+  uint16_t i;
+
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    CO_CANtxBufferInit(&sender, i, (uint16_t)(0x181U + i), false, 8U, syncFirst && (i == 0U));
+  }
+}
+
+static void burst(void)
+{
+  uint32_t queued, i;
+  CO_ReturnError_t err;
+
+  CO_hostTest_recordReset(&recorder);
+  CO_HOST_TEST_CHECK(sender.firstCANtxMessage, "firstCANtxMessage not set by CO_CANmodule_init()");
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    senderTx[i].data[0] = (uint8_t)i;
+    senderTx[i].data[1] = 0x11U;
+    err = send((uint16_t)i);
+    CO_HOST_TEST_CHECK(err == CO_ERROR_NO, "CO_CANsend() of buffer %u returned %d", (unsigned int)i, (int)err);
+  }
+  queued = sender.CANtxCount;
+  CO_HOST_TEST_CHECK((queued > 0U) && (queued == waitingBuffers()), "CANtxCount %u, waiting buffers %u",
+                     (unsigned int)queued, (unsigned int)waitingBuffers());
+
+  /* waiting message is sent with new data, but counted once */
+  senderTx[TX_BUFFERS - 1U].data[1] = 0x22U;
+  err = send(TX_BUFFERS - 1U);
+  CO_HOST_TEST_CHECK(err == CO_ERROR_TX_OVERFLOW, "overflow returned %d", (int)err);
+  CO_HOST_TEST_CHECK(sender.CANtxCount == queued, "CANtxCount %u after overflow, was %u",
+                     (unsigned int)sender.CANtxCount, (unsigned int)queued);
+  CO_HOST_TEST_CHECK((sender.CANerrorStatus & CO_CAN_ERRTX_OVERFLOW) == 0U, "overflow error before bootup was sent");
+
+  CO_HOST_TEST_CHECK(drain(1000U), "%u messages not sent", (unsigned int)sender.CANtxCount);
+  CO_HOST_TEST_CHECK(!sender.firstCANtxMessage, "firstCANtxMessage not cleared");
+  CO_HOST_TEST_CHECK(waitingBuffers() == 0U, "%u buffers still waiting", (unsigned int)waitingBuffers());
+  CO_HOST_TEST_CHECK(CO_hostTest_recordWait(&recorder, TX_BUFFERS, 1000U) == TX_BUFFERS, "%u of %u frames received",
+                     (unsigned int)CO_hostTest_recorded(&recorder), TX_BUFFERS);
+  for (i = 0U; (i < TX_BUFFERS) && (i < CO_hostTest_recorded(&recorder)); i++)
+  {
+    CO_HOST_TEST_CHECK((frames[i].ident == (0x181U + i)) && (frames[i].data[0] == i), "frame %u is 0x%03X",
+                       (unsigned int)i, (unsigned int)frames[i].ident);
+  }
+  CO_HOST_TEST_CHECK(frames[TX_BUFFERS - 1U].data[1] == 0x22U, "waiting message sent with old data");
+
+  /* after bootup overflow is an error */
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    send((uint16_t)i);
+  }
+  send(TX_BUFFERS - 1U);
+  CO_HOST_TEST_CHECK((sender.CANerrorStatus & CO_CAN_ERRTX_OVERFLOW) != 0U, "no overflow error");
+  CO_HOST_TEST_CHECK(drain(1000U), "%u messages not sent", (unsigned int)sender.CANtxCount);
+}
+
+/* Synchronous message goes only into empty TWAI queue and inhibits others
+ * until it is sent */
+static void syncMessage(void)
+{
+  uint16_t i;
+
+  txConfig(true);
+  send(0U);
+  CO_HOST_TEST_CHECK(sender.bufferInhibitFlag && (sender.CANtxCount == 0U), "synchronous message not sent");
+  CO_HOST_TEST_CHECK(drain(1000U), "synchronous message not retired");
+  CO_HOST_TEST_CHECK(!sender.bufferInhibitFlag, "bufferInhibitFlag not cleared");
+
+  for (i = 1U; i < 4U; i++)
+  {
+    send(i);
+  }
+  send(0U);
+  CO_HOST_TEST_CHECK(senderTx[0].bufferFull && (sender.CANtxCount == 1U),
+                     "synchronous message not waiting behind others");
+  CO_HOST_TEST_CHECK(drain(1000U), "synchronous message not sent after others");
+  CO_HOST_TEST_CHECK(!sender.bufferInhibitFlag, "bufferInhibitFlag not cleared");
+  txConfig(false);
+}
+
+/* Mainline offers two frames each millisecond, twice the bus capacity */
+static void saturate(CO_hostBus_t *bus)
+{
+  uint32_t lastData[TX_BUFFERS] = {0};
+  uint32_t offered = 0U, overflows = 0U, violations = 0U;
+  uint32_t received, seq = 0U, i;
+  CO_hostBusStats_t stats0, stats1;
+  int64_t start, elapsed_us, latencySum = 0, latencyMax = 0;
+  uint16_t next = 0U;
+
+  CO_hostTest_recordReset(&recorder);
+  sendMax_us = 0;
+  CO_hostBus_getStats(bus, &stats0);
+  start = esp_timer_get_time();
+  while ((esp_timer_get_time() - start) < (int64_t)SATURATE_MS * 1000)
+  {
+    for (i = 0U; i < 2U; i++)
+    {
+      CO_CANtx_t *buffer = &senderTx[next];
+      uint32_t now = (uint32_t)esp_timer_get_time();
+
+      seq++;
+      memcpy(&buffer->data[0], &now, sizeof(now));
+      memcpy(&buffer->data[4], &seq, sizeof(seq));
+      lastData[next] = seq;
+      if (send(next) == CO_ERROR_TX_OVERFLOW)
+      {
+        overflows++;
+      }
+      offered++;
+      next = (uint16_t)((next + 1U) % TX_BUFFERS);
+    }
+    CO_CANmodule_process(&sender);
+    if (sender.CANtxCount != waitingBuffers())
+    {
+      violations++;
+    }
+    vTaskDelay(1);
+  }
+  elapsed_us = esp_timer_get_time() - start;
+  CO_hostBus_getStats(bus, &stats1);
+  received = CO_hostTest_recorded(&recorder);
+
+  CO_HOST_TEST_CHECK(violations == 0U, "CANtxCount differed from waiting buffers %u times", (unsigned int)violations);
+  CO_HOST_TEST_CHECK(drain(1000U), "%u messages not sent", (unsigned int)sender.CANtxCount);
+  CO_hostTest_recordWait(&recorder, FRAMES_MAX, 100U);
+  CO_HOST_TEST_CHECK(CO_hostTest_recorded(&recorder) <= FRAMES_MAX, "recorder too small");
+
+  /* the last message of each buffer must not get lost in txArray */
+  for (i = 0U; (i < CO_hostTest_recorded(&recorder)) && (i < FRAMES_MAX); i++)
+  {
+    uint32_t sent, frameSeq;
+    int64_t latency;
+
+    memcpy(&sent, &frames[i].data[0], sizeof(sent));
+    memcpy(&frameSeq, &frames[i].data[4], sizeof(frameSeq));
+    latency = (int64_t)(uint32_t)((uint32_t)frames[i].time_us - sent);
+    latencySum += latency;
+    if (latency > latencyMax)
+    {
+      latencyMax = latency;
+    }
+    if (lastData[frames[i].ident - 0x181U] == frameSeq)
+    {
+      lastData[frames[i].ident - 0x181U] = 0U;
+    }
+  }
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    CO_HOST_TEST_CHECK(lastData[i] == 0U, "last message of buffer %u not received", (unsigned int)i);
+  }
+
+  printf("saturated %u kbit/s bus, %u ms: %u frames offered, %u overflows, %u received (%.0f frames/s), "
+         "bus load %.1f %%\n",
+         BITRATE, SATURATE_MS, (unsigned int)offered, (unsigned int)overflows, (unsigned int)received,
+         (double)received * 1e6 / (double)elapsed_us, (double)(stats1.busyNs - stats0.busyNs) / (double)elapsed_us / 10.0);
+  printf("latency from CO_CANsend() to reception: mean %.0f us, max %lld us; CO_CANsend() max %lld us\n",
+         (CO_hostTest_recorded(&recorder) > 0U) ? (double)latencySum / CO_hostTest_recorded(&recorder) : 0.0,
+         (long long)latencyMax, (long long)sendMax_us);
+  CO_HOST_TEST_CHECK((double)(stats1.busyNs - stats0.busyNs) >= (double)elapsed_us * 1000.0 * 0.85,
+                     "bus not saturated");
+}
+
+int main(void)
+{
+  CO_hostBus_t *bus;
+  CO_hostNode_t *senderNode, *receiverNode;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(NULL);
+  receiverNode = CO_hostNode_create(bus, "receiver");
+  senderNode = CO_hostNode_create(bus, "sender");
+
+  CO_hostNode_bind(receiverNode);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, 1U, receiverTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&receiver, 0U, 0U, 0U, false, &recorder, CO_hostTest_record);
+  CO_CANsetNormalMode(&receiver);
+  CO_CANrxTaskStart(&receiver);
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, TX_BUFFERS, BITRATE);
+  txConfig(false);
+  CO_CANsetNormalMode(&sender);
+
+  burst();
+  syncMessage();
+  CO_HOST_TEST_CHECK(sendMax_us < SEND_MAX_US, "CO_CANsend() took %lld us", (long long)sendMax_us);
+  saturate(bus);
+  CO_HOST_TEST_CHECK(sendMax_us < SEND_MAX_US, "CO_CANsend() took %lld us", (long long)sendMax_us);
+
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_bind(receiverNode);
+  CO_CANrxTaskStop(&receiver);
+  CO_CANmodule_disable(&receiver);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(receiverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
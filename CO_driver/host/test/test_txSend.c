@@ -0,0 +1,215 @@
+/*
+ * Host test of transmit buffer layout and send path of ESP32 TWAI driver.
+ *
+ * @file        test_txSend.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Sender node sends from mainline, receiver node records the bus.
+ * - Layout: CO_CANtx_t members used by the stack alias its twai_message_t,
+ *   CO_CANtxBufferInit() precomputes RTR flag and clears it again.
+ * - Frames on the bus are exactly the tx buffers, remote frames included.
+ * - Benchmark: CPU time per frame of CO_CANsend() into empty TWAI queue is
+ *   compared with marshalling of the previous driver (copy to stack
+ *   twai_message_t with byte loop) followed by twai_transmit(), and with the
+ *   marshalling alone, which the layout removed. */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define TX_BUFFERS 8U
+#define FRAMES_MAX 64U
+#define BENCH_BATCHES 5000U
+
+static CO_CANmodule_t sender, receiver;
+static CO_CANrx_t senderRx[1], receiverRx[2];
+static CO_CANtx_t senderTx[TX_BUFFERS], receiverTx[1];
+static CO_hostTestFrame_t frames[FRAMES_MAX];
+static CO_hostTestRecorder_t recorder = {frames, FRAMES_MAX, 0U};
+
+/* Send path of the previous driver, without its locking */
+static __attribute__((noinline)) void marshal(const CO_CANtx_t *buffer, twai_message_t *msg)
+{
+  msg->identifier = buffer->ident;
+  msg->data_length_code = buffer->DLC;
+  msg->flags = TWAI_MSG_FLAG_NONE;
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    msg->data[i] = buffer->data[i];
+  }
+  __asm__ volatile("" : : "r"(msg) : "memory");
+}
+
+static esp_err_t marshalSend(const CO_CANtx_t *buffer)
+{
+  twai_message_t msg;
+
+  marshal(buffer, &msg);
+  return twai_transmit(&msg, 0);
+}
+
+/* Wait until TWAI transmit queue of sender is empty and retired */
+static void txIdle(void)
+{
+  twai_status_info_t status = {0};
+
+  while ((twai_get_status_info(&status) == ESP_OK) && ((status.msgs_to_tx > 0U) || (sender.txInflightCount > 0U)))
+  {
+    CO_CANmodule_process(&sender);
+    vTaskDelay(0);
+  }
+}
+
+static void layout(void)
+{
+  CO_CANtx_t *buffer;
+  uint8_t i;
+
+  buffer = CO_CANtxBufferInit(&sender, 0U, 0x701U, false, 1U, false);
+  CO_HOST_TEST_CHECK((buffer->msg.identifier == 0x701U) && (buffer->msg.data_length_code == 1U) &&
+                         (buffer->msg.flags == TWAI_MSG_FLAG_NONE),
+                     "data frame: 0x%03X, DLC %u, flags 0x%X", (unsigned int)buffer->msg.identifier,
+                     buffer->msg.data_length_code, (unsigned int)buffer->msg.flags);
+  for (i = 0U; i < 8U; i++)
+  {
+    buffer->data[i] = (uint8_t)(0xA0U + i);
+  }
+  CO_HOST_TEST_CHECK(memcmp(buffer->msg.data, "\xA0\xA1\xA2\xA3\xA4\xA5\xA6\xA7", 8U) == 0, "data not aliased");
+
+  buffer = CO_CANtxBufferInit(&sender, 1U, 0x181U, true, 8U, false);
+  CO_HOST_TEST_CHECK((buffer->msg.identifier == 0x181U) && (buffer->msg.data_length_code == 8U) &&
+                         ((buffer->msg.flags & TWAI_MSG_FLAG_RTR) != 0U),
+                     "remote frame: 0x%03X, DLC %u, flags 0x%X", (unsigned int)buffer->msg.identifier,
+                     buffer->msg.data_length_code, (unsigned int)buffer->msg.flags);
+  buffer = CO_CANtxBufferInit(&sender, 1U, 0x182U, false, 2U, true);
+  CO_HOST_TEST_CHECK((buffer->msg.identifier == 0x182U) && (buffer->msg.flags == TWAI_MSG_FLAG_NONE),
+                     "reconfigured: 0x%03X, flags 0x%X", (unsigned int)buffer->msg.identifier,
+                     (unsigned int)buffer->msg.flags);
+  CO_CANtxBufferInit(&sender, 2U, 0x601U, true, 0U, false);
+
+  /* the same frames on the bus, synchronous one waits for empty queue and
+   * the remote frame passes it */
+  memcpy(senderTx[1].data, "\x11\x22\x00\x00\x00\x00\x00\x00", 8U);
+  for (i = 0U; i < 3U; i++)
+  {
+    CO_CANsend(&sender, &senderTx[i]);
+  }
+  txIdle();
+  CO_HOST_TEST_CHECK(CO_hostTest_recordWait(&recorder, 3U, 1000U) == 3U, "%u of 3 frames received",
+                     (unsigned int)CO_hostTest_recorded(&recorder));
+  CO_HOST_TEST_CHECK((frames[0].ident == 0x701U) && (frames[0].DLC == 1U) && (frames[0].data[0] == 0xA0U) &&
+                         ((frames[0].flags & TWAI_MSG_FLAG_RTR) == 0U),
+                     "frame 0x%03X, DLC %u, flags 0x%X", (unsigned int)frames[0].ident, frames[0].DLC,
+                     (unsigned int)frames[0].flags);
+  CO_HOST_TEST_CHECK((frames[1].ident == 0x601U) && (frames[1].DLC == 0U) &&
+                         ((frames[1].flags & TWAI_MSG_FLAG_RTR) != 0U),
+                     "remote frame 0x%03X, DLC %u, flags 0x%X", (unsigned int)frames[1].ident, frames[1].DLC,
+                     (unsigned int)frames[1].flags);
+  CO_HOST_TEST_CHECK((frames[2].ident == 0x182U) && (frames[2].DLC == 2U) && (frames[2].data[1] == 0x22U) &&
+                         ((frames[2].flags & TWAI_MSG_FLAG_RTR) == 0U),
+                     "frame 0x%03X, DLC %u, flags 0x%X", (unsigned int)frames[2].ident, frames[2].DLC,
+                     (unsigned int)frames[2].flags);
+}
+
+static void benchmark(void)
+{
+  int64_t sendNs = 0, marshalSendNs = 0, marshalNs = 0, start;
+  uint32_t sent = 0U, marshalSent = 0U, deferred, batch;
+  twai_message_t msg;
+  uint16_t i;
+
+  for (i = 0U; i < TX_BUFFERS; i++)
+  {
+    CO_CANtxBufferInit(&sender, i, (uint16_t)(0x181U + i), false, 8U, false);
+  }
+  txIdle();
+  deferred = sender.stats.txDeferred;
+
+  for (batch = 0U; batch < BENCH_BATCHES; batch++)
+  {
+    /* TWAI queue takes all frames of batch */
+    txIdle();
+    start = CO_hostTest_cpuNs();
+    for (i = 0U; i < TX_BUFFERS; i++)
+    {
+      sent += (CO_CANsend(&sender, &senderTx[i]) == CO_ERROR_NO) ? 1U : 0U;
+    }
+    sendNs += CO_hostTest_cpuNs() - start;
+
+    txIdle();
+    start = CO_hostTest_cpuNs();
+    for (i = 0U; i < TX_BUFFERS; i++)
+    {
+      marshalSent += (marshalSend(&senderTx[i]) == ESP_OK) ? 1U : 0U;
+    }
+    marshalSendNs += CO_hostTest_cpuNs() - start;
+
+    start = CO_hostTest_cpuNs();
+    for (i = 0U; i < TX_BUFFERS; i++)
+    {
+      marshal(&senderTx[i], &msg);
+    }
+    marshalNs += CO_hostTest_cpuNs() - start;
+  }
+  txIdle();
+
+  CO_HOST_TEST_CHECK((sent == (BENCH_BATCHES * TX_BUFFERS)) && (marshalSent == sent) &&
+                         (sender.stats.txDeferred == deferred),
+                     "%u and %u frames sent, %u deferred", (unsigned int)sent, (unsigned int)marshalSent,
+                     (unsigned int)(sender.stats.txDeferred - deferred));
+  printf("send into empty TWAI queue: CO_CANsend() %.0f ns/frame, previous marshalling and twai_transmit() "
+         "%.0f ns/frame, marshalling alone %.1f ns/frame\n",
+         (double)sendNs / sent, (double)marshalSendNs / marshalSent, (double)marshalNs / sent);
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 0.0};
+  CO_hostBus_t *bus;
+  CO_hostNode_t *senderNode, *receiverNode;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  receiverNode = CO_hostNode_create(bus, "receiver");
+  senderNode = CO_hostNode_create(bus, "sender");
+
+  CO_hostNode_bind(receiverNode);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, 2U, receiverTx, 1U, 1000U);
+  CO_CANrxBufferInit(&receiver, 0U, 0U, 0U, false, &recorder, CO_hostTest_record);
+  CO_CANrxBufferInit(&receiver, 1U, 0U, 0U, true, &recorder, CO_hostTest_record);
+  CO_CANsetNormalMode(&receiver);
+  CO_CANrxTaskStart(&receiver);
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, TX_BUFFERS, 1000U);
+  CO_CANsetNormalMode(&sender);
+
+  layout();
+  /* recorder is full after FRAMES_MAX frames, its callback only counts */
+  benchmark();
+
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_bind(receiverNode);
+  CO_CANrxTaskStop(&receiver);
+  CO_CANmodule_disable(&receiver);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(receiverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+/*
+ * Host test of synchronous TPDO handling at the end of SYNC window of ESP32
+ * TWAI driver.
+ *
+ * @file        test_txSync.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Sender node sends from mainline at 25 kbit/s in real time, so a frame takes
+ * about 5 ms on the bus. Receiver node records the bus with its receive task.
+ * CO_CANclearPendingSyncPDOs() is called, as at the end of SYNC window:
+ * - TPDO, which was transmitted, but not retired by CO_CANmodule_process()
+ *   yet, is not late.
+ * - TPDO, which is still in the controller, is late, it is transmitted.
+ * - TPDO, which waits in txArray behind other frames, is late and dropped.
+ *   Other frames in TWAI queue and txArray are all transmitted.
+ * Frame with higher CAN-ID passes TPDO waiting for empty TWAI queue, but only
+ * once, the next one waits, until TPDO is transmitted. */
+
+#include "301/CO_driver.h"
+#include "CO_hostBus.h"
+#include "CO_hostTest.h"
+
+#define BITRATE 25U
+#define OTHERS 8U
+#define TPDO_INDEX OTHERS
+#define TPDO_IDENT 0x181U
+#define FRAMES_MAX 64U
+
+static CO_CANmodule_t sender, receiver;
+static CO_CANrx_t senderRx[1], receiverRx[1];
+static CO_CANtx_t senderTx[OTHERS + 1U], receiverTx[1];
+static CO_hostNode_t *senderNode, *receiverNode;
+static CO_hostTestFrame_t frames[FRAMES_MAX];
+static CO_hostTestRecorder_t recorder = {frames, FRAMES_MAX, 0U};
+
+/* Wait until the bus is idle, without CO_CANmodule_process() */
+static void busIdle(uint32_t count)
+{
+  twai_status_info_t status = {0};
+  TickType_t start = xTaskGetTickCount();
+
+  CO_hostTest_recordWait(&recorder, count, 1000U);
+  while ((twai_get_status_info(&status) == ESP_OK) && (status.msgs_to_tx > 0U) &&
+         ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(1000)))
+  {
+    vTaskDelay(1);
+  }
+}
+
+/* Clear pending synchronous TPDOs, returns true, if late TPDO was reported */
+static bool_t clearLate(void)
+{
+  bool_t late;
+
+  CO_CANclearPendingSyncPDOs(&sender);
+  late = (sender.CANerrorStatus & CO_CAN_ERRTX_PDO_LATE) != 0U;
+  sender.CANerrorStatus &= (uint16_t)~CO_CAN_ERRTX_PDO_LATE;
+  return late;
+}
+
+static uint32_t received(uint32_t from, uint16_t ident)
+{
+  uint32_t i, n = 0U;
+
+  for (i = from; (i < CO_hostTest_recorded(&recorder)) && (i < FRAMES_MAX); i++)
+  {
+    n += (frames[i].ident == ident) ? 1U : 0U;
+  }
+  return n;
+}
+
+static void transmitted(void)
+{
+  uint32_t count = CO_hostTest_recorded(&recorder);
+
+  CO_CANsend(&sender, &senderTx[TPDO_INDEX]);
+  busIdle(count + 1U);
+  CO_HOST_TEST_CHECK(received(count, TPDO_IDENT) == 1U, "TPDO not transmitted");
+  CO_HOST_TEST_CHECK(!clearLate(), "transmitted TPDO reported late");
+  CO_CANmodule_process(&sender);
+}
+
+static void inController(void)
+{
+  uint32_t count = CO_hostTest_recorded(&recorder);
+  bool_t late;
+
+  CO_CANsend(&sender, &senderTx[TPDO_INDEX]);
+  late = clearLate();
+  busIdle(count + 1U);
+  CO_HOST_TEST_CHECK(late, "TPDO in controller not reported late");
+  CO_HOST_TEST_CHECK(received(count, TPDO_IDENT) == 1U, "TPDO in controller not transmitted");
+  CO_CANmodule_process(&sender);
+}
+
+static void staged(void)
+{
+  uint32_t count = CO_hostTest_recorded(&recorder);
+  uint16_t i;
+  bool_t late;
+
+  for (i = 0U; i < (OTHERS / 2U); i++)
+  {
+    CO_CANsend(&sender, &senderTx[i]);
+  }
+  CO_CANsend(&sender, &senderTx[TPDO_INDEX]);
+  for (; i < OTHERS; i++)
+  {
+    CO_CANsend(&sender, &senderTx[i]);
+  }
+  late = clearLate();
+  for (i = 0U; (i < 100U) && (CO_hostTest_recorded(&recorder) < (count + OTHERS)); i++)
+  {
+    CO_CANmodule_process(&sender);
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+  busIdle(count + OTHERS);
+  CO_HOST_TEST_CHECK(late, "staged TPDO not reported late");
+  CO_HOST_TEST_CHECK(received(count, TPDO_IDENT) == 0U, "staged TPDO transmitted");
+  CO_HOST_TEST_CHECK((CO_hostTest_recorded(&recorder) - count) == OTHERS, "%u of %u other frames transmitted",
+                     (unsigned int)(CO_hostTest_recorded(&recorder) - count), OTHERS);
+}
+
+/* Index of the first frame with ident from recorded frame from */
+static uint32_t position(uint32_t from, uint16_t ident)
+{
+  uint32_t i;
+
+  for (i = from; (i < CO_hostTest_recorded(&recorder)) && (i < FRAMES_MAX); i++)
+  {
+    if (frames[i].ident == ident)
+    {
+      break;
+    }
+  }
+  return i;
+}
+
+static void passed(void)
+{
+  uint32_t count = CO_hostTest_recorded(&recorder);
+  uint16_t i, waitingPassed, waitingHeld;
+
+  for (i = 0U; i < (OTHERS / 2U); i++)
+  {
+    CO_CANsend(&sender, &senderTx[i]);
+  }
+  CO_CANsend(&sender, &senderTx[TPDO_INDEX]);
+  CO_CANsend(&sender, &senderTx[i]);
+  waitingPassed = sender.CANtxCount;
+  CO_CANsend(&sender, &senderTx[i + 1U]);
+  waitingHeld = sender.CANtxCount;
+  for (i = 0U; (i < 100U) && (CO_hostTest_recorded(&recorder) < (count + (OTHERS / 2U) + 3U)); i++)
+  {
+    CO_CANmodule_process(&sender);
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+  busIdle(count + (OTHERS / 2U) + 3U);
+  CO_HOST_TEST_CHECK((waitingPassed == 1U) && (waitingHeld == 2U), "%u and %u frames waiting behind TPDO",
+                     (unsigned int)waitingPassed, (unsigned int)waitingHeld);
+  CO_HOST_TEST_CHECK((position(count, 0x701U + (OTHERS / 2U)) < position(count, TPDO_IDENT)) &&
+                         (position(count, TPDO_IDENT) < position(count, 0x702U + (OTHERS / 2U))),
+                     "TPDO at %u, passing frame at %u, held frame at %u",
+                     (unsigned int)(position(count, TPDO_IDENT) - count),
+                     (unsigned int)(position(count, 0x701U + (OTHERS / 2U)) - count),
+                     (unsigned int)(position(count, 0x702U + (OTHERS / 2U)) - count));
+  CO_HOST_TEST_CHECK(!clearLate(), "TPDO reported late");
+}
+
+int main(void)
+{
+  CO_hostBusConfig_t config = {.timeScale = 1.0};
+  CO_hostBus_t *bus;
+  uint16_t i;
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  bus = CO_hostBus_create(&config);
+  receiverNode = CO_hostNode_create(bus, "receiver");
+  senderNode = CO_hostNode_create(bus, "sender");
+
+  CO_hostNode_bind(receiverNode);
+  CO_CANmodule_init(&receiver, NULL, receiverRx, 1U, receiverTx, 1U, BITRATE);
+  CO_CANrxBufferInit(&receiver, 0U, 0U, 0U, false, &recorder, CO_hostTest_record);
+  CO_CANsetNormalMode(&receiver);
+  CO_CANrxTaskStart(&receiver);
+
+  CO_hostNode_bind(senderNode);
+  CO_CANmodule_init(&sender, NULL, senderRx, 1U, senderTx, OTHERS + 1U, BITRATE);
+  for (i = 0U; i < OTHERS; i++)
+  {
+    CO_CANtxBufferInit(&sender, i, (uint16_t)(0x701U + i), false, 1U, false);
+  }
+  CO_CANtxBufferInit(&sender, TPDO_INDEX, TPDO_IDENT, false, 8U, true);
+  CO_CANsetNormalMode(&sender);
+
+  transmitted();
+  inController();
+  staged();
+  passed();
+  transmitted();
+  printf("%u frames received\n", (unsigned int)CO_hostTest_recorded(&recorder));
+
+  CO_CANmodule_disable(&sender);
+  CO_hostNode_bind(receiverNode);
+  CO_CANrxTaskStop(&receiver);
+  CO_CANmodule_disable(&receiver);
+  CO_hostNode_delete(senderNode);
+  CO_hostNode_delete(receiverNode);
+  CO_hostBus_delete(bus);
+  return CO_HOST_TEST_RESULT();
+}
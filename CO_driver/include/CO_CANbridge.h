@@ -0,0 +1,100 @@
+/*
+ * Bridge between two CAN modules for ESP32 TWAI driver.
+ *
+ * @file        CO_CANbridge.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_CAN_BRIDGE_H
+#define CO_CAN_BRIDGE_H
+
+#include "301/CO_driver.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if CO_CAN_BRIDGE
+
+    /* Range of identifiers, standard or extended */
+    typedef struct
+    {
+        uint32_t first;
+        uint32_t last;
+        bool_t extd;
+    } CO_CANbridgeRange_t;
+
+    /* Bridge forwards frames received by source CAN module, if identifier is
+     * in one of ranges, to target CAN module. Frame goes from receive buffer
+     * of source directly to TWAI transmit queue of target, before rx callback
+     * of source is called, without copy in between. Use two
+     * bridges for both directions. */
+    typedef struct CO_CANbridge_t
+    {
+        CO_CANmodule_t *source;
+        CO_CANmodule_t *target;
+        CO_CANbridgeRange_t ranges[CO_CAN_BRIDGE];
+        uint16_t count;
+        /* Frames given to target. Counters are written by rx task of source,
+         * other tasks read them with __atomic_load_n(). */
+        uint32_t forwarded;
+        /* Frames lost, because target was not in normal mode or its TWAI
+         * transmit queue was full */
+        uint32_t dropped;
+    } CO_CANbridge_t;
+
+    /* Initialize bridge from source to target without ranges. Bridge is not
+     * attached yet. */
+    CO_ReturnError_t CO_CANbridge_init(CO_CANbridge_t *bridge, CO_CANmodule_t *source, CO_CANmodule_t *target);
+
+    /* Add range of identifiers, first to last, with standard (extd false) or
+     * extended identifier. May be called also while bridge is attached.
+     * Returns CO_ERROR_OUT_OF_MEMORY, if all CO_CAN_BRIDGE ranges are used. */
+    CO_ReturnError_t CO_CANbridge_addRange(CO_CANbridge_t *bridge, uint32_t first, uint32_t last, bool_t extd);
+
+    /* Remove all ranges */
+    void CO_CANbridge_clear(CO_CANbridge_t *bridge);
+
+    /* Attach bridge to its source CAN module (enable true) or detach it.
+     * Acceptance filter of source is opened for all frames by the next
+     * CO_CANsetNormalMode(), so attach bridge before it. Detach waits for
+     * frame, which is being forwarded, so bridge is not used after return. */
+    void CO_CANbridge_attach(CO_CANbridge_t *bridge, bool_t enable);
+
+    /* Check, if frame is in one of ranges. Called by driver from CANreceive()
+     * of source inside its rxDispatchLock, together with rx buffer lookup. */
+    bool_t CO_CANbridge_match(const CO_CANbridge_t *bridge, const twai_message_t *msg);
+
+    /* Give matched frame to target. Called by driver from CANreceive() of
+     * source after rxDispatchLock is released, before rx callback. */
+    void CO_CANbridge_forward(CO_CANbridge_t *bridge, const twai_message_t *msg);
+
+#define CO_CAN_BRIDGE_MATCH(CAN_MODULE, msg) \
+    (((CAN_MODULE)->bridge != NULL) && CO_CANbridge_match((CAN_MODULE)->bridge, (msg)))
+#define CO_CAN_BRIDGE_FORWARD(CAN_MODULE, msg) CO_CANbridge_forward((CAN_MODULE)->bridge, (msg))
+#else
+#define CO_CAN_BRIDGE_MATCH(CAN_MODULE, msg) false
+#define CO_CAN_BRIDGE_FORWARD(CAN_MODULE, msg)
+#endif /* CO_CAN_BRIDGE */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_CAN_BRIDGE_H */
@@ -0,0 +1,126 @@
+/*
+ * Capture of received and sent CAN frames for ESP32 TWAI driver.
+ *
+ * @file        CO_CANcapture.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_CAN_CAPTURE_H
+#define CO_CAN_CAPTURE_H
+
+#include "301/CO_driver.h"
+#include "esp_timer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Flags in capture record. Extended and RTR flags are the same as in TWAI */
+#define CO_CAN_CAPTURE_FLAG_EXTD TWAI_MSG_FLAG_EXTD
+#define CO_CAN_CAPTURE_FLAG_RTR TWAI_MSG_FLAG_RTR
+#define CO_CAN_CAPTURE_FLAG_TX 0x80U
+
+    /* One captured frame */
+    typedef struct
+    {
+        int64_t timestamp_us; /* esp_timer time */
+        uint32_t ident;
+        uint16_t index; /* rx buffer or tx buffer index, CO_CAN_RX_LOOKUP_NONE if unmatched */
+        uint8_t flags;
+        uint8_t DLC;
+        uint8_t data[8];
+    } CO_CANcaptureRecord_t;
+
+    /* Capture ring. Records are preallocated by application, oldest are
+     * overwritten. */
+    typedef struct CO_CANcapture_t
+    {
+        CO_CANcaptureRecord_t *records;
+        uint32_t size;
+        uint32_t head;
+        volatile bool_t enabled;
+    } CO_CANcapture_t;
+
+    /* Function, which writes exported data, returns number of bytes written */
+    typedef size_t (*CO_CANcapture_write_t)(void *arg, const void *buf, size_t len);
+
+    /* Initialize capture ring, size must be power of 2. Capture is disabled. */
+    CO_ReturnError_t CO_CANcapture_init(CO_CANcapture_t *capture, CO_CANcaptureRecord_t records[], uint32_t size);
+
+    /* Attach capture ring to CAN module, NULL detaches it */
+    void CO_CANcapture_attach(CO_CANmodule_t *CANmodule, CO_CANcapture_t *capture);
+
+    /* Start or stop recording. Records should be exported while stopped. */
+    static inline void CO_CANcapture_enable(CO_CANcapture_t *capture, bool_t enable)
+    {
+        capture->enabled = enable;
+    }
+
+    /* Clear all records */
+    void CO_CANcapture_clear(CO_CANcapture_t *capture);
+
+    /* Number of valid records in ring */
+    uint32_t CO_CANcapture_count(const CO_CANcapture_t *capture);
+
+    /* Record frame. Called by driver from CANreceive() and CO_CANsend(), no
+     * allocation, no locking. */
+    static inline void CO_CANcapture_record(CO_CANcapture_t *capture, uint8_t flags, uint16_t index, const twai_message_t *msg)
+    {
+        uint32_t pos = __atomic_fetch_add(&capture->head, 1U, __ATOMIC_RELAXED);
+        CO_CANcaptureRecord_t *record = &capture->records[pos & (capture->size - 1U)];
+
+        record->timestamp_us = esp_timer_get_time();
+        record->ident = msg->identifier;
+        record->index = index;
+        record->flags = flags | (uint8_t)(msg->flags & (TWAI_MSG_FLAG_EXTD | TWAI_MSG_FLAG_RTR));
+        record->DLC = msg->data_length_code;
+        memcpy(record->data, msg->data, sizeof(record->data));
+    }
+
+    /* Export records, oldest first, as candump log text ("(sec.usec) ifName
+     * ident#data R|T" per line, data of remote frame is "R<dlc>"). Returns
+     * number of exported records. */
+    uint32_t CO_CANcapture_exportCandump(const CO_CANcapture_t *capture, const char *ifName,
+                                         CO_CANcapture_write_t write, void *arg);
+
+    /* Export records, oldest first, as pcap file with LINKTYPE_CAN_SOCKETCAN.
+     * Returns number of exported records. */
+    uint32_t CO_CANcapture_exportPcap(const CO_CANcapture_t *capture, CO_CANcapture_write_t write, void *arg);
+
+    /* Parse one line of candump log and, if it is a received frame, process it
+     * with CANreceiveMessage(), the same way as frame from TWAI. Sent frames
+     * and comments are skipped. Returns CO_ERROR_ILLEGAL_ARGUMENT, if line can
+     * not be parsed. */
+    CO_ReturnError_t CO_CANcapture_replayCandump(CO_CANmodule_t *CANmodule, const char *line);
+
+#if CO_CAN_CAPTURE
+#define CO_CAN_CAPTURE_FRAME(CAN_MODULE, flags, index, msg)                           \
+    if (((CAN_MODULE)->capture != NULL) && (CAN_MODULE)->capture->enabled)            \
+    {                                                                                 \
+        CO_CANcapture_record((CAN_MODULE)->capture, (flags), (index), (msg));         \
+    }
+#else
+#define CO_CAN_CAPTURE_FRAME(CAN_MODULE, flags, index, msg)
+#endif
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_CAN_CAPTURE_H */
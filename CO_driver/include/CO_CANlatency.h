@@ -0,0 +1,143 @@
+/*
+ * Latency histograms of received and sent CAN frames for ESP32 TWAI driver.
+ *
+ * @file        CO_CANlatency.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_CAN_LATENCY_H
+#define CO_CAN_LATENCY_H
+
+#include "301/CO_driver.h"
+#include "esp_timer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Histogram buckets are log2 of latency in microseconds: bucket 0 counts
+ * latencies below 2 us, bucket k counts [2^k, 2^(k+1)) us, the last bucket
+ * counts everything above. */
+#define CO_CAN_LATENCY_BUCKETS 20
+
+/* Frames are classified by CANopen function code, CAN-ID >> 7 */
+#define CO_CAN_LATENCY_CLASSES 16
+
+/* CAN-ID of SYNC message, start of SYNC to TPDO latency */
+#ifndef CO_CAN_LATENCY_SYNC_ID
+#define CO_CAN_LATENCY_SYNC_ID 0x080U
+#endif
+
+    /* Latency histogram, constant size */
+    typedef struct
+    {
+        uint32_t bucket[CO_CAN_LATENCY_BUCKETS];
+        uint32_t count;
+        uint32_t max_us;
+        uint64_t sum_us;
+    } CO_CANlatencyHist_t;
+
+    /* Histograms of one CAN module. Written with relaxed atomics from receive
+     * task and mainline, so it may be read at any time. */
+    typedef struct CO_CANlatency_t
+    {
+        /* Message received to its rx callback finished, by class */
+        CO_CANlatencyHist_t rxCallback[CO_CAN_LATENCY_CLASSES];
+        /* Message copied to TWAI queue to its transmission detected, by class */
+        CO_CANlatencyHist_t txComplete[CO_CAN_LATENCY_CLASSES];
+        /* SYNC received to synchronous TPDO transmitted */
+        CO_CANlatencyHist_t syncTpdo;
+        /* Time of the last SYNC */
+        int64_t syncTime_us;
+    } CO_CANlatency_t;
+
+    /* Function, which writes exported data, returns number of bytes written */
+    typedef size_t (*CO_CANlatency_write_t)(void *arg, const void *buf, size_t len);
+
+    /* Clear all histograms */
+    void CO_CANlatency_reset(CO_CANlatency_t *latency);
+
+    /* Attach histograms to CAN module, NULL detaches them */
+    void CO_CANlatency_attach(CO_CANmodule_t *CANmodule, CO_CANlatency_t *latency);
+
+    /* Add latency to histogram. No allocation, no locking. */
+    static inline void CO_CANlatency_record(CO_CANlatencyHist_t *hist, int64_t latency_us)
+    {
+        uint32_t us = (latency_us <= 0) ? 0U : ((latency_us >= (int64_t)UINT32_MAX) ? UINT32_MAX : (uint32_t)latency_us);
+        uint32_t k = (us < 2U) ? 0U : (31U - (uint32_t)__builtin_clz(us));
+        uint32_t max = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+
+        if (k >= CO_CAN_LATENCY_BUCKETS)
+        {
+            k = CO_CAN_LATENCY_BUCKETS - 1U;
+        }
+        __atomic_fetch_add(&hist->bucket[k], 1U, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&hist->count, 1U, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&hist->sum_us, (uint64_t)us, __ATOMIC_RELAXED);
+        while ((us > max) &&
+               !__atomic_compare_exchange_n(&hist->max_us, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+        }
+    }
+
+    /* Upper bound of the bucket, which contains given permille of latencies,
+     * for example 990 for 99th percentile. Returns 0, if histogram is empty. */
+    uint32_t CO_CANlatency_percentile(const CO_CANlatencyHist_t *hist, uint16_t permille);
+
+    /* Export non-empty histograms as text, one per line: "name class count
+     * mean max p50 p99 p999 : buckets". Returns number of exported lines. */
+    uint32_t CO_CANlatency_export(const CO_CANlatency_t *latency, CO_CANlatency_write_t write, void *arg);
+
+#if CO_CAN_LATENCY
+#define CO_CAN_LATENCY_RX(CAN_MODULE, ident, timestamp_us)                                       \
+    if ((CAN_MODULE)->latency != NULL)                                                           \
+    {                                                                                            \
+        CO_CANlatency_record(&(CAN_MODULE)->latency->rxCallback[((ident) >> 7) & 0x0FU],         \
+                             esp_timer_get_time() - (timestamp_us));                             \
+        if (((ident) & 0x07FFU) == CO_CAN_LATENCY_SYNC_ID)                                       \
+        {                                                                                        \
+            __atomic_store_n(&(CAN_MODULE)->latency->syncTime_us, (timestamp_us), __ATOMIC_RELAXED); \
+        }                                                                                        \
+    }
+/* SYNC to synchronous TPDO is measured from the last SYNC before TPDO was
+ * queued, later SYNC may come before its transmission is detected */
+#define CO_CAN_LATENCY_QUEUE(CAN_MODULE, inflight)                                                      \
+    (inflight)->syncTime_us =                                                                           \
+        ((CAN_MODULE)->latency != NULL) ? __atomic_load_n(&(CAN_MODULE)->latency->syncTime_us, __ATOMIC_RELAXED) : 0
+#define CO_CAN_LATENCY_TX(CAN_MODULE, buffer, inflight, now_us)                                         \
+    if ((CAN_MODULE)->latency != NULL)                                                                  \
+    {                                                                                                   \
+        CO_CANlatency_record(&(CAN_MODULE)->latency->txComplete[((buffer)->ident >> 7) & 0x0FU],        \
+                             (now_us) - (inflight)->queued_us);                                         \
+        if ((buffer)->syncFlag && ((inflight)->syncTime_us != 0))                                       \
+        {                                                                                               \
+            CO_CANlatency_record(&(CAN_MODULE)->latency->syncTpdo, (now_us) - (inflight)->syncTime_us); \
+        }                                                                                               \
+    }
+#else
+#define CO_CAN_LATENCY_RX(CAN_MODULE, ident, timestamp_us)
+#define CO_CAN_LATENCY_QUEUE(CAN_MODULE, inflight)
+#define CO_CAN_LATENCY_TX(CAN_MODULE, buffer, inflight, now_us)
+#endif
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_CAN_LATENCY_H */
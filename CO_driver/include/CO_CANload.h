@@ -0,0 +1,286 @@
+/*
+ * Bus load meter and top talkers of CAN module for ESP32 TWAI driver.
+ *
+ * @file        CO_CANload.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_CAN_LOAD_H
+#define CO_CAN_LOAD_H
+
+#include "301/CO_driver.h"
+#include "esp_timer.h"
+#if CO_CAN_LOAD_OD
+#include "301/CO_ODinterface.h"
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Width of time bucket in milliseconds. Time is counted in units of 1024 us,
+ * so frame path needs no 64-bit division, and bucket is 2.4 % longer. */
+#ifndef CO_CAN_LOAD_BUCKET_MS
+#define CO_CAN_LOAD_BUCKET_MS 10U
+#endif
+
+/* Number of time buckets. Utilization window is up to one bucket less than
+ * all of them, the last bucket is being filled. */
+#ifndef CO_CAN_LOAD_BUCKETS
+#define CO_CAN_LOAD_BUCKETS 100U
+#endif
+
+/* Number of COB-IDs counted per direction, power of 2. Frames of COB-IDs,
+ * which do not fit, are counted in idsOverflow. */
+#ifndef CO_CAN_LOAD_IDS
+#define CO_CAN_LOAD_IDS 64U
+#endif
+
+/* Window of utilization in Object Dictionary subindex 1, in milliseconds */
+#ifndef CO_CAN_LOAD_OD_WINDOW_MS
+#define CO_CAN_LOAD_OD_WINDOW_MS 100U
+#endif
+
+#define CO_CAN_LOAD_RX 0U
+#define CO_CAN_LOAD_TX 1U
+
+/* Flags of COB-ID key, identifier is in lower 29 bits */
+#define CO_CAN_LOAD_KEY_EXTD 0x20000000UL
+#define CO_CAN_LOAD_KEY_USED 0x80000000UL
+
+    /* Frames of one time bucket */
+    typedef struct
+    {
+        /* Number of bucket from start of esp_timer, bucket is valid only for
+         * that time */
+        uint32_t id;
+        uint32_t frames;
+        /* Bits on the wire without stuff bits, including interframe space */
+        uint32_t bits;
+        /* Stuff bits in the worst case */
+        uint32_t stuffBits;
+    } CO_CANloadBucket_t;
+
+    /* Frames of one COB-ID */
+    typedef struct
+    {
+        /* Identifier with CO_CAN_LOAD_KEY_ flags, 0 for empty entry */
+        uint32_t key;
+        uint32_t frames;
+        uint32_t bytes;
+        /* Bits with worst case stuffing */
+        uint32_t bits;
+    } CO_CANloadId_t;
+
+    /* Counters of one direction, written only from CANreceive() for rx or by
+     * holder of CO_LOCK_CAN_SEND for tx, with relaxed atomics, so they may be
+     * read at any time. */
+    typedef struct
+    {
+        CO_CANloadBucket_t buckets[CO_CAN_LOAD_BUCKETS];
+        CO_CANloadId_t ids[CO_CAN_LOAD_IDS];
+        uint32_t idsOverflow;
+    } CO_CANloadDir_t;
+
+    /* Bus load meter of one CAN module. Own frames are not received by TWAI,
+     * so bus load is sum of both directions. Frames rejected by acceptance
+     * filter are not received either, meter sees the whole bus only with
+     * CO_CAN_RX_FILTERS 0. */
+    typedef struct CO_CANload_t
+    {
+        CO_CANloadDir_t dir[2];
+        /* Bus bitrate in kbit/s, set by CO_CANload_attach() */
+        uint16_t bitRate;
+        /* Bucket with at least that load is part of burst */
+        uint16_t burstPermille;
+
+        /* Written by CO_CANload_process() only */
+        uint32_t processed;
+        uint16_t peakPermille;
+        /* Time of peak bucket start, lower 32 bits of esp_timer_get_time() */
+        uint32_t peakTime_us;
+        uint32_t bursts;
+        /* Buckets of the current burst and of the longest one */
+        uint32_t burstLength;
+        uint32_t burstMax;
+        /* Buckets, which were overwritten before CO_CANload_process() saw them */
+        uint32_t bucketsMissed;
+    } CO_CANload_t;
+
+    /* Load over window, frames of both directions */
+    typedef struct
+    {
+        uint32_t frames;
+        uint32_t bits;
+        uint32_t stuffBits;
+        /* Utilization without stuff bits and with worst case stuffing */
+        uint16_t permilleMin;
+        uint16_t permille;
+        /* Real window length in milliseconds */
+        uint32_t window_ms;
+    } CO_CANloadUtil_t;
+
+    /* Function, which writes exported data, returns number of bytes written */
+    typedef size_t (*CO_CANload_write_t)(void *arg, const void *buf, size_t len);
+
+    /* Clear all counters. burstPermille is utilization of one bucket, from
+     * which it counts as burst, 0 means 800. */
+    void CO_CANload_init(CO_CANload_t *load, uint16_t burstPermille);
+
+    /* Attach meter to CAN module, NULL detaches it. Bitrate is taken from CAN
+     * module and follows CO_CANsetBitRate(). */
+    void CO_CANload_attach(CO_CANmodule_t *CANmodule, CO_CANload_t *load);
+
+    /* Clear COB-ID tables, peak and bursts. Counters are not locked, frame
+     * counted at the same time may survive the reset. */
+    void CO_CANload_reset(CO_CANload_t *load);
+
+    /* Bits of frame on the wire, [extended][DLC], without stuff bits and worst
+     * case stuff bits. Data frame is 47 bits plus data (67 extended), stuffing
+     * applies to 34 bits plus data (54 extended), from SOF to CRC. */
+    extern const uint8_t CO_CANload_bits[2][9];
+    extern const uint8_t CO_CANload_stuffBits[2][9];
+
+    /* Count frame. Called by driver from CANreceive() and CO_CANsend(), no
+     * allocation, no locking, single writer per direction. */
+    static inline void CO_CANload_frame(CO_CANload_t *load, uint8_t dir, const twai_message_t *msg, int64_t time_us)
+    {
+        CO_CANloadDir_t *d = &load->dir[dir];
+        uint32_t extd = ((msg->flags & TWAI_MSG_FLAG_EXTD) != 0U) ? 1U : 0U;
+        uint32_t bytes = ((msg->flags & TWAI_MSG_FLAG_RTR) != 0U) ? 0U
+                         : (msg->data_length_code > 8U)           ? 8U
+                                                                  : msg->data_length_code;
+        uint32_t bits = CO_CANload_bits[extd][bytes];
+        uint32_t stuffBits = CO_CANload_stuffBits[extd][bytes];
+        uint32_t id = (uint32_t)(time_us >> 10) / CO_CAN_LOAD_BUCKET_MS;
+        CO_CANloadBucket_t *bucket = &d->buckets[id % CO_CAN_LOAD_BUCKETS];
+        uint32_t key = (msg->identifier & 0x1FFFFFFFUL) | (extd != 0U ? CO_CAN_LOAD_KEY_EXTD : 0U) |
+                       CO_CAN_LOAD_KEY_USED;
+        uint32_t i = (key * 0x9E3779B1UL) >> 16;
+        uint32_t n;
+
+        if (__atomic_load_n(&bucket->id, __ATOMIC_RELAXED) != id)
+        {
+            /* bucket from the previous turn, id is written last */
+            __atomic_store_n(&bucket->frames, 0U, __ATOMIC_RELAXED);
+            __atomic_store_n(&bucket->bits, 0U, __ATOMIC_RELAXED);
+            __atomic_store_n(&bucket->stuffBits, 0U, __ATOMIC_RELAXED);
+            __atomic_store_n(&bucket->id, id, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&bucket->frames, bucket->frames + 1U, __ATOMIC_RELAXED);
+        __atomic_store_n(&bucket->bits, bucket->bits + bits, __ATOMIC_RELAXED);
+        __atomic_store_n(&bucket->stuffBits, bucket->stuffBits + stuffBits, __ATOMIC_RELAXED);
+
+        /* open addressing, CANopen network has few COB-IDs, so probe is short */
+        for (n = 0U; n < CO_CAN_LOAD_IDS; n++)
+        {
+            CO_CANloadId_t *entry = &d->ids[(i + n) & (CO_CAN_LOAD_IDS - 1U)];
+            uint32_t entryKey = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+
+            if (entryKey == 0U)
+            {
+                __atomic_store_n(&entry->key, key, __ATOMIC_RELAXED);
+                entryKey = key;
+            }
+            if (entryKey == key)
+            {
+                __atomic_store_n(&entry->frames, entry->frames + 1U, __ATOMIC_RELAXED);
+                __atomic_store_n(&entry->bytes, entry->bytes + bytes, __ATOMIC_RELAXED);
+                __atomic_store_n(&entry->bits, entry->bits + bits + stuffBits, __ATOMIC_RELAXED);
+                return;
+            }
+        }
+        __atomic_store_n(&d->idsOverflow, d->idsOverflow + 1U, __ATOMIC_RELAXED);
+    }
+
+    /* Load of the last window_ms, rounded to whole buckets, from one and up to
+     * CO_CAN_LOAD_BUCKETS - 1. Bucket, which is being filled, is not included.
+     * util may be NULL. Returns utilization with worst case stuffing in
+     * permille, it may be above 1000, if bitrate is wrong. */
+    uint16_t CO_CANload_utilization(const CO_CANload_t *load, uint32_t window_ms, CO_CANloadUtil_t *util);
+
+    /* Check buckets completed since the last call for peak and bursts. Call it
+     * from mainline at least once per CO_CAN_LOAD_BUCKETS buckets, otherwise
+     * buckets are missed. */
+    void CO_CANload_process(CO_CANload_t *load);
+
+    /* Top talker, COB-ID of one direction */
+    typedef struct
+    {
+        uint32_t key;
+        uint8_t dir;
+        uint32_t frames;
+        uint32_t bytes;
+        uint32_t bits;
+    } CO_CANloadTop_t;
+
+    /* Copy up to n COB-IDs with most bits on the bus since reset, from both
+     * directions, sorted by bits. Returns number of copied COB-IDs. */
+    uint16_t CO_CANload_top(const CO_CANload_t *load, CO_CANloadTop_t top[], uint16_t n);
+
+    /* Export load as text: "load window_ms frames permilleMin permille" for
+     * window of one bucket and of all buckets, "peak permille time_us bursts
+     * burstMax_ms", then up to n top talkers "rx|tx ident frames bytes bits
+     * permille" with permille of all counted bits, extended ident has "x"
+     * suffix. Returns number of exported lines. */
+    uint32_t CO_CANload_export(const CO_CANload_t *load, uint16_t n, CO_CANload_write_t write, void *arg);
+
+#if CO_CAN_LOAD_OD
+    /* Items, also subindexes of Object Dictionary entry */
+    typedef enum
+    {
+        CO_CAN_LOAD_OD_WINDOW = 1,    /* permille over CO_CAN_LOAD_OD_WINDOW_MS */
+        CO_CAN_LOAD_OD_SPAN = 2,      /* permille over all buckets */
+        CO_CAN_LOAD_OD_PEAK = 3,      /* permille of the peak bucket */
+        CO_CAN_LOAD_OD_BURSTS = 4,
+        CO_CAN_LOAD_OD_BURST_MAX = 5, /* longest burst in milliseconds */
+        CO_CAN_LOAD_OD_TOP_ID = 6,    /* COB-ID of top talker, bit 29 for extended frame */
+        CO_CAN_LOAD_OD_TOP_SHARE = 7  /* permille of top talker in all counted bits */
+    } CO_CANloadItem_t;
+
+#define CO_CAN_LOAD_OD_ITEMS 7U
+
+    /* Make load readable through Object Dictionary entry, usually in
+     * manufacturer specific area, for example:
+     *
+     *   0x2111 ARRAY "CAN bus load", UNSIGNED32
+     *     sub 0:  highest subindex, 7, ro
+     *     sub 1..7: CO_CANloadItem_t, rw, TPDO mappable
+     *
+     * SDO download of value 0 to subindex 3 to 7 calls CO_CANload_reset(),
+     * other values are refused. Extension object must exist as long as the
+     * entry is used. */
+    ODR_t CO_CANload_initOD(CO_CANload_t *load, OD_entry_t *entry, OD_extension_t *extension);
+#endif
+
+#if CO_CAN_LOAD
+#define CO_CAN_LOAD_FRAME(CAN_MODULE, dir, msg, time_us)                 \
+    if ((CAN_MODULE)->load != NULL)                                      \
+    {                                                                    \
+        CO_CANload_frame((CAN_MODULE)->load, (dir), (msg), (time_us));   \
+    }
+#else
+#define CO_CAN_LOAD_FRAME(CAN_MODULE, dir, msg, time_us)
+#endif
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_CAN_LOAD_H */
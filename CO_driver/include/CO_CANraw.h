@@ -0,0 +1,55 @@
+/*
+ * Frames with extended identifier outside of CANopen for ESP32 TWAI driver.
+ *
+ * @file        CO_CANraw.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_CAN_RAW_H
+#define CO_CAN_RAW_H
+
+#include "301/CO_driver.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Register callback for frames with extended (29-bit) identifier from
+     * first to last. Such frames never match CANopen rx buffers. Callback is
+     * called directly from CANreceive(), also if CO_CAN_RX_RING is used, so
+     * it must be short. It may send or block, it is not called inside critical
+     * section. Range is not removed while its callback runs. Acceptance filter is opened for all frames while any
+     * range is registered. Returns CO_ERROR_ILLEGAL_ARGUMENT, if range overlaps
+     * other range, or CO_ERROR_OUT_OF_MEMORY, if all CO_CAN_RAW_RANGES are used. */
+    CO_ReturnError_t CO_CANrawRangeAdd(CO_CANmodule_t *CANmodule, uint32_t first, uint32_t last,
+                                       void *object, CO_CANrawCallback_t callback);
+
+    /* Remove range with the first identifier */
+    CO_ReturnError_t CO_CANrawRangeRemove(CO_CANmodule_t *CANmodule, uint32_t first);
+
+    /* Copy frame with any identifier and flags to TWAI transmit queue, without
+     * waiting and without buffering in txArray. Returns CO_ERROR_TX_OVERFLOW,
+     * if TWAI queue is full. */
+    CO_ReturnError_t CO_CANsendRaw(CO_CANmodule_t *CANmodule, const twai_message_t *msg);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_CAN_RAW_H */
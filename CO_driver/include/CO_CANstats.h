@@ -0,0 +1,77 @@
+/*
+ * Driver statistics of ESP32 TWAI driver and their Object Dictionary entry.
+ *
+ * @file        CO_CANstats.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_CAN_STATS_H
+#define CO_CAN_STATS_H
+
+#include "301/CO_driver.h"
+#if CO_CAN_STATS_OD
+#include "301/CO_ODinterface.h"
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Statistics items, also subindexes of Object Dictionary entry */
+    typedef enum
+    {
+        CO_CAN_STATS_RX_FRAMES = 1,
+        CO_CAN_STATS_RX_MATCHED = 2,
+        CO_CAN_STATS_RX_UNMATCHED = 3,
+        CO_CAN_STATS_TX_FRAMES = 4,
+        CO_CAN_STATS_TX_DEFERRED = 5,
+        CO_CAN_STATS_TX_OVERFLOW = 6,
+        CO_CAN_STATS_RX_OVERRUNS = 7, /* TWAI queue full, controller FIFO overrun and receive ring full */
+        CO_CAN_STATS_TX_QUEUE_MAX = 8,
+        CO_CAN_STATS_RX_LATENCY_MAX = 9, /* in microseconds */
+        CO_CAN_STATS_BUS_OFF = 10
+    } CO_CANstatsItem_t;
+
+#define CO_CAN_STATS_ITEMS 10U
+
+    /* Get statistics item, 0 for unknown item */
+    uint32_t CO_CANstats_get(const CO_CANmodule_t *CANmodule, uint8_t item);
+
+    /* Reset statistics item, 0 resets all items */
+    void CO_CANstats_reset(CO_CANmodule_t *CANmodule, uint8_t item);
+
+#if CO_CAN_STATS_OD
+    /* Make statistics readable through Object Dictionary entry, usually in
+     * manufacturer specific area, for example:
+     *
+     *   0x2110 ARRAY "CAN driver statistics", UNSIGNED32
+     *     sub 0:  highest subindex, 10, ro
+     *     sub 1..10: CO_CANstatsItem_t, rw, TPDO mappable
+     *
+     * Entry can be read with SDO upload or mapped to TPDO. SDO download of
+     * value 0 resets the item, other values are refused. Extension object
+     * must exist as long as the entry is used. */
+    ODR_t CO_CANstats_initOD(CO_CANmodule_t *CANmodule, OD_entry_t *entry, OD_extension_t *extension);
+#endif
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_CAN_STATS_H */
@@ -0,0 +1,113 @@
+/*
+ * Binary tracing of CAN frames and driver events for ESP32 TWAI driver.
+ *
+ * @file        CO_CANtrace.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_CAN_TRACE_H
+#define CO_CAN_TRACE_H
+
+#include "301/CO_driver.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Trace levels. Driver records events up to CO_CAN_TRACE_LEVEL, calls above
+ * it compile to nothing. */
+#define CO_CAN_TRACE_LEVEL_OFF 0
+#define CO_CAN_TRACE_LEVEL_ERROR 1  /* tx overflow, pending sync PDOs cleared */
+#define CO_CAN_TRACE_LEVEL_CONFIG 2 /* rx/tx buffer setup, acceptance filter */
+#define CO_CAN_TRACE_LEVEL_FRAME 3  /* every received and sent frame */
+
+#ifndef CO_CAN_TRACE_LEVEL
+#define CO_CAN_TRACE_LEVEL CO_CAN_TRACE_LEVEL_OFF
+#endif
+
+/* Number of records in trace ring, power of 2. Oldest records are
+ * overwritten, if they are not read in time. */
+#ifndef CO_CAN_TRACE_SIZE
+#define CO_CAN_TRACE_SIZE 256
+#endif
+
+    /* Type of trace record */
+    typedef enum
+    {
+        CO_CAN_TRACE_RX = 0,          /* received, index of rx buffer */
+        CO_CAN_TRACE_RX_UNMATCHED = 1, /* received, no rx buffer */
+        CO_CAN_TRACE_TX = 2,          /* copied to TWAI queue, index of tx buffer */
+        CO_CAN_TRACE_TX_DEFERRED = 3, /* waits in txArray */
+        CO_CAN_TRACE_TX_OVERFLOW = 4, /* previous message still waiting */
+        CO_CAN_TRACE_RX_SETUP = 5,    /* rx buffer configured, mask in data[0..1] */
+        CO_CAN_TRACE_TX_SETUP = 6,    /* tx buffer configured */
+        CO_CAN_TRACE_FILTER = 7,      /* acceptance filter, code/mask in data */
+        CO_CAN_TRACE_SYNC_CLEARED = 8 /* pending synchronous TPDOs cleared */
+    } CO_CANtraceType_t;
+
+    /* Trace record, written without formatting */
+    typedef struct
+    {
+        uint32_t seq;
+        uint32_t ident;
+        uint16_t index;
+        uint8_t type;
+        uint8_t DLC;
+        uint8_t data[8];
+    } CO_CANtraceRecord_t;
+
+#if CO_CAN_TRACE_LEVEL > CO_CAN_TRACE_LEVEL_OFF
+    /* Write record to trace ring. Lock-free, may be called from any task. */
+    void CO_CANtrace_record(CO_CANtraceType_t type, uint16_t index, uint32_t ident, uint8_t DLC, const uint8_t *data);
+
+    /* Read the oldest unread record. Returns false, if there is none. Must be
+     * called from one task only. */
+    bool_t CO_CANtrace_read(CO_CANtraceRecord_t *record);
+
+    /* Number of records overwritten before they were read */
+    uint32_t CO_CANtrace_lost(void);
+
+    /* Format up to maxRecords unread records with ESP_LOGI. Intended for low
+     * priority task or idle loop. Returns number of printed records. */
+    uint16_t CO_CANtrace_print(uint16_t maxRecords);
+#endif
+
+#if CO_CAN_TRACE_LEVEL >= CO_CAN_TRACE_LEVEL_ERROR
+#define CO_CAN_TRACE_ERROR(type, index, ident, DLC, data) CO_CANtrace_record(type, index, ident, DLC, data)
+#else
+#define CO_CAN_TRACE_ERROR(type, index, ident, DLC, data)
+#endif
+
+#if CO_CAN_TRACE_LEVEL >= CO_CAN_TRACE_LEVEL_CONFIG
+#define CO_CAN_TRACE_CONFIG(type, index, ident, DLC, data) CO_CANtrace_record(type, index, ident, DLC, data)
+#else
+#define CO_CAN_TRACE_CONFIG(type, index, ident, DLC, data)
+#endif
+
+#if CO_CAN_TRACE_LEVEL >= CO_CAN_TRACE_LEVEL_FRAME
+#define CO_CAN_TRACE_FRAME(type, index, ident, DLC, data) CO_CANtrace_record(type, index, ident, DLC, data)
+#else
+#define CO_CAN_TRACE_FRAME(type, index, ident, DLC, data)
+#endif
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_CAN_TRACE_H */
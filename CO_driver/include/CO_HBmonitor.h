@@ -0,0 +1,142 @@
+/*
+ * Heartbeat monitor of the whole CANopen network for ESP32 TWAI driver.
+ *
+ * @file        CO_HBmonitor.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_HB_MONITOR_H
+#define CO_HB_MONITOR_H
+
+#include "301/CO_driver.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Width of timer wheel slot in milliseconds. Timeout is detected up to one
+ * slot late. */
+#ifndef CO_HB_MONITOR_SLOT_MS
+#define CO_HB_MONITOR_SLOT_MS 10U
+#endif
+
+/* Number of timer wheel slots, power of 2. Node with longer timeout than
+ * wheel span is checked once per turn of the wheel. */
+#ifndef CO_HB_MONITOR_SLOTS
+#define CO_HB_MONITOR_SLOTS 64U
+#endif
+
+/* Length of event queue */
+#ifndef CO_HB_MONITOR_QUEUE
+#define CO_HB_MONITOR_QUEUE 32U
+#endif
+
+/* Node-IDs 1 to 127, index 0 is not used */
+#define CO_HB_MONITOR_NODES 128U
+
+/* State of node, which was not heard yet, or its heartbeat timed out */
+#define CO_HB_MONITOR_UNKNOWN 0xFFU
+
+    /* Change of node state. States are NMT states from heartbeat: 0 boot-up,
+     * 4 stopped, 5 operational, 127 pre-operational. */
+    typedef struct
+    {
+        uint8_t nodeId;
+        /* New state, CO_HB_MONITOR_UNKNOWN on timeout */
+        uint8_t state;
+        uint8_t previous;
+        /* Time of heartbeat or of timeout detection, lower 32 bits of
+         * esp_timer_get_time() */
+        uint32_t time_us;
+    } CO_HBmonitorEvent_t;
+
+    /* Heartbeat monitor. Receive callback writes rx fields and pending bits,
+     * CO_HBmonitor_process() owns the rest. */
+    typedef struct
+    {
+        /* Consumer heartbeat time per node, 0 if node is not monitored */
+        uint16_t time_ms[CO_HB_MONITOR_NODES];
+        /* Last heartbeat of node and its state */
+        uint32_t rxTime_us[CO_HB_MONITOR_NODES];
+        uint8_t rxState[CO_HB_MONITOR_NODES];
+        /* Heartbeat received since the last process, by node-ID bit */
+        uint32_t rxPending[CO_HB_MONITOR_NODES / 32U];
+        /* Boot-up received since the last process */
+        uint32_t rxBootup[CO_HB_MONITOR_NODES / 32U];
+
+        /* State reported by the last event */
+        uint8_t state[CO_HB_MONITOR_NODES];
+        /* Node is in timer wheel */
+        uint32_t active[CO_HB_MONITOR_NODES / 32U];
+        /* Timer wheel: slot lists of node-IDs linked by next, 0 ends them */
+        uint8_t slot[CO_HB_MONITOR_SLOTS];
+        uint8_t next[CO_HB_MONITOR_NODES];
+        uint16_t cursor;
+        /* Start of slot at cursor */
+        uint32_t wheelTime_us;
+
+        QueueHandle_t queue;
+        StaticQueue_t queueBuffer;
+        uint8_t queueStorage[CO_HB_MONITOR_QUEUE * sizeof(CO_HBmonitorEvent_t)];
+        /* Heartbeats processed, several of one node between two process
+         * calls count once */
+        uint32_t heartbeats;
+        uint32_t timeouts;
+        uint32_t eventsLost;
+    } CO_HBmonitor_t;
+
+    /* Initialize monitor and receive all heartbeats (0x701 to 0x77F) with
+     * rx buffer rxIndex of CANmodule. It replaces HB consumer of the stack
+     * (CO_CONFIG_HB_CONS), which needs rx buffer per node and checks all of
+     * them in each CO_process(). No node is monitored after init. CO_new()
+     * does not count rx buffer for the monitor, use the one reserved by the
+     * driver with CONFIG_CANOPEN_MONITOR_HB_NETWORK:
+     * CO_CANrxExtraIndex(CANmodule, 0). Call it after CO_CANinit(), which
+     * clears rx buffers. */
+    CO_ReturnError_t CO_HBmonitor_init(CO_HBmonitor_t *hbMonitor, CO_CANmodule_t *CANmodule, uint16_t rxIndex);
+
+    /* Monitor node with consumer heartbeat time time_ms, 0 stops monitoring.
+     * Monitoring starts with the first heartbeat of the node, as in HB
+     * consumer. Call it from the same task as CO_HBmonitor_process(). */
+    CO_ReturnError_t CO_HBmonitor_setNode(CO_HBmonitor_t *hbMonitor, uint8_t nodeId, uint16_t time_ms);
+
+    /* Process received heartbeats and expired slots of timer wheel, call it
+     * from mainline. Cost does not depend on number of monitored nodes, only
+     * on heartbeats received and nodes due since the last call. timerNext_us
+     * may be NULL. */
+    void CO_HBmonitor_process(CO_HBmonitor_t *hbMonitor, uint32_t *timerNext_us);
+
+    /* Get the next event, wait up to ticks. Returns false, if there is none. */
+    static inline bool_t CO_HBmonitor_getEvent(CO_HBmonitor_t *hbMonitor, CO_HBmonitorEvent_t *event,
+                                               TickType_t ticks)
+    {
+        return xQueueReceive(hbMonitor->queue, event, ticks) == pdTRUE;
+    }
+
+    /* State of node as reported by the last event */
+    static inline uint8_t CO_HBmonitor_getState(const CO_HBmonitor_t *hbMonitor, uint8_t nodeId)
+    {
+        return (nodeId < CO_HB_MONITOR_NODES) ? hbMonitor->state[nodeId] : CO_HB_MONITOR_UNKNOWN;
+    }
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* CO_HB_MONITOR_H */
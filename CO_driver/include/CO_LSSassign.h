@@ -0,0 +1,108 @@
+/*
+ * Node-ID assignment of unconfigured nodes with LSS fastscan.
+ *
+ * @file        CO_LSSassign.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_LSS_ASSIGN_H
+#define CO_LSS_ASSIGN_H
+
+#include "305/CO_LSSmaster.h"
+
+#if ((CO_CONFIG_LSS) & CO_CONFIG_LSS_MASTER)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* LSS timeout during fastscan in milliseconds. Fastscan waits it for each
+ * step, about 36 steps per node with one scanned field. Slaves, which do not
+ * respond directly from receive callback, may need more. Node-ID is
+ * configured and stored with timeout given to CO_LSSmaster_init(). */
+#ifndef CO_LSS_ASSIGN_TIMEOUT_MS
+#define CO_LSS_ASSIGN_TIMEOUT_MS 5U
+#endif
+
+/* Number of failed fastscans or configurations in a row, after which
+ * assignment ends with error. Also number of fastscans without answer, after
+ * which assignment ends, so node answering late is not missed. */
+#ifndef CO_LSS_ASSIGN_ATTEMPTS
+#define CO_LSS_ASSIGN_ATTEMPTS 3U
+#endif
+
+    /* Node found by fastscan and its assigned node-ID */
+    typedef struct
+    {
+        CO_LSS_address_t address;
+        uint8_t nodeId;
+    } CO_LSSassignNode_t;
+
+    /* Node-ID assignment object */
+    typedef struct
+    {
+        CO_LSSmaster_t *LSSmaster;
+        /* Fields to scan, skip or match, see CO_LSSmaster_IdentifyFastscan() */
+        CO_LSSmaster_fastscan_t fastscan;
+        /* Next node-ID to assign and the last one */
+        uint8_t nodeId;
+        uint8_t lastNodeId;
+        /* Store node-ID in the node */
+        bool_t store;
+        uint8_t state;
+        /* Failures in a row */
+        uint8_t attempts;
+        CO_LSSassignNode_t *nodes;
+        uint8_t nodesMax;
+        uint8_t nodesCount;
+        /* Time from CO_LSSassign_init() */
+        uint32_t elapsed_us;
+        /* Failed fastscans and configurations since init */
+        uint32_t failures;
+        uint16_t timeoutOld_ms;
+    } CO_LSSassign_t;
+
+    /* Initialize assignment of node-IDs from firstNodeId to lastNodeId to all
+     * unconfigured nodes, which match fastscan (for example only serial
+     * number scanned, vendor and product matched for replacement drives of
+     * known type). Found nodes with their node-IDs are written to nodes
+     * array. LSS master timeout is set to CO_LSS_ASSIGN_TIMEOUT_MS during
+     * fastscan, so mainline must call CO_LSSassign_process() at least that often, or
+     * sleep in CO_CANwait() until timerNext_us. */
+    CO_ReturnError_t CO_LSSassign_init(CO_LSSassign_t *assign, CO_LSSmaster_t *LSSmaster,
+                                       const CO_LSSmaster_fastscan_t *fastscan, uint8_t firstNodeId,
+                                       uint8_t lastNodeId, bool_t store, CO_LSSassignNode_t *nodes, uint8_t nodesMax);
+
+    /* Process assignment, timerNext_us may be NULL. Returns
+     * CO_LSSmaster_WAIT_SLAVE while nodes are being found and configured,
+     * CO_LSSmaster_OK, when no unconfigured node answers anymore, or error:
+     * CO_LSSmaster_ILLEGAL_ARGUMENT, if node-IDs or nodes array are
+     * exhausted, CO_LSSmaster_SCAN_FAILED or CO_LSSmaster_TIMEOUT after
+     * CO_LSS_ASSIGN_ATTEMPTS failures in a row. LSS master timeout is
+     * restored when assignment ends. */
+    CO_LSSmaster_return_t CO_LSSassign_process(CO_LSSassign_t *assign, uint32_t timeDifference_us,
+                                               uint32_t *timerNext_us);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* (CO_CONFIG_LSS) & CO_CONFIG_LSS_MASTER */
+
+#endif /* CO_LSS_ASSIGN_H */
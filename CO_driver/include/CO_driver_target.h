@@ -36,6 +36,7 @@
 #include "driver/twai.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
@@ -53,29 +54,306 @@ extern "C"
 /* Stack configuration override from CO_driver.h.
  * For more information see file CO_config.h. 
  https://github.com/CANopenNode/CANopenPIC/blob/21fa73185bcf5392738b5239958bb67c36fb4e89/PIC24_dsPIC33/CO_driver_target.h*/
+/* Objects report time to their next deadline in timerNext_us of CO_process(),
+ * so mainline can sleep in CO_CANwait() until then. Enables the flag in
+ * default configuration of all objects (NMT, HB consumer, SDO, PDO, SYNC,
+ * EMCY, ...), configurations below include it too. */
+#ifndef CO_CONFIG_GLOBAL_FLAG_TIMERNEXT
+#define CO_CONFIG_GLOBAL_FLAG_TIMERNEXT CO_CONFIG_FLAG_TIMERNEXT
+#endif
+
 #ifndef CO_CONFIG_NMT
-#define CO_CONFIG_NMT CO_CONFIG_NMT_MASTER
+#define CO_CONFIG_NMT (CO_CONFIG_NMT_MASTER | CO_CONFIG_GLOBAL_FLAG_TIMERNEXT)
 #endif
 
+/* With CONFIG_CANOPEN_MONITOR_HB_NETWORK heartbeats of the whole network are
+ * monitored by CO_HBmonitor (one rx buffer, timer wheel) instead of HB
+ * consumer, see CO_HBmonitor.h */
 #ifndef CO_CONFIG_HB_CONS
-#ifdef CONFIG_CANOPEN_MONITOR_HB
+#if defined CONFIG_CANOPEN_MONITOR_HB_NETWORK
+#define CO_CONFIG_HB_CONS (0)
+#elif defined CONFIG_CANOPEN_MONITOR_HB
 #define CO_CONFIG_HB_CONS (CO_CONFIG_HB_CONS_ENABLE |          \
                            CO_CONFIG_HB_CONS_CALLBACK_CHANGE | \
-                           CO_CONFIG_FLAG_TIMERNEXT)
+                           CO_CONFIG_GLOBAL_FLAG_TIMERNEXT)
 #endif
 #endif
 
+/* Bitrate in kbit/s, used if CO_CANmodule_init() gets CANbitRate 0 */
+#if defined CONFIG_CANOPEN_BITRATE_25KBITS
+#define CO_CAN_BITRATE_DEFAULT 25U
+#elif defined CONFIG_CANOPEN_BITRATE_50KBITS
+#define CO_CAN_BITRATE_DEFAULT 50U
+#elif defined CONFIG_CANOPEN_BITRATE_100KBITS
+#define CO_CAN_BITRATE_DEFAULT 100U
+#elif defined CONFIG_CANOPEN_BITRATE_125KBITS
+#define CO_CAN_BITRATE_DEFAULT 125U
+#elif defined CONFIG_CANOPEN_BITRATE_250KBITS
+#define CO_CAN_BITRATE_DEFAULT 250U
+#elif defined CONFIG_CANOPEN_BITRATE_800KBITS
+#define CO_CAN_BITRATE_DEFAULT 800U
+#elif defined CONFIG_CANOPEN_BITRATE_1MBITS
+#define CO_CAN_BITRATE_DEFAULT 1000U
+#else
+#define CO_CAN_BITRATE_DEFAULT 500U
+#endif
+
+/* SDO client, as by default. With CONFIG_CANOPEN_SDO_BLOCK SDO client and
+ * server have segmented and block transfer, which needs alternate FIFO read
+ * for retransmission and CRC, and client can also access local Object
+ * Dictionary. */
+#ifdef CONFIG_CANOPEN_SDO_BLOCK
 #ifndef CO_CONFIG_SDO_CLI
-#define CO_CONFIG_SDO_CLI (CO_CONFIG_SDO_CLI_ENABLE)
+#define CO_CONFIG_SDO_CLI (CO_CONFIG_SDO_CLI_ENABLE | CO_CONFIG_SDO_CLI_SEGMENTED | CO_CONFIG_SDO_CLI_BLOCK | \
+                           CO_CONFIG_SDO_CLI_LOCAL | CO_CONFIG_GLOBAL_FLAG_TIMERNEXT)
+#endif
+#ifndef CO_CONFIG_SDO_SRV
+#define CO_CONFIG_SDO_SRV (CO_CONFIG_SDO_SRV_SEGMENTED | CO_CONFIG_SDO_SRV_BLOCK |             \
+                           CO_CONFIG_GLOBAL_FLAG_CALLBACK_PRE | CO_CONFIG_GLOBAL_FLAG_TIMERNEXT | \
+                           CO_CONFIG_GLOBAL_FLAG_OD_DYNAMIC)
+#endif
+#ifndef CO_CONFIG_FIFO
+#define CO_CONFIG_FIFO (CO_CONFIG_FIFO_ENABLE | CO_CONFIG_FIFO_ALT_READ | CO_CONFIG_FIFO_CRC16_CCITT)
+#endif
+
+/* SDO buffers hold a whole block of 127 segments, so block size is not
+ * limited, plus data, which the bus carries in CO_SDO_REFILL_MS at default
+ * bitrate (7 bytes in about 128 bits), so application can refill buffer of
+ * the client once per mainline period without stalling the transfer. */
+#ifndef CO_SDO_REFILL_MS
+#define CO_SDO_REFILL_MS 10
+#endif
+#define CO_SDO_BLOCK_BUFFER_SIZE ((127 * 7) + ((CO_CAN_BITRATE_DEFAULT * CO_SDO_REFILL_MS * 7) / 128))
+#ifndef CO_CONFIG_SDO_CLI_BUFFER_SIZE
+#define CO_CONFIG_SDO_CLI_BUFFER_SIZE CO_SDO_BLOCK_BUFFER_SIZE
+#endif
+#ifndef CO_CONFIG_SDO_SRV_BUFFER_SIZE
+#define CO_CONFIG_SDO_SRV_BUFFER_SIZE CO_SDO_BLOCK_BUFFER_SIZE
 #endif
+#endif /* CONFIG_CANOPEN_SDO_BLOCK */
 
+#ifndef CO_CONFIG_SDO_CLI
+#define CO_CONFIG_SDO_CLI (CO_CONFIG_SDO_CLI_ENABLE)
+#endif
 #ifndef CO_CONFIG_FIFO
 #define CO_CONFIG_FIFO (CO_CONFIG_FIFO_ENABLE)
 #endif
 
+/* Use handle based TWAI API (twai_*_v2(), ESP-IDF 5.2 and later), which
+ * can drive more controllers, see CO_CANport_t. Legacy API drives only
+ * controller 0. */
+#ifndef CO_CAN_TWAI_V2
+#ifdef TWAI_GENERAL_CONFIG_DEFAULT_V2
+#define CO_CAN_TWAI_V2 1
+#else
+#define CO_CAN_TWAI_V2 0
+#endif
+#endif
+
+/* Program TWAI acceptance filter from rx buffers in CO_CANsetNormalMode().
+ * Rx buffer, which is configured later and is not accepted by the filter,
+ * opens it to accept all identifiers, as soon as TWAI transmit queue is
+ * empty. Filter is narrowed again by the next CO_CANsetNormalMode(). */
+#ifndef CO_CAN_RX_FILTERS
+#define CO_CAN_RX_FILTERS 1
+#endif
+
+/* Number of CAN-ID lookup tables in CANmodule, each CO_CAN_RX_LOOKUP_SIZE
+ * entries of 2 bytes, so 4 KB of RAM per table. Data frame is dispatched
+ * with single table read, independent of the number of rx buffers.
+ * - 2: CO_CANrxBufferInit() updates copy of the table, while CANreceive()
+ *   dispatches with the other one (8 KB).
+ * - 1: Table is updated in place inside rxDispatchLock, so CANreceive() waits
+ *   for reconfiguration, thousands of steps for short mask (4 KB).
+ * - 0: No table, rx buffers are searched linearly, as for remote frame. */
+#ifndef CO_CAN_RX_LOOKUP
+#define CO_CAN_RX_LOOKUP 2
+#endif
+
+/* Maximum time in ms CANreceive() waits for a message, so acceptance filter
+ * can be reprogrammed between calls */
+#ifndef CO_CAN_RX_WAIT_MS
+#define CO_CAN_RX_WAIT_MS 10
+#endif
+
+/* Length of TWAI driver transmit queue. Messages, which don't fit into it,
+ * wait in txArray and are sent from CO_CANmodule_process(), lowest CAN-ID
+ * first. TWAI queue itself is FIFO, so shorter queue gives better priority. */
+#ifndef CO_CAN_TX_QUEUE_LEN
+#define CO_CAN_TX_QUEUE_LEN 8
+#endif
+
+/* Maximum number of CAN transmit buffers (txSize), up to 1024 */
+#ifndef CO_CAN_TX_MAX
+#define CO_CAN_TX_MAX 256
+#endif
+#define CO_CAN_TX_PENDING_WORDS ((CO_CAN_TX_MAX + 31) / 32)
+
+/* Number of messages (power of 2) in transmit stream, 0 disables it. Message
+ * of tx buffer with CO_CAN_TX_STREAMED(ident), which can not be copied to
+ * TWAI queue, is copied to the stream instead of waiting in the buffer, so
+ * the stack can prepare the next one at once. SDO block transfer sends up to
+ * 127 segments back to back, so with CONFIG_CANOPEN_SDO_BLOCK the stream
+ * keeps all of them. */
+#ifndef CO_CAN_TX_STREAM
+#ifdef CONFIG_CANOPEN_SDO_BLOCK
+#define CO_CAN_TX_STREAM 128
+#else
+#define CO_CAN_TX_STREAM 0
+#endif
+#endif
+#if (CO_CAN_TX_STREAM & (CO_CAN_TX_STREAM - 1)) != 0
+#error CO_CAN_TX_STREAM must be power of 2
+#endif
+
+/* Tx buffers with these identifiers use the stream: SDO server responses and
+ * client requests, and NMT master commands, which configuration manager sends
+ * back to back for different nodes. Messages of one buffer are sent in
+ * order, stream and waiting buffers by CAN-ID. */
+#ifndef CO_CAN_TX_STREAMED
+#define CO_CAN_TX_STREAMED(ident) (((ident) == 0x000U) || (((ident) >= 0x581U) && ((ident) <= 0x67FU)))
+#endif
+
+/* Number of messages CANreceiveBatch() takes from TWAI queue at once */
+#ifndef CO_CAN_RX_BATCH
+#define CO_CAN_RX_BATCH 16
+#endif
+
+/* Receive task waits for messages with CANreceiveBatch() instead of
+ * CANreceive(). Batch is faster for bursts of 3 and more messages, but slower
+ * for single ones, because it polls empty TWAI receive queue after the last
+ * message. */
+#ifndef CO_CAN_RX_TASK_BATCH
+#define CO_CAN_RX_TASK_BATCH 0
+#endif
+
+/* Automatic recovery from bus-off. Recovery is started after backoff delay,
+ * which is doubled, up to maximum, if node goes bus-off again before maximum
+ * delay elapses after previous recovery. */
+#ifndef CO_CAN_BUSOFF_RECOVERY
+#define CO_CAN_BUSOFF_RECOVERY 1
+#endif
+#ifndef CO_CAN_BUSOFF_BACKOFF_MIN_MS
+#define CO_CAN_BUSOFF_BACKOFF_MIN_MS 100
+#endif
+#ifndef CO_CAN_BUSOFF_BACKOFF_MAX_MS
+#define CO_CAN_BUSOFF_BACKOFF_MAX_MS 10000
+#endif
+
+/* Period of TWAI status sampling in CO_CANmodule_process(), while error is
+ * reported. Otherwise status is sampled only on TWAI error alerts. */
+#ifndef CO_CAN_STATUS_PERIOD_MS
+#define CO_CAN_STATUS_PERIOD_MS 100
+#endif
+
+/* Receive task created by CO_CANrxTaskStart(). By default it runs on PRO
+ * core (0), mainline with CO_process() should run on APP core (1). */
+#ifndef CO_CAN_RX_TASK_STACK
+#define CO_CAN_RX_TASK_STACK 4096
+#endif
+#ifndef CO_CAN_RX_TASK_PRIORITY
+#define CO_CAN_RX_TASK_PRIORITY 10
+#endif
+#ifndef CO_CAN_RX_TASK_CORE
+#define CO_CAN_RX_TASK_CORE 0
+#endif
+
+/* Number of entries (power of 2) in the ring, through which the receive task
+ * hands matched messages to the mainline, 0 disables the ring. If enabled,
+ * CANreceive() only classifies messages and rx callbacks are called from
+ * CO_CANmodule_process(), so slow callbacks don't delay TWAI queue draining. */
+#ifndef CO_CAN_RX_RING
+#define CO_CAN_RX_RING 0
+#endif
+#if (CO_CAN_RX_RING & (CO_CAN_RX_RING - 1)) != 0
+#error CO_CAN_RX_RING must be power of 2
+#endif
+
+/* Rx buffers with these identifiers bypass the ring: their callbacks are
+ * called directly from CANreceive(), if no older message waits in the ring. */
+#ifndef CO_CAN_RX_DIRECT
+#define CO_CAN_RX_DIRECT(ident) (((ident) == 0x000U) || ((ident) == 0x080U))
+#endif
+
+/* Number of rx buffers, which CO_CANmodule_init() reserves after rxArray for
+ * driver objects not counted by CO_new(), see CO_CANrxExtraIndex(). One for
+ * CO_HBmonitor with CONFIG_CANOPEN_MONITOR_HB_NETWORK, as HB consumer of the
+ * stack is disabled and has no rx buffers then. */
+#ifndef CO_CAN_RX_EXTRA
+#ifdef CONFIG_CANOPEN_MONITOR_HB_NETWORK
+#define CO_CAN_RX_EXTRA 1
+#else
+#define CO_CAN_RX_EXTRA 0
+#endif
+#endif
+
+/* Number of 29-bit identifier ranges, which can be registered with
+ * CO_CANrawRangeAdd(), 0 disables raw receive */
+#ifndef CO_CAN_RAW_RANGES
+#define CO_CAN_RAW_RANGES 0
+#endif
+
+/* Statistics in Object Dictionary, see CO_CANstats.h */
+#ifndef CO_CAN_STATS_OD
+#define CO_CAN_STATS_OD 0
+#endif
+
+/* Latency histograms in CO_CANlatency_t, see CO_CANlatency.h */
+#ifndef CO_CAN_LATENCY
+#define CO_CAN_LATENCY 0
+#endif
+
+/* Number of identifier ranges in CO_CANbridge_t, 0 disables bridge, see
+ * CO_CANbridge.h */
+#ifndef CO_CAN_BRIDGE
+#define CO_CAN_BRIDGE 0
+#endif
+
+/* Capture of CAN frames into CO_CANcapture_t ring, see CO_CANcapture.h */
+#ifndef CO_CAN_CAPTURE
+#define CO_CAN_CAPTURE 0
+#endif
+
+/* Bus load meter CO_CANload_t, see CO_CANload.h */
+#ifndef CO_CAN_LOAD
+#define CO_CAN_LOAD 0
+#endif
+
+/* Bus load in Object Dictionary, see CO_CANload.h */
+#ifndef CO_CAN_LOAD_OD
+#define CO_CAN_LOAD_OD 0
+#endif
+
 // Custom
+/* With CONFIG_CANOPEN_STORAGE parameters are stored and restored (0x1010,
+ * 0x1011) in flash partition, see CO_storageFlash.h. CRC-16 from the stack
+ * protects its records and SDO block transfer. */
+#ifndef CO_CONFIG_STORAGE
+#ifdef CONFIG_CANOPEN_STORAGE
+#define CO_CONFIG_STORAGE (CO_CONFIG_STORAGE_ENABLE)
+#else
 #define CO_CONFIG_STORAGE (0)
+#endif
+#endif
+#ifndef CO_CONFIG_CRC16
+#if defined CONFIG_CANOPEN_STORAGE || defined CONFIG_CANOPEN_SDO_BLOCK
+#define CO_CONFIG_CRC16 (CO_CONFIG_CRC16_ENABLE)
+#endif
+#endif
+/* With CONFIG_CANOPEN_LSS_SLAVE node-ID can be assigned by LSS, fastscan is
+ * answered directly from receive task. With CONFIG_CANOPEN_LSS_MASTER node
+ * assigns node-IDs with fastscan, see CO_LSSassign.h. */
+#ifndef CO_CONFIG_LSS
+#if defined CONFIG_CANOPEN_LSS_SLAVE && defined CONFIG_CANOPEN_LSS_MASTER
+#define CO_CONFIG_LSS (CO_CONFIG_LSS_SLAVE | CO_CONFIG_LSS_SLAVE_FASTSCAN_DIRECT_RESPOND | CO_CONFIG_LSS_MASTER)
+#elif defined CONFIG_CANOPEN_LSS_SLAVE
+#define CO_CONFIG_LSS (CO_CONFIG_LSS_SLAVE | CO_CONFIG_LSS_SLAVE_FASTSCAN_DIRECT_RESPOND)
+#elif defined CONFIG_CANOPEN_LSS_MASTER
+#define CO_CONFIG_LSS (CO_CONFIG_LSS_MASTER)
+#else
 #define CO_CONFIG_LSS (0)
+#endif
+#endif
 #define CO_CONFIG_LEDS (0)
 #define CO_CONFIG_TIME (0)
 
@@ -94,10 +372,37 @@ extern "C"
     typedef unsigned char oChar_t;
     typedef unsigned char domain_t;
 
+    /* Received CAN message, as given to rx callbacks. TWAI message is the
+     * first member, so message can also be used as twai_message_t. */
+    typedef struct
+    {
+        twai_message_t msg;
+        /* esp_timer time, when message was taken from TWAI receive queue */
+        int64_t timestamp_us;
+    } CO_CANrxMsg_t;
+
 /* Access to received CAN message */
 #define CO_CANrxMsg_readIdent(msg) ((uint16_t)((twai_message_t *)msg)->identifier)
 #define CO_CANrxMsg_readDLC(msg) ((uint8_t)((twai_message_t *)msg)->data_length_code)
 #define CO_CANrxMsg_readData(msg) ((uint8_t *)((twai_message_t *)msg)->data)
+#define CO_CANrxMsg_readTimestamp(msg) (((CO_CANrxMsg_t *)msg)->timestamp_us)
+
+    /* Callback for frame with extended identifier, see CO_CANrawRangeAdd() */
+    typedef void (*CO_CANrawCallback_t)(void *object, const CO_CANrxMsg_t *message);
+
+    /* Range of extended identifiers with its callback */
+    typedef struct
+    {
+        uint32_t first;
+        uint32_t last;
+        void *object;
+        CO_CANrawCallback_t callback;
+    } CO_CANrawRange_t;
+
+/* Number of entries in CAN-ID lookup table, one for each standard identifier */
+#define CO_CAN_RX_LOOKUP_SIZE 0x0800U
+/* Value in CAN-ID lookup table for identifier, which is not accepted by any rx buffer */
+#define CO_CAN_RX_LOOKUP_NONE 0xFFFFU
 
     /* Received message object */
     typedef struct
@@ -106,24 +411,131 @@ extern "C"
         uint16_t mask;
         void *object;
         void (*CANrx_callback)(void *object, void *message);
+        /* Callback is called from CANreceive() even if CO_CAN_RX_RING is used */
+        bool_t direct;
     } CO_CANrx_t;
 
-    /* Transmit message object */
+    /* Transmit message object. Message is kept as twai_message_t, prepared by
+     * CO_CANtxBufferInit(), and given to twai_transmit() as it is. Members
+     * ident, DLC and data, used by the stack, overlay the TWAI ones. */
     typedef struct
     {
-        uint32_t ident;
-        uint8_t DLC;
-        uint8_t data[8];
+        union
+        {
+            twai_message_t msg;
+            struct
+            {
+                uint32_t flags;
+                uint32_t ident;
+                uint8_t DLC;
+                uint8_t data[8];
+            };
+        };
         volatile bool_t bufferFull;
         volatile bool_t syncFlag;
+        /* Message is copied to transmit stream, if it has to wait */
+        bool_t stream;
+        /* Position of this buffer in txArray sorted by CAN-ID */
+        uint16_t rank;
+        /* Index of buffer, which is on position of this buffer in sorted txArray */
+        uint16_t byRank;
+        /* esp_timer time of the last transmission, detected by
+         * CO_CANmodule_process() */
+        int64_t txTime_us;
     } CO_CANtx_t;
 
+#ifndef __cplusplus
+    _Static_assert(offsetof(CO_CANtx_t, flags) == offsetof(CO_CANtx_t, msg.flags), "CO_CANtx_t flags");
+    _Static_assert(offsetof(CO_CANtx_t, ident) == offsetof(CO_CANtx_t, msg.identifier), "CO_CANtx_t ident");
+    _Static_assert(offsetof(CO_CANtx_t, DLC) == offsetof(CO_CANtx_t, msg.data_length_code), "CO_CANtx_t DLC");
+    _Static_assert(offsetof(CO_CANtx_t, data) == offsetof(CO_CANtx_t, msg.data), "CO_CANtx_t data");
+    _Static_assert(sizeof(((CO_CANtx_t *)0)->data) == sizeof(((twai_message_t *)0)->data), "CO_CANtx_t data size");
+#endif
+
+    /* Bus statistics, accumulated from TWAI status, which is reset on each
+     * TWAI driver installation */
+    typedef struct
+    {
+        twai_state_t state;
+        uint32_t txErrorCounter;  /* TEC at last sample */
+        uint32_t rxErrorCounter;  /* REC at last sample */
+        uint32_t txFailed;
+        uint32_t rxMissed;        /* TWAI receive queue full */
+        uint32_t rxOverrun;       /* hardware receive FIFO overrun */
+        uint32_t arbitrationLost;
+        uint32_t busErrors;
+        uint32_t busOffCount;
+        uint32_t recoveryCount;
+        uint32_t recoveryDelayMs; /* current bus-off backoff */
+        /* Driver counters. Each has single writer, CANreceive() for rx and
+         * holder of CO_LOCK_CAN_SEND for tx, and is updated with relaxed
+         * atomics, so it can be read from any task without locking. */
+        uint32_t rxFrames;
+        uint32_t rxMatched;
+        uint32_t rxUnmatched;
+        uint32_t txFrames;
+        uint32_t txDeferred;      /* waited in txArray */
+        uint32_t txOverflow;      /* CO_CANsend() while previous message waits */
+        uint32_t txQueueMax;      /* maximum number of messages in txArray */
+        uint32_t rxLatencyMax_us; /* maximum time from reception to rx callback */
+    } CO_CANstats_t;
+
+    /* Message in receive ring, matched to rx buffer */
+    typedef struct
+    {
+        int64_t timestamp_us;
+        uint32_t ident;
+        uint16_t index;
+        uint8_t flags;
+        uint8_t DLC;
+        uint8_t data[8];
+    } CO_CANrxRingEntry_t;
+
+    /* Message in TWAI transmit queue */
+    typedef struct
+    {
+        int64_t queued_us;
+#if CO_CAN_LATENCY
+        int64_t syncTime_us; /* the last SYNC, when message was queued */
+#endif
+        uint16_t index; /* tx buffer */
+        bool_t sync;    /* synchronous TPDO */
+    } CO_CANtxInflight_t;
+
+    /* Message in transmit stream */
+    typedef struct
+    {
+        twai_message_t msg;
+        uint16_t index; /* tx buffer */
+    } CO_CANtxStreamEntry_t;
+
+    /* TWAI controller of CAN module, given to CO_CANmodule_init() as CANptr.
+     * NULL CANptr is controller 0 on CONFIG_CAN_TX_GPIO and CONFIG_CAN_RX_GPIO.
+     * Other controllers require CO_CAN_TWAI_V2. */
+    typedef struct
+    {
+        int controllerId;
+        int txGpio;
+        int rxGpio;
+        /* TWAI_MODE_NORMAL, or TWAI_MODE_LISTEN_ONLY for monitored bus */
+        twai_mode_t mode;
+    } CO_CANport_t;
+
     /* CAN module object */
     typedef struct
     {
         void *CANptr;
+        /* Controller, copied from CANptr */
+        CO_CANport_t port;
+#if CO_CAN_TWAI_V2
+        twai_handle_t twai;
+#endif
         CO_CANrx_t *rxArray;
         uint16_t rxSize;
+#if CO_CAN_RX_EXTRA
+        /* Rx buffers with index rxSize and above, see CO_CANrxExtraIndex() */
+        CO_CANrx_t rxExtra[CO_CAN_RX_EXTRA];
+#endif
         CO_CANtx_t *txArray;
         uint16_t txSize;
         uint16_t CANerrorStatus;
@@ -131,8 +543,129 @@ extern "C"
         volatile bool_t useCANrxFilters;
         volatile bool_t bufferInhibitFlag;
         volatile bool_t firstCANtxMessage;
+        /* Messages waiting in txArray and in transmit stream */
         volatile uint16_t CANtxCount;
+        /* Bit for each waiting tx buffer, by rank, and bit for each non-zero word */
+        uint32_t txPending[CO_CAN_TX_PENDING_WORDS];
+        uint32_t txPendingSummary;
+#if CO_CAN_TX_STREAM
+        /* Messages copied from streamed tx buffers, oldest first */
+        CO_CANtxStreamEntry_t txStream[CO_CAN_TX_STREAM];
+        uint16_t txStreamFirst;
+        uint16_t txStreamCount;
+#endif
+        /* Messages in TWAI transmit queue, oldest first. TWAI queue is FIFO,
+         * so messages, which left it, are the oldest ones. */
+        CO_CANtxInflight_t txInflight[CO_CAN_TX_QUEUE_LEN + 1];
+        uint16_t txInflightFirst;
+        uint16_t txInflightCount;
+        /* Synchronous TPDOs among them, also reflected in bufferInhibitFlag */
+        uint16_t txInflightSync;
+        /* Messages behind waiting synchronous TPDO were copied to TWAI queue
+         * once, now the queue drains for it */
+        bool_t txSyncPassed;
+        uint32_t txFailedLast;
         uint32_t errOld;
+        /* Acceptance filter installed in TWAI driver */
+        twai_filter_config_t rxFilter;
+        volatile bool_t rxFilterDirty;
+        /* Acceptance filter waits for empty TWAI transmit queue to be opened,
+         * see CO_CAN_RX_FILTERS */
+        bool_t rxFilterOpen;
+        /* Identifiers kept in acceptance filter without rx buffer, see
+         * CO_CANrxFilterReserve() */
+        uint16_t rxReserveIdent;
+        uint16_t rxReserveMask;
+        bool_t rxReserved;
+        bool_t driverInstalled;
+        /* Bitrate in kbit/s and TWAI timing for it */
+        uint16_t CANbitRate;
+        twai_timing_config_t timing;
+        /* Held by CANreceive() while waiting for message */
+        SemaphoreHandle_t rxLock;
+        StaticSemaphore_t rxLockBuffer;
+        /* Held while CANreceive() looks up rx buffer and while rx buffers
+         * are changed, never while rx callback is called */
+        portMUX_TYPE rxDispatchLock;
+        /* Recursive mutex, held while rx buffers, raw ranges and spare lookup
+         * table are changed and while rx callbacks are called, so callback
+         * may block and may reconfigure rx buffers itself */
+        SemaphoreHandle_t rxConfigLock;
+        StaticSemaphore_t rxConfigLockBuffer;
+        /* Locks for CO_LOCK_CAN_SEND(), CO_LOCK_EMCY() and CO_LOCK_OD() */
+        SemaphoreHandle_t sendLock;
+        StaticSemaphore_t sendLockBuffer;
+        portMUX_TYPE emcyLock;
+        SemaphoreHandle_t odLock;
+        StaticSemaphore_t odLockBuffer;
+        /* Task started by CO_CANrxTaskStart() */
+        TaskHandle_t rxTask;
+        TaskHandle_t rxTaskStopper;
+        volatile bool_t rxTaskRun;
+        /* Task sleeping in CO_CANwait(), set by its first call, events for it
+         * and semaphore it waits on */
+        TaskHandle_t waitTask;
+        uint32_t waitEvents;
+        SemaphoreHandle_t waitSem;
+        StaticSemaphore_t waitSemBuffer;
+        /* Gives waitSem at timeout, which is not whole ticks */
+        esp_timer_handle_t waitTimer;
+        /* TWAI alerts taken by receive task for CO_CANmodule_process() */
+        uint32_t alertsPending;
+        /* Messages accepted by hardware filter, but not by any rx buffer */
+        uint32_t rxFalseAccepts;
+        /* Bus statistics, updated by CO_CANmodule_process() */
+        CO_CANstats_t stats;
+        /* Raw TWAI status from last sample, for accumulating counters */
+        twai_status_info_t statusLast;
+        TickType_t statusTime;
+        TickType_t busOffTime;
+        TickType_t recoveredTime;
+        bool_t busOff;
+        bool_t rxOverflow;
+#if CO_CAN_RAW_RANGES
+        /* Ranges of extended identifiers sorted by first identifier, not
+         * overlapping. Kept over communication reset. */
+        CO_CANrawRange_t rawRanges[CO_CAN_RAW_RANGES];
+        uint16_t rawCount;
+#endif
+#if CO_CAN_RX_RING
+        /* Receive ring, written by CANreceive() and read by mainline. Head and
+         * tail are free running, entry is released after its callback. */
+        CO_CANrxRingEntry_t rxRing[CO_CAN_RX_RING];
+        uint32_t rxRingHead;
+        uint32_t rxRingTail;
+        /* Messages lost, because ring was full */
+        uint32_t rxRingOverruns;
+        /* Messages dropped, because rx buffer was reconfigured meanwhile */
+        uint32_t rxRingStale;
+        /* Maximum number of waiting messages */
+        uint32_t rxRingPeak;
+#endif
+#if CO_CAN_RX_LOOKUP
+        /* Index of the first rx buffer, which accepts the standard identifier.
+         * CANreceive() uses table rxLookup points to. With two tables
+         * CO_CANrxBufferInit() updates copy of it in the other table and
+         * swaps them, see CO_CAN_RX_LOOKUP. */
+        uint16_t rxLookupTables[CO_CAN_RX_LOOKUP][CO_CAN_RX_LOOKUP_SIZE];
+        uint16_t *rxLookup;
+#endif
+#if CO_CAN_CAPTURE
+        /* Capture ring, attached by CO_CANcapture_attach() */
+        struct CO_CANcapture_t *capture;
+#endif
+#if CO_CAN_LATENCY
+        /* Latency histograms, attached by CO_CANlatency_attach() */
+        struct CO_CANlatency_t *latency;
+#endif
+#if CO_CAN_BRIDGE
+        /* Bridge to other CAN module, attached by CO_CANbridge_attach() */
+        struct CO_CANbridge_t *bridge;
+#endif
+#if CO_CAN_LOAD
+        /* Bus load meter, attached by CO_CANload_attach() */
+        struct CO_CANload_t *load;
+#endif
     } CO_CANmodule_t;
 
     /* Data storage object for one entry */
@@ -143,37 +676,136 @@ extern "C"
         uint8_t subIndexOD;
         uint8_t attr;
         /* Additional variables (target specific) */
+        /* Stored data in mapped partition, NULL if partition is not mapped
+         * or entry is not stored */
         void *addrNV;
+        /* Flash storage of the entry, set by CO_storageFlash_init() */
+        struct CO_storageFlash_t *flash;
+        /* Offset of the latest record of the entry in partition, UINT32_MAX
+         * if there is none */
+        uint32_t offsetNV;
+        /* CRC of the latest record, if it contains data */
+        uint16_t crcNV;
+        /* Latest record contains data, not restore of defaults */
+        bool_t storedNV;
     } CO_storage_entry_t;
 
+/* Locks are safe with CANreceive() and mainline in tasks on different cores.
+ * CO_CANsend() calls twai_transmit(), which may not be called with interrupts
+ * disabled, so it is protected by mutex. OD access may call application
+ * functions (storage, SDO extensions), so it is protected by recursive mutex.
+ * Emergency section only updates few variables, so it is a spinlock. */
+
 /* (un)lock critical section in CO_CANsend() */
-#define CO_LOCK_CAN_SEND(CAN_MODULE)
-#define CO_UNLOCK_CAN_SEND(CAN_MODULE)
+#define CO_LOCK_CAN_SEND(CAN_MODULE) xSemaphoreTake((CAN_MODULE)->sendLock, portMAX_DELAY)
+#define CO_UNLOCK_CAN_SEND(CAN_MODULE) xSemaphoreGive((CAN_MODULE)->sendLock)
 
 /* (un)lock critical section in CO_errorReport() or CO_errorReset() */
-#define CO_LOCK_EMCY(CAN_MODULE)
-#define CO_UNLOCK_EMCY(CAN_MODULE)
+#define CO_LOCK_EMCY(CAN_MODULE) portENTER_CRITICAL(&(CAN_MODULE)->emcyLock)
+#define CO_UNLOCK_EMCY(CAN_MODULE) portEXIT_CRITICAL(&(CAN_MODULE)->emcyLock)
 
 /* (un)lock critical section when accessing Object Dictionary */
-#define CO_LOCK_OD(CAN_MODULE)
-#define CO_UNLOCK_OD(CAN_MODULE)
-
-/* Synchronization between CAN receive and message processing threads. */
-#define CO_MemoryBarrier()
-#define CO_FLAG_READ(rxNew) ((rxNew) != NULL)
-#define CO_FLAG_SET(rxNew)  \
-    {                       \
-        CO_MemoryBarrier(); \
-        rxNew = (void *)1L; \
-    }
-#define CO_FLAG_CLEAR(rxNew) \
-    {                        \
-        CO_MemoryBarrier();  \
-        rxNew = NULL;        \
-    }
+#define CO_LOCK_OD(CAN_MODULE) xSemaphoreTakeRecursive((CAN_MODULE)->odLock, portMAX_DELAY)
+#define CO_UNLOCK_OD(CAN_MODULE) xSemaphoreGiveRecursive((CAN_MODULE)->odLock)
+
+/* Synchronization between CAN receive and message processing threads. Data
+ * written before CO_FLAG_SET() is visible after CO_FLAG_READ() returns true,
+ * data read before CO_FLAG_CLEAR() is not overwritten by next message. */
+#define CO_MemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define CO_FLAG_READ(rxNew) (__atomic_load_n(&(rxNew), __ATOMIC_ACQUIRE) != NULL)
+#define CO_FLAG_SET(rxNew) __atomic_store_n(&(rxNew), (void *)1L, __ATOMIC_RELEASE)
+#define CO_FLAG_CLEAR(rxNew) __atomic_store_n(&(rxNew), NULL, __ATOMIC_RELEASE)
 
+    /* Wait for one CAN message and process it. Returns after CO_CAN_RX_WAIT_MS,
+     * if there is no message. */
     void CANreceive(CO_CANmodule_t *CANmodule);
 
+    /* Wait up to timeout_ms for CAN messages, then process all already queued
+     * ones, up to budget. Returns number of processed messages, so the caller
+     * can interleave CO_process() with message bursts. */
+    uint16_t CANreceiveBatch(CO_CANmodule_t *CANmodule, uint32_t timeout_ms, uint16_t budget);
+
+    /* Call rx callbacks for up to budget messages from receive ring, returns
+     * number of processed messages. Called also by CO_CANmodule_process(). Does
+     * nothing, if CO_CAN_RX_RING is 0. */
+    uint16_t CO_CANrxRingProcess(CO_CANmodule_t *CANmodule, uint16_t budget);
+
+/* Events returned by CO_CANwait() */
+#define CO_CAN_WAIT_RX 0x01U     /* received message is ready for CO_process() */
+#define CO_CAN_WAIT_TX 0x02U     /* messages waiting in txArray can be sent */
+#define CO_CAN_WAIT_STATUS 0x04U /* TWAI error state changed */
+
+    /* Sleep until there is work for CO_process(): message was received (rx
+     * callback was called or message is in receive ring), TWAI transmit queue
+     * has space for messages waiting in txArray, bus error state changed, or
+     * timeout_us elapsed. timeout_us is timerNext_us from the previous
+     * CO_process(), UINT32_MAX waits for event only. Timeout, which is not
+     * whole ticks, ends with esp_timer, so short protocol timeouts (LSS
+     * fastscan, SDO) are not stretched to tick (10 ms at 100 Hz). Wait is
+     * shortened to driver deadlines (bus-off recovery, status sampling).
+     * Returns events, 0 on timeout, immediately if some are already
+     * pending.
+     *
+     * Messages must be received by other task. Receive task started with
+     * CO_CANrxTaskStart() then waits for any TWAI alert, so also transmit and
+     * status events wake the caller. With other receive task, txArray is
+     * polled each tick while messages wait in it. Must always be called from
+     * the same task. */
+    uint32_t CO_CANwait(CO_CANmodule_t *CANmodule, uint32_t timeout_us);
+
+    /* Start task, which receives CAN messages with CANreceive() (or
+     * CANreceiveBatch(), see CO_CAN_RX_TASK_BATCH) and calls rx callbacks,
+     * pinned to CO_CAN_RX_TASK_CORE. Mainline with CO_process() and
+     * application then run in other task, preferably on the other core. Task keeps running over CANopen communication reset. Returns
+     * false, if task is already running or can not be created. */
+    bool_t CO_CANrxTaskStart(CO_CANmodule_t *CANmodule);
+
+    /* Stop task started by CO_CANrxTaskStart() and wait for it */
+    void CO_CANrxTaskStop(CO_CANmodule_t *CANmodule);
+
+    /* Check, if bitrate in kbit/s is supported by TWAI. Can be used as
+     * CO_LSSslave_initCheckBitRateCallback() function, object is not used. */
+    bool_t CO_CANcheckBitRate(void *object, uint16_t bitRate);
+
+    /* Change bitrate at runtime by reinstalling TWAI driver, messages in TWAI
+     * queues are lost. Returns false, if bitrate is not supported. */
+    bool_t CO_CANsetBitRate(CO_CANmodule_t *CANmodule, uint16_t CANbitRate);
+
+    /* Object for CO_CANactivateBitRate() */
+    typedef struct
+    {
+        CO_CANmodule_t *CANmodule;
+        /* Bitrate configured by LSS master, same as given to CO_LSSinit() */
+        uint16_t *pendingBitRate;
+    } CO_CANbitRateSwitch_t;
+
+    /* LSS "activate bit timing": waits delay ms, switches to pending bitrate
+     * and waits delay ms again. Can be used as
+     * CO_LSSslave_initActivateBitRateCallback() function with
+     * CO_CANbitRateSwitch_t object. */
+    void CO_CANactivateBitRate(void *object, uint16_t delay);
+
+    /* Keep identifiers, which match ident with mask, in acceptance filter,
+     * also if no rx buffer uses them yet. Rx buffers, which are often moved
+     * between such identifiers (SDO client of configuration manager), then
+     * do not cause reinstallation of TWAI driver, which loses queued
+     * messages. One range per module, mask 0 removes it. */
+    void CO_CANrxFilterReserve(CO_CANmodule_t *CANmodule, uint16_t ident, uint16_t mask);
+
+    /* Index of rx buffer n (0 to CO_CAN_RX_EXTRA - 1) reserved by
+     * CO_CANmodule_init() after rxArray, for CO_CANrxBufferInit() or
+     * CO_HBmonitor_init(). It is free also when rxArray is allocated by
+     * CO_new() with exact number of buffers for the stack. Valid after
+     * CO_CANmodule_init(). */
+    static inline uint16_t CO_CANrxExtraIndex(const CO_CANmodule_t *CANmodule, uint16_t n)
+    {
+        return (uint16_t)(CANmodule->rxSize + n);
+    }
+
+    /* Process message, which was not taken from TWAI receive queue, for
+     * example replayed from capture. */
+    void CANreceiveMessage(CO_CANmodule_t *CANmodule, twai_message_t *rcvMsg);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,156 @@
+/*
+ * Parallel SDO configuration of network nodes by NMT master.
+ *
+ * @file        CO_netConfig.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_NET_CONFIG_H
+#define CO_NET_CONFIG_H
+
+#include "301/CO_NMT_Heartbeat.h"
+#include "301/CO_SDOclient.h"
+
+#if ((CO_CONFIG_SDO_CLI) & CO_CONFIG_SDO_CLI_ENABLE) && ((CO_CONFIG_NMT) & CO_CONFIG_NMT_MASTER)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Maximum number of SDO clients used by one configuration manager */
+#ifndef CO_NET_CONFIG_CHANNELS
+#define CO_NET_CONFIG_CHANNELS 8
+#endif
+
+/* SDO timeout of each entry in milliseconds */
+#ifndef CO_NET_CONFIG_TIMEOUT_MS
+#define CO_NET_CONFIG_TIMEOUT_MS 500U
+#endif
+
+/* Number of times entry is written again after timeout or other client error.
+ * Entry rejected by the node (SDO abort from server) is not repeated. */
+#ifndef CO_NET_CONFIG_RETRIES
+#define CO_NET_CONFIG_RETRIES 2U
+#endif
+
+    /* One object written to the node, as in DCF file */
+    typedef struct
+    {
+        uint16_t index;
+        uint8_t subIndex;
+        /* Value of up to 4 bytes, used if data is NULL */
+        uint32_t value;
+        /* Longer data (domain, string), NULL for value */
+        const uint8_t *data;
+        size_t size;
+    } CO_netConfigEntry_t;
+
+    typedef enum
+    {
+        CO_NET_CONFIG_WAITING = 0, /* not configured yet */
+        CO_NET_CONFIG_BUSY = 1,    /* entries are being written */
+        CO_NET_CONFIG_DONE = 2,    /* configured and started */
+        CO_NET_CONFIG_FAILED = 3   /* entry failed, node is not started */
+    } CO_netConfigState_t;
+
+    /* Node with its configuration script. Fields below script are set by
+     * configuration manager. */
+    typedef struct
+    {
+        uint8_t nodeId;
+        const CO_netConfigEntry_t *script;
+        uint16_t scriptCount;
+        /* Node supports SDO block transfer, used for entries longer than
+         * 28 bytes */
+        bool_t block;
+
+        CO_netConfigState_t state;
+        /* Entry being written, scriptCount when done */
+        uint16_t entry;
+        /* Attempts of the entry, which failed */
+        uint8_t attempts;
+        CO_SDO_abortCode_t abortCode;
+        /* Time from CO_netConfig_start() to done or failed */
+        uint32_t time_us;
+    } CO_netConfigNode_t;
+
+    /* SDO client and the node it configures */
+    typedef struct
+    {
+        CO_SDOclient_t *client;
+        CO_netConfigNode_t *node;
+        /* Transfer of the entry was initiated, bytes given to client */
+        bool_t active;
+        size_t written;
+    } CO_netConfigChannel_t;
+
+    /* Configuration manager */
+    typedef struct
+    {
+        CO_NMT_t *NMT;
+        CO_netConfigChannel_t channels[CO_NET_CONFIG_CHANNELS];
+        uint8_t channelsCount;
+        CO_netConfigNode_t *nodes;
+        uint8_t nodesCount;
+        /* Nodes before it are not waiting */
+        uint8_t nextNode;
+        /* Nodes not done or failed yet */
+        uint8_t pending;
+        uint32_t elapsed_us;
+        /* Entries written again after error, since init */
+        uint32_t retries;
+        void (*pFunctSignal)(void *object, const CO_netConfigNode_t *node);
+        void *functSignalObject;
+    } CO_netConfig_t;
+
+    /* Initialize configuration manager with clientsCount SDO clients from
+     * array clients (for example CO->SDOclient with CO_config_t.CNT_SDO_CLI),
+     * which must not be used by application meanwhile. Nodes are configured in
+     * given order, each client configures one node at a time, so
+     * clientsCount nodes are configured at once. Node is started with NMT
+     * command as soon as all its entries are written.
+     *
+     * If CANmodule is not NULL, all default SDO server response identifiers
+     * are kept in acceptance filter, so moving client to the next node does
+     * not reinstall TWAI driver and lose frames of other transfers. */
+    CO_ReturnError_t CO_netConfig_init(CO_netConfig_t *netConfig, CO_SDOclient_t *clients, uint8_t clientsCount,
+                                       CO_NMT_t *NMT, CO_CANmodule_t *CANmodule, CO_netConfigNode_t *nodes,
+                                       uint8_t nodesCount);
+
+    /* Initialize callback, which is called from CO_netConfig_process(), when
+     * node is done or failed. */
+    void CO_netConfig_initCallback(CO_netConfig_t *netConfig, void *object,
+                                   void (*pFunctSignal)(void *object, const CO_netConfigNode_t *node));
+
+    /* Start configuration of nodes, which are not done. Can be called again
+     * after CO_netConfig_process() returned 0, to retry failed nodes. */
+    void CO_netConfig_start(CO_netConfig_t *netConfig);
+
+    /* Process SDO transfers, call it from mainline together with
+     * CO_process(), timerNext_us may be NULL. Returns number of nodes, which
+     * are not done or failed yet. */
+    uint8_t CO_netConfig_process(CO_netConfig_t *netConfig, uint32_t timeDifference_us, uint32_t *timerNext_us);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ((CO_CONFIG_SDO_CLI) & CO_CONFIG_SDO_CLI_ENABLE) && ((CO_CONFIG_NMT) & CO_CONFIG_NMT_MASTER) */
+
+#endif /* CO_NET_CONFIG_H */
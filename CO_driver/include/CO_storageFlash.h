@@ -0,0 +1,122 @@
+/*
+ * CANopen data storage in flash partition for ESP32.
+ *
+ * @file        CO_storageFlash.h
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CO_STORAGE_FLASH_H
+#define CO_STORAGE_FLASH_H
+
+#include "storage/CO_storage.h"
+#include "esp_idf_version.h"
+#include "esp_partition.h"
+
+#if ((CO_CONFIG_STORAGE) & CO_CONFIG_STORAGE_ENABLE)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+    /* Partition mapping types before ESP-IDF 5.0 */
+    typedef spi_flash_mmap_handle_t esp_partition_mmap_handle_t;
+#define ESP_PARTITION_MMAP_DATA SPI_FLASH_MMAP_DATA
+#endif
+
+/* Erase unit of flash. Partition is a ring of sectors, records of entries are
+ * appended to the newest sector, the sector after it is always erased. */
+#ifndef CO_STORAGE_FLASH_SECTOR
+#define CO_STORAGE_FLASH_SECTOR 4096U
+#endif
+
+    /* Counters of flash storage, never reset by the driver */
+    typedef struct
+    {
+        uint32_t stores;      /* store requests, by 0x1010 or auto storage */
+        uint32_t unchanged;   /* store requests skipped, data was already stored */
+        uint32_t records;     /* records written, including copies */
+        uint32_t copies;      /* records copied from the sector to be erased */
+        uint32_t dataBytes;   /* bytes of entry data stored on request */
+        uint32_t flashBytes;  /* all bytes written to flash, with headers and copies */
+        uint32_t erases;      /* erased sectors */
+        uint32_t restore_us;  /* duration of restore in CO_storageFlash_init() */
+    } CO_storageFlashStats_t;
+
+    /* Flash storage object */
+    typedef struct CO_storageFlash_t
+    {
+        const esp_partition_t *partition;
+        /* Partition mapped into data address space, NULL if it is read with
+         * esp_partition_read() */
+        const uint8_t *map;
+        esp_partition_mmap_handle_t mapHandle;
+        CO_CANmodule_t *CANmodule;
+        CO_storage_entry_t *entries;
+        uint8_t entriesCount;
+        uint16_t sectors;
+        /* Sector, to which records are appended, and its sequence number */
+        uint16_t active;
+        uint32_t sequence;
+        /* Offset of free space in active sector */
+        uint32_t writeOffset;
+        CO_storageFlashStats_t stats;
+    } CO_storageFlash_t;
+
+    /* Initialize data storage in data partition with partitionLabel and
+     * restore entries from it, then initialize CO_storage_t. Partition must
+     * have at least two sectors and must not be encrypted. Records of all
+     * entries, each with 8-byte header, and one more record of the largest
+     * entry must fit into one sector after its 16-byte header.
+     *
+     * Partition is mapped, so all sectors are checked in one pass from
+     * newest to oldest and each entry is copied from its latest record. If
+     * mapping fails, each sector is read into temporary buffer at once.
+     * Entry with corrupted latest record, or with record of different length
+     * (Object Dictionary changed), keeps its default value and bit
+     * subIndexOD (31 for higher) is set in storageInitError, function then
+     * returns CO_ERROR_DATA_CORRUPT. Entries, which were never stored or
+     * were restored by 0x1011, keep default values without error.
+     *
+     * Entry is written on store only, if its data differ from the latest
+     * record. Store erases one sector, when active sector is full, so it may
+     * block mainline for tens of milliseconds. Store and restore must be
+     * called from mainline. */
+    CO_ReturnError_t CO_storageFlash_init(CO_storageFlash_t *flash, const char *partitionLabel,
+                                          CO_storage_t *storage, CO_CANmodule_t *CANmodule,
+                                          OD_entry_t *OD_1010_StoreParameters,
+                                          OD_entry_t *OD_1011_RestoreDefaultParameters, CO_storage_entry_t *entries,
+                                          uint8_t entriesCount, uint32_t *storageInitError);
+
+    /* Store entries with CO_storage_auto attribute, which changed since
+     * last store. Should be called from mainline periodically, for example
+     * every few seconds, each call calculates CRC of all such entries.
+     * Returns bits of subIndexOD (31 for higher) of entries, which failed. */
+    uint32_t CO_storageFlash_auto_process(CO_storageFlash_t *flash);
+
+    /* Unmap partition. Storage may be initialized again after it. */
+    void CO_storageFlash_close(CO_storageFlash_t *flash);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* (CO_CONFIG_STORAGE) & CO_CONFIG_STORAGE_ENABLE */
+
+#endif /* CO_STORAGE_FLASH_H */
@@ -0,0 +1,128 @@
+/*
+ * Bridge between two CAN modules for ESP32 TWAI driver.
+ *
+ * @file        CO_CANbridge.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_CANbridge.h"
+#include "CO_CANraw.h"
+
+#if CO_CAN_BRIDGE
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANbridge_init(CO_CANbridge_t *bridge, CO_CANmodule_t *source, CO_CANmodule_t *target)
+{
+  if ((bridge == NULL) || (source == NULL) || (target == NULL) || (source == target))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  memset(bridge, 0, sizeof(*bridge));
+  bridge->source = source;
+  bridge->target = target;
+  return CO_ERROR_NO;
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANbridge_addRange(CO_CANbridge_t *bridge, uint32_t first, uint32_t last, bool_t extd)
+{
+  CO_ReturnError_t ret = CO_ERROR_NO;
+
+  if ((bridge == NULL) || (first > last) || (last > (extd ? 0x1FFFFFFFUL : 0x07FFUL)))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  /* ranges are read by CANreceive() of source */
+  portENTER_CRITICAL(&bridge->source->rxDispatchLock);
+  if (bridge->count >= CO_CAN_BRIDGE)
+  {
+    ret = CO_ERROR_OUT_OF_MEMORY;
+  }
+  else
+  {
+    bridge->ranges[bridge->count].first = first;
+    bridge->ranges[bridge->count].last = last;
+    bridge->ranges[bridge->count].extd = extd;
+    bridge->count++;
+  }
+  portEXIT_CRITICAL(&bridge->source->rxDispatchLock);
+
+  return ret;
+}
+
+/******************************************************************************/
+void CO_CANbridge_clear(CO_CANbridge_t *bridge)
+{
+  if (bridge != NULL)
+  {
+    portENTER_CRITICAL(&bridge->source->rxDispatchLock);
+    bridge->count = 0U;
+    portEXIT_CRITICAL(&bridge->source->rxDispatchLock);
+  }
+}
+
+/******************************************************************************/
+void CO_CANbridge_attach(CO_CANbridge_t *bridge, bool_t enable)
+{
+  if (bridge != NULL)
+  {
+    /* rxConfigLock of source is held, while frame is forwarded */
+    xSemaphoreTakeRecursive(bridge->source->rxConfigLock, portMAX_DELAY);
+    portENTER_CRITICAL(&bridge->source->rxDispatchLock);
+    bridge->source->bridge = enable ? bridge : NULL;
+    portEXIT_CRITICAL(&bridge->source->rxDispatchLock);
+    xSemaphoreGiveRecursive(bridge->source->rxConfigLock);
+  }
+}
+
+/******************************************************************************/
+bool_t CO_CANbridge_match(const CO_CANbridge_t *bridge, const twai_message_t *msg)
+{
+  bool_t extd = (msg->flags & TWAI_MSG_FLAG_EXTD) != 0U;
+  uint16_t i;
+
+  for (i = 0U; i < bridge->count; i++)
+  {
+    const CO_CANbridgeRange_t *range = &bridge->ranges[i];
+
+    if ((range->extd == extd) && (msg->identifier >= range->first) && (msg->identifier <= range->last))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/******************************************************************************/
+void CO_CANbridge_forward(CO_CANbridge_t *bridge, const twai_message_t *msg)
+{
+  /* target TWAI driver copies the frame into its queue, frame is not queued
+   * in bridge, so it is dropped, if target can not take it now */
+  if (bridge->target->CANnormal && (CO_CANsendRaw(bridge->target, msg) == CO_ERROR_NO))
+  {
+    __atomic_store_n(&bridge->forwarded, bridge->forwarded + 1U, __ATOMIC_RELAXED);
+  }
+  else
+  {
+    __atomic_store_n(&bridge->dropped, bridge->dropped + 1U, __ATOMIC_RELAXED);
+  }
+}
+
+#endif /* CO_CAN_BRIDGE */
@@ -0,0 +1,264 @@
+/*
+ * Capture of received and sent CAN frames for ESP32 TWAI driver.
+ *
+ * @file        CO_CANcapture.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_CANcapture.h"
+
+#if CO_CAN_CAPTURE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* SocketCAN identifier flags and pcap link type */
+#define CO_CAN_SOCKETCAN_EFF 0x80000000UL
+#define CO_CAN_SOCKETCAN_RTR 0x40000000UL
+#define CO_CAN_PCAP_LINKTYPE 227U
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANcapture_init(CO_CANcapture_t *capture, CO_CANcaptureRecord_t records[], uint32_t size)
+{
+  if ((capture == NULL) || (records == NULL) || (size == 0U) || ((size & (size - 1U)) != 0U))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  capture->records = records;
+  capture->size = size;
+  capture->head = 0U;
+  capture->enabled = false;
+
+  return CO_ERROR_NO;
+}
+
+/******************************************************************************/
+void CO_CANcapture_attach(CO_CANmodule_t *CANmodule, CO_CANcapture_t *capture)
+{
+  if (CANmodule != NULL)
+  {
+    CANmodule->capture = capture;
+  }
+}
+
+/******************************************************************************/
+void CO_CANcapture_clear(CO_CANcapture_t *capture)
+{
+  __atomic_store_n(&capture->head, 0U, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************/
+uint32_t CO_CANcapture_count(const CO_CANcapture_t *capture)
+{
+  uint32_t head = __atomic_load_n(&capture->head, __ATOMIC_RELAXED);
+
+  return (head < capture->size) ? head : capture->size;
+}
+
+/* Get record by age, 0 is the oldest valid one */
+static const CO_CANcaptureRecord_t *CO_CANcapture_get(const CO_CANcapture_t *capture, uint32_t head, uint32_t i)
+{
+  uint32_t first = (head < capture->size) ? 0U : (head - capture->size);
+
+  return &capture->records[(first + i) & (capture->size - 1U)];
+}
+
+/******************************************************************************/
+uint32_t CO_CANcapture_exportCandump(const CO_CANcapture_t *capture, const char *ifName,
+                                     CO_CANcapture_write_t write, void *arg)
+{
+  uint32_t head = __atomic_load_n(&capture->head, __ATOMIC_RELAXED);
+  uint32_t count = CO_CANcapture_count(capture);
+  uint32_t i;
+
+  for (i = 0U; i < count; i++)
+  {
+    const CO_CANcaptureRecord_t *r = CO_CANcapture_get(capture, head, i);
+    char line[80];
+    int len;
+    uint8_t b;
+
+    len = snprintf(line, sizeof(line), ((r->flags & CO_CAN_CAPTURE_FLAG_EXTD) != 0U) ? "(%lld.%06lld) %s %08X#" : "(%lld.%06lld) %s %03X#",
+                   (long long)(r->timestamp_us / 1000000), (long long)(r->timestamp_us % 1000000), ifName, (unsigned int)r->ident);
+    if ((r->flags & CO_CAN_CAPTURE_FLAG_RTR) != 0U)
+    {
+      /* remote frame has DLC, but no data */
+      len += snprintf(&line[len], sizeof(line) - (size_t)len, "R%u", (unsigned int)(r->DLC & 0x0FU));
+    }
+    else
+    {
+      for (b = 0U; (b < r->DLC) && (b < 8U); b++)
+      {
+        len += snprintf(&line[len], sizeof(line) - (size_t)len, "%02X", r->data[b]);
+      }
+    }
+    len += snprintf(&line[len], sizeof(line) - (size_t)len, ((r->flags & CO_CAN_CAPTURE_FLAG_TX) != 0U) ? " T\n" : " R\n");
+
+    if (write(arg, line, (size_t)len) != (size_t)len)
+    {
+      return i;
+    }
+  }
+  return count;
+}
+
+/******************************************************************************/
+uint32_t CO_CANcapture_exportPcap(const CO_CANcapture_t *capture, CO_CANcapture_write_t write, void *arg)
+{
+  static const uint32_t header[6] = {0xA1B2C3D4UL, 0x00040002UL, 0U, 0U, 16U, CO_CAN_PCAP_LINKTYPE};
+  uint32_t head = __atomic_load_n(&capture->head, __ATOMIC_RELAXED);
+  uint32_t count = CO_CANcapture_count(capture);
+  uint32_t i;
+
+  if (write(arg, header, sizeof(header)) != sizeof(header))
+  {
+    return 0U;
+  }
+
+  for (i = 0U; i < count; i++)
+  {
+    const CO_CANcaptureRecord_t *r = CO_CANcapture_get(capture, head, i);
+    uint32_t packet[4 + 4];
+    uint32_t canId = r->ident;
+    uint8_t *frame = (uint8_t *)&packet[4];
+
+    /* pcap record header: seconds, microseconds, captured and original length */
+    packet[0] = (uint32_t)(r->timestamp_us / 1000000);
+    packet[1] = (uint32_t)(r->timestamp_us % 1000000);
+    packet[2] = 16U;
+    packet[3] = 16U;
+
+    /* struct can_frame, identifier in network byte order */
+    if ((r->flags & CO_CAN_CAPTURE_FLAG_EXTD) != 0U)
+    {
+      canId |= CO_CAN_SOCKETCAN_EFF;
+    }
+    if ((r->flags & CO_CAN_CAPTURE_FLAG_RTR) != 0U)
+    {
+      canId |= CO_CAN_SOCKETCAN_RTR;
+    }
+    frame[0] = (uint8_t)(canId >> 24);
+    frame[1] = (uint8_t)(canId >> 16);
+    frame[2] = (uint8_t)(canId >> 8);
+    frame[3] = (uint8_t)canId;
+    frame[4] = r->DLC;
+    frame[5] = 0U;
+    frame[6] = 0U;
+    frame[7] = 0U;
+    memcpy(&frame[8], r->data, 8U);
+
+    if (write(arg, packet, sizeof(packet)) != sizeof(packet))
+    {
+      return i;
+    }
+  }
+  return count;
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANcapture_replayCandump(CO_CANmodule_t *CANmodule, const char *line)
+{
+  twai_message_t msg = {0};
+  const char *p;
+  char *end;
+  size_t idLen;
+
+  if ((CANmodule == NULL) || (line == NULL))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  /* skip comments and empty lines */
+  while ((*line == ' ') || (*line == '\t'))
+  {
+    line++;
+  }
+  if ((*line == '#') || (*line == '\0') || (*line == '\n') || (*line == '\r'))
+  {
+    return CO_ERROR_NO;
+  }
+
+  /* "(timestamp) interface ident#data [R|T]", data is "R<dlc>" for remote
+   * frame */
+  p = strchr(line, ')');
+  if ((*line != '(') || (p == NULL))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+  p = strchr(p + 1, ' ');
+  if (p != NULL)
+  {
+    p = strchr(p + 1, ' ');
+  }
+  if (p == NULL)
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+  p++;
+
+  msg.identifier = (uint32_t)strtoul(p, &end, 16);
+  idLen = (size_t)(end - p);
+  if ((*end != '#') || (idLen == 0U))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+  if (idLen > 3U)
+  {
+    msg.flags |= TWAI_MSG_FLAG_EXTD;
+  }
+  p = end + 1;
+
+  if (*p == 'R')
+  {
+    /* "R" or "R<dlc>" */
+    msg.flags |= TWAI_MSG_FLAG_RTR;
+    p++;
+    if ((*p >= '0') && (*p <= '8'))
+    {
+      msg.data_length_code = (uint8_t)(*p - '0');
+      p++;
+    }
+  }
+  else
+  {
+    while ((msg.data_length_code < 8U) && isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]))
+    {
+      char byte[3] = {p[0], p[1], '\0'};
+
+      msg.data[msg.data_length_code++] = (uint8_t)strtoul(byte, NULL, 16);
+      p += 2;
+    }
+  }
+
+  /* frames sent by this node are not processed again */
+  while (*p == ' ')
+  {
+    p++;
+  }
+  if (*p == 'T')
+  {
+    return CO_ERROR_NO;
+  }
+
+  CANreceiveMessage(CANmodule, &msg);
+  return CO_ERROR_NO;
+}
+
+#endif /* CO_CAN_CAPTURE */
@@ -0,0 +1,123 @@
+/*
+ * Latency histograms of received and sent CAN frames for ESP32 TWAI driver.
+ *
+ * @file        CO_CANlatency.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_CANlatency.h"
+
+#if CO_CAN_LATENCY
+
+#include <stdio.h>
+
+/******************************************************************************/
+void CO_CANlatency_reset(CO_CANlatency_t *latency)
+{
+  memset(latency, 0, sizeof(*latency));
+}
+
+/******************************************************************************/
+void CO_CANlatency_attach(CO_CANmodule_t *CANmodule, CO_CANlatency_t *latency)
+{
+  if (CANmodule != NULL)
+  {
+    CANmodule->latency = latency;
+  }
+}
+
+/******************************************************************************/
+uint32_t CO_CANlatency_percentile(const CO_CANlatencyHist_t *hist, uint16_t permille)
+{
+  uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+  uint64_t limit = (count * permille + 999U) / 1000U;
+  uint64_t sum = 0U;
+  uint32_t k;
+
+  if (count == 0U)
+  {
+    return 0U;
+  }
+
+  for (k = 0U; k < (CO_CAN_LATENCY_BUCKETS - 1U); k++)
+  {
+    sum += __atomic_load_n(&hist->bucket[k], __ATOMIC_RELAXED);
+    if (sum >= limit)
+    {
+      return (2UL << k) - 1U;
+    }
+  }
+  return __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+}
+
+/* Export one histogram, if not empty. Returns number of exported lines. */
+static uint32_t CO_CANlatency_exportHist(const CO_CANlatencyHist_t *hist, const char *name, int cls,
+                                         CO_CANlatency_write_t write, void *arg)
+{
+  char line[64 + (CO_CAN_LATENCY_BUCKETS * 11)];
+  uint32_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+  uint64_t sum = __atomic_load_n(&hist->sum_us, __ATOMIC_RELAXED);
+  int len;
+  uint32_t k;
+
+  if (count == 0U)
+  {
+    return 0U;
+  }
+
+  len = snprintf(line, sizeof(line), "%s %d %u %u %u %u %u %u :", name, cls, (unsigned int)count,
+                 (unsigned int)(sum / count), (unsigned int)__atomic_load_n(&hist->max_us, __ATOMIC_RELAXED),
+                 (unsigned int)CO_CANlatency_percentile(hist, 500U), (unsigned int)CO_CANlatency_percentile(hist, 990U),
+                 (unsigned int)CO_CANlatency_percentile(hist, 999U));
+  for (k = 0U; k < CO_CAN_LATENCY_BUCKETS; k++)
+  {
+    len += snprintf(&line[len], sizeof(line) - (size_t)len, " %u",
+                    (unsigned int)__atomic_load_n(&hist->bucket[k], __ATOMIC_RELAXED));
+  }
+  len += snprintf(&line[len], sizeof(line) - (size_t)len, "\n");
+  write(arg, line, (size_t)len);
+
+  return 1U;
+}
+
+/******************************************************************************/
+uint32_t CO_CANlatency_export(const CO_CANlatency_t *latency, CO_CANlatency_write_t write, void *arg)
+{
+  uint32_t lines = 0U;
+  int cls;
+
+  if ((latency == NULL) || (write == NULL))
+  {
+    return 0U;
+  }
+
+  /* class is function code, -1 for histograms without class */
+  for (cls = 0; cls < CO_CAN_LATENCY_CLASSES; cls++)
+  {
+    lines += CO_CANlatency_exportHist(&latency->rxCallback[cls], "rx", cls, write, arg);
+  }
+  for (cls = 0; cls < CO_CAN_LATENCY_CLASSES; cls++)
+  {
+    lines += CO_CANlatency_exportHist(&latency->txComplete[cls], "tx", cls, write, arg);
+  }
+  lines += CO_CANlatency_exportHist(&latency->syncTpdo, "sync-tpdo", -1, write, arg);
+
+  return lines;
+}
+
+#endif /* CO_CAN_LATENCY */
@@ -0,0 +1,453 @@
+/*
+ * Bus load meter and top talkers of CAN module for ESP32 TWAI driver.
+ *
+ * @file        CO_CANload.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_CANload.h"
+
+#if CO_CAN_LOAD
+
+#include <stdio.h>
+
+#if (CO_CAN_LOAD_IDS & (CO_CAN_LOAD_IDS - 1U)) != 0U
+#error CO_CAN_LOAD_IDS must be power of 2
+#endif
+#if CO_CAN_LOAD_BUCKETS < 2U
+#error CO_CAN_LOAD_BUCKETS must be at least 2
+#endif
+
+#define CO_CAN_LOAD_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/* Default utilization of bucket, from which it counts as burst */
+#define CO_CAN_LOAD_BURST_PERMILLE 800U
+
+/* Maximum number of top talkers in CO_CANload_export() */
+#define CO_CAN_LOAD_EXPORT_TOP 16U
+
+/* SOF, identifier, RTR, IDE, r0, DLC, data, CRC, delimiters, ACK, EOF and
+ * interframe space. Extended frame adds SRR, 18 identifier bits and r1. */
+const uint8_t CO_CANload_bits[2][9] = {{47U, 55U, 63U, 71U, 79U, 87U, 95U, 103U, 111U},
+                                       {67U, 75U, 83U, 91U, 99U, 107U, 115U, 123U, 131U}};
+
+/* One stuff bit after each 4 bits of the stuffed part, without the first bit
+ * of it: (34 + 8 * n - 1) / 4 and (54 + 8 * n - 1) / 4 */
+const uint8_t CO_CANload_stuffBits[2][9] = {{8U, 10U, 12U, 14U, 16U, 18U, 20U, 22U, 24U},
+                                            {13U, 15U, 17U, 19U, 21U, 23U, 25U, 27U, 29U}};
+
+/* Number of bucket, which is being filled now */
+static uint32_t CO_CANload_now(void)
+{
+  return (uint32_t)(esp_timer_get_time() >> 10) / CO_CAN_LOAD_BUCKET_MS;
+}
+
+/* Add bucket with given id from both directions to util, if it was filled at
+ * that time */
+static void CO_CANload_sum(const CO_CANload_t *load, uint32_t id, CO_CANloadUtil_t *util)
+{
+  uint8_t dir;
+
+  for (dir = CO_CAN_LOAD_RX; dir <= CO_CAN_LOAD_TX; dir++)
+  {
+    const CO_CANloadBucket_t *bucket = &load->dir[dir].buckets[id % CO_CAN_LOAD_BUCKETS];
+
+    if (__atomic_load_n(&bucket->id, __ATOMIC_ACQUIRE) == id)
+    {
+      util->frames += CO_CAN_LOAD_READ(bucket->frames);
+      util->bits += CO_CAN_LOAD_READ(bucket->bits);
+      util->stuffBits += CO_CAN_LOAD_READ(bucket->stuffBits);
+    }
+  }
+}
+
+/* Utilization of bits during buckets in permille */
+static uint16_t CO_CANload_permille(const CO_CANload_t *load, uint32_t bits, uint32_t buckets)
+{
+  /* kbit/s is bit/ms, bucket is CO_CAN_LOAD_BUCKET_MS * 1.024 ms */
+  uint64_t capacity = ((uint64_t)load->bitRate * buckets * CO_CAN_LOAD_BUCKET_MS * 1024U) / 1000U;
+  uint64_t permille;
+
+  if (capacity == 0U)
+  {
+    return 0U;
+  }
+  permille = ((uint64_t)bits * 1000U) / capacity;
+  return (permille > UINT16_MAX) ? UINT16_MAX : (uint16_t)permille;
+}
+
+/******************************************************************************/
+void CO_CANload_init(CO_CANload_t *load, uint16_t burstPermille)
+{
+  memset(load, 0, sizeof(*load));
+  load->burstPermille = (burstPermille == 0U) ? CO_CAN_LOAD_BURST_PERMILLE : burstPermille;
+  load->processed = CO_CANload_now();
+}
+
+/******************************************************************************/
+void CO_CANload_attach(CO_CANmodule_t *CANmodule, CO_CANload_t *load)
+{
+  if (CANmodule != NULL)
+  {
+    if (load != NULL)
+    {
+      load->bitRate = CANmodule->CANbitRate;
+    }
+    CANmodule->load = load;
+  }
+}
+
+/******************************************************************************/
+void CO_CANload_reset(CO_CANload_t *load)
+{
+  uint8_t dir;
+
+  for (dir = CO_CAN_LOAD_RX; dir <= CO_CAN_LOAD_TX; dir++)
+  {
+    memset(load->dir[dir].ids, 0, sizeof(load->dir[dir].ids));
+    __atomic_store_n(&load->dir[dir].idsOverflow, 0U, __ATOMIC_RELAXED);
+  }
+  load->peakPermille = 0U;
+  load->peakTime_us = 0U;
+  load->bursts = 0U;
+  load->burstLength = 0U;
+  load->burstMax = 0U;
+  load->bucketsMissed = 0U;
+}
+
+/******************************************************************************/
+uint16_t CO_CANload_utilization(const CO_CANload_t *load, uint32_t window_ms, CO_CANloadUtil_t *util)
+{
+  CO_CANloadUtil_t sum = {0};
+  uint32_t buckets = (window_ms / CO_CAN_LOAD_BUCKET_MS) +
+                     (((window_ms % CO_CAN_LOAD_BUCKET_MS) >= (CO_CAN_LOAD_BUCKET_MS / 2U)) ? 1U : 0U);
+  uint32_t now = CO_CANload_now();
+  uint32_t k;
+
+  if (load == NULL)
+  {
+    return 0U;
+  }
+  if (buckets < 1U)
+  {
+    buckets = 1U;
+  }
+  else if (buckets > (CO_CAN_LOAD_BUCKETS - 1U))
+  {
+    buckets = CO_CAN_LOAD_BUCKETS - 1U;
+  }
+
+  for (k = 1U; k <= buckets; k++)
+  {
+    CO_CANload_sum(load, now - k, &sum);
+  }
+  sum.permilleMin = CO_CANload_permille(load, sum.bits, buckets);
+  sum.permille = CO_CANload_permille(load, sum.bits + sum.stuffBits, buckets);
+  sum.window_ms = (buckets * CO_CAN_LOAD_BUCKET_MS * 1024U) / 1000U;
+
+  if (util != NULL)
+  {
+    *util = sum;
+  }
+  return sum.permille;
+}
+
+/******************************************************************************/
+void CO_CANload_process(CO_CANload_t *load)
+{
+  uint32_t now = CO_CANload_now();
+  uint32_t id;
+
+  if (load == NULL)
+  {
+    return;
+  }
+
+  id = load->processed;
+  if ((now - id) > (CO_CAN_LOAD_BUCKETS - 1U))
+  {
+    /* oldest buckets are already overwritten */
+    load->bucketsMissed += now - id - (CO_CAN_LOAD_BUCKETS - 1U);
+    load->burstLength = 0U;
+    id = now - (CO_CAN_LOAD_BUCKETS - 1U);
+  }
+
+  for (; id != now; id++)
+  {
+    CO_CANloadUtil_t sum = {0};
+    uint16_t permille;
+
+    CO_CANload_sum(load, id, &sum);
+    permille = CO_CANload_permille(load, sum.bits + sum.stuffBits, 1U);
+    if (permille > load->peakPermille)
+    {
+      load->peakPermille = permille;
+      load->peakTime_us = (id * CO_CAN_LOAD_BUCKET_MS) << 10;
+    }
+    if ((permille >= load->burstPermille) && (load->burstPermille != 0U))
+    {
+      if (load->burstLength == 0U)
+      {
+        load->bursts++;
+      }
+      load->burstLength++;
+      if (load->burstLength > load->burstMax)
+      {
+        load->burstMax = load->burstLength;
+      }
+    }
+    else
+    {
+      load->burstLength = 0U;
+    }
+  }
+  load->processed = now;
+}
+
+/* Sum of bits of all counted COB-IDs */
+static uint32_t CO_CANload_totalBits(const CO_CANload_t *load)
+{
+  uint32_t total = 0U;
+  uint8_t dir;
+  uint32_t i;
+
+  for (dir = CO_CAN_LOAD_RX; dir <= CO_CAN_LOAD_TX; dir++)
+  {
+    for (i = 0U; i < CO_CAN_LOAD_IDS; i++)
+    {
+      total += CO_CAN_LOAD_READ(load->dir[dir].ids[i].bits);
+    }
+  }
+  return total;
+}
+
+/******************************************************************************/
+uint16_t CO_CANload_top(const CO_CANload_t *load, CO_CANloadTop_t top[], uint16_t n)
+{
+  uint16_t count = 0U;
+  uint8_t dir;
+  uint32_t i;
+
+  if ((load == NULL) || (top == NULL))
+  {
+    return 0U;
+  }
+
+  /* insertion into sorted array, table is small */
+  for (dir = CO_CAN_LOAD_RX; dir <= CO_CAN_LOAD_TX; dir++)
+  {
+    for (i = 0U; i < CO_CAN_LOAD_IDS; i++)
+    {
+      const CO_CANloadId_t *entry = &load->dir[dir].ids[i];
+      CO_CANloadTop_t item = {.key = CO_CAN_LOAD_READ(entry->key),
+                              .dir = dir,
+                              .frames = CO_CAN_LOAD_READ(entry->frames),
+                              .bytes = CO_CAN_LOAD_READ(entry->bytes),
+                              .bits = CO_CAN_LOAD_READ(entry->bits)};
+      uint16_t pos = count;
+
+      if ((item.key == 0U) || (item.frames == 0U))
+      {
+        continue;
+      }
+      while ((pos > 0U) && (top[pos - 1U].bits < item.bits))
+      {
+        if (pos < n)
+        {
+          top[pos] = top[pos - 1U];
+        }
+        pos--;
+      }
+      if (pos < n)
+      {
+        top[pos] = item;
+        if (count < n)
+        {
+          count++;
+        }
+      }
+    }
+  }
+  return count;
+}
+
+/******************************************************************************/
+uint32_t CO_CANload_export(const CO_CANload_t *load, uint16_t n, CO_CANload_write_t write, void *arg)
+{
+  char line[96];
+  CO_CANloadUtil_t util;
+  CO_CANloadTop_t top[CO_CAN_LOAD_EXPORT_TOP];
+  uint32_t total;
+  uint32_t lines = 0U;
+  uint16_t count;
+  uint16_t k;
+  int len;
+
+  if ((load == NULL) || (write == NULL))
+  {
+    return 0U;
+  }
+
+  /* the last bucket and all of them */
+  for (k = 0U; k < 2U; k++)
+  {
+    (void)CO_CANload_utilization(load, (k == 0U) ? 0U : UINT32_MAX, &util);
+    len = snprintf(line, sizeof(line), "load %u %u %u %u\n", (unsigned int)util.window_ms,
+                   (unsigned int)util.frames, (unsigned int)util.permilleMin, (unsigned int)util.permille);
+    write(arg, line, (size_t)len);
+    lines++;
+  }
+  len = snprintf(line, sizeof(line), "peak %u %u %u %u\n", (unsigned int)load->peakPermille,
+                 (unsigned int)load->peakTime_us, (unsigned int)load->bursts,
+                 (unsigned int)((load->burstMax * CO_CAN_LOAD_BUCKET_MS * 1024U) / 1000U));
+  write(arg, line, (size_t)len);
+  lines++;
+
+  total = CO_CANload_totalBits(load);
+  count = CO_CANload_top(load, top, (n < CO_CAN_LOAD_EXPORT_TOP) ? n : CO_CAN_LOAD_EXPORT_TOP);
+  for (k = 0U; k < count; k++)
+  {
+    len = snprintf(line, sizeof(line), "%s %X%s %u %u %u %u\n", (top[k].dir == CO_CAN_LOAD_TX) ? "tx" : "rx",
+                   (unsigned int)(top[k].key & 0x1FFFFFFFUL), ((top[k].key & CO_CAN_LOAD_KEY_EXTD) != 0U) ? "x" : "",
+                   (unsigned int)top[k].frames, (unsigned int)top[k].bytes, (unsigned int)top[k].bits,
+                   (total == 0U) ? 0U : (unsigned int)(((uint64_t)top[k].bits * 1000U) / total));
+    write(arg, line, (size_t)len);
+    lines++;
+  }
+
+  return lines;
+}
+
+#if CO_CAN_LOAD_OD
+/* Read load item by subindex, for SDO upload or TPDO */
+static ODR_t CO_CANload_readOD(OD_stream_t *stream, void *buf, OD_size_t count, OD_size_t *countRead)
+{
+  const CO_CANload_t *load;
+  CO_CANloadTop_t top = {0};
+  uint32_t value = 0U;
+  uint32_t total;
+
+  if ((stream == NULL) || (buf == NULL) || (countRead == NULL))
+  {
+    return ODR_DEV_INCOMPAT;
+  }
+
+  if (stream->subIndex == 0U)
+  {
+    if (count < sizeof(uint8_t))
+    {
+      return ODR_DEV_INCOMPAT;
+    }
+    *countRead = CO_setUint8(buf, (uint8_t)CO_CAN_LOAD_OD_ITEMS);
+    return ODR_OK;
+  }
+  if (stream->subIndex > CO_CAN_LOAD_OD_ITEMS)
+  {
+    return ODR_SUB_NOT_EXIST;
+  }
+  if (count < sizeof(uint32_t))
+  {
+    return ODR_DEV_INCOMPAT;
+  }
+
+  load = (const CO_CANload_t *)stream->object;
+  switch (stream->subIndex)
+  {
+  case CO_CAN_LOAD_OD_WINDOW:
+    value = CO_CANload_utilization(load, CO_CAN_LOAD_OD_WINDOW_MS, NULL);
+    break;
+  case CO_CAN_LOAD_OD_SPAN:
+    value = CO_CANload_utilization(load, UINT32_MAX, NULL);
+    break;
+  case CO_CAN_LOAD_OD_PEAK:
+    value = load->peakPermille;
+    break;
+  case CO_CAN_LOAD_OD_BURSTS:
+    value = load->bursts;
+    break;
+  case CO_CAN_LOAD_OD_BURST_MAX:
+    value = (load->burstMax * CO_CAN_LOAD_BUCKET_MS * 1024U) / 1000U;
+    break;
+  case CO_CAN_LOAD_OD_TOP_ID:
+    if (CO_CANload_top(load, &top, 1U) != 0U)
+    {
+      /* extended flag is at bit 29, as in COB-ID */
+      value = top.key & ~CO_CAN_LOAD_KEY_USED;
+    }
+    break;
+  default:
+    total = CO_CANload_totalBits(load);
+    if ((CO_CANload_top(load, &top, 1U) != 0U) && (total != 0U))
+    {
+      value = (uint32_t)(((uint64_t)top.bits * 1000U) / total);
+    }
+    break;
+  }
+
+  *countRead = CO_setUint32(buf, value);
+  return ODR_OK;
+}
+
+/* Reset peak, bursts and top talkers by SDO download of 0 */
+static ODR_t CO_CANload_writeOD(OD_stream_t *stream, const void *buf, OD_size_t count, OD_size_t *countWritten)
+{
+  if ((stream == NULL) || (buf == NULL) || (countWritten == NULL))
+  {
+    return ODR_DEV_INCOMPAT;
+  }
+
+  if (stream->subIndex < (uint8_t)CO_CAN_LOAD_OD_PEAK)
+  {
+    return ODR_READONLY;
+  }
+  if (stream->subIndex > CO_CAN_LOAD_OD_ITEMS)
+  {
+    return ODR_SUB_NOT_EXIST;
+  }
+  if (count != sizeof(uint32_t))
+  {
+    return ODR_TYPE_MISMATCH;
+  }
+  if (CO_getUint32(buf) != 0U)
+  {
+    return ODR_INVALID_VALUE;
+  }
+
+  CO_CANload_reset((CO_CANload_t *)stream->object);
+  *countWritten = count;
+  return ODR_OK;
+}
+
+/******************************************************************************/
+ODR_t CO_CANload_initOD(CO_CANload_t *load, OD_entry_t *entry, OD_extension_t *extension)
+{
+  if ((load == NULL) || (entry == NULL) || (extension == NULL))
+  {
+    return ODR_DEV_INCOMPAT;
+  }
+
+  memset(extension, 0, sizeof(*extension));
+  extension->object = load;
+  extension->read = CO_CANload_readOD;
+  extension->write = CO_CANload_writeOD;
+
+  return OD_extension_init(entry, extension);
+}
+#endif /* CO_CAN_LOAD_OD */
+
+#endif /* CO_CAN_LOAD */
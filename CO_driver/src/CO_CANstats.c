@@ -0,0 +1,206 @@
+/*
+ * Driver statistics of ESP32 TWAI driver and their Object Dictionary entry.
+ *
+ * @file        CO_CANstats.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_CANstats.h"
+
+#define CO_CAN_STATS_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define CO_CAN_STATS_CLEAR(counter) __atomic_store_n(&(counter), 0U, __ATOMIC_RELAXED)
+
+/******************************************************************************/
+uint32_t CO_CANstats_get(const CO_CANmodule_t *CANmodule, uint8_t item)
+{
+  const CO_CANstats_t *stats = &CANmodule->stats;
+  uint32_t value = 0U;
+
+  switch (item)
+  {
+  case CO_CAN_STATS_RX_FRAMES:
+    value = CO_CAN_STATS_READ(stats->rxFrames);
+    break;
+  case CO_CAN_STATS_RX_MATCHED:
+    value = CO_CAN_STATS_READ(stats->rxMatched);
+    break;
+  case CO_CAN_STATS_RX_UNMATCHED:
+    value = CO_CAN_STATS_READ(stats->rxUnmatched);
+    break;
+  case CO_CAN_STATS_TX_FRAMES:
+    value = CO_CAN_STATS_READ(stats->txFrames);
+    break;
+  case CO_CAN_STATS_TX_DEFERRED:
+    value = CO_CAN_STATS_READ(stats->txDeferred);
+    break;
+  case CO_CAN_STATS_TX_OVERFLOW:
+    value = CO_CAN_STATS_READ(stats->txOverflow);
+    break;
+  case CO_CAN_STATS_RX_OVERRUNS:
+    value = CO_CAN_STATS_READ(stats->rxMissed) + CO_CAN_STATS_READ(stats->rxOverrun);
+#if CO_CAN_RX_RING
+    value += CO_CAN_STATS_READ(CANmodule->rxRingOverruns);
+#endif
+    break;
+  case CO_CAN_STATS_TX_QUEUE_MAX:
+    value = CO_CAN_STATS_READ(stats->txQueueMax);
+    break;
+  case CO_CAN_STATS_RX_LATENCY_MAX:
+    value = CO_CAN_STATS_READ(stats->rxLatencyMax_us);
+    break;
+  case CO_CAN_STATS_BUS_OFF:
+    value = CO_CAN_STATS_READ(stats->busOffCount);
+    break;
+  default:
+    break;
+  }
+
+  return value;
+}
+
+/******************************************************************************/
+void CO_CANstats_reset(CO_CANmodule_t *CANmodule, uint8_t item)
+{
+  CO_CANstats_t *stats = &CANmodule->stats;
+
+  /* Counters are not locked, increment in other task at the same time may
+   * survive the reset. */
+  switch (item)
+  {
+  case 0U:
+    for (item = 1U; item <= CO_CAN_STATS_ITEMS; item++)
+    {
+      CO_CANstats_reset(CANmodule, item);
+    }
+    break;
+  case CO_CAN_STATS_RX_FRAMES:
+    CO_CAN_STATS_CLEAR(stats->rxFrames);
+    break;
+  case CO_CAN_STATS_RX_MATCHED:
+    CO_CAN_STATS_CLEAR(stats->rxMatched);
+    break;
+  case CO_CAN_STATS_RX_UNMATCHED:
+    CO_CAN_STATS_CLEAR(stats->rxUnmatched);
+    break;
+  case CO_CAN_STATS_TX_FRAMES:
+    CO_CAN_STATS_CLEAR(stats->txFrames);
+    break;
+  case CO_CAN_STATS_TX_DEFERRED:
+    CO_CAN_STATS_CLEAR(stats->txDeferred);
+    break;
+  case CO_CAN_STATS_TX_OVERFLOW:
+    CO_CAN_STATS_CLEAR(stats->txOverflow);
+    break;
+  case CO_CAN_STATS_RX_OVERRUNS:
+    CO_CAN_STATS_CLEAR(stats->rxMissed);
+    CO_CAN_STATS_CLEAR(stats->rxOverrun);
+#if CO_CAN_RX_RING
+    CO_CAN_STATS_CLEAR(CANmodule->rxRingOverruns);
+#endif
+    break;
+  case CO_CAN_STATS_TX_QUEUE_MAX:
+    CO_CAN_STATS_CLEAR(stats->txQueueMax);
+    break;
+  case CO_CAN_STATS_RX_LATENCY_MAX:
+    CO_CAN_STATS_CLEAR(stats->rxLatencyMax_us);
+    break;
+  case CO_CAN_STATS_BUS_OFF:
+    CO_CAN_STATS_CLEAR(stats->busOffCount);
+    break;
+  default:
+    break;
+  }
+}
+
+#if CO_CAN_STATS_OD
+/* Read statistics item by subindex, for SDO upload or TPDO */
+static ODR_t CO_CANstats_readOD(OD_stream_t *stream, void *buf, OD_size_t count, OD_size_t *countRead)
+{
+  if ((stream == NULL) || (buf == NULL) || (countRead == NULL))
+  {
+    return ODR_DEV_INCOMPAT;
+  }
+
+  if (stream->subIndex == 0U)
+  {
+    if (count < sizeof(uint8_t))
+    {
+      return ODR_DEV_INCOMPAT;
+    }
+    *countRead = CO_setUint8(buf, (uint8_t)CO_CAN_STATS_ITEMS);
+    return ODR_OK;
+  }
+  if (stream->subIndex > CO_CAN_STATS_ITEMS)
+  {
+    return ODR_SUB_NOT_EXIST;
+  }
+  if (count < sizeof(uint32_t))
+  {
+    return ODR_DEV_INCOMPAT;
+  }
+
+  *countRead = CO_setUint32(buf, CO_CANstats_get((const CO_CANmodule_t *)stream->object, stream->subIndex));
+  return ODR_OK;
+}
+
+/* Reset statistics item by SDO download of 0 */
+static ODR_t CO_CANstats_writeOD(OD_stream_t *stream, const void *buf, OD_size_t count, OD_size_t *countWritten)
+{
+  if ((stream == NULL) || (buf == NULL) || (countWritten == NULL))
+  {
+    return ODR_DEV_INCOMPAT;
+  }
+
+  if (stream->subIndex == 0U)
+  {
+    return ODR_READONLY;
+  }
+  if (stream->subIndex > CO_CAN_STATS_ITEMS)
+  {
+    return ODR_SUB_NOT_EXIST;
+  }
+  if (count != sizeof(uint32_t))
+  {
+    return ODR_TYPE_MISMATCH;
+  }
+  if (CO_getUint32(buf) != 0U)
+  {
+    return ODR_INVALID_VALUE;
+  }
+
+  CO_CANstats_reset((CO_CANmodule_t *)stream->object, stream->subIndex);
+  *countWritten = count;
+  return ODR_OK;
+}
+
+/******************************************************************************/
+ODR_t CO_CANstats_initOD(CO_CANmodule_t *CANmodule, OD_entry_t *entry, OD_extension_t *extension)
+{
+  if ((CANmodule == NULL) || (entry == NULL) || (extension == NULL))
+  {
+    return ODR_DEV_INCOMPAT;
+  }
+
+  memset(extension, 0, sizeof(*extension));
+  extension->object = CANmodule;
+  extension->read = CO_CANstats_readOD;
+  extension->write = CO_CANstats_writeOD;
+
+  return OD_extension_init(entry, extension);
+}
+#endif /* CO_CAN_STATS_OD */
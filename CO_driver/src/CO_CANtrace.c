@@ -0,0 +1,133 @@
+/*
+ * Binary tracing of CAN frames and driver events for ESP32 TWAI driver.
+ *
+ * @file        CO_CANtrace.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_CANtrace.h"
+
+#if CO_CAN_TRACE_LEVEL > CO_CAN_TRACE_LEVEL_OFF
+
+#include "esp_log.h"
+
+#define CO_CAN_TRACE_TAG "co-trace"
+
+#if (CO_CAN_TRACE_SIZE & (CO_CAN_TRACE_SIZE - 1)) != 0
+#error CO_CAN_TRACE_SIZE must be power of 2
+#endif
+
+/* Writers reserve slot by incrementing head. Record is valid, when its seq
+ * equals its position + 1; seq is zero while record is being written. */
+static CO_CANtraceRecord_t traceRing[CO_CAN_TRACE_SIZE];
+static uint32_t traceHead;
+static uint32_t traceTail;
+static uint32_t traceLost;
+
+/******************************************************************************/
+void CO_CANtrace_record(CO_CANtraceType_t type, uint16_t index, uint32_t ident, uint8_t DLC, const uint8_t *data)
+{
+  uint32_t pos = __atomic_fetch_add(&traceHead, 1U, __ATOMIC_RELAXED);
+  CO_CANtraceRecord_t *record = &traceRing[pos & (CO_CAN_TRACE_SIZE - 1U)];
+
+  __atomic_store_n(&record->seq, 0U, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  record->ident = ident;
+  record->index = index;
+  record->type = (uint8_t)type;
+  record->DLC = DLC;
+  if (data != NULL)
+  {
+    memcpy(record->data, data, sizeof(record->data));
+  }
+  else
+  {
+    memset(record->data, 0, sizeof(record->data));
+  }
+
+  __atomic_store_n(&record->seq, pos + 1U, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************/
+bool_t CO_CANtrace_read(CO_CANtraceRecord_t *record)
+{
+  for (;;)
+  {
+    uint32_t head = __atomic_load_n(&traceHead, __ATOMIC_ACQUIRE);
+    const CO_CANtraceRecord_t *slot = &traceRing[traceTail & (CO_CAN_TRACE_SIZE - 1U)];
+    uint32_t seq;
+
+    if ((head - traceTail) > CO_CAN_TRACE_SIZE)
+    {
+      /* writers went around the ring */
+      traceLost += head - traceTail - CO_CAN_TRACE_SIZE;
+      traceTail = head - CO_CAN_TRACE_SIZE;
+      continue;
+    }
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if ((seq != 0U) && ((int32_t)(seq - (traceTail + 1U)) > 0))
+    {
+      /* overwritten by newer record, head is reloaded */
+      continue;
+    }
+    if (seq != (traceTail + 1U))
+    {
+      /* empty or record is being written */
+      return false;
+    }
+
+    *record = *slot;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    traceTail++;
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+    {
+      /* overwritten while copying */
+      traceLost++;
+      continue;
+    }
+    return true;
+  }
+}
+
+/******************************************************************************/
+uint32_t CO_CANtrace_lost(void)
+{
+  return traceLost;
+}
+
+/******************************************************************************/
+uint16_t CO_CANtrace_print(uint16_t maxRecords)
+{
+  static const char *const typeName[] = {
+      "rx", "rx ?", "tx", "tx deferred", "tx overflow", "rx setup", "tx setup", "filter", "sync cleared"};
+  CO_CANtraceRecord_t r;
+  uint16_t n;
+
+  for (n = 0U; (n < maxRecords) && CO_CANtrace_read(&r); n++)
+  {
+    ESP_LOGI(CO_CAN_TRACE_TAG, "%s[%u] ident: 0x%03X, DLC: %u 0x[%02X %02X %02X %02X %02X %02X %02X %02X]",
+             (r.type < (sizeof(typeName) / sizeof(typeName[0]))) ? typeName[r.type] : "?",
+             (unsigned int)r.index, (unsigned int)r.ident, (unsigned int)r.DLC,
+             r.data[0], r.data[1], r.data[2], r.data[3], r.data[4], r.data[5], r.data[6], r.data[7]);
+  }
+  return n;
+}
+
+#endif /* CO_CAN_TRACE_LEVEL > CO_CAN_TRACE_LEVEL_OFF */
@@ -0,0 +1,251 @@
+/*
+ * Heartbeat monitor of the whole CANopen network for ESP32 TWAI driver.
+ *
+ * @file        CO_HBmonitor.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_HBmonitor.h"
+#include "esp_timer.h"
+
+#if (CO_HB_MONITOR_SLOTS & (CO_HB_MONITOR_SLOTS - 1U)) != 0U
+#error CO_HB_MONITOR_SLOTS must be power of 2
+#endif
+
+#define CO_HB_MONITOR_SLOT_US (CO_HB_MONITOR_SLOT_MS * 1000U)
+
+/* Heartbeat producers, 0x700 + node-ID */
+#define CO_HB_MONITOR_IDENT 0x0700U
+#define CO_HB_MONITOR_MASK 0x0780U
+
+#define CO_HB_MONITOR_BIT(nodeId) (1UL << ((nodeId) & 0x1FU))
+
+/* Receive callback, called from receive task */
+static void CO_HBmonitor_receive(void *object, void *msg)
+{
+  CO_HBmonitor_t *hbMonitor = (CO_HBmonitor_t *)object;
+  uint8_t nodeId = (uint8_t)(CO_CANrxMsg_readIdent(msg) & 0x7FU);
+  uint8_t state;
+
+  if ((nodeId == 0U) || (CO_CANrxMsg_readDLC(msg) != 1U) ||
+      (__atomic_load_n(&hbMonitor->time_ms[nodeId], __ATOMIC_RELAXED) == 0U))
+  {
+    return;
+  }
+
+  state = CO_CANrxMsg_readData(msg)[0] & 0x7FU;
+  __atomic_store_n(&hbMonitor->rxTime_us[nodeId], (uint32_t)CO_CANrxMsg_readTimestamp(msg), __ATOMIC_RELAXED);
+  __atomic_store_n(&hbMonitor->rxState[nodeId], state, __ATOMIC_RELAXED);
+  if (state == 0U)
+  {
+    /* boot-up may be followed by other state before the next process */
+    __atomic_fetch_or(&hbMonitor->rxBootup[nodeId >> 5], CO_HB_MONITOR_BIT(nodeId), __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_or(&hbMonitor->rxPending[nodeId >> 5], CO_HB_MONITOR_BIT(nodeId), __ATOMIC_RELEASE);
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_HBmonitor_init(CO_HBmonitor_t *hbMonitor, CO_CANmodule_t *CANmodule, uint16_t rxIndex)
+{
+  if ((hbMonitor == NULL) || (CANmodule == NULL))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  memset(hbMonitor, 0, sizeof(*hbMonitor));
+  memset(hbMonitor->state, CO_HB_MONITOR_UNKNOWN, sizeof(hbMonitor->state));
+  hbMonitor->wheelTime_us = (uint32_t)esp_timer_get_time();
+  hbMonitor->queue = xQueueCreateStatic(CO_HB_MONITOR_QUEUE, sizeof(CO_HBmonitorEvent_t), hbMonitor->queueStorage,
+                                        &hbMonitor->queueBuffer);
+  if (hbMonitor->queue == NULL)
+  {
+    return CO_ERROR_OUT_OF_MEMORY;
+  }
+
+  /* one buffer for all nodes, lookup table dispatches it in constant time */
+  return CO_CANrxBufferInit(CANmodule, rxIndex, CO_HB_MONITOR_IDENT, CO_HB_MONITOR_MASK, false, (void *)hbMonitor,
+                            CO_HBmonitor_receive);
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_HBmonitor_setNode(CO_HBmonitor_t *hbMonitor, uint8_t nodeId, uint16_t time_ms)
+{
+  if ((hbMonitor == NULL) || (nodeId == 0U) || (nodeId >= CO_HB_MONITOR_NODES))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  /* node, which is in timer wheel, is removed or rescheduled when its slot
+   * expires */
+  __atomic_store_n(&hbMonitor->time_ms[nodeId], time_ms, __ATOMIC_RELAXED);
+  if (time_ms == 0U)
+  {
+    hbMonitor->state[nodeId] = CO_HB_MONITOR_UNKNOWN;
+  }
+  return CO_ERROR_NO;
+}
+
+/* Queue event, it is lost if queue is full */
+static void CO_HBmonitor_event(CO_HBmonitor_t *hbMonitor, uint8_t nodeId, uint8_t state, uint32_t time_us)
+{
+  CO_HBmonitorEvent_t event = {
+      .nodeId = nodeId, .state = state, .previous = hbMonitor->state[nodeId], .time_us = time_us};
+
+  hbMonitor->state[nodeId] = state;
+  if (xQueueSend(hbMonitor->queue, &event, 0) != pdTRUE)
+  {
+    hbMonitor->eventsLost++;
+  }
+}
+
+/* Put node to the first slot, which starts at or after deadline. Node due
+ * later than wheel span goes to the last slot and is checked again there. */
+static void CO_HBmonitor_schedule(CO_HBmonitor_t *hbMonitor, uint8_t nodeId, uint32_t deadline_us)
+{
+  int32_t diff = (int32_t)(deadline_us - hbMonitor->wheelTime_us);
+  uint32_t slots = (diff <= 0) ? 1U : (((uint32_t)diff + CO_HB_MONITOR_SLOT_US - 1U) / CO_HB_MONITOR_SLOT_US);
+  uint16_t slot;
+
+  if (slots >= CO_HB_MONITOR_SLOTS)
+  {
+    slots = CO_HB_MONITOR_SLOTS - 1U;
+  }
+  slot = (uint16_t)((hbMonitor->cursor + slots) & (CO_HB_MONITOR_SLOTS - 1U));
+  hbMonitor->next[nodeId] = hbMonitor->slot[slot];
+  hbMonitor->slot[slot] = nodeId;
+}
+
+/* Check nodes of the slot at cursor */
+static void CO_HBmonitor_expire(CO_HBmonitor_t *hbMonitor, uint32_t now_us)
+{
+  uint8_t nodeId = hbMonitor->slot[hbMonitor->cursor];
+
+  hbMonitor->slot[hbMonitor->cursor] = 0U;
+  while (nodeId != 0U)
+  {
+    uint8_t next = hbMonitor->next[nodeId];
+    uint16_t time_ms = hbMonitor->time_ms[nodeId];
+    uint32_t deadline_us = __atomic_load_n(&hbMonitor->rxTime_us[nodeId], __ATOMIC_RELAXED) + (uint32_t)time_ms * 1000U;
+
+    if ((time_ms != 0U) && ((int32_t)(now_us - deadline_us) < 0))
+    {
+      /* heartbeat came meanwhile, check it again at its deadline */
+      CO_HBmonitor_schedule(hbMonitor, nodeId, deadline_us);
+    }
+    else
+    {
+      hbMonitor->active[nodeId >> 5] &= ~CO_HB_MONITOR_BIT(nodeId);
+      if (time_ms != 0U)
+      {
+        hbMonitor->timeouts++;
+        CO_HBmonitor_event(hbMonitor, nodeId, CO_HB_MONITOR_UNKNOWN, now_us);
+      }
+    }
+    nodeId = next;
+  }
+}
+
+/******************************************************************************/
+void CO_HBmonitor_process(CO_HBmonitor_t *hbMonitor, uint32_t *timerNext_us)
+{
+  uint32_t now_us = (uint32_t)esp_timer_get_time();
+  uint32_t slots;
+  uint16_t w;
+
+  if (hbMonitor == NULL)
+  {
+    return;
+  }
+
+  /* heartbeats received since the last call */
+  for (w = 0U; w < (CO_HB_MONITOR_NODES / 32U); w++)
+  {
+    uint32_t pending = __atomic_exchange_n(&hbMonitor->rxPending[w], 0U, __ATOMIC_ACQUIRE);
+    uint32_t bootup = 0U;
+
+    if (pending != 0U)
+    {
+      /* boot-up of heartbeat, which is not pending yet, stays for the next call */
+      bootup = __atomic_fetch_and(&hbMonitor->rxBootup[w], ~pending, __ATOMIC_RELAXED) & pending;
+    }
+
+    while (pending != 0U)
+    {
+      uint8_t nodeId = (uint8_t)((w << 5) | (uint32_t)__builtin_ctz(pending));
+      uint8_t state = __atomic_load_n(&hbMonitor->rxState[nodeId], __ATOMIC_RELAXED);
+      uint32_t rxTime_us = __atomic_load_n(&hbMonitor->rxTime_us[nodeId], __ATOMIC_RELAXED);
+
+      pending &= pending - 1U;
+      hbMonitor->heartbeats++;
+      if (hbMonitor->time_ms[nodeId] == 0U)
+      {
+        continue;
+      }
+      if ((hbMonitor->active[w] & CO_HB_MONITOR_BIT(nodeId)) == 0U)
+      {
+        /* the first heartbeat, or the first one after timeout */
+        hbMonitor->active[w] |= CO_HB_MONITOR_BIT(nodeId);
+        CO_HBmonitor_schedule(hbMonitor, nodeId, rxTime_us + (uint32_t)hbMonitor->time_ms[nodeId] * 1000U);
+      }
+      if (((bootup & CO_HB_MONITOR_BIT(nodeId)) != 0U) && (state != 0U))
+      {
+        CO_HBmonitor_event(hbMonitor, nodeId, 0U, rxTime_us);
+      }
+      if ((state != hbMonitor->state[nodeId]) || ((bootup & CO_HB_MONITOR_BIT(nodeId)) != 0U))
+      {
+        CO_HBmonitor_event(hbMonitor, nodeId, state, rxTime_us);
+      }
+    }
+  }
+
+  /* expired slots, each of them only once, if process was late for more
+   * than the whole wheel */
+  slots = (now_us - hbMonitor->wheelTime_us) / CO_HB_MONITOR_SLOT_US;
+  if (slots > CO_HB_MONITOR_SLOTS)
+  {
+    hbMonitor->wheelTime_us += (slots - CO_HB_MONITOR_SLOTS) * CO_HB_MONITOR_SLOT_US;
+    slots = CO_HB_MONITOR_SLOTS;
+  }
+  while (slots > 0U)
+  {
+    slots--;
+    hbMonitor->cursor = (uint16_t)((hbMonitor->cursor + 1U) & (CO_HB_MONITOR_SLOTS - 1U));
+    hbMonitor->wheelTime_us += CO_HB_MONITOR_SLOT_US;
+    CO_HBmonitor_expire(hbMonitor, now_us);
+  }
+
+  if (timerNext_us != NULL)
+  {
+    uint16_t k;
+
+    /* the next slot with nodes, constant bound */
+    for (k = 1U; k < CO_HB_MONITOR_SLOTS; k++)
+    {
+      if (hbMonitor->slot[(hbMonitor->cursor + k) & (CO_HB_MONITOR_SLOTS - 1U)] != 0U)
+      {
+        uint32_t due = hbMonitor->wheelTime_us + (uint32_t)k * CO_HB_MONITOR_SLOT_US - now_us;
+
+        if (*timerNext_us > due)
+        {
+          *timerNext_us = due;
+        }
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,220 @@
+/*
+ * Node-ID assignment of unconfigured nodes with LSS fastscan.
+ *
+ * @file        CO_LSSassign.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_LSSassign.h"
+
+#if ((CO_CONFIG_LSS) & CO_CONFIG_LSS_MASTER)
+
+#include "esp_log.h"
+
+#define CO_LSS_ASSIGN_TAG "co-lssassign"
+
+#define CO_LSS_ASSIGN_SCAN 0U
+#define CO_LSS_ASSIGN_CONFIGURE 1U
+#define CO_LSS_ASSIGN_STORE 2U
+#define CO_LSS_ASSIGN_DESELECT 3U
+#define CO_LSS_ASSIGN_END 4U
+
+/******************************************************************************/
+CO_ReturnError_t CO_LSSassign_init(CO_LSSassign_t *assign, CO_LSSmaster_t *LSSmaster,
+                                   const CO_LSSmaster_fastscan_t *fastscan, uint8_t firstNodeId, uint8_t lastNodeId,
+                                   bool_t store, CO_LSSassignNode_t *nodes, uint8_t nodesMax)
+{
+  if ((assign == NULL) || (LSSmaster == NULL) || (fastscan == NULL) || (firstNodeId < 1U) ||
+      (lastNodeId > 127U) || (firstNodeId > lastNodeId) || (nodes == NULL) || (nodesMax == 0U))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  memset(assign, 0, sizeof(*assign));
+  assign->LSSmaster = LSSmaster;
+  assign->fastscan = *fastscan;
+  assign->nodeId = firstNodeId;
+  assign->lastNodeId = lastNodeId;
+  assign->store = store;
+  assign->state = CO_LSS_ASSIGN_SCAN;
+  assign->nodes = nodes;
+  assign->nodesMax = nodesMax;
+
+  /* Fastscan waits the whole timeout for each bit without answer. Default
+   * LSS timeout is kept for slow responses to configuration commands. */
+  assign->timeoutOld_ms = (uint16_t)(LSSmaster->timeout_us / 1000U);
+  CO_LSSmaster_changeTimeout(LSSmaster, CO_LSS_ASSIGN_TIMEOUT_MS);
+
+  return CO_ERROR_NO;
+}
+
+/* End assignment with ret */
+static CO_LSSmaster_return_t CO_LSSassign_end(CO_LSSassign_t *assign, CO_LSSmaster_return_t ret)
+{
+  assign->state = CO_LSS_ASSIGN_END;
+  CO_LSSmaster_changeTimeout(assign->LSSmaster, assign->timeoutOld_ms);
+  if (ret == CO_LSSmaster_OK)
+  {
+    ESP_LOGI(CO_LSS_ASSIGN_TAG, "%u nodes assigned in %u ms", assign->nodesCount,
+             (unsigned int)(assign->elapsed_us / 1000U));
+  }
+  else
+  {
+    ESP_LOGW(CO_LSS_ASSIGN_TAG, "Assignment ended with %d after %u nodes", (int)ret, assign->nodesCount);
+  }
+  return ret;
+}
+
+/* Failed scan or configuration, deselect and scan again, unless it failed
+ * too many times in a row */
+static CO_LSSmaster_return_t CO_LSSassign_fail(CO_LSSassign_t *assign, CO_LSSmaster_return_t ret)
+{
+  assign->failures++;
+  assign->attempts++;
+  if (assign->attempts >= CO_LSS_ASSIGN_ATTEMPTS)
+  {
+    (void)CO_LSSmaster_swStateDeselect(assign->LSSmaster);
+    return CO_LSSassign_end(assign, (ret == CO_LSSmaster_OK_ILLEGAL_ARGUMENT) ? CO_LSSmaster_ILLEGAL_ARGUMENT : ret);
+  }
+  assign->state = CO_LSS_ASSIGN_DESELECT;
+  return CO_LSSmaster_WAIT_SLAVE;
+}
+
+/******************************************************************************/
+CO_LSSmaster_return_t CO_LSSassign_process(CO_LSSassign_t *assign, uint32_t timeDifference_us,
+                                           uint32_t *timerNext_us)
+{
+  CO_LSSmaster_t *LSSmaster;
+  CO_LSSmaster_return_t ret = CO_LSSmaster_WAIT_SLAVE;
+  bool_t next;
+
+  if ((assign == NULL) || (assign->state == CO_LSS_ASSIGN_END))
+  {
+    return CO_LSSmaster_INVALID_STATE;
+  }
+  LSSmaster = assign->LSSmaster;
+  assign->elapsed_us += timeDifference_us;
+
+  /* Continue with the next step in the same call, as long as steps finish
+   * without waiting for the slave. */
+  do
+  {
+    CO_LSSassignNode_t *node = &assign->nodes[assign->nodesCount];
+
+    next = false;
+    switch (assign->state)
+    {
+    case CO_LSS_ASSIGN_SCAN:
+      ret = CO_LSSmaster_IdentifyFastscan(LSSmaster, timeDifference_us, &assign->fastscan);
+      timeDifference_us = 0U;
+      if (ret == CO_LSSmaster_SCAN_NOACK)
+      {
+        /* No unconfigured node left, unless its answer was late. Deselect
+         * is not needed, no node was selected. */
+        assign->attempts++;
+        if (assign->attempts >= CO_LSS_ASSIGN_ATTEMPTS)
+        {
+          return CO_LSSassign_end(assign, CO_LSSmaster_OK);
+        }
+        ret = CO_LSSmaster_WAIT_SLAVE;
+        next = true;
+      }
+      else if (ret == CO_LSSmaster_SCAN_FINISHED)
+      {
+        if ((assign->nodeId > assign->lastNodeId) || (assign->nodesCount >= assign->nodesMax))
+        {
+          (void)CO_LSSmaster_swStateDeselect(LSSmaster);
+          return CO_LSSassign_end(assign, CO_LSSmaster_ILLEGAL_ARGUMENT);
+        }
+        node->address = assign->fastscan.found;
+        node->nodeId = assign->nodeId;
+        /* Node, which takes node-ID but answers after short timeout, would
+         * keep it and the next node would get the same. */
+        CO_LSSmaster_changeTimeout(LSSmaster, assign->timeoutOld_ms);
+        assign->state = CO_LSS_ASSIGN_CONFIGURE;
+        next = true;
+      }
+      else if (ret != CO_LSSmaster_WAIT_SLAVE)
+      {
+        ret = CO_LSSassign_fail(assign, ret);
+        next = ret == CO_LSSmaster_WAIT_SLAVE;
+      }
+      break;
+
+    case CO_LSS_ASSIGN_CONFIGURE:
+      ret = CO_LSSmaster_configureNodeId(LSSmaster, timeDifference_us, node->nodeId);
+      timeDifference_us = 0U;
+      if (ret == CO_LSSmaster_OK)
+      {
+        ESP_LOGI(CO_LSS_ASSIGN_TAG, "Node %08X:%08X:%08X:%08X is %u", (unsigned int)node->address.addr[0],
+                 (unsigned int)node->address.addr[1], (unsigned int)node->address.addr[2],
+                 (unsigned int)node->address.addr[3], node->nodeId);
+        assign->nodesCount++;
+        assign->nodeId++;
+        assign->attempts = 0U;
+        assign->state = assign->store ? CO_LSS_ASSIGN_STORE : CO_LSS_ASSIGN_DESELECT;
+        next = true;
+      }
+      else if (ret != CO_LSSmaster_WAIT_SLAVE)
+      {
+        ret = CO_LSSassign_fail(assign, ret);
+        next = ret == CO_LSSmaster_WAIT_SLAVE;
+      }
+      break;
+
+    case CO_LSS_ASSIGN_STORE:
+      ret = CO_LSSmaster_configureStore(LSSmaster, timeDifference_us);
+      timeDifference_us = 0U;
+      if (ret != CO_LSSmaster_WAIT_SLAVE)
+      {
+        if (ret != CO_LSSmaster_OK)
+        {
+          /* node-ID is active anyway, until reset of the node */
+          ESP_LOGW(CO_LSS_ASSIGN_TAG, "Node %u did not store node-ID (%d)",
+                   assign->nodes[assign->nodesCount - 1U].nodeId, (int)ret);
+        }
+        assign->state = CO_LSS_ASSIGN_DESELECT;
+        next = true;
+      }
+      break;
+
+    default:
+      /* Deselect is not confirmed. Node with pending node-ID does not answer
+       * fastscan anymore, so the next scan finds another node. */
+      (void)CO_LSSmaster_swStateDeselect(LSSmaster);
+      CO_LSSmaster_changeTimeout(LSSmaster, CO_LSS_ASSIGN_TIMEOUT_MS);
+      assign->state = CO_LSS_ASSIGN_SCAN;
+      next = true;
+      break;
+    }
+  } while (next);
+
+  if ((timerNext_us != NULL) && (LSSmaster->timeoutTimer < LSSmaster->timeout_us))
+  {
+    uint32_t diff = LSSmaster->timeout_us - LSSmaster->timeoutTimer;
+
+    if (*timerNext_us > diff)
+    {
+      *timerNext_us = diff;
+    }
+  }
+
+  return ret;
+}
+
+#endif /* (CO_CONFIG_LSS) & CO_CONFIG_LSS_MASTER */
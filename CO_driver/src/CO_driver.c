@@ -26,40 +26,520 @@
  */
 
 #include "301/CO_driver.h"
+#include "CO_CANbridge.h"
+#include "CO_CANcapture.h"
+#include "CO_CANlatency.h"
+#include "CO_CANload.h"
+#include "CO_CANraw.h"
+#include "CO_CANtrace.h"
 
 #include "esp_log.h"
 
 #define CO_DRIVER_TAG "co-driver"
 
-static const twai_general_config_t g_config =
-    TWAI_GENERAL_CONFIG_DEFAULT(CONFIG_CAN_TX_GPIO, CONFIG_CAN_RX_GPIO, TWAI_MODE_NORMAL);
+/* Update statistics counter, which has single writer, without locking */
+#define CO_CAN_STAT_INC(counter) \
+  __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + 1U, __ATOMIC_RELAXED)
+#define CO_CAN_STAT_MAX(counter, value)                            \
+  if ((value) > __atomic_load_n(&(counter), __ATOMIC_RELAXED))     \
+  {                                                                \
+    __atomic_store_n(&(counter), (value), __ATOMIC_RELAXED);       \
+  }
+
+/* Member written only by holder of CO_LOCK_CAN_SEND and read also without
+ * the lock, for example to skip it, when there is nothing to transmit */
+#define CO_CAN_SEND_LOAD(member) __atomic_load_n(&(member), __ATOMIC_RELAXED)
+#define CO_CAN_SEND_STORE(member, value) __atomic_store_n(&(member), (__typeof__(member))(value), __ATOMIC_RELAXED)
+
+/* Call TWAI driver function for controller of CAN module */
+#if CO_CAN_TWAI_V2
+#define CO_TWAI(CAN_MODULE, function, ...) twai_##function##_v2((CAN_MODULE)->twai, ##__VA_ARGS__)
+#else
+#define CO_TWAI(CAN_MODULE, function, ...) twai_##function(__VA_ARGS__)
+#endif
 
-#ifdef CONFIG_CANOPEN_BITRATE_25KBITS
-static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_25KBITS();
+/******************************************************************************/
+#define CO_CAN_TIMING(kbit, config) \
+  case kbit:                        \
+  {                                 \
+    twai_timing_config_t t = config; \
+    *timing = t;                    \
+    return true;                    \
+  }
+
+/* Get TWAI timing for CANopen bitrate in kbit/s. Returns false, if bitrate is
+ * not supported by the controller. Bitrates below 25 kbit/s need larger
+ * prescaler, which is available only on newer chips. */
+static bool_t CO_CANbitRateTiming(uint16_t CANbitRate, twai_timing_config_t *timing)
+{
+  switch (CANbitRate)
+  {
+    CO_CAN_TIMING(1000U, TWAI_TIMING_CONFIG_1MBITS())
+    CO_CAN_TIMING(800U, TWAI_TIMING_CONFIG_800KBITS())
+    CO_CAN_TIMING(500U, TWAI_TIMING_CONFIG_500KBITS())
+    CO_CAN_TIMING(250U, TWAI_TIMING_CONFIG_250KBITS())
+    CO_CAN_TIMING(125U, TWAI_TIMING_CONFIG_125KBITS())
+    CO_CAN_TIMING(100U, TWAI_TIMING_CONFIG_100KBITS())
+    CO_CAN_TIMING(50U, TWAI_TIMING_CONFIG_50KBITS())
+    CO_CAN_TIMING(25U, TWAI_TIMING_CONFIG_25KBITS())
+#ifdef TWAI_TIMING_CONFIG_20KBITS
+    CO_CAN_TIMING(20U, TWAI_TIMING_CONFIG_20KBITS())
 #endif
-#ifdef CONFIG_CANOPEN_BITRATE_50KBITS
-static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_50KBITS();
+#ifdef TWAI_TIMING_CONFIG_10KBITS
+    CO_CAN_TIMING(10U, TWAI_TIMING_CONFIG_10KBITS())
 #endif
-#ifdef CONFIG_CANOPEN_BITRATE_100KBITS
-static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_100KBITS();
+  default:
+    return false;
+  }
+}
+
+/******************************************************************************/
+/* Number of rx buffers: rxArray and rx buffers reserved by driver after it */
+#define CO_CAN_RX_COUNT(CANmodule) ((uint16_t)((CANmodule)->rxSize + CO_CAN_RX_EXTRA))
+
+/* Rx buffer at index, which is below CO_CAN_RX_COUNT() */
+#if CO_CAN_RX_EXTRA
+#define CO_CAN_RX_BUFFER(CANmodule, index)                        \
+  (((index) < (CANmodule)->rxSize) ? &(CANmodule)->rxArray[index] \
+                                   : &(CANmodule)->rxExtra[(index) - (CANmodule)->rxSize])
+#else
+#define CO_CAN_RX_BUFFER(CANmodule, index) (&(CANmodule)->rxArray[index])
 #endif
-#ifdef CONFIG_CANOPEN_BITRATE_125KBITS
-static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_125KBITS();
+
+/* Search rx buffers from index 'from' for the first buffer, which accepts the
+ * identifier. Returns CO_CAN_RX_LOOKUP_NONE, if there is no such buffer. */
+static uint16_t CO_CANrxFindFirst(const CO_CANmodule_t *CANmodule, uint16_t from, uint32_t ident)
+{
+  uint16_t index;
+
+  for (index = from; index < CO_CAN_RX_COUNT(CANmodule); index++)
+  {
+    const CO_CANrx_t *buffer = CO_CAN_RX_BUFFER(CANmodule, index);
+
+    if (((ident ^ buffer->ident) & buffer->mask) == 0U)
+    {
+      return index;
+    }
+  }
+  return CO_CAN_RX_LOOKUP_NONE;
+}
+
+#if CO_CAN_RX_LOOKUP
+/* Get the standard identifiers accepted by ident/mask pair: all of them are
+ * 'base' combined with any subset of the 'free' bits. Returns false, if pair
+ * accepts no standard identifier (RTR bit or higher bits are required). */
+static bool_t CO_CANrxLookupKeys(uint16_t ident, uint16_t mask, uint16_t *base, uint16_t *free)
+{
+  if ((ident & mask & ~(CO_CAN_RX_LOOKUP_SIZE - 1U)) != 0U)
+  {
+    return false;
+  }
+  *base = ident & mask & (CO_CAN_RX_LOOKUP_SIZE - 1U);
+  *free = ~mask & (CO_CAN_RX_LOOKUP_SIZE - 1U);
+  return true;
+}
+
+/* Lookup table, which is not used by CANreceive(). Single table is always
+ * the used one, it is written only inside rxDispatchLock. */
+static uint16_t *CO_CANrxLookupSpare(CO_CANmodule_t *CANmodule)
+{
+#if CO_CAN_RX_LOOKUP > 1
+  return (CANmodule->rxLookup == CANmodule->rxLookupTables[0]) ? CANmodule->rxLookupTables[1]
+                                                                : CANmodule->rxLookupTables[0];
+#else
+  return CANmodule->rxLookupTables[0];
 #endif
-#ifdef CONFIG_CANOPEN_BITRATE_250KBITS
-static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_250KBITS();
+}
+
+/* Lookup table for rx buffers just reset by CO_CANmodule_init() */
+static void CO_CANrxLookupReset(const CO_CANmodule_t *CANmodule, uint16_t *lookup)
+{
+  uint16_t i;
+
+  for (i = 0U; i < CO_CAN_RX_LOOKUP_SIZE; i++)
+  {
+    lookup[i] = CO_CAN_RX_LOOKUP_NONE;
+  }
+  if (CO_CAN_RX_COUNT(CANmodule) > 0U)
+  {
+    lookup[0] = 0U;
+  }
+}
+
+/* Update lookup table for rx buffer index changing from oldIdent/oldMask to
+ * buffer, which is not written to it yet. Table keeps first-match order of rx
+ * buffers, so overlapping masks are resolved the same way as with the linear
+ * search. */
+static void CO_CANrxLookupUpdate(const CO_CANmodule_t *CANmodule, uint16_t *lookup, uint16_t index,
+                                 const CO_CANrx_t *buffer, uint16_t oldIdent, uint16_t oldMask)
+{
+  uint16_t base, free, sub;
+
+  /* identifiers, which were dispatched to this buffer, go to the next matching one */
+  if (CO_CANrxLookupKeys(oldIdent, oldMask, &base, &free))
+  {
+    sub = 0U;
+    do
+    {
+      if (lookup[base | sub] == index)
+      {
+        lookup[base | sub] = CO_CANrxFindFirst(CANmodule, index + 1U, base | sub);
+      }
+      sub = (sub - free) & free;
+    } while (sub != 0U);
+  }
+
+  /* identifiers accepted by new configuration, if no buffer before accepts them */
+  if (CO_CANrxLookupKeys(buffer->ident, buffer->mask, &base, &free))
+  {
+    sub = 0U;
+    do
+    {
+      if (lookup[base | sub] > index)
+      {
+        lookup[base | sub] = index;
+      }
+      sub = (sub - free) & free;
+    } while (sub != 0U);
+  }
+}
+#endif /* CO_CAN_RX_LOOKUP */
+
+/******************************************************************************/
+/* TWAI acceptance filter. Identifier and RTR bit of the standard frame are
+ * handled as 12-bit value, ordered as in acceptance code register: ID10..ID0
+ * followed by RTR. Single filter uses bits 31..20 of acceptance code, dual
+ * filter uses bits 31..20 and 15..4. Data bytes are never filtered. */
+#define CO_CAN_FILTER_BITS 12U
+#define CO_CAN_FILTER_ALL 0x0FFFU
+#define CO_CAN_FILTER_SINGLE_DATA 0x000FFFFFU
+#define CO_CAN_FILTER_DUAL_DATA 0x000F000FU
+
+static uint32_t CO_CANfilterBits(uint16_t identOrMask)
+{
+  return ((uint32_t)(identOrMask & 0x07FFU) << 1) | ((uint32_t)(identOrMask >> 11) & 1U);
+}
+
+/* Check if filter, given by code and care bits, accepts all identifiers of rx buffer */
+static bool_t CO_CANfilterCovers(uint32_t code, uint32_t care, uint32_t ident, uint32_t identCare)
+{
+  return ((care & ~identCare) == 0U) && (((code ^ ident) & care) == 0U);
+}
+
+#if CO_CAN_RX_FILTERS
+/* Group of rx buffers, which share one acceptance filter */
+typedef struct
+{
+  uint32_t identAnd;
+  uint32_t identOr;
+  uint32_t careAnd;
+  uint16_t count;
+} CO_CANfilterGroup_t;
+
+static void CO_CANfilterGroupAdd(CO_CANfilterGroup_t *group, uint32_t ident, uint32_t care)
+{
+  if (group->count == 0U)
+  {
+    group->identAnd = ident;
+    group->identOr = ident;
+    group->careAnd = care;
+  }
+  else
+  {
+    group->identAnd &= ident;
+    group->identOr |= ident;
+    group->careAnd &= care;
+  }
+  group->count++;
+}
+
+/* Bits, which are compared by all buffers and are equal in all of them */
+static uint32_t CO_CANfilterGroupCare(const CO_CANfilterGroup_t *group)
+{
+  return group->careAnd & ~(group->identAnd ^ group->identOr) & CO_CAN_FILTER_ALL;
+}
+
+/* Number of identifiers (with RTR) accepted by the filter for the group */
+static uint32_t CO_CANfilterGroupSize(const CO_CANfilterGroup_t *group)
+{
+  if (group->count == 0U)
+  {
+    return 0U;
+  }
+  return 1UL << (CO_CAN_FILTER_BITS - (uint32_t)__builtin_popcount(CO_CANfilterGroupCare(group)));
+}
+
+/* Calculate the tightest single or dual filter, which accepts all identifiers
+ * of configured rx buffers. Dual filter splits buffers by the identifier bit,
+ * which gives the lowest number of accepted identifiers. Returns false, if
+ * all identifiers must be accepted anyway. */
+static bool_t CO_CANrxFilterPlan(const CO_CANmodule_t *CANmodule, twai_filter_config_t *filter)
+{
+  CO_CANfilterGroup_t all = {0};
+  CO_CANfilterGroup_t split[CO_CAN_FILTER_BITS][2] = {0};
+  uint32_t best;
+  uint16_t bestBit = CO_CAN_FILTER_BITS;
+  uint16_t i, b;
+
+#if CO_CAN_RAW_RANGES
+  /* filter is for standard frames, extended frames would not pass */
+  if (CANmodule->rawCount > 0U)
+  {
+    return false;
+  }
 #endif
-#ifdef CONFIG_CANOPEN_BITRATE_500KBITS
-static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
+#if CO_CAN_BRIDGE
+  /* forwarded frames have no rx buffers */
+  if (CANmodule->bridge != NULL)
+  {
+    return false;
+  }
 #endif
-#ifdef CONFIG_CANOPEN_BITRATE_800KBITS
-static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_800KBITS();
+
+  /* reserved range is planned as one more rx buffer, after the last one */
+  for (i = 0U; i <= CO_CAN_RX_COUNT(CANmodule); i++)
+  {
+    uint32_t ident, care;
+
+    if (i == CO_CAN_RX_COUNT(CANmodule))
+    {
+      if (!CANmodule->rxReserved)
+      {
+        break;
+      }
+      ident = CO_CANfilterBits(CANmodule->rxReserveIdent & CANmodule->rxReserveMask);
+      care = CO_CANfilterBits(CANmodule->rxReserveMask | 0x0800U);
+    }
+    else
+    {
+      const CO_CANrx_t *buffer = CO_CAN_RX_BUFFER(CANmodule, i);
+
+      if (buffer->CANrx_callback == NULL)
+      {
+        continue;
+      }
+      ident = CO_CANfilterBits(buffer->ident & buffer->mask);
+      care = CO_CANfilterBits(buffer->mask);
+    }
+    CO_CANfilterGroupAdd(&all, ident, care);
+    for (b = 0U; b < CO_CAN_FILTER_BITS; b++)
+    {
+      CO_CANfilterGroupAdd(&split[b][(ident >> b) & 1U], ident, care);
+    }
+  }
+
+  if ((all.count == 0U) || (CO_CANfilterGroupCare(&all) == 0U))
+  {
+    return false;
+  }
+
+  best = CO_CANfilterGroupSize(&all);
+  for (b = 0U; b < CO_CAN_FILTER_BITS; b++)
+  {
+    uint32_t size = CO_CANfilterGroupSize(&split[b][0]) + CO_CANfilterGroupSize(&split[b][1]);
+
+    if ((split[b][0].count != 0U) && (split[b][1].count != 0U) && (size < best))
+    {
+      best = size;
+      bestBit = b;
+    }
+  }
+
+  if (bestBit == CO_CAN_FILTER_BITS)
+  {
+    uint32_t care = CO_CANfilterGroupCare(&all);
+
+    filter->acceptance_code = (all.identAnd & care) << 20;
+    filter->acceptance_mask = ((~care & CO_CAN_FILTER_ALL) << 20) | CO_CAN_FILTER_SINGLE_DATA;
+    filter->single_filter = true;
+  }
+  else
+  {
+    uint32_t care1 = CO_CANfilterGroupCare(&split[bestBit][0]);
+    uint32_t care2 = CO_CANfilterGroupCare(&split[bestBit][1]);
+
+    filter->acceptance_code = ((split[bestBit][0].identAnd & care1) << 20) |
+                              ((split[bestBit][1].identAnd & care2) << 4);
+    filter->acceptance_mask = ((~care1 & CO_CAN_FILTER_ALL) << 20) |
+                              ((~care2 & CO_CAN_FILTER_ALL) << 4) | CO_CAN_FILTER_DUAL_DATA;
+    filter->single_filter = false;
+  }
+  return true;
+}
+#endif /* CO_CAN_RX_FILTERS */
+
+/* Check if installed acceptance filter accepts all identifiers of rx buffer */
+static bool_t CO_CANrxFilterAccepts(const twai_filter_config_t *filter, uint16_t ident, uint16_t mask)
+{
+  uint32_t identBits = CO_CANfilterBits(ident & mask);
+  uint32_t careBits = CO_CANfilterBits(mask);
+  uint32_t code = filter->acceptance_code;
+  uint32_t care = ~filter->acceptance_mask;
+
+  if (filter->single_filter)
+  {
+    return CO_CANfilterCovers((code >> 20) & CO_CAN_FILTER_ALL, (care >> 20) & CO_CAN_FILTER_ALL, identBits, careBits);
+  }
+  return CO_CANfilterCovers((code >> 20) & CO_CAN_FILTER_ALL, (care >> 20) & CO_CAN_FILTER_ALL, identBits, careBits) ||
+         CO_CANfilterCovers((code >> 4) & CO_CAN_FILTER_ALL, (care >> 4) & CO_CAN_FILTER_ALL, identBits, careBits);
+}
+
+/* TWAI alerts, which change bus state or error counters */
+#define CO_CAN_ALERTS_ERROR                                                       \
+  (TWAI_ALERT_ABOVE_ERR_WARN | TWAI_ALERT_BELOW_ERR_WARN | TWAI_ALERT_ERR_PASS |  \
+   TWAI_ALERT_ERR_ACTIVE | TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED |        \
+   TWAI_ALERT_RX_QUEUE_FULL | TWAI_ALERT_RX_FIFO_OVERRUN | TWAI_ALERT_BUS_ERROR | \
+   TWAI_ALERT_ARB_LOST | TWAI_ALERT_TX_FAILED)
+
+/* TWAI alerts used by driver. Transmit complete alerts are used to send
+ * messages waiting in txArray, error alerts to sample TWAI status only when
+ * it changes. Received data alert is added for CO_CANwait(). */
+#define CO_CAN_ALERTS (TWAI_ALERT_TX_SUCCESS | TWAI_ALERT_TX_IDLE | CO_CAN_ALERTS_ERROR)
+
+/* Install TWAI driver with acceptance filter from CANmodule. If driver is
+ * already installed, it is uninstalled first. */
+static esp_err_t CO_CANdriverInstall(CO_CANmodule_t *CANmodule)
+{
+  twai_general_config_t config =
+      TWAI_GENERAL_CONFIG_DEFAULT(CANmodule->port.txGpio, CANmodule->port.rxGpio, CANmodule->port.mode);
+  esp_err_t ret;
+
+  if (CANmodule->driverInstalled)
+  {
+    CO_TWAI(CANmodule, stop);
+    CO_TWAI(CANmodule, driver_uninstall);
+    __atomic_store_n(&CANmodule->driverInstalled, false, __ATOMIC_RELEASE);
+  }
+
+  config.tx_queue_len = CO_CAN_TX_QUEUE_LEN;
+  config.alerts_enabled = CO_CAN_ALERTS | ((CANmodule->waitTask != NULL) ? TWAI_ALERT_RX_DATA : 0U);
+
+#if CO_CAN_TWAI_V2
+  config.controller_id = CANmodule->port.controllerId;
+  ret = twai_driver_install_v2(&config, &CANmodule->timing, &CANmodule->rxFilter, &CANmodule->twai);
+#else
+  ret = twai_driver_install(&config, &CANmodule->timing, &CANmodule->rxFilter);
 #endif
-#ifdef CONFIG_CANOPEN_BITRATE_1MBITS
-static const twai_timing_config_t t_config = TWAI_TIMING_CONFIG_1MBITS();
+  if (ret == ESP_OK)
+  {
+    __atomic_store_n(&CANmodule->driverInstalled, true, __ATOMIC_RELEASE);
+    /* TWAI counters start from zero, transmit queue is empty */
+    memset(&CANmodule->statusLast, 0, sizeof(CANmodule->statusLast));
+    CO_CAN_SEND_STORE(CANmodule->txInflightCount, 0U);
+    CANmodule->txInflightSync = 0U;
+    CANmodule->bufferInhibitFlag = false;
+    CANmodule->txSyncPassed = false;
+    CANmodule->txFailedLast = 0U;
+    CANmodule->busOff = false;
+  }
+  return ret;
+}
+
+/* Reinstall TWAI driver with filter and timing from CANmodule and start it
+ * again, if module is in normal mode. Messages, which are in TWAI queues, are
+ * lost. CANreceive() is kept out of twai_receive() meanwhile. Must be called
+ * inside CO_LOCK_CAN_SEND, as transmit state is reset. */
+static esp_err_t CO_CANdriverReinstall(CO_CANmodule_t *CANmodule)
+{
+  esp_err_t ret;
+
+  __atomic_store_n(&CANmodule->rxFilterDirty, true, __ATOMIC_RELEASE);
+  xSemaphoreTake(CANmodule->rxLock, portMAX_DELAY);
+
+  ret = CO_CANdriverInstall(CANmodule);
+  if ((ret == ESP_OK) && CANmodule->CANnormal)
+  {
+    CO_TWAI(CANmodule, start);
+  }
+
+  __atomic_store_n(&CANmodule->rxFilterDirty, false, __ATOMIC_RELEASE);
+  xSemaphoreGive(CANmodule->rxLock);
+
+  return ret;
+}
+
+/* Reinstall TWAI driver with acceptance filter. TWAI filter can only be set at
+ * driver installation. Must be called inside rxConfigLock and
+ * CO_LOCK_CAN_SEND. */
+static esp_err_t CO_CANrxFilterInstall(CO_CANmodule_t *CANmodule, const twai_filter_config_t *filter,
+                                       bool_t useFilters)
+{
+  esp_err_t ret;
+
+  CANmodule->rxFilter = *filter;
+  CANmodule->useCANrxFilters = useFilters;
+  CO_CAN_SEND_STORE(CANmodule->rxFilterOpen, false);
+  ret = CO_CANdriverReinstall(CANmodule);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(CO_DRIVER_TAG, "Acceptance filter not installed: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  CO_CAN_TRACE_CONFIG(CO_CAN_TRACE_FILTER, filter->single_filter ? 1U : 2U, filter->acceptance_code, 0U,
+                      ((const uint8_t[8]){(uint8_t)filter->acceptance_mask, (uint8_t)(filter->acceptance_mask >> 8),
+                                          (uint8_t)(filter->acceptance_mask >> 16),
+                                          (uint8_t)(filter->acceptance_mask >> 24)}));
+  return ret;
+}
+
+#if CO_CAN_RX_FILTERS
+/* Calculate new acceptance filter and install it, if it is different from the
+ * installed one. Only CO_CANsetNormalMode() narrows the filter, when all rx
+ * buffers are configured. Must be called inside rxConfigLock. */
+static esp_err_t CO_CANrxFilterApply(CO_CANmodule_t *CANmodule)
+{
+  twai_filter_config_t filter = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+  bool_t useFilters = CO_CANrxFilterPlan(CANmodule, &filter);
+  esp_err_t ret = ESP_OK;
+
+  CO_LOCK_CAN_SEND(CANmodule);
+  if ((filter.acceptance_code == CANmodule->rxFilter.acceptance_code) &&
+      (filter.acceptance_mask == CANmodule->rxFilter.acceptance_mask) &&
+      (filter.single_filter == CANmodule->rxFilter.single_filter))
+  {
+    CANmodule->useCANrxFilters = useFilters;
+    CO_CAN_SEND_STORE(CANmodule->rxFilterOpen, false);
+  }
+  else
+  {
+    ret = CO_CANrxFilterInstall(CANmodule, &filter, useFilters);
+  }
+  CO_UNLOCK_CAN_SEND(CANmodule);
+
+  return ret;
+}
 #endif
 
-static const twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+/* Defined with transmit functions below */
+static bool_t CO_CANtxQueueEmpty(CO_CANmodule_t *CANmodule);
+
+/* Open acceptance filter for rx buffer or raw range configured in normal mode,
+ * so it accepts all identifiers. Reinstall would lose messages in TWAI
+ * transmit queue, so until the queue is empty, new messages wait in txArray
+ * and CO_CANmodule_process() tries again. Must be called inside rxConfigLock. */
+static esp_err_t CO_CANrxFilterOpen(CO_CANmodule_t *CANmodule)
+{
+  twai_filter_config_t filter = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+  esp_err_t ret = ESP_OK;
+
+  CO_LOCK_CAN_SEND(CANmodule);
+  if (!CANmodule->useCANrxFilters)
+  {
+    /* already open */
+  }
+  else if (CO_CANtxQueueEmpty(CANmodule))
+  {
+    ret = CO_CANrxFilterInstall(CANmodule, &filter, false);
+  }
+  else
+  {
+    CO_CAN_SEND_STORE(CANmodule->rxFilterOpen, true);
+  }
+  CO_UNLOCK_CAN_SEND(CANmodule);
+
+  return ret;
+}
 
 /******************************************************************************/
 void CO_CANsetConfigurationMode(void *CANptr)
@@ -73,9 +553,16 @@ void CO_CANsetNormalMode(CO_CANmodule_t *CANmodule)
 {
   /* Put CAN module in normal mode */
 
+#if CO_CAN_RX_FILTERS
+  /* All rx buffers are configured now, program hardware acceptance filter */
+  xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+  (void)CO_CANrxFilterApply(CANmodule);
+  xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+#endif
+
   CANmodule->CANnormal = true;
 
-  if (twai_start() == ESP_OK)
+  if (CO_TWAI(CANmodule, start) == ESP_OK)
   {
     ESP_LOGI(CO_DRIVER_TAG, "Driver started\n");
   }
@@ -95,127 +582,567 @@ CO_ReturnError_t CO_CANmodule_init(
     uint16_t txSize,
     uint16_t CANbitRate)
 {
+  const CO_CANport_t portDefault = {0, CONFIG_CAN_TX_GPIO, CONFIG_CAN_RX_GPIO, TWAI_MODE_NORMAL};
+  const CO_CANport_t *port = (CANptr != NULL) ? (const CO_CANport_t *)CANptr : &portDefault;
   uint16_t i;
 
   /* verify arguments */
-  if (CANmodule == NULL || rxArray == NULL || txArray == NULL)
+  if (CANmodule == NULL || rxArray == NULL || txArray == NULL || txSize > CO_CAN_TX_MAX)
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+#if !CO_CAN_TWAI_V2
+  /* legacy TWAI API has no controller handle */
+  if (port->controllerId != 0)
   {
     return CO_ERROR_ILLEGAL_ARGUMENT;
   }
+#endif
+  if (CANmodule->driverInstalled && (port->controllerId != CANmodule->port.controllerId))
+  {
+    /* controller can not change over communication reset */
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+  if (CANbitRate == 0U)
+  {
+    CANbitRate = CO_CAN_BITRATE_DEFAULT;
+  }
+  if (!CO_CANbitRateTiming(CANbitRate, &CANmodule->timing))
+  {
+    return CO_ERROR_ILLEGAL_BAUDRATE;
+  }
 
   /* Configure object variables */
   CANmodule->CANptr = CANptr;
+  CANmodule->port = *port;
   CANmodule->rxArray = rxArray;
   CANmodule->rxSize = rxSize;
   CANmodule->txArray = txArray;
   CANmodule->txSize = txSize;
+  CANmodule->CANbitRate = CANbitRate;
   CANmodule->CANerrorStatus = 0;
   CANmodule->CANnormal = false;
-  CANmodule->useCANrxFilters = false; // TODO: (rxSize <= 32U) ? true : false; /* microcontroller dependent */
+  CANmodule->useCANrxFilters = false; /* enabled in CO_CANsetNormalMode() */
   CANmodule->bufferInhibitFlag = false;
   CANmodule->firstCANtxMessage = true;
   CANmodule->CANtxCount = 0U;
   CANmodule->errOld = 0U;
+  CANmodule->rxFilter = (twai_filter_config_t)TWAI_FILTER_CONFIG_ACCEPT_ALL();
+  __atomic_store_n(&CANmodule->rxFilterDirty, false, __ATOMIC_RELEASE);
+  CANmodule->rxFilterOpen = false;
+  CANmodule->rxReserved = false;
+  CANmodule->rxFalseAccepts = 0U;
+  memset(&CANmodule->stats, 0, sizeof(CANmodule->stats));
+  CANmodule->stats.recoveryDelayMs = CO_CAN_BUSOFF_BACKOFF_MIN_MS;
+  CANmodule->statusTime = 0;
+  CANmodule->recoveredTime = 0;
+  CANmodule->rxOverflow = false;
+  if (CANmodule->rxLock == NULL)
+  {
+    /* locks are created once and kept over communication reset */
+    CANmodule->rxLock = xSemaphoreCreateMutexStatic(&CANmodule->rxLockBuffer);
+    CANmodule->sendLock = xSemaphoreCreateMutexStatic(&CANmodule->sendLockBuffer);
+    CANmodule->odLock = xSemaphoreCreateRecursiveMutexStatic(&CANmodule->odLockBuffer);
+    CANmodule->rxConfigLock = xSemaphoreCreateRecursiveMutexStatic(&CANmodule->rxConfigLockBuffer);
+    portMUX_INITIALIZE(&CANmodule->rxDispatchLock);
+    portMUX_INITIALIZE(&CANmodule->emcyLock);
+  }
+
+  /* All rx buffers will be identical (ident 0, full mask), so only identifier 0
+   * is accepted, by the first buffer. */
+  xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+#if CO_CAN_RX_LOOKUP > 1
+  CO_CANrxLookupReset(CANmodule, CO_CANrxLookupSpare(CANmodule));
+#endif
 
-  for (i = 0U; i < rxSize; i++)
+  portENTER_CRITICAL(&CANmodule->rxDispatchLock);
+#if CO_CAN_RX_LOOKUP == 1
+  CO_CANrxLookupReset(CANmodule, CO_CANrxLookupSpare(CANmodule));
+#endif
+#if CO_CAN_RX_LOOKUP
+  CANmodule->rxLookup = CO_CANrxLookupSpare(CANmodule);
+#endif
+  for (i = 0U; i < CO_CAN_RX_COUNT(CANmodule); i++)
   {
-    rxArray[i].ident = 0U;
-    rxArray[i].mask = 0xFFFFU;
-    rxArray[i].object = NULL;
-    rxArray[i].CANrx_callback = NULL;
+    CO_CANrx_t *buffer = CO_CAN_RX_BUFFER(CANmodule, i);
+
+    buffer->ident = 0U;
+    buffer->mask = 0xFFFFU;
+    buffer->object = NULL;
+    buffer->CANrx_callback = NULL;
+    buffer->direct = false;
   }
   for (i = 0U; i < txSize; i++)
   {
+    txArray[i].flags = TWAI_MSG_FLAG_NONE;
+    txArray[i].ident = 0U;
     txArray[i].bufferFull = false;
+    txArray[i].stream = false;
+    txArray[i].txTime_us = 0;
+    txArray[i].rank = i;
+    txArray[i].byRank = i;
+  }
+  for (i = 0U; i < CO_CAN_TX_PENDING_WORDS; i++)
+  {
+    CANmodule->txPending[i] = 0U;
   }
+  CANmodule->txPendingSummary = 0U;
+#if CO_CAN_TX_STREAM
+  CANmodule->txStreamFirst = 0U;
+  CANmodule->txStreamCount = 0U;
+#endif
+
+#if CO_CAN_RX_RING
+  /* Messages for previous rx buffer configuration are discarded */
+  __atomic_store_n(&CANmodule->rxRingTail, __atomic_load_n(&CANmodule->rxRingHead, __ATOMIC_RELAXED), __ATOMIC_RELEASE);
+  CANmodule->rxRingOverruns = 0U;
+  CANmodule->rxRingStale = 0U;
+  CANmodule->rxRingPeak = 0U;
+#endif
+  portEXIT_CRITICAL(&CANmodule->rxDispatchLock);
+  xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
 
   /* Configure CAN module registers */
 
-  /* Configure CAN timing */
+  /* Configure CAN timing, CANmodule->timing is set from CANbitRate above */
 
   /* Configure CAN module hardware filters */
-  if (CANmodule->useCANrxFilters)
-  {
-    /* CAN module filters are used, they will be configured with */
-    /* CO_CANrxBufferInit() functions, called by separate CANopen */
-    /* init functions. */
-    /* Configure all masks so, that received message must match filter */
-  }
-  else
-  {
-    /* CAN module filters are not used, all messages with standard 11-bit */
-    /* identifier will be received */
-    /* Configure mask 0 so, that all messages with standard identifier are accepted */
-  }
+  /* Filters are not used yet, all messages will be received. Rx buffers are */
+  /* configured with CO_CANrxBufferInit() functions, called by separate */
+  /* CANopen init functions, filter is then programmed in CO_CANsetNormalMode(). */
 
   /* configure CAN interrupt registers */
 
-  ESP_ERROR_CHECK(twai_driver_install(&g_config, &t_config, &f_config));
+  ESP_ERROR_CHECK(CO_CANdriverInstall(CANmodule));
 
-  ESP_LOGI(CO_DRIVER_TAG, "CO_CANmodule_init (Driver installed)");
+  ESP_LOGI(CO_DRIVER_TAG, "CO_CANmodule_init (Driver installed, %u kbit/s)", CANbitRate);
   return CO_ERROR_NO;
 }
 
 /******************************************************************************/
 void CO_CANmodule_disable(CO_CANmodule_t *CANmodule)
 {
-  /* turn off the module */
-  ESP_ERROR_CHECK(twai_stop());
-  //ESP_ERROR_CHECK(twai_driver_uninstall());
+  if ((CANmodule == NULL) || !CANmodule->driverInstalled)
+  {
+    return;
+  }
+
+  /* turn off the module, CANreceive() must not wait in twai_receive() */
+  __atomic_store_n(&CANmodule->rxFilterDirty, true, __ATOMIC_RELEASE);
+  xSemaphoreTake(CANmodule->rxLock, portMAX_DELAY);
 
-  ESP_LOGI(CO_DRIVER_TAG, "CO_CANmodule_disable (twai_stop)");
+  CANmodule->CANnormal = false;
+  CO_TWAI(CANmodule, stop);
+  ESP_ERROR_CHECK(CO_TWAI(CANmodule, driver_uninstall));
+  __atomic_store_n(&CANmodule->driverInstalled, false, __ATOMIC_RELEASE);
+
+  __atomic_store_n(&CANmodule->rxFilterDirty, false, __ATOMIC_RELEASE);
+  xSemaphoreGive(CANmodule->rxLock);
+
+  ESP_LOGI(CO_DRIVER_TAG, "CO_CANmodule_disable (Driver uninstalled)");
 }
 
 /******************************************************************************/
-CO_ReturnError_t CO_CANrxBufferInit(
-    CO_CANmodule_t *CANmodule,
-    uint16_t index,
-    uint16_t ident,
-    uint16_t mask,
-    bool_t rtr,
-    void *object,
-    void (*CANrx_callback)(void *object, void *message))
+/* Wake task sleeping in CO_CANwait(). Must not be called inside spinlock. */
+static void CO_CANwake(CO_CANmodule_t *CANmodule, uint32_t events)
 {
-  CO_ReturnError_t ret = CO_ERROR_NO;
+  TaskHandle_t waitTask = __atomic_load_n(&CANmodule->waitTask, __ATOMIC_ACQUIRE);
 
-  if ((CANmodule != NULL) && (object != NULL) && (CANrx_callback != NULL) && (index < CANmodule->rxSize))
+  if ((waitTask != NULL) && (events != 0U))
   {
-    /* buffer, which will be configured */
-    CO_CANrx_t *buffer = &CANmodule->rxArray[index];
+    __atomic_fetch_or(&CANmodule->waitEvents, events, __ATOMIC_RELEASE);
+    xSemaphoreGive(CANmodule->waitSem);
+  }
+}
 
-    /* Configure object variables */
-    buffer->object = object;
-    buffer->CANrx_callback = CANrx_callback;
+/* Receive task reads TWAI alerts, if it waits for them for CO_CANwait() */
+static bool_t CO_CANrxAlertReader(const CO_CANmodule_t *CANmodule)
+{
+  return (__atomic_load_n(&CANmodule->waitTask, __ATOMIC_ACQUIRE) != NULL) &&
+         (__atomic_load_n(&CANmodule->rxTaskRun, __ATOMIC_ACQUIRE));
+}
 
-    /* CAN identifier and CAN mask, bit aligned with CAN module. Different on different microcontrollers. */
-    buffer->ident = ident & 0x07FFU;
-    if (rtr)
-    {
-      buffer->ident |= 0x0800U;
-    }
-    buffer->mask = (mask & 0x07FFU) | 0x0800U;
+/* Wait for any TWAI alert instead of waiting for message only, then receive
+ * all queued messages. Used by receive task, while mainline sleeps in
+ * CO_CANwait(), so it is woken also for transmit and status events. */
+static void CO_CANrxAlertWait(CO_CANmodule_t *CANmodule)
+{
+  uint32_t alerts = 0U;
+  uint32_t events = 0U;
 
-    /* Set CAN hardware module filter and mask. */
-    if (CANmodule->useCANrxFilters)
-    {
-    }
+  if (__atomic_load_n(&CANmodule->rxFilterDirty, __ATOMIC_ACQUIRE) ||
+      !__atomic_load_n(&CANmodule->driverInstalled, __ATOMIC_ACQUIRE))
+  {
+    /* driver is being reinstalled or is disabled, let it take rxLock */
+    vTaskDelay(1);
+    return;
+  }
 
-    ESP_LOGI(CO_DRIVER_TAG, "Setup buffer rx[%d] ident: %d mask %d", index, ident, mask);
+  xSemaphoreTake(CANmodule->rxLock, portMAX_DELAY);
+  if (CO_TWAI(CANmodule, read_alerts, &alerts, pdMS_TO_TICKS(CO_CAN_RX_WAIT_MS)) != ESP_OK)
+  {
+    alerts = 0U;
   }
-  else
+  xSemaphoreGive(CANmodule->rxLock);
+
+  /* Messages are taken also without alert, they may have been queued before
+   * received data alert was enabled */
+  while (CANreceiveBatch(CANmodule, 0U, CO_CAN_RX_BATCH) == CO_CAN_RX_BATCH)
   {
-    ret = CO_ERROR_ILLEGAL_ARGUMENT;
   }
 
-  return ret;
+  alerts &= ~(uint32_t)TWAI_ALERT_RX_DATA;
+  if (alerts != 0U)
+  {
+    __atomic_fetch_or(&CANmodule->alertsPending, alerts, __ATOMIC_RELAXED);
+    if ((alerts & CO_CAN_ALERTS_ERROR) != 0U)
+    {
+      events |= CO_CAN_WAIT_STATUS;
+    }
+    if (((alerts & (TWAI_ALERT_TX_SUCCESS | TWAI_ALERT_TX_IDLE)) != 0U) &&
+        (CO_CAN_SEND_LOAD(CANmodule->CANtxCount) > 0U))
+    {
+      events |= CO_CAN_WAIT_TX;
+    }
+    CO_CANwake(CANmodule, events);
+  }
 }
 
 /******************************************************************************/
-CO_CANtx_t *CO_CANtxBufferInit(
-    CO_CANmodule_t *CANmodule,
-    uint16_t index,
-    uint16_t ident,
-    bool_t rtr,
+static void CO_CANrxTask(void *arg)
+{
+  CO_CANmodule_t *CANmodule = (CO_CANmodule_t *)arg;
+
+  while (__atomic_load_n(&CANmodule->rxTaskRun, __ATOMIC_ACQUIRE))
+  {
+    if (CO_CANrxAlertReader(CANmodule))
+    {
+      CO_CANrxAlertWait(CANmodule);
+    }
+    else
+    {
+#if CO_CAN_RX_TASK_BATCH
+      CANreceiveBatch(CANmodule, CO_CAN_RX_WAIT_MS, CO_CAN_RX_BATCH);
+#else
+      CANreceive(CANmodule);
+#endif
+    }
+  }
+
+  xTaskNotifyGive(CANmodule->rxTaskStopper);
+  vTaskDelete(NULL);
+}
+
+/******************************************************************************/
+bool_t CO_CANrxTaskStart(CO_CANmodule_t *CANmodule)
+{
+  if ((CANmodule == NULL) || (CANmodule->rxTask != NULL))
+  {
+    return false;
+  }
+
+  CANmodule->rxTaskRun = true;
+  if (xTaskCreatePinnedToCore(CO_CANrxTask, "CO_CANrx", CO_CAN_RX_TASK_STACK, CANmodule,
+                              CO_CAN_RX_TASK_PRIORITY, &CANmodule->rxTask, CO_CAN_RX_TASK_CORE) != pdPASS)
+  {
+    CANmodule->rxTaskRun = false;
+    CANmodule->rxTask = NULL;
+    return false;
+  }
+  return true;
+}
+
+/******************************************************************************/
+void CO_CANrxTaskStop(CO_CANmodule_t *CANmodule)
+{
+  if ((CANmodule == NULL) || (CANmodule->rxTask == NULL))
+  {
+    return;
+  }
+
+  CANmodule->rxTaskStopper = xTaskGetCurrentTaskHandle();
+  __atomic_store_n(&CANmodule->rxTaskRun, false, __ATOMIC_RELEASE);
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  CANmodule->rxTask = NULL;
+}
+
+/******************************************************************************/
+bool_t CO_CANcheckBitRate(void *object, uint16_t bitRate)
+{
+  twai_timing_config_t timing;
+
+  (void)object;
+  return CO_CANbitRateTiming(bitRate, &timing);
+}
+
+/******************************************************************************/
+bool_t CO_CANsetBitRate(CO_CANmodule_t *CANmodule, uint16_t CANbitRate)
+{
+  twai_timing_config_t timing;
+
+  if (CANmodule == NULL)
+  {
+    return false;
+  }
+  if (!CO_CANbitRateTiming(CANbitRate, &timing))
+  {
+    return false;
+  }
+  if (CANbitRate == CANmodule->CANbitRate)
+  {
+    return true;
+  }
+
+  CANmodule->timing = timing;
+  CANmodule->CANbitRate = CANbitRate;
+#if CO_CAN_LOAD
+  if (CANmodule->load != NULL)
+  {
+    CANmodule->load->bitRate = CANbitRate;
+  }
+#endif
+  if (CANmodule->driverInstalled)
+  {
+    esp_err_t ret;
+
+    CO_LOCK_CAN_SEND(CANmodule);
+    ret = CO_CANdriverReinstall(CANmodule);
+    CO_UNLOCK_CAN_SEND(CANmodule);
+    if (ret != ESP_OK)
+    {
+      return false;
+    }
+  }
+
+  ESP_LOGI(CO_DRIVER_TAG, "Bitrate %u kbit/s", CANbitRate);
+  return true;
+}
+
+/******************************************************************************/
+void CO_CANrxFilterReserve(CO_CANmodule_t *CANmodule, uint16_t ident, uint16_t mask)
+{
+  if (CANmodule == NULL)
+  {
+    return;
+  }
+
+  xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+  CANmodule->rxReserveIdent = ident & 0x07FFU;
+  CANmodule->rxReserveMask = mask & 0x07FFU;
+  CANmodule->rxReserved = mask != 0U;
+  /* open filter at once, CO_CANsetNormalMode() narrows it again */
+  if (CANmodule->useCANrxFilters && CANmodule->rxReserved &&
+      !CO_CANrxFilterAccepts(&CANmodule->rxFilter, CANmodule->rxReserveIdent, CANmodule->rxReserveMask | 0x0800U))
+  {
+    (void)CO_CANrxFilterOpen(CANmodule);
+  }
+  xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+}
+
+/******************************************************************************/
+void CO_CANactivateBitRate(void *object, uint16_t delay)
+{
+  CO_CANbitRateSwitch_t *bitRateSwitch = (CO_CANbitRateSwitch_t *)object;
+  CO_CANmodule_t *CANmodule = bitRateSwitch->CANmodule;
+
+  /* CiA 305: stay silent for delay, switch, stay silent for delay again */
+  vTaskDelay(pdMS_TO_TICKS(delay));
+  CO_CANsetBitRate(CANmodule, *bitRateSwitch->pendingBitRate);
+  vTaskDelay(pdMS_TO_TICKS(delay));
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANrxBufferInit(
+    CO_CANmodule_t *CANmodule,
+    uint16_t index,
+    uint16_t ident,
+    uint16_t mask,
+    bool_t rtr,
+    void *object,
+    void (*CANrx_callback)(void *object, void *message))
+{
+  CO_ReturnError_t ret = CO_ERROR_NO;
+
+  if ((CANmodule != NULL) && (object != NULL) && (CANrx_callback != NULL) && (index < CO_CAN_RX_COUNT(CANmodule)))
+  {
+    /* buffer, which will be configured */
+    CO_CANrx_t *buffer = CO_CAN_RX_BUFFER(CANmodule, index);
+    CO_CANrx_t config;
+#if CO_CAN_RX_LOOKUP > 1
+    uint16_t *lookup;
+#endif
+
+    /* Configure object variables */
+    config.object = object;
+    config.CANrx_callback = CANrx_callback;
+
+    /* CAN identifier and CAN mask, bit aligned with CAN module. Different on different microcontrollers. */
+    config.ident = ident & 0x07FFU;
+    if (rtr)
+    {
+      config.ident |= 0x0800U;
+    }
+    config.mask = (mask & 0x07FFU) | 0x0800U;
+    config.direct = CO_CAN_RX_DIRECT(ident & 0x07FFU);
+
+    /* Update copy of CAN-ID lookup table, it can take thousands of steps for
+     * short mask. CANreceive() uses the current one meanwhile, the copy is
+     * published together with the buffer. Single table is updated in place,
+     * CANreceive() waits for it. */
+    xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+#if CO_CAN_RX_LOOKUP > 1
+    lookup = CO_CANrxLookupSpare(CANmodule);
+    memcpy(lookup, CANmodule->rxLookup, sizeof(CANmodule->rxLookupTables[0]));
+    CO_CANrxLookupUpdate(CANmodule, lookup, index, &config, buffer->ident, buffer->mask);
+#endif
+
+    portENTER_CRITICAL(&CANmodule->rxDispatchLock);
+#if CO_CAN_RX_LOOKUP == 1
+    CO_CANrxLookupUpdate(CANmodule, CANmodule->rxLookup, index, &config, buffer->ident, buffer->mask);
+#endif
+    *buffer = config;
+#if CO_CAN_RX_LOOKUP > 1
+    CANmodule->rxLookup = lookup;
+#endif
+    portEXIT_CRITICAL(&CANmodule->rxDispatchLock);
+
+    /* Set CAN hardware module filter and mask. In normal mode it is only */
+    /* opened, if identifiers of the buffer are not accepted already. */
+    if (CANmodule->useCANrxFilters && !CO_CANrxFilterAccepts(&CANmodule->rxFilter, buffer->ident, buffer->mask) &&
+        (CO_CANrxFilterOpen(CANmodule) != ESP_OK))
+    {
+      ret = CO_ERROR_SYSCALL;
+    }
+    xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+
+    CO_CAN_TRACE_CONFIG(CO_CAN_TRACE_RX_SETUP, index, buffer->ident, 0U,
+                        ((const uint8_t[8]){(uint8_t)buffer->mask, (uint8_t)(buffer->mask >> 8)}));
+  }
+  else
+  {
+    ret = CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  return ret;
+}
+
+/******************************************************************************/
+/* Waiting tx buffers are marked in bitmap by their rank, so the one with the
+ * lowest CAN-ID is found in constant time. */
+static void CO_CANtxPendingSet(CO_CANmodule_t *CANmodule, const CO_CANtx_t *buffer)
+{
+  uint16_t word = buffer->rank >> 5;
+
+  CANmodule->txPending[word] |= 1UL << (buffer->rank & 0x1FU);
+  CANmodule->txPendingSummary |= 1UL << word;
+}
+
+static void CO_CANtxPendingClear(CO_CANmodule_t *CANmodule, const CO_CANtx_t *buffer)
+{
+  uint16_t word = buffer->rank >> 5;
+
+  CANmodule->txPending[word] &= ~(1UL << (buffer->rank & 0x1FU));
+  if (CANmodule->txPending[word] == 0U)
+  {
+    CANmodule->txPendingSummary &= ~(1UL << word);
+  }
+}
+
+/* Get waiting tx buffer with the lowest CAN-ID, starting from rank, or NULL */
+static CO_CANtx_t *CO_CANtxPendingFrom(CO_CANmodule_t *CANmodule, uint16_t from)
+{
+  uint16_t word = from >> 5;
+  uint32_t bits, summary;
+  uint16_t rank;
+
+  if (word >= CO_CAN_TX_PENDING_WORDS)
+  {
+    return NULL;
+  }
+  bits = CANmodule->txPending[word] & (uint32_t)(0xFFFFFFFFUL << (from & 0x1FU));
+  if (bits == 0U)
+  {
+    /* words after this one */
+    summary = CANmodule->txPendingSummary & ~(uint32_t)((2UL << word) - 1U);
+    if (summary == 0U)
+    {
+      return NULL;
+    }
+    word = (uint16_t)__builtin_ctz(summary);
+    bits = CANmodule->txPending[word];
+  }
+  rank = (uint16_t)((word << 5) + __builtin_ctz(bits));
+  return &CANmodule->txArray[CANmodule->txArray[rank].byRank];
+}
+
+/* Move tx buffer to its position in txArray sorted by CAN-ID (and index for
+ * equal CAN-IDs), then rebuild bitmap of waiting buffers. Must be called
+ * inside CO_LOCK_CAN_SEND. */
+static void CO_CANtxRank(CO_CANmodule_t *CANmodule, uint16_t index)
+{
+  CO_CANtx_t *txArray = CANmodule->txArray;
+  uint32_t key = (txArray[index].ident << 16) | index;
+  uint16_t rank = txArray[index].rank;
+  uint16_t i;
+
+  while ((rank > 0U) && (((txArray[txArray[rank - 1U].byRank].ident << 16) | txArray[rank - 1U].byRank) > key))
+  {
+    txArray[rank].byRank = txArray[rank - 1U].byRank;
+    txArray[txArray[rank].byRank].rank = rank;
+    rank--;
+  }
+  while (((rank + 1U) < CANmodule->txSize) && (((txArray[txArray[rank + 1U].byRank].ident << 16) | txArray[rank + 1U].byRank) < key))
+  {
+    txArray[rank].byRank = txArray[rank + 1U].byRank;
+    txArray[txArray[rank].byRank].rank = rank;
+    rank++;
+  }
+  txArray[rank].byRank = index;
+  txArray[index].rank = rank;
+
+  for (i = 0U; i < CO_CAN_TX_PENDING_WORDS; i++)
+  {
+    CANmodule->txPending[i] = 0U;
+  }
+  CANmodule->txPendingSummary = 0U;
+  for (i = 0U; i < CANmodule->txSize; i++)
+  {
+    if (txArray[i].bufferFull)
+    {
+      CO_CANtxPendingSet(CANmodule, &txArray[i]);
+    }
+  }
+}
+
+#if CO_CAN_TX_STREAM
+/* Remove messages of tx buffer from transmit stream, keep order of others.
+ * Must be called inside CO_LOCK_CAN_SEND. */
+static void CO_CANtxStreamDrop(CO_CANmodule_t *CANmodule, uint16_t index)
+{
+  uint16_t kept = 0U;
+  uint16_t i;
+
+  for (i = 0U; i < CANmodule->txStreamCount; i++)
+  {
+    const CO_CANtxStreamEntry_t *entry = &CANmodule->txStream[(CANmodule->txStreamFirst + i) & (CO_CAN_TX_STREAM - 1U)];
+
+    if (entry->index != index)
+    {
+      CANmodule->txStream[(CANmodule->txStreamFirst + kept) & (CO_CAN_TX_STREAM - 1U)] = *entry;
+      kept++;
+    }
+  }
+  CO_CAN_SEND_STORE(CANmodule->CANtxCount, CANmodule->CANtxCount - (CANmodule->txStreamCount - kept));
+  CANmodule->txStreamCount = kept;
+}
+#endif
+
+/******************************************************************************/
+CO_CANtx_t *CO_CANtxBufferInit(
+    CO_CANmodule_t *CANmodule,
+    uint16_t index,
+    uint16_t ident,
+    bool_t rtr,
     uint8_t noOfBytes,
     bool_t syncFlag)
 {
@@ -226,256 +1153,1207 @@ CO_CANtx_t *CO_CANtxBufferInit(
     /* get specific buffer */
     buffer = &CANmodule->txArray[index];
 
-    /* CAN identifier, DLC and rtr, bit aligned with CAN module transmit buffer.
-         * Microcontroller specific. */
-    //buffer->ident = ((uint32_t)ident & 0x07FFU) | ((uint32_t)(((uint32_t)noOfBytes & 0xFU) << 12U)) | ((uint32_t)(rtr ? 0x8000U : 0U));
-    buffer->ident = ident & 0x07FFU;
-    buffer->DLC = noOfBytes & 0xFU;
+    /* CAN identifier, DLC and rtr, bit aligned with CAN module transmit buffer.
+         * Microcontroller specific. */
+    //buffer->ident = ((uint32_t)ident & 0x07FFU) | ((uint32_t)(((uint32_t)noOfBytes & 0xFU) << 12U)) | ((uint32_t)(rtr ? 0x8000U : 0U));
+    CO_LOCK_CAN_SEND(CANmodule);
+    if (buffer->bufferFull)
+    {
+      /* drop message, which was waiting with old configuration */
+      buffer->bufferFull = false;
+      CO_CAN_SEND_STORE(CANmodule->CANtxCount, CANmodule->CANtxCount - 1U);
+    }
+#if CO_CAN_TX_STREAM
+    CO_CANtxStreamDrop(CANmodule, index);
+#endif
+    buffer->flags = rtr ? TWAI_MSG_FLAG_RTR : TWAI_MSG_FLAG_NONE;
+    buffer->ident = ident & 0x07FFU;
+    buffer->DLC = noOfBytes & 0xFU;
+
+    buffer->syncFlag = syncFlag;
+#if CO_CAN_TX_STREAM
+    buffer->stream = !syncFlag && !rtr && CO_CAN_TX_STREAMED(buffer->ident);
+#endif
+
+    /* keep transmit priority order */
+    CO_CANtxRank(CANmodule, index);
+    CO_UNLOCK_CAN_SEND(CANmodule);
+  }
+
+  CO_CAN_TRACE_CONFIG(CO_CAN_TRACE_TX_SETUP, index, ident, noOfBytes, NULL);
+
+  return buffer;
+}
+
+/******************************************************************************/
+/* Remove the oldest message from the list of messages in TWAI transmit queue */
+static void CO_CANtxInflightPop(CO_CANmodule_t *CANmodule)
+{
+  const uint16_t size = sizeof(CANmodule->txInflight) / sizeof(CANmodule->txInflight[0]);
+
+  if (CANmodule->txInflight[CANmodule->txInflightFirst].sync)
+  {
+    CANmodule->txInflightSync--;
+    CANmodule->bufferInhibitFlag = CANmodule->txInflightSync > 0U;
+  }
+  CANmodule->txInflightFirst = (CANmodule->txInflightFirst + 1U) % size;
+  CO_CAN_SEND_STORE(CANmodule->txInflightCount, CANmodule->txInflightCount - 1U);
+}
+
+/* Remember message copied to TWAI transmit queue, for transmit timestamp and
+ * for synchronous TPDO tracking. Must be called inside CO_LOCK_CAN_SEND. */
+static void CO_CANtxInflightPush(CO_CANmodule_t *CANmodule, uint16_t index, bool_t sync)
+{
+  const uint16_t size = sizeof(CANmodule->txInflight) / sizeof(CANmodule->txInflight[0]);
+  CO_CANtxInflight_t *inflight;
+
+  if (CANmodule->txInflightCount >= size)
+  {
+    /* should not happen, TWAI queue is shorter, forget the oldest */
+    CO_CANtxInflightPop(CANmodule);
+  }
+  inflight = &CANmodule->txInflight[(CANmodule->txInflightFirst + CANmodule->txInflightCount) % size];
+  inflight->queued_us = esp_timer_get_time();
+  CO_CAN_LATENCY_QUEUE(CANmodule, inflight);
+  inflight->index = index;
+  inflight->sync = sync;
+  CO_CAN_SEND_STORE(CANmodule->txInflightCount, CANmodule->txInflightCount + 1U);
+  if (inflight->sync)
+  {
+    CANmodule->txInflightSync++;
+    CANmodule->bufferInhibitFlag = true;
+  }
+}
+
+/* Messages, which are not in TWAI transmit queue anymore, are the oldest ones.
+ * They were transmitted, except the newest failed ones (TWAI fails all queued
+ * messages at bus-off), and get the current time as transmit time. Must be
+ * called inside CO_LOCK_CAN_SEND. */
+static void CO_CANtxInflightRetire(CO_CANmodule_t *CANmodule, const twai_status_info_t *status)
+{
+  uint32_t failed = status->tx_failed_count - CANmodule->txFailedLast;
+  uint32_t done;
+  int64_t now = esp_timer_get_time();
+
+  CANmodule->txFailedLast = status->tx_failed_count;
+  if (CANmodule->txInflightCount <= status->msgs_to_tx)
+  {
+    return;
+  }
+  done = CANmodule->txInflightCount - status->msgs_to_tx;
+  failed = (failed < done) ? failed : done;
+
+  for (; done > 0U; done--)
+  {
+    const CO_CANtxInflight_t *inflight = &CANmodule->txInflight[CANmodule->txInflightFirst];
+
+    if ((done > failed) && (inflight->index < CANmodule->txSize))
+    {
+      CO_CANtx_t *buffer = &CANmodule->txArray[inflight->index];
+
+      buffer->txTime_us = now;
+      CO_CAN_LATENCY_TX(CANmodule, buffer, inflight, now);
+    }
+    CO_CANtxInflightPop(CANmodule);
+  }
+}
+
+/* Check, if TWAI transmit queue is empty, so next message goes directly to
+ * the controller. Must be called inside CO_LOCK_CAN_SEND. */
+static bool_t CO_CANtxQueueEmpty(CO_CANmodule_t *CANmodule)
+{
+  twai_status_info_t status;
+
+  if ((CANmodule->txInflightCount > 0U) && (CO_TWAI(CANmodule, get_status_info, &status) == ESP_OK))
+  {
+    CO_CANtxInflightRetire(CANmodule, &status);
+  }
+  return CANmodule->txInflightCount == 0U;
+}
+
+/* Copy message of tx buffer with index to TWAI transmit queue, without
+ * waiting. */
+static esp_err_t CO_CANtxFrame(CO_CANmodule_t *CANmodule, const twai_message_t *msg, uint16_t index, bool_t sync)
+{
+  esp_err_t ret;
+
+  /* TWAI transmit queue drains for reinstall, see CO_CANrxFilterOpen() */
+  if (CANmodule->rxFilterOpen)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  ret = CO_TWAI(CANmodule, transmit, msg, 0);
+  if (ret == ESP_OK)
+  {
+    CO_CAN_TRACE_FRAME(CO_CAN_TRACE_TX, index, (uint16_t)msg->identifier, msg->data_length_code, msg->data);
+    CO_CAN_CAPTURE_FRAME(CANmodule, CO_CAN_CAPTURE_FLAG_TX, index, msg);
+    CO_CAN_LOAD_FRAME(CANmodule, CO_CAN_LOAD_TX, msg, esp_timer_get_time());
+    CO_CANtxInflightPush(CANmodule, index, sync);
+    CO_CAN_STAT_INC(CANmodule->stats.txFrames);
+  }
+  return ret;
+}
+
+/* Copy message to TWAI transmit queue, without waiting. Buffer is already
+ * laid out as twai_message_t. */
+static esp_err_t CO_CANtxHardware(CO_CANmodule_t *CANmodule, CO_CANtx_t *buffer)
+{
+  return CO_CANtxFrame(CANmodule, &buffer->msg, (uint16_t)(buffer - CANmodule->txArray), buffer->syncFlag);
+}
+
+/* Send messages, which are waiting in txArray or in transmit stream, lowest
+ * CAN-ID first, until TWAI transmit queue is full. Messages of the same
+ * buffer are older in the stream. Synchronous TPDO is sent only into empty
+ * TWAI queue, see CO_CANclearPendingSyncPDOs(). Messages behind it pass it
+ * once, then the queue is left to drain for it, so it is not starved. Must be
+ * called inside CO_LOCK_CAN_SEND. */
+static void CO_CANtxDrain(CO_CANmodule_t *CANmodule)
+{
+  CO_CANtx_t *buffer;
+  uint16_t from = 0U; /* rank after skipped synchronous TPDOs */
+
+  for (;;)
+  {
+    buffer = CO_CANtxPendingFrom(CANmodule, from);
+#if CO_CAN_TX_STREAM
+    if (CANmodule->txStreamCount > 0U)
+    {
+      const CO_CANtxStreamEntry_t *entry = &CANmodule->txStream[CANmodule->txStreamFirst];
+
+      if ((buffer == NULL) || (entry->msg.identifier <= buffer->ident))
+      {
+        if (CO_CANtxFrame(CANmodule, &entry->msg, entry->index, false) != ESP_OK)
+        {
+          break;
+        }
+        CANmodule->txStreamFirst = (CANmodule->txStreamFirst + 1U) & (CO_CAN_TX_STREAM - 1U);
+        CANmodule->txStreamCount--;
+        CO_CAN_SEND_STORE(CANmodule->CANtxCount, CANmodule->CANtxCount - 1U);
+        CANmodule->txSyncPassed = CANmodule->txSyncPassed || (from != 0U);
+        continue;
+      }
+    }
+#endif
+    if ((buffer != NULL) && buffer->syncFlag && !CO_CANtxQueueEmpty(CANmodule))
+    {
+      if ((from == 0U) && CANmodule->txSyncPassed)
+      {
+        break;
+      }
+      from = buffer->rank + 1U;
+      continue;
+    }
+    if ((buffer == NULL) || (CO_CANtxHardware(CANmodule, buffer) != ESP_OK))
+    {
+      break;
+    }
+    if (buffer->syncFlag || (from != 0U))
+    {
+      CANmodule->txSyncPassed = !buffer->syncFlag;
+    }
+    buffer->bufferFull = false;
+    CO_CANtxPendingClear(CANmodule, buffer);
+    CO_CAN_SEND_STORE(CANmodule->CANtxCount, CANmodule->CANtxCount - 1U);
+  }
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANsend(CO_CANmodule_t *CANmodule, CO_CANtx_t *buffer)
+{
+  CO_ReturnError_t err = CO_ERROR_NO;
+
+  CO_LOCK_CAN_SEND(CANmodule);
+  /* Verify overflow */
+  if (buffer->bufferFull)
+  {
+    if (!CANmodule->firstCANtxMessage)
+    {
+      /* don't set error, if bootup message is still on buffers */
+      CO_CAN_SEND_STORE(CANmodule->CANerrorStatus, CANmodule->CANerrorStatus | CO_CAN_ERRTX_OVERFLOW);
+    }
+    err = CO_ERROR_TX_OVERFLOW;
+    CO_CAN_STAT_INC(CANmodule->stats.txOverflow);
+    CO_CAN_TRACE_ERROR(CO_CAN_TRACE_TX_OVERFLOW, (uint16_t)(buffer - CANmodule->txArray), buffer->ident, buffer->DLC, buffer->data);
+    /* previous message is still waiting, it will be sent with new data */
+  }
+  /* if no message is waiting and TWAI queue is free, copy message to it */
+  else if ((CANmodule->CANtxCount == 0U) && (!buffer->syncFlag || CO_CANtxQueueEmpty(CANmodule)) &&
+           (CO_CANtxHardware(CANmodule, buffer) == ESP_OK))
+  {
+  }
+#if CO_CAN_TX_STREAM
+  /* otherwise message of streamed buffer is copied to the stream, so buffer
+   * is free for the next message at once */
+  else if (buffer->stream && (CANmodule->txStreamCount < CO_CAN_TX_STREAM))
+  {
+    CO_CANtxStreamEntry_t *entry =
+        &CANmodule->txStream[(CANmodule->txStreamFirst + CANmodule->txStreamCount) & (CO_CAN_TX_STREAM - 1U)];
+
+    entry->msg = buffer->msg;
+    entry->index = (uint16_t)(buffer - CANmodule->txArray);
+    CANmodule->txStreamCount++;
+    CO_CAN_SEND_STORE(CANmodule->CANtxCount, CANmodule->CANtxCount + 1U);
+    CO_CAN_STAT_INC(CANmodule->stats.txDeferred);
+    CO_CAN_STAT_MAX(CANmodule->stats.txQueueMax, (uint32_t)CANmodule->CANtxCount);
+    CO_CAN_TRACE_FRAME(CO_CAN_TRACE_TX_DEFERRED, entry->index, buffer->ident, buffer->DLC, buffer->data);
+    CO_CANtxDrain(CANmodule);
+  }
+#endif
+  /* otherwise message waits in txArray and is sent after previous ones */
+  else
+  {
+    buffer->bufferFull = true;
+    CO_CANtxPendingSet(CANmodule, buffer);
+    CO_CAN_SEND_STORE(CANmodule->CANtxCount, CANmodule->CANtxCount + 1U);
+    CO_CAN_STAT_INC(CANmodule->stats.txDeferred);
+    CO_CAN_STAT_MAX(CANmodule->stats.txQueueMax, (uint32_t)CANmodule->CANtxCount);
+    CO_CAN_TRACE_FRAME(CO_CAN_TRACE_TX_DEFERRED, (uint16_t)(buffer - CANmodule->txArray), buffer->ident, buffer->DLC, buffer->data);
+    CO_CANtxDrain(CANmodule);
+  }
+  CO_UNLOCK_CAN_SEND(CANmodule);
+
+  return err;
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_CANsendRaw(CO_CANmodule_t *CANmodule, const twai_message_t *msg)
+{
+  CO_ReturnError_t err = CO_ERROR_NO;
+
+  if ((CANmodule == NULL) || (msg == NULL))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  CO_LOCK_CAN_SEND(CANmodule);
+  if (!CANmodule->rxFilterOpen && (CO_TWAI(CANmodule, transmit, msg, 0) == ESP_OK))
+  {
+    CO_CAN_TRACE_FRAME(CO_CAN_TRACE_TX, CO_CAN_RX_LOOKUP_NONE, msg->identifier, msg->data_length_code, msg->data);
+    CO_CAN_CAPTURE_FRAME(CANmodule, CO_CAN_CAPTURE_FLAG_TX, CO_CAN_RX_LOOKUP_NONE, msg);
+    CO_CAN_LOAD_FRAME(CANmodule, CO_CAN_LOAD_TX, msg, esp_timer_get_time());
+    /* not a tx buffer, only counted for transmit tracking */
+    CO_CANtxInflightPush(CANmodule, CO_CAN_RX_LOOKUP_NONE, false);
+    CO_CAN_STAT_INC(CANmodule->stats.txFrames);
+  }
+  else
+  {
+    err = CO_ERROR_TX_OVERFLOW;
+  }
+  CO_UNLOCK_CAN_SEND(CANmodule);
+
+  return err;
+}
+
+/******************************************************************************/
+void CO_CANclearPendingSyncPDOs(CO_CANmodule_t *CANmodule)
+{
+  uint32_t tpdoLate = 0U;
+
+  CO_LOCK_CAN_SEND(CANmodule);
+  /* Synchronous TPDO is copied only into empty TWAI queue, so it is never
+   * queued behind other messages. A late one is in the controller, where TWAI
+   * can not abort it, and it is only reported. Other messages in TWAI queue
+   * (heartbeat, EMCY, SDO) are not touched. Transmitted messages are retired
+   * first, so bufferInhibitFlag is not left from TPDO, which is already out,
+   * when CO_CANmodule_process() did not run since. */
+  CO_CANtxQueueEmpty(CANmodule);
+  if (CANmodule->bufferInhibitFlag)
+  {
+    tpdoLate = 1U;
+  }
+  /* delete pending synchronous TPDOs in TX buffers */
+  if (CANmodule->CANtxCount != 0U)
+  {
+    uint16_t i;
+    CO_CANtx_t *buffer = &CANmodule->txArray[0];
+    for (i = CANmodule->txSize; i > 0U; i--)
+    {
+      if (buffer->bufferFull)
+      {
+        if (buffer->syncFlag)
+        {
+          buffer->bufferFull = false;
+          CO_CANtxPendingClear(CANmodule, buffer);
+          CO_CAN_SEND_STORE(CANmodule->CANtxCount, CANmodule->CANtxCount - 1U);
+          CANmodule->txSyncPassed = false;
+          tpdoLate = 2U;
+        }
+      }
+      buffer++;
+    }
+  }
+  if (tpdoLate != 0U)
+  {
+    CO_CAN_SEND_STORE(CANmodule->CANerrorStatus, CANmodule->CANerrorStatus | CO_CAN_ERRTX_PDO_LATE);
+  }
+  CO_UNLOCK_CAN_SEND(CANmodule);
+
+  if (tpdoLate != 0U)
+  {
+    CO_CAN_TRACE_ERROR(CO_CAN_TRACE_SYNC_CLEARED, (uint16_t)tpdoLate, 0U, 0U, NULL);
+  }
+}
+
+/* Add increase of TWAI counter since last sample to total. Counters restart
+ * from zero, when TWAI driver is reinstalled. */
+static uint32_t CO_CANstatsAdd(uint32_t *total, uint32_t last, uint32_t now)
+{
+  uint32_t delta = (now >= last) ? (now - last) : now;
+
+  *total += delta;
+  return delta;
+}
+
+/* Sample TWAI status into statistics */
+static void CO_CANstatusSample(CO_CANmodule_t *CANmodule)
+{
+  twai_status_info_t status;
+  twai_status_info_t *last = &CANmodule->statusLast;
+  CO_CANstats_t *stats = &CANmodule->stats;
+  uint32_t lost = 0U;
+
+  if (CO_TWAI(CANmodule, get_status_info, &status) != ESP_OK)
+  {
+    return;
+  }
+
+  stats->state = status.state;
+  stats->txErrorCounter = status.tx_error_counter;
+  stats->rxErrorCounter = status.rx_error_counter;
+  CO_CANstatsAdd(&stats->txFailed, last->tx_failed_count, status.tx_failed_count);
+  CO_CANstatsAdd(&stats->arbitrationLost, last->arb_lost_count, status.arb_lost_count);
+  CO_CANstatsAdd(&stats->busErrors, last->bus_error_count, status.bus_error_count);
+  lost += CO_CANstatsAdd(&stats->rxMissed, last->rx_missed_count, status.rx_missed_count);
+  lost += CO_CANstatsAdd(&stats->rxOverrun, last->rx_overrun_count, status.rx_overrun_count);
+
+  /* overflow is reported until a sample without new lost messages */
+  CANmodule->rxOverflow = lost != 0U;
+  CANmodule->statusLast = status;
+  CANmodule->statusTime = xTaskGetTickCount();
+}
+
+/* Handle bus-off and start recovery after backoff delay. Recovered TWAI
+ * controller is stopped, so it is started again. */
+static void CO_CANbusOffProcess(CO_CANmodule_t *CANmodule, uint32_t alerts)
+{
+  CO_CANstats_t *stats = &CANmodule->stats;
+  TickType_t now = xTaskGetTickCount();
+
+  if ((alerts & TWAI_ALERT_BUS_OFF) != 0U)
+  {
+    CANmodule->busOff = true;
+    CANmodule->busOffTime = now;
+    stats->busOffCount++;
+
+    /* double backoff, if bus-off repeats soon after recovery */
+    if ((stats->recoveryCount == 0U) ||
+        ((now - CANmodule->recoveredTime) >= pdMS_TO_TICKS(CO_CAN_BUSOFF_BACKOFF_MAX_MS)))
+    {
+      stats->recoveryDelayMs = CO_CAN_BUSOFF_BACKOFF_MIN_MS;
+    }
+    else if (stats->recoveryDelayMs < CO_CAN_BUSOFF_BACKOFF_MAX_MS)
+    {
+      stats->recoveryDelayMs *= 2U;
+      if (stats->recoveryDelayMs > CO_CAN_BUSOFF_BACKOFF_MAX_MS)
+      {
+        stats->recoveryDelayMs = CO_CAN_BUSOFF_BACKOFF_MAX_MS;
+      }
+    }
+  }
+
+  if ((alerts & TWAI_ALERT_BUS_RECOVERED) != 0U)
+  {
+    CANmodule->busOff = false;
+    CANmodule->recoveredTime = now;
+    stats->recoveryCount++;
+    if (CANmodule->CANnormal)
+    {
+      CO_TWAI(CANmodule, start);
+    }
+  }
+#if CO_CAN_BUSOFF_RECOVERY
+  else if (CANmodule->busOff && (stats->state == TWAI_STATE_BUS_OFF) &&
+           ((now - CANmodule->busOffTime) >= pdMS_TO_TICKS(stats->recoveryDelayMs)))
+  {
+    if (CO_TWAI(CANmodule, initiate_recovery) == ESP_OK)
+    {
+      stats->state = TWAI_STATE_RECOVERING;
+    }
+  }
+#endif
+}
+
+/******************************************************************************/
+void CO_CANmodule_process(CO_CANmodule_t *CANmodule)
+{
+  // this one is called from main continuously
+  uint32_t alerts = 0U;
+  uint32_t txErrors, rxErrors;
+  uint32_t err;
+
+#if CO_CAN_RX_RING
+  /* Messages received since last call, before stack objects are processed */
+  CO_CANrxRingProcess(CANmodule, CO_CAN_RX_RING);
+#endif
+
+  /* Receive task, which waits for alerts for CO_CANwait(), is their only
+   * reader, it publishes them in alertsPending. Taking them here would also
+   * take received data alert, its wait would time out. */
+  if (!CO_CANrxAlertReader(CANmodule) && (CO_TWAI(CANmodule, read_alerts, &alerts, 0) == ESP_OK))
+  {
+    alerts &= ~(uint32_t)TWAI_ALERT_RX_DATA;
+  }
+  else
+  {
+    alerts = 0U;
+  }
+  alerts |= __atomic_exchange_n(&CANmodule->alertsPending, 0U, __ATOMIC_RELAXED);
+
+  /* Transmit complete, send messages waiting in txArray */
+  if ((alerts & TWAI_ALERT_TX_SUCCESS) != 0U)
+  {
+    /* First CAN message (bootup) was sent successfully */
+    CANmodule->firstCANtxMessage = false;
+  }
+  /* Acceptance filter waits for empty TWAI transmit queue */
+  if (CO_CAN_SEND_LOAD(CANmodule->rxFilterOpen))
+  {
+    xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+    (void)CO_CANrxFilterOpen(CANmodule);
+    xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+  }
+  if ((CO_CAN_SEND_LOAD(CANmodule->txInflightCount) > 0U) || (CO_CAN_SEND_LOAD(CANmodule->CANtxCount) > 0U))
+  {
+    /* Retire transmitted messages, this also clears bufferInhibitFlag after
+     * synchronous TPDO. Status is read inside the lock, so no message is
+     * queued meanwhile. */
+    CO_LOCK_CAN_SEND(CANmodule);
+    CO_CANtxQueueEmpty(CANmodule);
+    CO_CANtxDrain(CANmodule);
+    CO_UNLOCK_CAN_SEND(CANmodule);
+  }
+
+  /* Sample TWAI status on error alert, or periodically while error is active */
+  if (((alerts & CO_CAN_ALERTS_ERROR) != 0U) ||
+      (((CO_CAN_SEND_LOAD(CANmodule->CANerrorStatus) != 0U) || CANmodule->busOff) &&
+       ((xTaskGetTickCount() - CANmodule->statusTime) >= pdMS_TO_TICKS(CO_CAN_STATUS_PERIOD_MS))))
+  {
+    CO_CANstatusSample(CANmodule);
+  }
+  CO_CANbusOffProcess(CANmodule, alerts);
+
+  txErrors = CANmodule->stats.txErrorCounter;
+  rxErrors = CANmodule->stats.rxErrorCounter;
+  if (CANmodule->stats.state == TWAI_STATE_BUS_OFF)
+  {
+    txErrors = 256U;
+  }
+  err = ((uint32_t)txErrors << 16) | ((uint32_t)rxErrors << 8) | (CANmodule->rxOverflow ? 1U : 0U);
+
+  if (CANmodule->errOld != err)
+  {
+    uint16_t status;
+
+    /* CANerrorStatus is also modified by CO_CANsend() */
+    CO_LOCK_CAN_SEND(CANmodule);
+    status = CANmodule->CANerrorStatus;
+    CANmodule->errOld = err;
+
+    if (txErrors >= 256U)
+    {
+      /* bus off */
+      status |= CO_CAN_ERRTX_BUS_OFF;
+    }
+    else
+    {
+      /* recalculate CANerrorStatus, first clear some flags */
+      status &= 0xFFFF ^ (CO_CAN_ERRTX_BUS_OFF |
+                          CO_CAN_ERRRX_WARNING | CO_CAN_ERRRX_PASSIVE |
+                          CO_CAN_ERRTX_WARNING | CO_CAN_ERRTX_PASSIVE);
+
+      /* rx bus warning or passive */
+      if (rxErrors >= 128)
+      {
+        status |= CO_CAN_ERRRX_WARNING | CO_CAN_ERRRX_PASSIVE;
+      }
+      else if (rxErrors >= 96)
+      {
+        status |= CO_CAN_ERRRX_WARNING;
+      }
+
+      /* tx bus warning or passive */
+      if (txErrors >= 128)
+      {
+        status |= CO_CAN_ERRTX_WARNING | CO_CAN_ERRTX_PASSIVE;
+      }
+      else if (txErrors >= 96)
+      {
+        status |= CO_CAN_ERRTX_WARNING;
+      }
+
+      /* if not tx passive clear also overflow */
+      if ((status & CO_CAN_ERRTX_PASSIVE) == 0)
+      {
+        status &= 0xFFFF ^ CO_CAN_ERRTX_OVERFLOW;
+      }
+    }
+
+    /* CAN RX bus overflow */
+    if (CANmodule->rxOverflow)
+    {
+      status |= CO_CAN_ERRRX_OVERFLOW;
+    }
+    else
+    {
+      status &= 0xFFFF ^ CO_CAN_ERRRX_OVERFLOW;
+    }
+
+    CO_CAN_SEND_STORE(CANmodule->CANerrorStatus, status);
+    CO_UNLOCK_CAN_SEND(CANmodule);
+  }
+}
+
+/* Update maximum time from reception to rx callback. Callbacks are called
+ * from receive task and, with receive ring, also from mainline. */
+static void CO_CANrxLatencyMax(CO_CANmodule_t *CANmodule, int64_t timestamp_us)
+{
+  int64_t latency = esp_timer_get_time() - timestamp_us;
+  uint32_t value = (latency <= 0) ? 0U : ((latency >= (int64_t)UINT32_MAX) ? UINT32_MAX : (uint32_t)latency);
+  uint32_t max = __atomic_load_n(&CANmodule->stats.rxLatencyMax_us, __ATOMIC_RELAXED);
+
+  while ((value > max) &&
+         !__atomic_compare_exchange_n(&CANmodule->stats.rxLatencyMax_us, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+}
+
+#if CO_CAN_RX_RING
+/******************************************************************************/
+/* Receive ring has single producer, because CO_CANrxDispatch() holds
+ * rxDispatchLock, and single consumer, the mainline. */
+static bool_t CO_CANrxRingEmpty(CO_CANmodule_t *CANmodule)
+{
+  return __atomic_load_n(&CANmodule->rxRingTail, __ATOMIC_ACQUIRE) == __atomic_load_n(&CANmodule->rxRingHead, __ATOMIC_RELAXED);
+}
+
+static void CO_CANrxRingPush(CO_CANmodule_t *CANmodule, uint16_t index, const CO_CANrxMsg_t *rcvMsg)
+{
+  uint32_t head = __atomic_load_n(&CANmodule->rxRingHead, __ATOMIC_RELAXED);
+  uint32_t used = head - __atomic_load_n(&CANmodule->rxRingTail, __ATOMIC_ACQUIRE);
+  CO_CANrxRingEntry_t *entry;
+
+  if (used >= CO_CAN_RX_RING)
+  {
+    CANmodule->rxRingOverruns++;
+    return;
+  }
+
+  entry = &CANmodule->rxRing[head & (CO_CAN_RX_RING - 1U)];
+  entry->timestamp_us = rcvMsg->timestamp_us;
+  entry->ident = rcvMsg->msg.identifier;
+  entry->index = index;
+  entry->flags = (uint8_t)rcvMsg->msg.flags;
+  entry->DLC = rcvMsg->msg.data_length_code;
+  memcpy(entry->data, rcvMsg->msg.data, sizeof(entry->data));
+  __atomic_store_n(&CANmodule->rxRingHead, head + 1U, __ATOMIC_RELEASE);
+
+  if (used >= CANmodule->rxRingPeak)
+  {
+    CANmodule->rxRingPeak = used + 1U;
+  }
+}
+#endif
+
+/******************************************************************************/
+uint16_t CO_CANrxRingProcess(CO_CANmodule_t *CANmodule, uint16_t budget)
+{
+  uint16_t processed = 0U;
+#if CO_CAN_RX_RING
+  uint32_t tail = CANmodule->rxRingTail;
+  uint32_t head = __atomic_load_n(&CANmodule->rxRingHead, __ATOMIC_ACQUIRE);
 
-    buffer->bufferFull = false;
-    buffer->syncFlag = syncFlag;
+  if (tail == head)
+  {
+    return 0U;
   }
+  /* rx buffers are not reconfigured from other task during callbacks */
+  xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+  while ((tail != head) && (processed < budget))
+  {
+    const CO_CANrxRingEntry_t *entry = &CANmodule->rxRing[tail & (CO_CAN_RX_RING - 1U)];
+    CO_CANrx_t *buffer = (entry->index < CO_CAN_RX_COUNT(CANmodule)) ? CO_CAN_RX_BUFFER(CANmodule, entry->index) : NULL;
 
-  ESP_LOGI(CO_DRIVER_TAG, "Setup buffer tx[%d] ident: %d bytes %d", index, ident, noOfBytes);
+    /* Rx buffer may be reconfigured for other identifier after the message
+     * was queued */
+    uint32_t key = entry->ident | (((entry->flags & TWAI_MSG_FLAG_RTR) != 0U) ? 0x0800U : 0U);
 
-  return buffer;
+    if ((buffer != NULL) && (buffer->CANrx_callback != NULL) && (((key ^ buffer->ident) & buffer->mask) == 0U))
+    {
+      CO_CANrxMsg_t rcvMsg = {0};
+
+      rcvMsg.msg.identifier = entry->ident;
+      rcvMsg.msg.flags = entry->flags;
+      rcvMsg.msg.data_length_code = entry->DLC;
+      memcpy(rcvMsg.msg.data, entry->data, sizeof(entry->data));
+      rcvMsg.timestamp_us = entry->timestamp_us;
+      CO_CANrxLatencyMax(CANmodule, entry->timestamp_us);
+      buffer->CANrx_callback(buffer->object, (void *)&rcvMsg);
+      CO_CAN_LATENCY_RX(CANmodule, entry->ident, entry->timestamp_us);
+    }
+    else
+    {
+      CANmodule->rxRingStale++;
+    }
+
+    /* Release entry after callback, so direct messages are not processed
+     * before it is finished */
+    tail++;
+    __atomic_store_n(&CANmodule->rxRingTail, tail, __ATOMIC_RELEASE);
+    processed++;
+  }
+  xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+#else
+  (void)CANmodule;
+  (void)budget;
+#endif
+  return processed;
 }
 
+#if CO_CAN_RAW_RANGES
 /******************************************************************************/
-CO_ReturnError_t CO_CANsend(CO_CANmodule_t *CANmodule, CO_CANtx_t *buffer)
+/* Find raw range, which contains extended identifier, binary search. Must be
+ * called inside rxDispatchLock. */
+static const CO_CANrawRange_t *CO_CANrawFind(const CO_CANmodule_t *CANmodule, uint32_t ident)
 {
-  CO_ReturnError_t err = CO_ERROR_NO;
+  uint16_t low = 0U;
+  uint16_t high = CANmodule->rawCount;
 
-  /* Verify overflow */
-  if (buffer->bufferFull)
+  while (low < high)
   {
-    if (!CANmodule->firstCANtxMessage)
+    uint16_t mid = (low + high) / 2U;
+
+    if (CANmodule->rawRanges[mid].first <= ident)
     {
-      /* don't set error, if bootup message is still on buffers */
-      CANmodule->CANerrorStatus |= CO_CAN_ERRTX_OVERFLOW;
+      low = mid + 1U;
+    }
+    else
+    {
+      high = mid;
     }
-    err = CO_ERROR_TX_OVERFLOW;
   }
+  if ((low > 0U) && (ident <= CANmodule->rawRanges[low - 1U].last))
+  {
+    return &CANmodule->rawRanges[low - 1U];
+  }
+  return NULL;
+}
+#endif
 
-  CO_LOCK_CAN_SEND();
-  /* if CAN TX buffer is free, copy message to it */
-
-  twai_message_t msg;
-  msg.identifier = buffer->ident;
-  msg.data_length_code = buffer->DLC;
-  msg.flags = TWAI_MSG_FLAG_NONE;
-  // TODO: Use memcpy
-  for (uint8_t i = 0; i < 8; i++)
-    msg.data[i] = buffer->data[i];
+/******************************************************************************/
+CO_ReturnError_t CO_CANrawRangeAdd(CO_CANmodule_t *CANmodule, uint32_t first, uint32_t last,
+                                   void *object, CO_CANrawCallback_t callback)
+{
+#if CO_CAN_RAW_RANGES
+  CO_ReturnError_t ret = CO_ERROR_NO;
+  uint16_t i;
 
-  esp_err_t ret = twai_transmit(&msg, pdMS_TO_TICKS(10));
+  if ((CANmodule == NULL) || (callback == NULL) || (first > last) || (last > 0x1FFFFFFFUL))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
 
-  if ((ret == ESP_OK) && CANmodule->CANtxCount == 0)
+  /* rxConfigLock waits for callback of the range, which may run */
+  xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+  portENTER_CRITICAL(&CANmodule->rxDispatchLock);
+  /* position of the new range, keep ranges sorted and not overlapping */
+  for (i = 0U; (i < CANmodule->rawCount) && (CANmodule->rawRanges[i].first < first); i++)
+  {
+  }
+  if (((i > 0U) && (CANmodule->rawRanges[i - 1U].last >= first)) ||
+      ((i < CANmodule->rawCount) && (CANmodule->rawRanges[i].first <= last)))
+  {
+    ret = CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+  else if (CANmodule->rawCount >= CO_CAN_RAW_RANGES)
+  {
+    ret = CO_ERROR_OUT_OF_MEMORY;
+  }
+  else
   {
-    CANmodule->bufferInhibitFlag = buffer->syncFlag;
-    /* copy message and txRequest */
+    memmove(&CANmodule->rawRanges[i + 1U], &CANmodule->rawRanges[i],
+            (CANmodule->rawCount - i) * sizeof(CANmodule->rawRanges[0]));
+    CANmodule->rawRanges[i].first = first;
+    CANmodule->rawRanges[i].last = last;
+    CANmodule->rawRanges[i].object = object;
+    CANmodule->rawRanges[i].callback = callback;
+    CANmodule->rawCount++;
+  }
+  portEXIT_CRITICAL(&CANmodule->rxDispatchLock);
 
-    // ESP_LOGI(CO_DRIVER_TAG, "twai_transmit ident: 0x%03X, DLC: %d 0x[%02X %02X %02X %02X %02X %02X %02X %02X] flags: 0x%08X",
-    //          msg.identifier, msg.data_length_code, msg.data[0], msg.data[1], msg.data[2], msg.data[3], msg.data[4],
-    //          msg.data[5], msg.data[6], msg.data[7], msg.flags);
+#if CO_CAN_RX_FILTERS
+  /* extended frames must pass acceptance filter */
+  if ((ret == CO_ERROR_NO) && (CO_CANrxFilterOpen(CANmodule) != ESP_OK))
+  {
+    ret = CO_ERROR_SYSCALL;
   }
+#endif
+  xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+  return ret;
+#else
+  (void)CANmodule;
+  (void)first;
+  (void)last;
+  (void)object;
+  (void)callback;
+  return CO_ERROR_OUT_OF_MEMORY;
+#endif
+}
 
-  /* if no buffer is free, message will be sent by interrupt */
-  else
+/******************************************************************************/
+CO_ReturnError_t CO_CANrawRangeRemove(CO_CANmodule_t *CANmodule, uint32_t first)
+{
+#if CO_CAN_RAW_RANGES
+  CO_ReturnError_t ret = CO_ERROR_ILLEGAL_ARGUMENT;
+  uint16_t i;
+
+  if (CANmodule == NULL)
   {
-    ESP_LOGI(CO_DRIVER_TAG, "Tx fail! %d", (int) buffer->ident);
-    buffer->bufferFull = true;
-    CANmodule->CANtxCount++;
+    return CO_ERROR_ILLEGAL_ARGUMENT;
   }
 
-  CO_UNLOCK_CAN_SEND();
+  xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+  portENTER_CRITICAL(&CANmodule->rxDispatchLock);
+  for (i = 0U; i < CANmodule->rawCount; i++)
+  {
+    if (CANmodule->rawRanges[i].first == first)
+    {
+      CANmodule->rawCount--;
+      memmove(&CANmodule->rawRanges[i], &CANmodule->rawRanges[i + 1U],
+              (CANmodule->rawCount - i) * sizeof(CANmodule->rawRanges[0]));
+      ret = CO_ERROR_NO;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&CANmodule->rxDispatchLock);
 
-  return err;
+  /* acceptance filter is narrowed again by CO_CANsetNormalMode() */
+  xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+  return ret;
+#else
+  (void)CANmodule;
+  (void)first;
+  return CO_ERROR_ILLEGAL_ARGUMENT;
+#endif
 }
 
 /******************************************************************************/
-void CO_CANclearPendingSyncPDOs(CO_CANmodule_t *CANmodule)
+/* Find rx buffer for received message and call its function. Returns true,
+ * if message was processed or queued for processing. Caller holds
+ * rxConfigLock, so rx buffer or raw range, found inside rxDispatchLock, is not
+ * reconfigured before its callback returns. Callback is called outside
+ * rxDispatchLock, it may block. */
+static bool_t CO_CANrxDispatch(CO_CANmodule_t *CANmodule, CO_CANrxMsg_t *rxMsg)
 {
-  ESP_LOGI(CO_DRIVER_TAG, "CO_CANclearPendingSyncPDOs");
+  twai_message_t *rcvMsg = &rxMsg->msg;
+  uint16_t index;            /* index of received message */
+  uint32_t rcvMsgIdent;      /* identifier of the received message */
+  CO_CANrx_t *buffer = NULL; /* receive message buffer from CO_CANmodule_t object. */
+  bool_t msgMatched = false;
+  bool_t forward;
+  void *object = NULL;
+  void (*callback)(void *object, void *message) = NULL;
+#if CO_CAN_RAW_RANGES
+  const CO_CANrawRange_t *raw = NULL;
+  void *rawObject = NULL;
+  CO_CANrawCallback_t rawCallback = NULL;
+#endif
+
+  /* rx buffers may be reconfigured from other task meanwhile */
+  portENTER_CRITICAL(&CANmodule->rxDispatchLock);
 
-  uint32_t tpdoDeleted = 0U;
+  forward = CO_CAN_BRIDGE_MATCH(CANmodule, rcvMsg);
 
-  CO_LOCK_CAN_SEND();
-  /* Abort message from CAN module, if there is synchronous TPDO.
-     * Take special care with this functionality. */
-  if (/*messageIsOnCanBuffer && */ CANmodule->bufferInhibitFlag)
+  rcvMsgIdent = rcvMsg->identifier;
+  index = CO_CAN_RX_LOOKUP_NONE;
+  if ((rcvMsg->flags & TWAI_MSG_FLAG_EXTD) != 0U)
   {
-    /* clear TXREQ */
-    twai_clear_transmit_queue();
+    /* Extended identifier never matches CANopen rx buffer, which would see
+     * only its lower bits. It may belong to raw range. */
+#if CO_CAN_RAW_RANGES
+    raw = CO_CANrawFind(CANmodule, rcvMsgIdent);
+    if (raw != NULL)
+    {
+      rawObject = raw->object;
+      rawCallback = raw->callback;
+    }
+#endif
+  }
+  else if ((rcvMsg->flags & TWAI_MSG_FLAG_RTR) == 0U)
+  {
+    /* Data frame, get the first rx buffer, which accepts the identifier, from
+     * lookup table. Lookup table contains only buffers for data frames. */
+#if CO_CAN_RX_LOOKUP
+    index = CANmodule->rxLookup[rcvMsgIdent & (CO_CAN_RX_LOOKUP_SIZE - 1U)];
+#else
+    index = CO_CANrxFindFirst(CANmodule, 0U, rcvMsgIdent & 0x07FFU);
+#endif
+  }
+  else
+  {
+    /* Remote frame is rare, search rx buffers for one, which accepts it. RTR
+     * is bit 11 of rx buffer identifier. */
+    index = CO_CANrxFindFirst(CANmodule, 0U, (rcvMsgIdent & 0x07FFU) | 0x0800U);
+  }
 
-    CANmodule->bufferInhibitFlag = false;
-    tpdoDeleted = 1U;
+  if (index != CO_CAN_RX_LOOKUP_NONE)
+  {
+    buffer = CO_CAN_RX_BUFFER(CANmodule, index);
+    object = buffer->object;
+    callback = buffer->CANrx_callback;
+    msgMatched = callback != NULL;
   }
-  /* delete also pending synchronous TPDOs in TX buffers */
-  if (CANmodule->CANtxCount != 0U)
+  else if (CANmodule->useCANrxFilters && ((rcvMsg->flags & TWAI_MSG_FLAG_EXTD) == 0U))
   {
-    uint16_t i;
-    CO_CANtx_t *buffer = &CANmodule->txArray[0];
-    for (i = CANmodule->txSize; i > 0U; i--)
+    /* filter is wider than configured rx buffers */
+    CANmodule->rxFalseAccepts++;
+  }
+
+  CO_CAN_CAPTURE_FRAME(CANmodule, 0U, index, rcvMsg);
+  CO_CAN_LOAD_FRAME(CANmodule, CO_CAN_LOAD_RX, rcvMsg, rxMsg->timestamp_us);
+  CO_CAN_STAT_INC(CANmodule->stats.rxFrames);
+
+  if (msgMatched)
+  {
+    CO_CAN_STAT_INC(CANmodule->stats.rxMatched);
+    CO_CAN_TRACE_FRAME(CO_CAN_TRACE_RX, index, rcvMsgIdent, rcvMsg->data_length_code, rcvMsg->data);
+#if CO_CAN_RX_RING
+    /* Direct message must not overtake older messages, which wait in ring */
+    if (!buffer->direct || !CO_CANrxRingEmpty(CANmodule))
     {
-      if (buffer->bufferFull)
-      {
-        if (buffer->syncFlag)
-        {
-          buffer->bufferFull = false;
-          CANmodule->CANtxCount--;
-          tpdoDeleted = 2U;
-        }
-      }
-      buffer++;
+      CO_CANrxRingPush(CANmodule, index, rxMsg);
+      callback = NULL;
     }
+#endif
+  }
+#if CO_CAN_RAW_RANGES
+  else if (rawCallback != NULL)
+  {
+    msgMatched = true;
+    CO_CAN_STAT_INC(CANmodule->stats.rxMatched);
+    CO_CAN_TRACE_FRAME(CO_CAN_TRACE_RX, CO_CAN_RX_LOOKUP_NONE, rcvMsgIdent, rcvMsg->data_length_code, rcvMsg->data);
+  }
+#endif
+  else
+  {
+    CO_CAN_STAT_INC(CANmodule->stats.rxUnmatched);
+    CO_CAN_TRACE_FRAME(CO_CAN_TRACE_RX_UNMATCHED, CO_CAN_RX_LOOKUP_NONE, rcvMsgIdent, rcvMsg->data_length_code, rcvMsg->data);
   }
-  CO_UNLOCK_CAN_SEND();
 
-  if (tpdoDeleted != 0U)
+  portEXIT_CRITICAL(&CANmodule->rxDispatchLock);
+
+  /* forward to other bus first, it takes locks of the other CAN module */
+  if (forward)
   {
-    CANmodule->CANerrorStatus |= CO_CAN_ERRTX_PDO_LATE;
+    CO_CAN_BRIDGE_FORWARD(CANmodule, rcvMsg);
   }
-}
 
-/******************************************************************************/
-/* Get error counters from the module. If necessary, function may use
-    * different way to determine errors. */
-static uint16_t rxErrors = 0, txErrors = 0, overflow = 0;
+  /* Call specific function, which will process the message */
+  if (msgMatched && (callback != NULL))
+  {
+    CO_CANrxLatencyMax(CANmodule, rxMsg->timestamp_us);
+    callback(object, (void *)rxMsg);
+    CO_CAN_LATENCY_RX(CANmodule, rcvMsgIdent, rxMsg->timestamp_us);
+  }
+#if CO_CAN_RAW_RANGES
+  else if (rawCallback != NULL)
+  {
+    rawCallback(rawObject, rxMsg);
+  }
+#endif
 
-void CO_CANmodule_process(CO_CANmodule_t *CANmodule)
+  return msgMatched;
+}
+
+/* Take up to 'count' messages from TWAI receive queue. Waits up to 'ticks'
+ * for the first one, others are taken only if already queued. */
+static uint16_t CO_CANrxFetch(CO_CANmodule_t *CANmodule, CO_CANrxMsg_t *msgs, uint16_t count, TickType_t ticks)
 {
-  // this one is called from main continuously
-  uint32_t err;
+  uint16_t n = 0U;
 
-  err = ((uint32_t)txErrors << 16) | ((uint32_t)rxErrors << 8) | overflow;
+  if (__atomic_load_n(&CANmodule->rxFilterDirty, __ATOMIC_ACQUIRE) ||
+      !__atomic_load_n(&CANmodule->driverInstalled, __ATOMIC_ACQUIRE))
+  {
+    /* driver is being reinstalled or is disabled, let it take rxLock */
+    vTaskDelay(1);
+    return 0U;
+  }
 
-  if (CANmodule->errOld != err)
+  xSemaphoreTake(CANmodule->rxLock, portMAX_DELAY);
+  if (CO_TWAI(CANmodule, receive, &msgs[0].msg, ticks) == ESP_OK)
   {
-    uint16_t status = CANmodule->CANerrorStatus;
+    msgs[0].timestamp_us = esp_timer_get_time();
+    n = 1U;
+    while ((n < count) && (CO_TWAI(CANmodule, receive, &msgs[n].msg, 0) == ESP_OK))
+    {
+      msgs[n].timestamp_us = esp_timer_get_time();
+      n++;
+    }
+  }
+  xSemaphoreGive(CANmodule->rxLock);
 
-    CANmodule->errOld = err;
+  return n;
+}
 
-    if (txErrors >= 256U)
+/******************************************************************************/
+void CANreceive(CO_CANmodule_t *CANmodule)
+{
+  CO_CANrxMsg_t rcvMsg; /* received message in CAN module */
+
+  if (CO_CANrxFetch(CANmodule, &rcvMsg, 1U, pdMS_TO_TICKS(CO_CAN_RX_WAIT_MS)) == 1U)
+  {
+    bool_t matched;
+
+    xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+    matched = CO_CANrxDispatch(CANmodule, &rcvMsg);
+    xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+    if (matched)
     {
-      /* bus off */
-      status |= CO_CAN_ERRTX_BUS_OFF;
+      CO_CANwake(CANmodule, CO_CAN_WAIT_RX);
     }
-    else
-    {
-      /* recalculate CANerrorStatus, first clear some flags */
-      status &= 0xFFFF ^ (CO_CAN_ERRTX_BUS_OFF |
-                          CO_CAN_ERRRX_WARNING | CO_CAN_ERRRX_PASSIVE |
-                          CO_CAN_ERRTX_WARNING | CO_CAN_ERRTX_PASSIVE);
+  }
+}
 
-      /* rx bus warning or passive */
-      if (rxErrors >= 128)
-      {
-        status |= CO_CAN_ERRRX_WARNING | CO_CAN_ERRRX_PASSIVE;
-      }
-      else if (rxErrors >= 96)
-      {
-        status |= CO_CAN_ERRRX_WARNING;
-      }
+/******************************************************************************/
+void CANreceiveMessage(CO_CANmodule_t *CANmodule, twai_message_t *rcvMsg)
+{
+  CO_CANrxMsg_t rxMsg;
+  bool_t matched;
+
+  rxMsg.msg = *rcvMsg;
+  rxMsg.timestamp_us = esp_timer_get_time();
+  xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+  matched = CO_CANrxDispatch(CANmodule, &rxMsg);
+  xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
+  if (matched)
+  {
+    CO_CANwake(CANmodule, CO_CAN_WAIT_RX);
+  }
+}
 
-      /* tx bus warning or passive */
-      if (txErrors >= 128)
-      {
-        status |= CO_CAN_ERRTX_WARNING | CO_CAN_ERRTX_PASSIVE;
-      }
-      else if (rxErrors >= 96)
+/******************************************************************************/
+uint16_t CANreceiveBatch(CO_CANmodule_t *CANmodule, uint32_t timeout_ms, uint16_t budget)
+{
+  CO_CANrxMsg_t msgs[CO_CAN_RX_BATCH]; /* received messages in CAN module */
+  TickType_t start = xTaskGetTickCount();
+  TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+  uint16_t processed = 0U;
+  bool_t matched = false;
+
+  while (processed < budget)
+  {
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    TickType_t wait = 0;
+    uint16_t count = budget - processed;
+    uint16_t n, i;
+
+    /* Wait for the first message in slices, so acceptance filter can be */
+    /* reprogrammed meanwhile. Later messages are taken only if queued. */
+    if ((processed == 0U) && (elapsed < timeout))
+    {
+      wait = timeout - elapsed;
+      if (wait > pdMS_TO_TICKS(CO_CAN_RX_WAIT_MS))
       {
-        status |= CO_CAN_ERRTX_WARNING;
+        wait = pdMS_TO_TICKS(CO_CAN_RX_WAIT_MS);
       }
+    }
+    if (count > CO_CAN_RX_BATCH)
+    {
+      count = CO_CAN_RX_BATCH;
+    }
 
-      /* if not tx passive clear also overflow */
-      if ((status & CO_CAN_ERRTX_PASSIVE) == 0)
+    n = CO_CANrxFetch(CANmodule, msgs, count, wait);
+    if (n > 0U)
+    {
+      xSemaphoreTakeRecursive(CANmodule->rxConfigLock, portMAX_DELAY);
+      for (i = 0U; i < n; i++)
       {
-        status &= 0xFFFF ^ CO_CAN_ERRTX_OVERFLOW;
+        matched = CO_CANrxDispatch(CANmodule, &msgs[i]) || matched;
       }
+      xSemaphoreGiveRecursive(CANmodule->rxConfigLock);
     }
+    processed += n;
 
-    if (overflow != 0)
+    if ((processed > 0U) ? (n < count) : (elapsed >= timeout))
     {
-      /* CAN RX bus overflow */
-      status |= CO_CAN_ERRRX_OVERFLOW;
+      break;
     }
+  }
 
-    CANmodule->CANerrorStatus = status;
+  if (matched)
+  {
+    CO_CANwake(CANmodule, CO_CAN_WAIT_RX);
   }
+  return processed;
 }
 
-/******************************************************************************/
-
-void CANreceive(CO_CANmodule_t *CANmodule)
+/* Events, which are pending without wake up */
+static uint32_t CO_CANwaitPending(CO_CANmodule_t *CANmodule)
 {
-  twai_message_t rcvMsg;      /* received message in CAN module */
-  uint16_t index;            /* index of received message */
-  uint32_t rcvMsgIdent;      /* identifier of the received message */
-  CO_CANrx_t *buffer = NULL; /* receive message buffer from CO_CANmodule_t object. */
-  bool_t msgMatched = false;
+  uint32_t events = __atomic_exchange_n(&CANmodule->waitEvents, 0U, __ATOMIC_ACQUIRE);
+  uint32_t alerts = __atomic_load_n(&CANmodule->alertsPending, __ATOMIC_RELAXED);
+
+#if CO_CAN_RX_RING
+  if (!CO_CANrxRingEmpty(CANmodule))
+  {
+    events |= CO_CAN_WAIT_RX;
+  }
+#endif
+  if ((alerts & CO_CAN_ALERTS_ERROR) != 0U)
+  {
+    events |= CO_CAN_WAIT_STATUS;
+  }
+  if (((alerts & (TWAI_ALERT_TX_SUCCESS | TWAI_ALERT_TX_IDLE)) != 0U) && (CO_CAN_SEND_LOAD(CANmodule->CANtxCount) > 0U))
+  {
+    events |= CO_CAN_WAIT_TX;
+  }
+  return events;
+}
 
-  esp_err_t ret = twai_receive(&rcvMsg, portMAX_DELAY);
+/* Shorten wait to the next deadline of CO_CANmodule_process(), set event,
+ * which is due then. portMAX_DELAY is not shortened by tick count. */
+static TickType_t CO_CANwaitDeadline(const CO_CANmodule_t *CANmodule, TickType_t ticks, uint32_t *due)
+{
+  TickType_t now = xTaskGetTickCount();
 
-  rcvMsgIdent = rcvMsg.identifier;
-  if (CANmodule->useCANrxFilters)
+#if CO_CAN_BUSOFF_RECOVERY
+  if (CANmodule->busOff && (CANmodule->stats.state == TWAI_STATE_BUS_OFF))
   {
-    /* CAN module filters are used. Message with known 11-bit identifier has */
-    /* been received */
+    TickType_t elapsed = now - CANmodule->busOffTime;
+    TickType_t delay = pdMS_TO_TICKS(CANmodule->stats.recoveryDelayMs);
+    TickType_t remaining = (elapsed < delay) ? (delay - elapsed) : 0;
 
-    // TODO: Hardare filters
-    index = 0; /* get index of the received message here. Or something similar */
-    // if (index < CANmodule->rxSize)
-    // {
-    //   buffer = &CANmodule->rxArray[index];
-    //   /* verify also RTR */
-    //   if (((rcvMsgIdent ^ buffer->ident) & buffer->mask) == 0U)
-    //   {
-    //     msgMatched = true;
-    //   }
-    // }
+    if (remaining < ticks)
+    {
+      ticks = remaining;
+      *due = CO_CAN_WAIT_STATUS;
+    }
   }
-  else
+#endif
+  if ((CO_CAN_SEND_LOAD(CANmodule->CANerrorStatus) != 0U) || CANmodule->busOff)
   {
-    /* CAN module filters are not used, message with any standard 11-bit identifier */
-    /* has been received. Search rxArray form CANmodule for the same CAN-ID. */
-    buffer = &CANmodule->rxArray[0];
-    for (index = CANmodule->rxSize; index > 0U; index--)
+    TickType_t elapsed = now - CANmodule->statusTime;
+    TickType_t period = pdMS_TO_TICKS(CO_CAN_STATUS_PERIOD_MS);
+    TickType_t remaining = (elapsed < period) ? (period - elapsed) : 0;
+
+    if (remaining < ticks)
     {
-      if (((rcvMsgIdent ^ buffer->ident) & buffer->mask) == 0U)
-      {
-        msgMatched = true;
-        break;
-      }
-      buffer++;
+      ticks = remaining;
+      *due = CO_CAN_WAIT_STATUS;
     }
   }
+  if ((CO_CAN_SEND_LOAD(CANmodule->CANtxCount) > 0U) && (CANmodule->rxTask == NULL) && (ticks > 1))
+  {
+    /* nobody waits for transmit alerts, poll */
+    ticks = 1;
+    *due = CO_CAN_WAIT_TX;
+  }
+  return ticks;
+}
 
-  /* Call specific function, which will process the message */
-  if (msgMatched && (buffer != NULL) && (buffer->CANrx_callback != NULL))
+/* Timeout of CO_CANwait() elapsed */
+static void CO_CANwaitTimer(void *arg)
+{
+  CO_CANmodule_t *CANmodule = (CO_CANmodule_t *)arg;
+
+  xSemaphoreGive(CANmodule->waitSem);
+}
+
+/******************************************************************************/
+uint32_t CO_CANwait(CO_CANmodule_t *CANmodule, uint32_t timeout_us)
+{
+  const uint32_t tick_us = 1000000U / configTICK_RATE_HZ;
+  TickType_t start = xTaskGetTickCount();
+  TickType_t ticks;
+  uint32_t events;
+  int64_t deadline_us = 0;
+
+  if (CANmodule->waitTask == NULL)
   {
-    ESP_LOGI(CO_DRIVER_TAG, "twai_receive * ident: 0x%03X, DLC: %d 0x[%02X %02X %02X %02X %02X %02X %02X %02X] flags: 0x%08X idx: %d, cb: %d",
-             (unsigned int) rcvMsg.identifier, rcvMsg.data_length_code, (unsigned int) rcvMsg.data[0], (unsigned int) rcvMsg.data[1], (unsigned int) rcvMsg.data[2], (unsigned int) rcvMsg.data[3],
-             (unsigned int) rcvMsg.data[4], (unsigned int) rcvMsg.data[5], (unsigned int) rcvMsg.data[6], (unsigned int) rcvMsg.data[7], (unsigned int) rcvMsg.flags, CANmodule->rxSize - index,
-             (int)(void *)buffer->CANrx_callback);
+    uint32_t alerts = 0U;
+
+    /* First call. Receive task waits for TWAI alerts from now on, received
+     * data alert is enabled for it. */
+    const esp_timer_create_args_t timerArgs = {.callback = CO_CANwaitTimer, .arg = CANmodule, .name = "co-wait"};
 
-    buffer->CANrx_callback(buffer->object, (void *)&rcvMsg);
+    CANmodule->waitSem = xSemaphoreCreateBinaryStatic(&CANmodule->waitSemBuffer);
+    if (esp_timer_create(&timerArgs, &CANmodule->waitTimer) != ESP_OK)
+    {
+      /* timeout is rounded up to ticks */
+      CANmodule->waitTimer = NULL;
+    }
+    __atomic_store_n(&CANmodule->waitTask, xTaskGetCurrentTaskHandle(), __ATOMIC_RELEASE);
+    if (CANmodule->driverInstalled &&
+        (CO_TWAI(CANmodule, reconfigure_alerts, CO_CAN_ALERTS | TWAI_ALERT_RX_DATA, &alerts) == ESP_OK))
+    {
+      __atomic_fetch_or(&CANmodule->alertsPending, alerts & ~(uint32_t)TWAI_ALERT_RX_DATA, __ATOMIC_RELAXED);
+    }
   }
-  else
+
+  /* rounded up, so timerNext_us has elapsed on timeout */
+  ticks = (timeout_us == UINT32_MAX)
+              ? portMAX_DELAY
+              : (TickType_t)(((uint64_t)timeout_us * configTICK_RATE_HZ + 999999U) / 1000000U);
+
+  events = CO_CANwaitPending(CANmodule);
+  if ((events == 0U) && (timeout_us != UINT32_MAX) && ((timeout_us % tick_us) != 0U) && (CANmodule->waitTimer != NULL))
   {
-    if (ret == ESP_OK)
+    /* esp_timer ends the wait, ticks are one more, so they don't */
+    deadline_us = esp_timer_get_time() + timeout_us;
+    (void)esp_timer_stop(CANmodule->waitTimer);
+    if (esp_timer_start_once(CANmodule->waitTimer, timeout_us) == ESP_OK)
+    {
+      ticks++;
+    }
+    else
     {
-      ESP_LOGI(CO_DRIVER_TAG, "twai_receive ident: 0x%03X, DLC: %d 0x[%02X %02X %02X %02X %02X %02X %02X %02X] flags: 0x%08X",
-               (unsigned int) rcvMsg.identifier, (unsigned int) rcvMsg.data_length_code, (unsigned int) rcvMsg.data[0], (unsigned int) rcvMsg.data[1], (unsigned int) rcvMsg.data[2], (unsigned int) rcvMsg.data[3],
-               (unsigned int) rcvMsg.data[4], (unsigned int) rcvMsg.data[5], (unsigned int) rcvMsg.data[6], (unsigned int) rcvMsg.data[7], (unsigned int) rcvMsg.flags);
+      deadline_us = 0;
     }
   }
-}
+  while (events == 0U)
+  {
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    TickType_t wait = portMAX_DELAY;
+    uint32_t due = 0U;
 
-typedef struct
-{
-  uint16_t ident;
-} CO_CANrxMsg_t;
+    if ((deadline_us != 0) && (esp_timer_get_time() >= deadline_us))
+    {
+      break;
+    }
+    if (ticks != portMAX_DELAY)
+    {
+      if (elapsed >= ticks)
+      {
+        break;
+      }
+      wait = ticks - elapsed;
+    }
+    wait = CO_CANwaitDeadline(CANmodule, wait, &due);
+    if ((wait == 0) || (xSemaphoreTake(CANmodule->waitSem, wait) != pdTRUE))
+    {
+      /* timeout, or driver deadline is due */
+      events = due;
+      break;
+    }
+    /* semaphore may be given for events, which were already returned */
+    events = CO_CANwaitPending(CANmodule);
+  }
+  if (deadline_us != 0)
+  {
+    (void)esp_timer_stop(CANmodule->waitTimer);
+  }
+
+  return events;
+}
 
 // void CO_CANinterrupt(CO_CANmodule_t *CANmodule)
 // {
@@ -556,7 +2434,7 @@ typedef struct
 //         if (buffer->bufferFull)
 //         {
 //           buffer->bufferFull = false;
-//           CANmodule->CANtxCount--;
+//           CO_CAN_SEND_STORE(CANmodule->CANtxCount, CANmodule->CANtxCount - 1U);
 
 //           /* Copy message to CAN buffer */
 //           CANmodule->bufferInhibitFlag = buffer->syncFlag;
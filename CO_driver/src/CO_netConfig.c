@@ -0,0 +1,327 @@
+/*
+ * Parallel SDO configuration of network nodes by NMT master.
+ *
+ * @file        CO_netConfig.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_netConfig.h"
+
+#if ((CO_CONFIG_SDO_CLI) & CO_CONFIG_SDO_CLI_ENABLE) && ((CO_CONFIG_NMT) & CO_CONFIG_NMT_MASTER)
+
+#include "esp_log.h"
+
+#define CO_NET_CONFIG_TAG "co-netconfig"
+
+/******************************************************************************/
+CO_ReturnError_t CO_netConfig_init(CO_netConfig_t *netConfig, CO_SDOclient_t *clients, uint8_t clientsCount,
+                                   CO_NMT_t *NMT, CO_CANmodule_t *CANmodule, CO_netConfigNode_t *nodes,
+                                   uint8_t nodesCount)
+{
+  uint8_t i;
+
+  if ((netConfig == NULL) || (clients == NULL) || (clientsCount == 0U) || (clientsCount > CO_NET_CONFIG_CHANNELS) ||
+      (NMT == NULL) || ((nodes == NULL) && (nodesCount > 0U)))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+  for (i = 0U; i < nodesCount; i++)
+  {
+    uint16_t e;
+
+    if ((nodes[i].nodeId < 1U) || (nodes[i].nodeId > 127U) || ((nodes[i].script == NULL) && (nodes[i].scriptCount > 0U)))
+    {
+      return CO_ERROR_ILLEGAL_ARGUMENT;
+    }
+    for (e = 0U; e < nodes[i].scriptCount; e++)
+    {
+      const CO_netConfigEntry_t *entry = &nodes[i].script[e];
+
+      if ((entry->data == NULL) ? (entry->size > 4U) : (entry->size == 0U))
+      {
+        return CO_ERROR_ILLEGAL_ARGUMENT;
+      }
+    }
+  }
+
+  memset(netConfig, 0, sizeof(*netConfig));
+  netConfig->NMT = NMT;
+  for (i = 0U; i < clientsCount; i++)
+  {
+    netConfig->channels[i].client = &clients[i];
+  }
+  netConfig->channelsCount = clientsCount;
+  netConfig->nodes = nodes;
+  netConfig->nodesCount = nodesCount;
+  for (i = 0U; i < nodesCount; i++)
+  {
+    nodes[i].state = CO_NET_CONFIG_WAITING;
+    nodes[i].entry = 0U;
+    nodes[i].attempts = 0U;
+    nodes[i].abortCode = CO_SDO_AB_NONE;
+    nodes[i].time_us = 0U;
+  }
+
+  if (CANmodule != NULL)
+  {
+    /* 0x581 to 0x5FF */
+    CO_CANrxFilterReserve(CANmodule, CO_CAN_ID_SDO_SRV, 0x0780U);
+  }
+
+  return CO_ERROR_NO;
+}
+
+/******************************************************************************/
+void CO_netConfig_initCallback(CO_netConfig_t *netConfig, void *object,
+                               void (*pFunctSignal)(void *object, const CO_netConfigNode_t *node))
+{
+  if (netConfig != NULL)
+  {
+    netConfig->functSignalObject = object;
+    netConfig->pFunctSignal = pFunctSignal;
+  }
+}
+
+/******************************************************************************/
+void CO_netConfig_start(CO_netConfig_t *netConfig)
+{
+  uint8_t i;
+
+  if (netConfig == NULL)
+  {
+    return;
+  }
+
+  /* abort transfers of previous start */
+  for (i = 0U; i < netConfig->channelsCount; i++)
+  {
+    CO_netConfigChannel_t *channel = &netConfig->channels[i];
+
+    if (channel->node != NULL)
+    {
+      if (channel->active)
+      {
+        CO_SDO_abortCode_t abortCode = CO_SDO_AB_GENERAL;
+
+        (void)CO_SDOclientDownload(channel->client, 0U, true, false, &abortCode, NULL, NULL);
+      }
+      CO_SDOclientClose(channel->client);
+      channel->node = NULL;
+    }
+    channel->active = false;
+  }
+
+  netConfig->pending = 0U;
+  for (i = 0U; i < netConfig->nodesCount; i++)
+  {
+    CO_netConfigNode_t *node = &netConfig->nodes[i];
+
+    if (node->state != CO_NET_CONFIG_DONE)
+    {
+      node->state = CO_NET_CONFIG_WAITING;
+      node->entry = 0U;
+      node->attempts = 0U;
+      node->abortCode = CO_SDO_AB_NONE;
+      netConfig->pending++;
+    }
+  }
+  netConfig->nextNode = 0U;
+  netConfig->elapsed_us = 0U;
+}
+
+/* Node is done or failed, free its channel. Caller logs the failure, node may
+ * fail before its first entry. */
+static void CO_netConfig_finish(CO_netConfig_t *netConfig, CO_netConfigChannel_t *channel, CO_netConfigState_t state)
+{
+  CO_netConfigNode_t *node = channel->node;
+
+  CO_SDOclientClose(channel->client);
+  channel->node = NULL;
+  channel->active = false;
+
+  node->state = state;
+  node->time_us = netConfig->elapsed_us;
+  netConfig->pending--;
+  if ((state == CO_NET_CONFIG_DONE) &&
+      (CO_NMT_sendCommand(netConfig->NMT, CO_NMT_ENTER_OPERATIONAL, node->nodeId) != CO_ERROR_NO))
+  {
+    ESP_LOGW(CO_NET_CONFIG_TAG, "Node %u configured, NMT start not sent", node->nodeId);
+  }
+
+  if (netConfig->pFunctSignal != NULL)
+  {
+    netConfig->pFunctSignal(netConfig->functSignalObject, node);
+  }
+}
+
+/* Assign the next waiting node to free channel. Returns false, if there is none. */
+static bool_t CO_netConfig_assign(CO_netConfig_t *netConfig, CO_netConfigChannel_t *channel)
+{
+  while (netConfig->nextNode < netConfig->nodesCount)
+  {
+    CO_netConfigNode_t *node = &netConfig->nodes[netConfig->nextNode];
+
+    netConfig->nextNode++;
+    if (node->state != CO_NET_CONFIG_WAITING)
+    {
+      continue;
+    }
+    channel->node = node;
+    channel->active = false;
+    node->state = CO_NET_CONFIG_BUSY;
+    if (CO_SDOclient_setup(channel->client, CO_CAN_ID_SDO_CLI + node->nodeId, CO_CAN_ID_SDO_SRV + node->nodeId,
+                           node->nodeId) != CO_SDO_RT_ok_communicationEnd)
+    {
+      node->abortCode = CO_SDO_AB_GENERAL;
+      ESP_LOGW(CO_NET_CONFIG_TAG, "Node %u SDO client setup failed", node->nodeId);
+      CO_netConfig_finish(netConfig, channel, CO_NET_CONFIG_FAILED);
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+/* Initiate transfer of current entry of the node */
+static CO_SDO_return_t CO_netConfig_initiate(CO_netConfigChannel_t *channel)
+{
+  const CO_netConfigNode_t *node = channel->node;
+  const CO_netConfigEntry_t *entry = &node->script[node->entry];
+  size_t size = (entry->data != NULL) ? entry->size : ((entry->size > 0U) ? entry->size : 4U);
+  bool_t block = node->block && (size > 28U);
+  CO_SDO_return_t ret;
+
+  ret = CO_SDOclientDownloadInitiate(channel->client, entry->index, entry->subIndex, size, CO_NET_CONFIG_TIMEOUT_MS,
+                                     block);
+  if (ret != CO_SDO_RT_ok_communicationEnd)
+  {
+    return ret;
+  }
+  if (entry->data != NULL)
+  {
+    channel->written = CO_SDOclientDownloadBufWrite(channel->client, entry->data, size);
+  }
+  else
+  {
+    uint8_t buf[4];
+
+    (void)CO_setUint32(buf, entry->value);
+    channel->written = CO_SDOclientDownloadBufWrite(channel->client, buf, (size < 4U) ? size : 4U);
+  }
+  channel->active = true;
+  return ret;
+}
+
+/* Write entries of the node on channel, until transfer has to wait. Returns
+ * true, if channel is free again. */
+static bool_t CO_netConfig_channel(CO_netConfig_t *netConfig, CO_netConfigChannel_t *channel,
+                                   uint32_t timeDifference_us, uint32_t *timerNext_us)
+{
+  CO_netConfigNode_t *node = channel->node;
+
+  for (;;)
+  {
+    const CO_netConfigEntry_t *entry;
+    CO_SDO_abortCode_t abortCode = CO_SDO_AB_NONE;
+    CO_SDO_return_t ret;
+    size_t size;
+
+    if (node->entry >= node->scriptCount)
+    {
+      CO_netConfig_finish(netConfig, channel, CO_NET_CONFIG_DONE);
+      return true;
+    }
+    entry = &node->script[node->entry];
+    size = (entry->data != NULL) ? entry->size : ((entry->size > 0U) ? entry->size : 4U);
+
+    if (!channel->active)
+    {
+      ret = CO_netConfig_initiate(channel);
+      if (ret == CO_SDO_RT_ok_communicationEnd)
+      {
+        continue;
+      }
+    }
+    else
+    {
+      /* refill buffer of long entry */
+      if ((entry->data != NULL) && (channel->written < size))
+      {
+        channel->written += CO_SDOclientDownloadBufWrite(channel->client, &entry->data[channel->written],
+                                                         size - channel->written);
+      }
+      ret = CO_SDOclientDownload(channel->client, timeDifference_us, false, channel->written < size, &abortCode,
+                                 NULL, timerNext_us);
+      timeDifference_us = 0U;
+      if (ret > CO_SDO_RT_ok_communicationEnd)
+      {
+        return false;
+      }
+      if (ret == CO_SDO_RT_ok_communicationEnd)
+      {
+        /* entry written */
+        channel->active = false;
+        node->entry++;
+        node->attempts = 0U;
+        continue;
+      }
+    }
+
+    /* error, repeat the entry, unless node rejected it */
+    channel->active = false;
+    node->abortCode = abortCode;
+    node->attempts++;
+    if ((ret == CO_SDO_RT_endedWithServerAbort) || (node->attempts > CO_NET_CONFIG_RETRIES))
+    {
+      ESP_LOGW(CO_NET_CONFIG_TAG, "Node %u entry %04X:%02X failed, abort code %08X", node->nodeId, entry->index,
+               entry->subIndex, (unsigned int)node->abortCode);
+      CO_netConfig_finish(netConfig, channel, CO_NET_CONFIG_FAILED);
+      return true;
+    }
+    netConfig->retries++;
+  }
+}
+
+/******************************************************************************/
+uint8_t CO_netConfig_process(CO_netConfig_t *netConfig, uint32_t timeDifference_us, uint32_t *timerNext_us)
+{
+  uint8_t i;
+
+  if ((netConfig == NULL) || (netConfig->pending == 0U))
+  {
+    return 0U;
+  }
+
+  netConfig->elapsed_us += timeDifference_us;
+  for (i = 0U; i < netConfig->channelsCount; i++)
+  {
+    CO_netConfigChannel_t *channel = &netConfig->channels[i];
+
+    while ((channel->node != NULL) || CO_netConfig_assign(netConfig, channel))
+    {
+      if (!CO_netConfig_channel(netConfig, channel, timeDifference_us, timerNext_us))
+      {
+        break;
+      }
+    }
+  }
+
+  return netConfig->pending;
+}
+
+#endif /* ((CO_CONFIG_SDO_CLI) & CO_CONFIG_SDO_CLI_ENABLE) && ((CO_CONFIG_NMT) & CO_CONFIG_NMT_MASTER) */
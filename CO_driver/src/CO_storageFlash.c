@@ -0,0 +1,685 @@
+/*
+ * CANopen data storage in flash partition for ESP32.
+ *
+ * @file        CO_storageFlash.c
+ *
+ * This file is part of CANopenNode, an opensource CANopen Stack.
+ * Project home page is <https://github.com/CANopenNode/CANopenNode>.
+ * For more information on CANopen see <http://www.can-cia.org/>.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CO_storageFlash.h"
+
+#if ((CO_CONFIG_STORAGE) & CO_CONFIG_STORAGE_ENABLE)
+
+#include <stdlib.h>
+
+#include "301/crc16-ccitt.h"
+#include "esp_timer.h"
+
+#if !((CO_CONFIG_CRC16) & CO_CONFIG_CRC16_ENABLE)
+#error CO_storageFlash requires CO_CONFIG_CRC16_ENABLE
+#endif
+
+#define CO_STORAGE_FLASH_TAG "co-storage"
+
+/* Sector header. Sector is complete, when records from the sector after it
+ * were copied into it, only then that sector is erased. */
+#define CO_STORAGE_FLASH_MAGIC 0x53534F43UL /* "COSS" */
+#define CO_STORAGE_FLASH_COMPLETE 0x00000000UL
+typedef struct
+{
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t sequenceInv;
+  uint32_t complete;
+} CO_storageFlashSector_t;
+
+/* Record header, followed by data and padding to 4 bytes. Erased flash
+ * reads as length 0xFFFF. crc covers the first four bytes and data. Record is
+ * committed after its data are written, so interrupted write is detected
+ * also, if torn data happen to match CRC. */
+#define CO_STORAGE_FLASH_DATA 0x5AU
+#define CO_STORAGE_FLASH_DEFAULTS 0xA5U
+#define CO_STORAGE_FLASH_COMMITTED 0x0000U
+typedef struct
+{
+  uint16_t length;
+  uint8_t subIndexOD;
+  uint8_t type;
+  uint16_t crc;
+  uint16_t committed;
+} CO_storageFlashRecord_t;
+
+#define CO_STORAGE_FLASH_NONE UINT32_MAX
+#define CO_STORAGE_FLASH_RECORD_SIZE(length) ((sizeof(CO_storageFlashRecord_t) + (length) + 3U) & ~3UL)
+
+/* Bytes compared or copied at once, when partition is not mapped */
+#define CO_STORAGE_FLASH_CHUNK 64U
+
+static uint32_t CO_storageFlash_errorBit(uint8_t subIndexOD)
+{
+  return 1UL << ((subIndexOD > 31U) ? 31U : subIndexOD);
+}
+
+static uint16_t CO_storageFlash_crc(uint8_t subIndexOD, uint8_t type, const void *data, uint16_t length)
+{
+  CO_storageFlashRecord_t record = {length, subIndexOD, type, 0U, 0xFFFFU};
+  uint16_t crc = crc16_ccitt((const uint8_t *)&record, 4U, 0U);
+
+  return (length > 0U) ? crc16_ccitt((const uint8_t *)data, length, crc) : crc;
+}
+
+static CO_storage_entry_t *CO_storageFlash_find(CO_storageFlash_t *flash, uint8_t subIndexOD)
+{
+  uint8_t i;
+
+  for (i = 0U; i < flash->entriesCount; i++)
+  {
+    if (flash->entries[i].subIndexOD == subIndexOD)
+    {
+      return &flash->entries[i];
+    }
+  }
+  return NULL;
+}
+
+static esp_err_t CO_storageFlash_read(CO_storageFlash_t *flash, uint32_t offset, void *buf, size_t len)
+{
+  if (flash->map != NULL)
+  {
+    memcpy(buf, &flash->map[offset], len);
+    return ESP_OK;
+  }
+  return esp_partition_read(flash->partition, offset, buf, len);
+}
+
+/* Compare stored data with data in RAM */
+static bool_t CO_storageFlash_equal(CO_storageFlash_t *flash, uint32_t offset, const uint8_t *data, size_t len)
+{
+  uint8_t buf[CO_STORAGE_FLASH_CHUNK];
+  size_t pos;
+
+  if (flash->map != NULL)
+  {
+    return memcmp(&flash->map[offset], data, len) == 0;
+  }
+  for (pos = 0U; pos < len; pos += sizeof(buf))
+  {
+    size_t n = ((len - pos) < sizeof(buf)) ? (len - pos) : sizeof(buf);
+
+    if ((esp_partition_read(flash->partition, offset + pos, buf, n) != ESP_OK) || (memcmp(buf, &data[pos], n) != 0))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static esp_err_t CO_storageFlash_write(CO_storageFlash_t *flash, uint32_t offset, const void *data, size_t len)
+{
+  flash->stats.flashBytes += len;
+  return esp_partition_write(flash->partition, offset, data, len);
+}
+
+static esp_err_t CO_storageFlash_erase(CO_storageFlash_t *flash, uint16_t sector)
+{
+  flash->stats.erases++;
+  return esp_partition_erase_range(flash->partition, (uint32_t)sector * CO_STORAGE_FLASH_SECTOR,
+                                   CO_STORAGE_FLASH_SECTOR);
+}
+
+/* Erase sector, if it is not erased already */
+static esp_err_t CO_storageFlash_prepare(CO_storageFlash_t *flash, uint16_t sector, uint8_t *buf)
+{
+  const uint32_t *words;
+  uint32_t offset = (uint32_t)sector * CO_STORAGE_FLASH_SECTOR;
+  uint32_t i;
+
+  if (flash->map != NULL)
+  {
+    words = (const uint32_t *)&flash->map[offset];
+  }
+  else if (esp_partition_read(flash->partition, offset, buf, CO_STORAGE_FLASH_SECTOR) == ESP_OK)
+  {
+    words = (const uint32_t *)buf;
+  }
+  else
+  {
+    return CO_storageFlash_erase(flash, sector);
+  }
+
+  for (i = 0U; i < (CO_STORAGE_FLASH_SECTOR / 4U); i++)
+  {
+    if (words[i] != 0xFFFFFFFFUL)
+    {
+      return CO_storageFlash_erase(flash, sector);
+    }
+  }
+  return ESP_OK;
+}
+
+/* Start sector with next sequence number */
+static esp_err_t CO_storageFlash_open(CO_storageFlash_t *flash, uint16_t sector, bool_t complete)
+{
+  CO_storageFlashSector_t header;
+  esp_err_t err;
+
+  flash->sequence++;
+  header.magic = CO_STORAGE_FLASH_MAGIC;
+  header.sequence = flash->sequence;
+  header.sequenceInv = ~flash->sequence;
+  header.complete = complete ? CO_STORAGE_FLASH_COMPLETE : 0xFFFFFFFFUL;
+  err = CO_storageFlash_write(flash, (uint32_t)sector * CO_STORAGE_FLASH_SECTOR, &header, sizeof(header));
+  flash->active = sector;
+  flash->writeOffset = sizeof(header);
+  return err;
+}
+
+/* Copy the latest record of entry into active sector */
+static esp_err_t CO_storageFlash_copy(CO_storageFlash_t *flash, CO_storage_entry_t *entry)
+{
+  uint8_t buf[CO_STORAGE_FLASH_CHUNK];
+  uint32_t size = CO_STORAGE_FLASH_RECORD_SIZE(entry->len);
+  uint32_t target = ((uint32_t)flash->active * CO_STORAGE_FLASH_SECTOR) + flash->writeOffset;
+  uint32_t pos;
+  esp_err_t err = ESP_OK;
+
+  for (pos = 0U; (pos < size) && (err == ESP_OK); pos += sizeof(buf))
+  {
+    uint32_t n = ((size - pos) < sizeof(buf)) ? (size - pos) : sizeof(buf);
+
+    err = CO_storageFlash_read(flash, entry->offsetNV + pos, buf, n);
+    if (err == ESP_OK)
+    {
+      err = CO_storageFlash_write(flash, target + pos, buf, n);
+    }
+  }
+  if (err == ESP_OK)
+  {
+    entry->offsetNV = target;
+    entry->addrNV = (flash->map != NULL) ? (void *)&flash->map[target + sizeof(CO_storageFlashRecord_t)] : NULL;
+    flash->writeOffset += size;
+    flash->stats.records++;
+    flash->stats.copies++;
+  }
+  return err;
+}
+
+/* Active sector is full. Continue in the erased sector after it, copy live
+ * records from the sector after that one (the oldest), mark new sector
+ * complete and erase the oldest sector, which is then the erased one. If
+ * power fails before new sector is complete, it is erased at next init. */
+static esp_err_t CO_storageFlash_switch(CO_storageFlash_t *flash)
+{
+  uint16_t next = (uint16_t)((flash->active + 1U) % flash->sectors);
+  uint16_t victim = (uint16_t)((next + 1U) % flash->sectors);
+  uint32_t complete = CO_STORAGE_FLASH_COMPLETE;
+  esp_err_t err = CO_storageFlash_open(flash, next, false);
+  uint8_t i;
+
+  for (i = 0U; (i < flash->entriesCount) && (err == ESP_OK); i++)
+  {
+    CO_storage_entry_t *entry = &flash->entries[i];
+
+    if ((entry->offsetNV == CO_STORAGE_FLASH_NONE) || ((entry->offsetNV / CO_STORAGE_FLASH_SECTOR) != victim))
+    {
+      continue;
+    }
+    if (entry->storedNV)
+    {
+      err = CO_storageFlash_copy(flash, entry);
+    }
+    else
+    {
+      /* restore of defaults or record of old length, older records are
+       * only in the victim itself */
+      entry->offsetNV = CO_STORAGE_FLASH_NONE;
+    }
+  }
+
+  if (err == ESP_OK)
+  {
+    err = CO_storageFlash_write(flash, ((uint32_t)next * CO_STORAGE_FLASH_SECTOR) + offsetof(CO_storageFlashSector_t, complete),
+                                &complete, sizeof(complete));
+  }
+  if (err == ESP_OK)
+  {
+    err = CO_storageFlash_erase(flash, victim);
+  }
+  return err;
+}
+
+/* Append record of entry to active sector */
+static esp_err_t CO_storageFlash_append(CO_storageFlash_t *flash, CO_storage_entry_t *entry, uint8_t type,
+                                        const void *data, uint16_t length, uint16_t crc)
+{
+  CO_storageFlashRecord_t record = {length, entry->subIndexOD, type, crc, 0xFFFFU};
+  uint32_t size = CO_STORAGE_FLASH_RECORD_SIZE(length);
+  uint32_t offset;
+  esp_err_t err = ESP_OK;
+
+  if ((flash->writeOffset + size) > CO_STORAGE_FLASH_SECTOR)
+  {
+    err = CO_storageFlash_switch(flash);
+  }
+  offset = ((uint32_t)flash->active * CO_STORAGE_FLASH_SECTOR) + flash->writeOffset;
+
+  /* header, data, then commit */
+  if (err == ESP_OK)
+  {
+    err = CO_storageFlash_write(flash, offset, &record, sizeof(record));
+  }
+  if ((err == ESP_OK) && (length > 0U))
+  {
+    err = CO_storageFlash_write(flash, offset + sizeof(record), data, length);
+  }
+  if (err == ESP_OK)
+  {
+    record.committed = CO_STORAGE_FLASH_COMMITTED;
+    err = CO_storageFlash_write(flash, offset + offsetof(CO_storageFlashRecord_t, committed), &record.committed,
+                                sizeof(record.committed));
+  }
+  if (err != ESP_OK)
+  {
+    /* space after failed write is not usable */
+    flash->writeOffset = CO_STORAGE_FLASH_SECTOR;
+    ESP_LOGE(CO_STORAGE_FLASH_TAG, "Write of entry %u failed: %s", entry->subIndexOD, esp_err_to_name(err));
+    return err;
+  }
+
+  entry->offsetNV = offset;
+  entry->crcNV = crc;
+  entry->storedNV = (type == CO_STORAGE_FLASH_DATA);
+  entry->addrNV = (entry->storedNV && (flash->map != NULL)) ? (void *)&flash->map[offset + sizeof(record)] : NULL;
+  flash->writeOffset += size;
+  flash->stats.records++;
+  return ESP_OK;
+}
+
+/*
+ * Function for writing data on "Store parameters" command - OD object 1010
+ *
+ * For more information see file CO_storage.h, CO_storage_entry_t.
+ */
+static ODR_t storeFlash(CO_storage_entry_t *entry, CO_CANmodule_t *CANmodule)
+{
+  CO_storageFlash_t *flash = entry->flash;
+  ODR_t ret = ODR_OK;
+  uint16_t crc;
+
+  flash->stats.stores++;
+
+  /* data must not change between CRC and write */
+  CO_LOCK_OD(CANmodule);
+  crc = CO_storageFlash_crc(entry->subIndexOD, CO_STORAGE_FLASH_DATA, entry->addr, (uint16_t)entry->len);
+  if (entry->storedNV && (crc == entry->crcNV) &&
+      CO_storageFlash_equal(flash, entry->offsetNV + sizeof(CO_storageFlashRecord_t), entry->addr, entry->len))
+  {
+    flash->stats.unchanged++;
+  }
+  else if (CO_storageFlash_append(flash, entry, CO_STORAGE_FLASH_DATA, entry->addr, (uint16_t)entry->len, crc) ==
+           ESP_OK)
+  {
+    flash->stats.dataBytes += entry->len;
+  }
+  else
+  {
+    ret = ODR_HW;
+  }
+  CO_UNLOCK_OD(CANmodule);
+
+  return ret;
+}
+
+/*
+ * Function for restoring data on "Restore default parameters" command - OD 1011
+ *
+ * For more information see file CO_storage.h, CO_storage_entry_t.
+ */
+static ODR_t restoreFlash(CO_storage_entry_t *entry, CO_CANmodule_t *CANmodule)
+{
+  CO_storageFlash_t *flash = entry->flash;
+  (void)CANmodule;
+
+  /* defaults are used after reset, if the latest record is not data */
+  if (!entry->storedNV)
+  {
+    return ODR_OK;
+  }
+  if (CO_storageFlash_append(flash, entry, CO_STORAGE_FLASH_DEFAULTS, NULL, 0U,
+                             CO_storageFlash_crc(entry->subIndexOD, CO_STORAGE_FLASH_DEFAULTS, NULL, 0U)) != ESP_OK)
+  {
+    return ODR_HW;
+  }
+  return ODR_OK;
+}
+
+/* Find the latest records of entries in sector, which have no record in newer
+ * sectors, and restore their data. Returns offset of free space. */
+static uint32_t CO_storageFlash_scan(CO_storageFlash_t *flash, uint16_t sector, const uint8_t *data,
+                                     uint32_t *storageInitError)
+{
+  uint32_t base = (uint32_t)sector * CO_STORAGE_FLASH_SECTOR;
+  uint32_t offset = sizeof(CO_storageFlashSector_t);
+  uint8_t i;
+
+  while ((offset + sizeof(CO_storageFlashRecord_t)) <= CO_STORAGE_FLASH_SECTOR)
+  {
+    CO_storageFlashRecord_t record;
+    CO_storage_entry_t *entry;
+    uint32_t size;
+
+    memcpy(&record, &data[offset], sizeof(record));
+    if ((record.length == 0xFFFFU) && (record.subIndexOD == 0xFFU) && (record.type == 0xFFU) &&
+        (record.crc == 0xFFFFU))
+    {
+      break;
+    }
+
+    size = CO_STORAGE_FLASH_RECORD_SIZE(record.length);
+    entry = CO_storageFlash_find(flash, record.subIndexOD);
+    if (((record.type != CO_STORAGE_FLASH_DATA) && (record.type != CO_STORAGE_FLASH_DEFAULTS)) ||
+        (record.committed != CO_STORAGE_FLASH_COMMITTED) || ((offset + size) > CO_STORAGE_FLASH_SECTOR) ||
+        (CO_storageFlash_crc(record.subIndexOD, record.type, &data[offset + sizeof(record)], record.length) !=
+         record.crc))
+    {
+      /* interrupted write, rest of sector is not usable */
+      if ((entry != NULL) &&
+          ((entry->offsetNV == CO_STORAGE_FLASH_NONE) || ((entry->offsetNV / CO_STORAGE_FLASH_SECTOR) == sector)))
+      {
+        *storageInitError |= CO_storageFlash_errorBit(entry->subIndexOD);
+      }
+      ESP_LOGW(CO_STORAGE_FLASH_TAG, "Corrupted record in sector %u at %u", sector, (unsigned int)offset);
+      offset = CO_STORAGE_FLASH_SECTOR;
+      break;
+    }
+
+    /* latest record of entry without record in newer sector */
+    if ((entry != NULL) && ((entry->offsetNV == CO_STORAGE_FLASH_NONE) || ((entry->offsetNV / CO_STORAGE_FLASH_SECTOR) == sector)))
+    {
+      entry->offsetNV = base + offset;
+      entry->crcNV = record.crc;
+      entry->storedNV = (record.type == CO_STORAGE_FLASH_DATA);
+    }
+    offset += size;
+  }
+
+  for (i = 0U; i < flash->entriesCount; i++)
+  {
+    CO_storage_entry_t *entry = &flash->entries[i];
+    CO_storageFlashRecord_t record;
+
+    if (!entry->storedNV || ((entry->offsetNV / CO_STORAGE_FLASH_SECTOR) != sector))
+    {
+      continue;
+    }
+    memcpy(&record, &data[entry->offsetNV - base], sizeof(record));
+    if (record.length != entry->len)
+    {
+      /* Object Dictionary changed, keep default */
+      entry->storedNV = false;
+      *storageInitError |= CO_storageFlash_errorBit(entry->subIndexOD);
+      ESP_LOGW(CO_STORAGE_FLASH_TAG, "Entry %u has length %u, stored %u", entry->subIndexOD,
+               (unsigned int)entry->len, record.length);
+      continue;
+    }
+    memcpy(entry->addr, &data[entry->offsetNV - base + sizeof(record)], entry->len);
+    if (flash->map != NULL)
+    {
+      entry->addrNV = (void *)&flash->map[entry->offsetNV + sizeof(record)];
+    }
+  }
+  return offset;
+}
+
+/* Restore entries from all sectors and find active sector */
+static CO_ReturnError_t CO_storageFlash_restore(CO_storageFlash_t *flash, uint8_t *buf, uint32_t *storageInitError)
+{
+  CO_storageFlashSector_t header;
+  uint32_t newest = 0U;
+  uint16_t active = 0U;
+  uint16_t sector;
+  uint16_t k;
+  bool_t found;
+  esp_err_t err = ESP_OK;
+
+  /* newest valid sector, incomplete one is erased, older sector is intact */
+  for (;;)
+  {
+    found = false;
+    for (sector = 0U; sector < flash->sectors; sector++)
+    {
+      if ((CO_storageFlash_read(flash, (uint32_t)sector * CO_STORAGE_FLASH_SECTOR, &header, sizeof(header)) ==
+           ESP_OK) &&
+          (header.magic == CO_STORAGE_FLASH_MAGIC) && (header.sequenceInv == ~header.sequence) &&
+          (!found || (header.sequence > newest)))
+      {
+        found = true;
+        newest = header.sequence;
+        active = sector;
+      }
+    }
+    if (!found)
+    {
+      break;
+    }
+    CO_storageFlash_read(flash, (uint32_t)active * CO_STORAGE_FLASH_SECTOR, &header, sizeof(header));
+    if (header.complete == CO_STORAGE_FLASH_COMPLETE)
+    {
+      break;
+    }
+    ESP_LOGW(CO_STORAGE_FLASH_TAG, "Sector %u is incomplete", active);
+    if (CO_storageFlash_erase(flash, active) != ESP_OK)
+    {
+      return CO_ERROR_SYSCALL;
+    }
+  }
+
+  if (!found)
+  {
+    /* empty partition */
+    flash->sequence = 0U;
+    err = CO_storageFlash_prepare(flash, 0U, buf);
+    if (err == ESP_OK)
+    {
+      err = CO_storageFlash_open(flash, 0U, true);
+    }
+    if (err == ESP_OK)
+    {
+      err = CO_storageFlash_prepare(flash, 1U, buf);
+    }
+    return (err == ESP_OK) ? CO_ERROR_NO : CO_ERROR_SYSCALL;
+  }
+
+  flash->active = active;
+  flash->sequence = newest;
+
+  /* from newest to oldest, sector after active is the erased one */
+  for (k = 0U; k < (flash->sectors - 1U); k++)
+  {
+    const uint8_t *data;
+    uint32_t end;
+
+    sector = (uint16_t)((active + flash->sectors - k) % flash->sectors);
+    if (flash->map != NULL)
+    {
+      data = &flash->map[(uint32_t)sector * CO_STORAGE_FLASH_SECTOR];
+    }
+    else if (esp_partition_read(flash->partition, (uint32_t)sector * CO_STORAGE_FLASH_SECTOR, buf,
+                                CO_STORAGE_FLASH_SECTOR) == ESP_OK)
+    {
+      data = buf;
+    }
+    else
+    {
+      return CO_ERROR_SYSCALL;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    if ((header.magic != CO_STORAGE_FLASH_MAGIC) || (header.sequenceInv != ~header.sequence))
+    {
+      continue;
+    }
+    end = CO_storageFlash_scan(flash, sector, data, storageInitError);
+    if (sector == active)
+    {
+      flash->writeOffset = end;
+    }
+  }
+
+  err = CO_storageFlash_prepare(flash, (uint16_t)((active + 1U) % flash->sectors), buf);
+  return (err == ESP_OK) ? CO_ERROR_NO : CO_ERROR_SYSCALL;
+}
+
+/******************************************************************************/
+CO_ReturnError_t CO_storageFlash_init(CO_storageFlash_t *flash, const char *partitionLabel, CO_storage_t *storage,
+                                      CO_CANmodule_t *CANmodule, OD_entry_t *OD_1010_StoreParameters,
+                                      OD_entry_t *OD_1011_RestoreDefaultParameters, CO_storage_entry_t *entries,
+                                      uint8_t entriesCount, uint32_t *storageInitError)
+{
+  const void *map = NULL;
+  uint8_t *buf = NULL;
+  uint32_t total = 0U;
+  uint32_t largest = 0U;
+  int64_t start_us = esp_timer_get_time();
+  CO_ReturnError_t ret;
+  uint8_t i;
+
+  if ((flash == NULL) || (storage == NULL) || (entries == NULL) || (entriesCount == 0U) ||
+      (storageInitError == NULL))
+  {
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  memset(flash, 0, sizeof(*flash));
+  flash->CANmodule = CANmodule;
+  flash->entries = entries;
+  flash->entriesCount = entriesCount;
+  *storageInitError = 0U;
+
+  for (i = 0U; i < entriesCount; i++)
+  {
+    CO_storage_entry_t *entry = &entries[i];
+    uint32_t size = CO_STORAGE_FLASH_RECORD_SIZE(entry->len);
+
+    if ((entry->addr == NULL) || (entry->len == 0U) || (entry->len >= 0xFFFFU) || (entry->subIndexOD < 2U))
+    {
+      return CO_ERROR_ILLEGAL_ARGUMENT;
+    }
+    entry->flash = flash;
+    entry->addrNV = NULL;
+    entry->offsetNV = CO_STORAGE_FLASH_NONE;
+    entry->crcNV = 0U;
+    entry->storedNV = false;
+    total += size;
+    largest = (size > largest) ? size : largest;
+  }
+  if ((total + largest) > (CO_STORAGE_FLASH_SECTOR - sizeof(CO_storageFlashSector_t)))
+  {
+    ESP_LOGE(CO_STORAGE_FLASH_TAG, "Entries need %u bytes, sector has %u", (unsigned int)(total + largest),
+             (unsigned int)(CO_STORAGE_FLASH_SECTOR - sizeof(CO_storageFlashSector_t)));
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+
+  flash->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partitionLabel);
+  if ((flash->partition == NULL) || flash->partition->encrypted ||
+      ((flash->partition->size / CO_STORAGE_FLASH_SECTOR) < 2U))
+  {
+    ESP_LOGE(CO_STORAGE_FLASH_TAG, "No usable partition %s", (partitionLabel != NULL) ? partitionLabel : "");
+    return CO_ERROR_ILLEGAL_ARGUMENT;
+  }
+  flash->sectors = (uint16_t)(flash->partition->size / CO_STORAGE_FLASH_SECTOR);
+
+  /* whole partition is read directly, otherwise sector by sector */
+  if (esp_partition_mmap(flash->partition, 0U, (size_t)flash->sectors * CO_STORAGE_FLASH_SECTOR,
+                         ESP_PARTITION_MMAP_DATA, &map, &flash->mapHandle) == ESP_OK)
+  {
+    flash->map = (const uint8_t *)map;
+  }
+  else
+  {
+    buf = malloc(CO_STORAGE_FLASH_SECTOR);
+    if (buf == NULL)
+    {
+      return CO_ERROR_OUT_OF_MEMORY;
+    }
+  }
+
+  ret = CO_storageFlash_restore(flash, buf, storageInitError);
+  free(buf);
+  if (ret != CO_ERROR_NO)
+  {
+    CO_storageFlash_close(flash);
+    return ret;
+  }
+  flash->stats.restore_us = (uint32_t)(esp_timer_get_time() - start_us);
+
+  ret = CO_storage_init(storage, CANmodule, OD_1010_StoreParameters, OD_1011_RestoreDefaultParameters, storeFlash,
+                        restoreFlash, entries, entriesCount);
+  if (ret != CO_ERROR_NO)
+  {
+    CO_storageFlash_close(flash);
+    return ret;
+  }
+
+  return (*storageInitError != 0U) ? CO_ERROR_DATA_CORRUPT : CO_ERROR_NO;
+}
+
+/******************************************************************************/
+uint32_t CO_storageFlash_auto_process(CO_storageFlash_t *flash)
+{
+  uint32_t storageErrors = 0U;
+  uint8_t i;
+
+  if ((flash == NULL) || (flash->partition == NULL))
+  {
+    return 0U;
+  }
+
+  for (i = 0U; i < flash->entriesCount; i++)
+  {
+    CO_storage_entry_t *entry = &flash->entries[i];
+
+    if (((entry->attr & CO_storage_auto) != 0U) && (storeFlash(entry, flash->CANmodule) != ODR_OK))
+    {
+      storageErrors |= CO_storageFlash_errorBit(entry->subIndexOD);
+    }
+  }
+  return storageErrors;
+}
+
+/******************************************************************************/
+void CO_storageFlash_close(CO_storageFlash_t *flash)
+{
+  uint8_t i;
+
+  if (flash == NULL)
+  {
+    return;
+  }
+  if (flash->map != NULL)
+  {
+    esp_partition_munmap(flash->mapHandle);
+    flash->map = NULL;
+  }
+  for (i = 0U; i < flash->entriesCount; i++)
+  {
+    flash->entries[i].addrNV = NULL;
+  }
+  flash->partition = NULL;
+}
+
+#endif /* (CO_CONFIG_STORAGE) & CO_CONFIG_STORAGE_ENABLE */